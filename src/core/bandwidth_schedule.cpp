@@ -0,0 +1,178 @@
+#include "bandwidth_schedule.h"
+
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+
+namespace {
+
+constexpr int kMinutesPerDay = 24 * 60;
+constexpr const char* kDayNames[7] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+
+bool dayEnabled(uint8_t weekdays, int day)
+{
+    return (weekdays >> ((day + 7) % 7)) & 1;
+}
+
+bool covers(const BandwidthWindow& window, int day, int minute)
+{
+    if (window.start_minute < window.end_minute) {
+        return dayEnabled(window.weekdays, day)
+            && minute >= window.start_minute && minute < window.end_minute;
+    }
+    // Overnight: the evening part belongs to the selected day, the morning
+    // part to the day after it
+    return (dayEnabled(window.weekdays, day) && minute >= window.start_minute)
+        || (dayEnabled(window.weekdays, day - 1) && minute < window.end_minute);
+}
+
+int parseDay(const std::string& name)
+{
+    for (int day = 0; day < 7; ++day) {
+        if (name.size() == 3
+            && std::tolower(static_cast<unsigned char>(name[0])) == std::tolower(kDayNames[day][0])
+            && std::tolower(static_cast<unsigned char>(name[1])) == kDayNames[day][1]
+            && std::tolower(static_cast<unsigned char>(name[2])) == kDayNames[day][2]) {
+            return day;
+        }
+    }
+    return -1;
+}
+
+/// "*", "Sat,Sun", "Mon-Fri" or a mix ("Mon-Wed,Sat"). Returns 0 on error.
+uint8_t parseDays(const std::string& text)
+{
+    if (text == "*") {
+        return 0x7F;
+    }
+    uint8_t days = 0;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t dash = item.find('-');
+        int first = parseDay(item.substr(0, dash));
+        int last = dash == std::string::npos ? first : parseDay(item.substr(dash + 1));
+        if (first < 0 || last < 0) {
+            return 0;
+        }
+        for (int day = first;; day = (day + 1) % 7) {  // Fri-Mon wraps over the weekend
+            days |= static_cast<uint8_t>(1u << day);
+            if (day == last) {
+                break;
+            }
+        }
+    }
+    return days;
+}
+
+/// "HH:MM", 24:00 allowed as an end. Returns -1 on error.
+int parseTime(const std::string& text)
+{
+    int hours = 0;
+    int minutes = 0;
+    char extra = 0;
+    if (std::sscanf(text.c_str(), "%d:%d%c", &hours, &minutes, &extra) != 2
+        || hours < 0 || minutes < 0 || minutes > 59 || hours * 60 + minutes > kMinutesPerDay) {
+        return -1;
+    }
+    return hours * 60 + minutes;
+}
+
+} // anonymous namespace
+
+BandwidthSchedule::BandwidthSchedule(std::vector<BandwidthWindow> windows)
+    : windows_(std::move(windows))
+{
+}
+
+const BandwidthWindow* BandwidthSchedule::windowAt(const std::tm& local) const
+{
+    int minute = local.tm_hour * 60 + local.tm_min;
+    for (const auto& window : windows_) {
+        if (covers(window, local.tm_wday, minute)) {
+            return &window;
+        }
+    }
+    return nullptr;
+}
+
+const BandwidthWindow* BandwidthSchedule::windowAt(std::chrono::system_clock::time_point time) const
+{
+    std::time_t t = std::chrono::system_clock::to_time_t(time);
+    std::tm local{};
+#ifdef _WIN32
+    localtime_s(&local, &t);
+#else
+    localtime_r(&t, &local);
+#endif
+    return windowAt(local);
+}
+
+bool BandwidthSchedule::empty() const
+{
+    return windows_.empty();
+}
+
+std::optional<BandwidthWindow> BandwidthSchedule::parse(const std::string& text)
+{
+    std::istringstream in(text);
+    std::string days;
+    std::string range;
+    int64_t kbps = -1;
+    if (!(in >> days >> range >> kbps) || kbps < 0) {
+        return std::nullopt;
+    }
+
+    BandwidthWindow window;
+    window.weekdays = parseDays(days);
+    size_t dash = range.find('-');
+    if (window.weekdays == 0 || dash == std::string::npos) {
+        return std::nullopt;
+    }
+    window.start_minute = parseTime(range.substr(0, dash));
+    window.end_minute = parseTime(range.substr(dash + 1));
+    if (window.start_minute < 0 || window.start_minute == kMinutesPerDay || window.end_minute < 0) {
+        return std::nullopt;
+    }
+    window.speed_limit = kbps * 1024;
+
+    int max_tasks = 0;
+    if (in >> max_tasks) {
+        if (max_tasks < 0) {
+            return std::nullopt;
+        }
+        window.max_concurrent_tasks = max_tasks;
+    }
+    std::string rest;
+    if (!in.eof() && (in.clear(), in >> rest)) {
+        return std::nullopt;  // trailing garbage
+    }
+    return window;
+}
+
+std::string BandwidthSchedule::format(const BandwidthWindow& window)
+{
+    std::string days;
+    if ((window.weekdays & 0x7F) == 0x7F) {
+        days = "*";
+    } else {
+        for (int day = 0; day < 7; ++day) {
+            if (dayEnabled(window.weekdays, day)) {
+                days += days.empty() ? "" : ",";
+                days += kDayNames[day];
+            }
+        }
+    }
+
+    char text[96];
+    std::snprintf(text, sizeof(text), "%s %02d:%02d-%02d:%02d %lld",
+                  days.c_str(),
+                  window.start_minute / 60, window.start_minute % 60,
+                  window.end_minute / 60, window.end_minute % 60,
+                  static_cast<long long>(window.speed_limit / 1024));
+    std::string result = text;
+    if (window.max_concurrent_tasks > 0) {
+        result += " " + std::to_string(window.max_concurrent_tasks);
+    }
+    return result;
+}
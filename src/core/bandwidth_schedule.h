@@ -0,0 +1,44 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <vector>
+
+/// One row of the bandwidth schedule: on the selected weekdays, from
+/// start_minute to end_minute (local time, minutes since midnight), the
+/// manager runs with these limits. A window with end_minute <= start_minute
+/// runs past midnight into the next day.
+struct BandwidthWindow {
+    uint8_t weekdays = 0x7F;        // bit 0 = Sunday ... bit 6 = Saturday
+    int start_minute = 0;
+    int end_minute = 24 * 60;
+    int64_t speed_limit = 0;        // bytes/sec, 0 = unlimited
+    int max_concurrent_tasks = 0;   // 0 = keep the configured value
+};
+
+class BandwidthSchedule {
+public:
+    explicit BandwidthSchedule(std::vector<BandwidthWindow> windows = {});
+
+    /// The first window covering the given local time, or nullptr.
+    const BandwidthWindow* windowAt(const std::tm& local) const;
+
+    /// The first window covering the given moment in the local time zone.
+    const BandwidthWindow* windowAt(std::chrono::system_clock::time_point time) const;
+
+    bool empty() const;
+
+    /// Parse one window in the text form "Mon-Fri 09:00-18:00 512 [2]":
+    /// days ("*", "Sat,Sun", "Mon-Fri"), time range, limit in KB/s (0 =
+    /// unlimited) and optionally the maximum concurrent tasks. Returns
+    /// std::nullopt on malformed input.
+    static std::optional<BandwidthWindow> parse(const std::string& text);
+
+    /// The text form read by parse().
+    static std::string format(const BandwidthWindow& window);
+
+private:
+    std::vector<BandwidthWindow> windows_;
+};
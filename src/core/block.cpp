@@ -1,106 +1,161 @@
 #include "block.h"
 #include "http_engine.h"
+#include "http_common.h"
 #include "token_bucket.h"
+#include "file_sink.h"
+#include "disk_writer.h"
+#include "chunk_map.h"
 
-#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace {
+
+/// Coalesced bytes are written out at the latest this long after the first
+/// of them arrived, so a slow transfer still reaches the disk (and the
+/// progress display) regularly.
+constexpr auto kMaxBufferAge = std::chrono::milliseconds(500);
+
+/// How long a transfer waits before offering a chunk again when the disk
+/// writer is busy.
+constexpr auto kBackpressureRetry = std::chrono::milliseconds(5);
+
+} // anonymous namespace
 
 Block::Block(BlockInfo info,
-             const std::string& file_path,
+             FileSink* sink,
              const std::string& url,
              HttpEngine* engine,
              TokenBucket* limiter,
              BlockProgressCallback on_progress)
     : info_(std::move(info))
-    , file_path_(file_path)
+    , sink_(sink)
     , url_(url)
     , engine_(engine)
-    , limiter_(limiter)
+    , lease_(limiter)
     , on_progress_(std::move(on_progress))
 {
 }
 
 Block::~Block()
 {
-#ifdef _WIN32
-    if (file_handle_ != INVALID_HANDLE_VALUE) {
-        ::CloseHandle(file_handle_);
-        file_handle_ = INVALID_HANDLE_VALUE;
+    // Make sure the reactor no longer holds callbacks into this object
+    paused_.store(true);
+    if (multi_) {
+        TransferId id = 0;
+        {
+            std::lock_guard<std::mutex> lock(transfer_mutex_);
+            id = transfer_id_;
+        }
+        // Not under transfer_mutex_: remove() waits for the reactor, which
+        // may itself be waiting on that mutex inside onAsyncData().
+        if (id != 0) {
+            multi_->remove(id);
+        }
+    }
+
+    // Unflushed bytes are simply dropped: downloaded never counted them.
+    // A buffer with the disk writer is released once its write is done.
+    std::unique_lock<std::mutex> lock(info_mutex_);
+    writes_done_.wait(lock, [this] { return pending_writes_ == 0; });
+    if (buffer_pool_) {
+        buffer_pool_->release(std::move(buffer_));
+        buffer_pool_->release(std::move(writing_));
     }
-#endif
 }
 
-void Block::execute(const HttpConfig& config)
+int64_t Block::resumeOffset() const
 {
-    if (info_.completed) {
-        return;
-    }
+    // range_start is -1 for unknown-size downloads, which start at offset 0
+    return std::max<int64_t>(info_.range_start, 0) + info_.downloaded;
+}
 
-    paused_.store(false);
+void Block::recordWrittenLocked(int64_t size)
+{
+    if (chunks_) {
+        chunks_->markWritten(resumeOffset(), size);
+    }
+    info_.downloaded += size;
+}
 
-#ifdef _WIN32
-    // Open file for overlapped writing, shared for reading
-    file_handle_ = ::CreateFileA(
-        file_path_.c_str(),
-        GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        OPEN_EXISTING,
-        FILE_FLAG_OVERLAPPED,
-        nullptr);
+int64_t Block::ownedEnd() const
+{
+    return resumeOffset() + static_cast<int64_t>(writing_size_ + buffered_);
+}
 
-    if (file_handle_ == INVALID_HANDLE_VALUE) {
-        throw std::runtime_error("Block: failed to open file for writing: " + file_path_);
+int64_t Block::beginTransferLocked()
+{
+    write_failed_ = false;
+    if (info_.range_start < 0) {
+        stream_offset_ = 0;
+        return -1;
     }
-#endif
+    stream_offset_ = ownedEnd();
+    return stream_offset_;
+}
+
+HttpError Block::writeError()
+{
+    return HttpError("Failed to write downloaded data to disk", CURLE_WRITE_ERROR, 0, true);
+}
+
+bool Block::isWriteError(const HttpError& error)
+{
+    // The engines report their own CURLE_WRITE_ERROR as not retryable
+    return error.curlCode() == CURLE_WRITE_ERROR && error.isRetryable();
+}
 
-    // Current write offset = range_start + already downloaded bytes
-    int64_t current_offset = info_.range_start + info_.downloaded;
+void Block::execute(const HttpConfig& config)
+{
+    int64_t range_start = -1;
+    int64_t range_end = -1;
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        if (info_.completed) {
+            return;
+        }
+        // Resume from where we left off (no Range header when the size is unknown)
+        range_start = beginTransferLocked();
+        range_end = info_.range_end;
+    }
 
-    // Range for the HTTP request: resume from where we left off
-    int64_t range_start = current_offset;
-    int64_t range_end = info_.range_end;
+    paused_.store(false);
 
     // Data callback: acquire tokens, write at offset, report progress
-    DataCallback on_data = [this, &current_offset](const char* data, size_t size) -> size_t {
+    DataCallback on_data = [this](const char* data, size_t size) -> size_t {
         if (paused_.load(std::memory_order_relaxed)) {
             return 0;  // returning 0 aborts the transfer
         }
 
-        size_t remaining = size;
         size_t total_written = 0;
-        const char* ptr = data;
-
-        while (remaining > 0) {
+        while (total_written < size) {
             if (paused_.load(std::memory_order_relaxed)) {
                 return 0;
             }
 
-            size_t chunk = remaining;
+            size_t chunk = size - total_written;
 
             // Acquire tokens from the rate limiter before writing
-            if (limiter_) {
-                int64_t granted = limiter_->acquire(static_cast<int64_t>(chunk));
-                if (granted == 0) {
-                    // Limiter was cancelled
-                    return 0;
-                }
-                chunk = static_cast<size_t>(granted);
+            int64_t granted = lease_.acquire(static_cast<int64_t>(chunk));
+            if (granted == 0) {
+                // Limiter was cancelled
+                return 0;
             }
+            chunk = static_cast<size_t>(granted);
 
-            size_t written = writeAtOffset(ptr, chunk, current_offset);
-            if (written == 0) {
-                return 0;  // write error
+            // Backpressure: a pool worker may simply wait for the writer
+            size_t written = 0;
+            while ((written = consume(data + total_written, chunk)) == kWriteBlocked) {
+                if (paused_.load(std::memory_order_relaxed)) {
+                    return 0;
+                }
+                std::this_thread::sleep_for(kBackpressureRetry);
             }
-
-            current_offset += static_cast<int64_t>(written);
-            info_.downloaded += static_cast<int64_t>(written);
             total_written += written;
-            ptr += written;
-            remaining -= written;
-
-            // Report incremental progress to the Task
-            if (on_progress_) {
-                on_progress_(info_.block_id, static_cast<int64_t>(written));
+            if (written < chunk) {
+                break;  // write error, or the range was shrunk by splitTail()
             }
         }
 
@@ -111,40 +166,144 @@ void Block::execute(const HttpConfig& config)
         // Progress tracking is handled via the data callback above
     };
 
+    // HttpError propagates; the caller (Task) decides retry policy
     try {
         engine_->download(url_, range_start, range_end, config, on_data, on_progress);
+    } catch (const HttpError&) {
+        // After a split the transfer is aborted on purpose once the
+        // shortened range is full; that is a success, not an error.
+        if (!rangeFilled()) {
+            // Keep what did arrive. A failed write stopped the transfer:
+            // report that rather than the abort it caused.
+            if (!flush()) {
+                throw writeError();
+            }
+            throw;
+        }
+    }
+
+    // If we reach here without being paused, the block is complete
+    if (!paused_.load(std::memory_order_relaxed) && !markCompleted()) {
+        throw writeError();
+    }
+}
+
+void Block::start(MultiHttpEngine* engine, const HttpConfig& config, BlockDoneCallback on_done)
+{
+    int64_t range_start = -1;
+    int64_t range_end = -1;
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        if (info_.completed) {
+            return;
+        }
+        range_start = beginTransferLocked();
+        range_end = info_.range_end;
+    }
 
-        // If we reach here without being paused, the block is complete
-        if (!paused_.load(std::memory_order_relaxed)) {
-            info_.completed = true;
-            // Notify Task so it can detect all-blocks-done
-            if (on_progress_) {
-                on_progress_(info_.block_id, 0);
+    paused_.store(false);
+    prepaid_ = 0;
+    multi_ = engine;
+    on_done_ = std::move(on_done);
+
+    std::lock_guard<std::mutex> lock(transfer_mutex_);
+    transfer_id_ = multi_->download(
+        url_, range_start, range_end, config,
+        [this](const char* data, size_t size) { return onAsyncData(data, size); },
+        [this](const HttpError* error) { onAsyncDone(error); });
+}
+
+size_t Block::onAsyncData(const char* data, size_t size)
+{
+    if (paused_.load(std::memory_order_relaxed)) {
+        return 0;  // returning 0 aborts the transfer
+    }
+
+    // The reactor must never block: if the limiter has no tokens yet,
+    // pause this transfer and let the engine re-deliver the chunk later.
+    // Tokens paid for a chunk the writer turned away are not taken twice.
+    if (prepaid_ < size) {
+        std::chrono::microseconds retry_after{0};
+        if (!lease_.tryAcquire(static_cast<int64_t>(size - prepaid_), &retry_after)) {
+            if (retry_after.count() == 0) {
+                return 0;  // limiter was cancelled
             }
+            std::lock_guard<std::mutex> lock(transfer_mutex_);
+            multi_->resume(transfer_id_,
+                std::chrono::duration_cast<std::chrono::milliseconds>(retry_after)
+                    + std::chrono::milliseconds(1));
+            return kTransferPause;
         }
-    } catch (const HttpError& e) {
-        // Re-throw; the caller (Task) decides retry policy
-        // Close the file handle before propagating
-#ifdef _WIN32
-        if (file_handle_ != INVALID_HANDLE_VALUE) {
-            ::CloseHandle(file_handle_);
-            file_handle_ = INVALID_HANDLE_VALUE;
+        prepaid_ = size;
+    }
+
+    size_t consumed = consume(data, size);
+    if (consumed == kWriteBlocked) {
+        // Backpressure: the disk writer is busy, get the chunk again shortly
+        std::lock_guard<std::mutex> lock(transfer_mutex_);
+        multi_->resume(transfer_id_, kBackpressureRetry);
+        return kTransferPause;
+    }
+
+    // A short count aborts the transfer (write error or shrunk range)
+    prepaid_ = 0;
+    return consumed;
+}
+
+void Block::onAsyncDone(const HttpError* error)
+{
+    TransferId id = 0;
+    {
+        std::lock_guard<std::mutex> lock(transfer_mutex_);
+        id = transfer_id_;
+    }
+
+    reportAsyncDone(error);
+
+    // Only now: until this returns the destructor must still remove() the
+    // transfer, which waits for the reactor to leave this callback. A
+    // restart from on_done_ may already have set a new id.
+    std::lock_guard<std::mutex> lock(transfer_mutex_);
+    if (transfer_id_ == id) {
+        transfer_id_ = 0;
+    }
+}
+
+void Block::reportAsyncDone(const HttpError* error)
+{
+    if (paused_.load(std::memory_order_relaxed)) {
+        return;  // paused / cancelled by the owner, nothing to report
+    }
+
+    // Aborted on purpose after a split filled the shortened range
+    if (error && rangeFilled()) {
+        error = nullptr;
+    }
+
+    HttpError write_error = writeError();
+    if (!error) {
+        if (!markCompleted()) {
+            error = &write_error;
         }
-#endif
-        throw;
+    } else if (!flush()) {
+        error = &write_error;  // a failed write stopped the transfer
     }
 
-#ifdef _WIN32
-    if (file_handle_ != INVALID_HANDLE_VALUE) {
-        ::CloseHandle(file_handle_);
-        file_handle_ = INVALID_HANDLE_VALUE;
+    if (on_done_) {
+        on_done_(info_.block_id, error);
     }
-#endif
 }
 
 void Block::pause()
 {
     paused_.store(true, std::memory_order_relaxed);
+    flush();
+    if (multi_) {
+        std::lock_guard<std::mutex> lock(transfer_mutex_);
+        if (transfer_id_ != 0) {
+            multi_->cancel(transfer_id_);
+        }
+    }
     if (engine_) {
         engine_->cancel();
     }
@@ -152,36 +311,338 @@ void Block::pause()
 
 BlockInfo Block::getInfo() const
 {
+    std::lock_guard<std::mutex> lock(info_mutex_);
     return info_;
 }
 
-size_t Block::writeAtOffset(const char* data, size_t size, int64_t offset)
+int64_t Block::remainingBytes() const
 {
-#ifdef _WIN32
-    OVERLAPPED ov = {};
-    ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
-    ov.OffsetHigh = static_cast<DWORD>((offset >> 32) & 0xFFFFFFFF);
-
-    DWORD bytes_written = 0;
-    BOOL ok = ::WriteFile(file_handle_, data, static_cast<DWORD>(size), &bytes_written, &ov);
-    if (!ok) {
-        // For overlapped I/O, ERROR_IO_PENDING means we need to wait
-        DWORD err = ::GetLastError();
-        if (err == ERROR_IO_PENDING) {
-            ok = ::GetOverlappedResult(file_handle_, &ov, &bytes_written, TRUE);
-            if (!ok) {
-                return 0;
+    std::lock_guard<std::mutex> lock(info_mutex_);
+    if (info_.completed || info_.range_end < 0) {
+        return 0;
+    }
+    return std::max<int64_t>(info_.range_end - ownedEnd() + 1, 0);
+}
+
+std::optional<BlockInfo> Block::splitTail(int64_t min_bytes)
+{
+    min_bytes = std::max<int64_t>(min_bytes, 1);
+
+    std::lock_guard<std::mutex> lock(info_mutex_);
+    if (info_.completed || info_.range_start < 0 || info_.range_end < 0) {
+        return std::nullopt;
+    }
+
+    int64_t offset = ownedEnd();
+    int64_t remaining = info_.range_end - offset + 1;
+    if (remaining < 2 * min_bytes) {
+        return std::nullopt;
+    }
+
+    BlockInfo tail;
+    tail.range_start = offset + remaining / 2;
+    tail.range_end = info_.range_end;
+    tail.downloaded = 0;
+    tail.completed = false;
+
+    // claim() re-reads range_end under the same lock, so no byte past
+    // the new end is written once this returns.
+    info_.range_end = tail.range_start - 1;
+    return tail;
+}
+
+void Block::raceFor(Block* primary)
+{
+    primary_ = primary;
+}
+
+void Block::setBufferPool(BufferPool* pool)
+{
+    buffer_pool_ = pool;
+}
+
+void Block::setDiskWriter(DiskWriter* writer)
+{
+    disk_writer_ = writer;
+}
+
+void Block::setChunkMap(ChunkMap* chunks)
+{
+    chunks_ = chunks;
+}
+
+void Block::setCompletionCounter(std::atomic<int>* remaining)
+{
+    remaining_ = remaining;
+}
+
+bool Block::flush()
+{
+    int64_t flushed = 0;
+    bool ok = true;
+    {
+        // The buffered bytes follow the ones being written: wait for those
+        std::unique_lock<std::mutex> lock(info_mutex_);
+        writes_done_.wait(lock, [this] { return pending_writes_ == 0; });
+        ok = flushLocked(&flushed) && !write_failed_;
+        if (buffer_pool_) {
+            buffer_pool_->release(std::move(buffer_));
+            buffer_pool_->release(std::move(writing_));
+        }
+    }
+
+    if (flushed > 0 && on_progress_) {
+        on_progress_(info_.block_id, flushed);
+    }
+    return ok;
+}
+
+bool Block::finishIfFilled()
+{
+    if (!rangeFilled()) {
+        return false;
+    }
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        if (info_.completed) {
+            return true;
+        }
+        completeLocked();
+    }
+    // The other transfer won the race: this one is now redundant
+    pause();
+    return true;
+}
+
+size_t Block::consume(const char* data, size_t size)
+{
+    Block* owner = primary_ ? primary_ : this;
+    size_t accepted = owner->claim(data, size, stream_offset_);
+    if (accepted == kWriteBlocked) {
+        // The chunk comes again from the same stream offset; whatever the
+        // owner did take of it is then skipped as already owned.
+        return kWriteBlocked;
+    }
+    stream_offset_ += static_cast<int64_t>(accepted);
+
+    if (primary_) {
+        // A racer's own BlockInfo only tracks its stream; it is never persisted
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        info_.downloaded += static_cast<int64_t>(accepted);
+    }
+    return accepted;
+}
+
+size_t Block::claim(const char* data, size_t size, int64_t pos)
+{
+    int64_t flushed = 0;
+    AppendResult result = AppendResult::Ok;
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        int64_t owned_end = ownedEnd();
+        if (info_.range_end >= 0) {
+            int64_t room = std::max<int64_t>(info_.range_end - pos + 1, 0);
+            size = static_cast<size_t>(std::min<int64_t>(static_cast<int64_t>(size), room));
+        }
+        if (size == 0 || pos > owned_end) {
+            return 0;  // range full, or a gap no transfer covers
+        }
+
+        // Bytes in [pos, owned_end) were delivered by the other transfer
+        int64_t skip = owned_end - pos;
+        if (skip < static_cast<int64_t>(size)) {
+            result = appendLocked(data + skip, size - static_cast<size_t>(skip), &flushed);
+        }
+    }
+
+    // Progress is reported when data reaches the disk (outside info_mutex_)
+    if (flushed > 0 && on_progress_) {
+        on_progress_(info_.block_id, flushed);
+    }
+    if (result == AppendResult::Blocked) {
+        return kWriteBlocked;
+    }
+    return result == AppendResult::Ok ? size : 0;
+}
+
+Block::AppendResult Block::appendLocked(const char* data, size_t size, int64_t* flushed)
+{
+    if (!buffer_ && buffer_pool_) {
+        buffer_ = buffer_pool_->acquire();
+    }
+
+    if (!buffer_) {
+        // The write in flight still holds this block's buffer
+        if (writing_size_ > 0) {
+            return AppendResult::Blocked;
+        }
+
+        // Pool exhausted (or no pool): write through
+        size_t written = writeAtOffset(data, size, resumeOffset());
+        if (written != size) {
+            write_failed_ = true;
+            return AppendResult::Failed;
+        }
+        recordWrittenLocked(static_cast<int64_t>(written));
+        *flushed += static_cast<int64_t>(written);
+        return AppendResult::Ok;
+    }
+
+    const size_t capacity = buffer_pool_->bufferSize();
+    auto now = std::chrono::steady_clock::now();
+    while (size > 0) {
+        if (buffered_ == capacity) {
+            AppendResult result = handOffLocked(flushed);
+            if (result != AppendResult::Ok) {
+                return result;
+            }
+            if (!buffer_) {
+                return AppendResult::Blocked;  // no second buffer free
             }
+        }
+        if (buffered_ == 0) {
+            buffered_since_ = now;
+        }
+        size_t take = std::min(size, capacity - buffered_);
+        std::memcpy(buffer_.get() + buffered_, data, take);
+        buffered_ += take;
+        data += take;
+        size -= take;
+    }
+
+    // A full buffer goes out at once, a partial one when it gets old. If the
+    // writer is busy the bytes just wait in the buffer for the next chunk.
+    if (buffered_ == capacity || (buffered_ > 0 && now - buffered_since_ >= kMaxBufferAge)) {
+        if (handOffLocked(flushed) == AppendResult::Failed) {
+            return AppendResult::Failed;
+        }
+    }
+    return AppendResult::Ok;
+}
+
+Block::AppendResult Block::handOffLocked(int64_t* flushed)
+{
+    if (buffered_ == 0) {
+        return AppendResult::Ok;
+    }
+    if (!disk_writer_ || !sink_) {
+        return flushLocked(flushed) ? AppendResult::Ok : AppendResult::Failed;
+    }
+
+    // One write in flight per block: downloaded must grow without gaps
+    if (writing_size_ > 0) {
+        return AppendResult::Blocked;
+    }
+    if (!disk_writer_->trySubmit(sink_, buffer_.get(), buffered_, resumeOffset(),
+                                 [this](bool ok) { onWriteDone(ok); })) {
+        return AppendResult::Blocked;
+    }
+
+    // onWriteDone() needs info_mutex_, so it cannot run before this is done
+    ++pending_writes_;
+    writing_ = std::move(buffer_);
+    writing_size_ = buffered_;
+    buffered_ = 0;
+    buffer_ = buffer_pool_->acquire();  // nullptr: reuse writing_ when it is done
+    return AppendResult::Ok;
+}
+
+void Block::onWriteDone(bool ok)
+{
+    int64_t flushed = 0;
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        if (ok) {
+            recordWrittenLocked(static_cast<int64_t>(writing_size_));
+            flushed = static_cast<int64_t>(writing_size_);
+        } else {
+            // The buffered bytes would now leave a gap on disk: drop them
+            // too. The transfer stops at the gap and ends with writeError();
+            // the Task restarts the block from there.
+            write_failed_ = true;
+            buffered_ = 0;
+        }
+        writing_size_ = 0;
+        if (!buffer_) {
+            buffer_ = std::move(writing_);
         } else {
-            return 0;
+            buffer_pool_->release(std::move(writing_));
         }
+
+        // A buffer that filled up meanwhile goes next
+        if (ok && buffered_ == buffer_pool_->bufferSize()) {
+            handOffLocked(&flushed);
+        }
+    }
+
+    if (flushed > 0 && on_progress_) {
+        on_progress_(info_.block_id, flushed);
+    }
+
+    // Last: flush() and the destructor wait for this
+    std::lock_guard<std::mutex> lock(info_mutex_);
+    --pending_writes_;
+    writes_done_.notify_all();
+}
+
+bool Block::flushLocked(int64_t* flushed)
+{
+    if (buffered_ == 0) {
+        return true;
+    }
+
+    size_t size = buffered_;
+    buffered_ = 0;
+    if (writeAtOffset(buffer_.get(), size, resumeOffset()) != size) {
+        write_failed_ = true;
+        return false;
+    }
+    recordWrittenLocked(static_cast<int64_t>(size));
+    *flushed += static_cast<int64_t>(size);
+    return true;
+}
+
+bool Block::rangeFilled() const
+{
+    if (primary_) {
+        return primary_->rangeFilled();
+    }
+    std::lock_guard<std::mutex> lock(info_mutex_);
+    return info_.range_end >= 0 && ownedEnd() > info_.range_end;
+}
+
+bool Block::markCompleted()
+{
+    if (!flush()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(info_mutex_);
+        completeLocked();
+    }
+    // Notify Task so it can detect all-blocks-done
+    if (on_progress_) {
+        on_progress_(info_.block_id, 0);
+    }
+    return true;
+}
+
+void Block::completeLocked()
+{
+    if (info_.completed) {
+        return;
+    }
+    info_.completed = true;
+    if (remaining_) {
+        remaining_->fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+size_t Block::writeAtOffset(const char* data, size_t size, int64_t offset)
+{
+    if (!sink_) {
+        return 0;
     }
-    return static_cast<size_t>(bytes_written);
-#else
-    // Fallback for non-Windows (e.g. testing on Linux)
-    (void)data;
-    (void)size;
-    (void)offset;
-    return 0;
-#endif
+    return sink_->writeAt(data, size, offset);
 }
@@ -3,25 +3,31 @@
 #include <string>
 #include <cstdint>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
-
-#ifdef _WIN32
-#include <windows.h>
-#endif
+#include <mutex>
+#include <optional>
 
 #include "meta_file.h"  // BlockInfo is defined here
+#include "multi_http_engine.h"
+#include "buffer_pool.h"
+#include "token_bucket.h"
 
 // Forward declarations
-class HttpEngine;
-class TokenBucket;
-struct HttpConfig;
+class FileSink;
+class DiskWriter;
+class ChunkMap;
 
 using BlockProgressCallback = std::function<void(int block_id, int64_t bytes_delta)>;
 
+/// Called when an asynchronous block transfer ends; error is nullptr on success.
+using BlockDoneCallback = std::function<void(int block_id, const HttpError* error)>;
+
 class Block {
 public:
     Block(BlockInfo info,
-          const std::string& file_path,
+          FileSink* sink,
           const std::string& url,
           HttpEngine* engine,
           TokenBucket* limiter,
@@ -32,28 +38,193 @@ public:
     Block(const Block&) = delete;
     Block& operator=(const Block&) = delete;
 
+    /// The error a block ends with when its data could not be written.
+    /// Retryable: execute()/start() again continue from the first byte
+    /// not on disk.
+    static HttpError writeError();
+
+    /// Whether error is writeError().
+    static bool isWriteError(const HttpError& error);
+
     /// Execute the download (called from a thread-pool worker).
     void execute(const HttpConfig& config);
 
+    /// Start the download on an event-driven engine and return immediately.
+    /// on_done runs on the engine's reactor thread when the transfer ends.
+    void start(MultiHttpEngine* engine, const HttpConfig& config, BlockDoneCallback on_done);
+
     /// Request pause – sets a flag checked inside the data callback.
     void pause();
 
     /// Return a snapshot of the current block state.
     BlockInfo getInfo() const;
 
+    /// Bytes of this block's range not yet written (0 when the size is unknown).
+    int64_t remainingBytes() const;
+
+    /// Give away the back half of the remaining range (work stealing).
+    /// Shrinks range_end in place and returns the detached tail with
+    /// downloaded = 0 (block_id is left for the caller to assign). An
+    /// in-flight transfer stops writing at the new range_end. Returns
+    /// std::nullopt if either half would be smaller than min_bytes.
+    std::optional<BlockInfo> splitTail(int64_t min_bytes);
+
+    /// End-game: make this block a duplicate of primary's remaining range.
+    /// Both transfers then write through primary, which owns every byte:
+    /// whichever transfer reaches a byte first writes it, the other's copy
+    /// is discarded. Must be called before execute()/start().
+    void raceFor(Block* primary);
+
+    /// The block this one is racing for, or nullptr for a regular block.
+    Block* primary() const { return primary_; }
+
+    /// Coalesce incoming data in a buffer from pool before writing it to
+    /// the FileSink. Without a pool every chunk is written directly.
+    /// Must be called before execute()/start().
+    void setBufferPool(BufferPool* pool);
+
+    /// Hand filled buffers to writer instead of writing them on the transfer
+    /// thread. While this block's previous buffer is still being written, or
+    /// the writer's queue is full, the transfer is paused (backpressure).
+    /// Needs a buffer pool. Must be called before execute()/start().
+    void setDiskWriter(DiskWriter* writer);
+
+    /// Report every byte this block writes to chunks (the task's map of
+    /// what is on disk). Must be called before execute()/start().
+    void setChunkMap(ChunkMap* chunks);
+
+    /// Decrement remaining exactly once, when this block becomes completed,
+    /// so the Task detects the last block without walking them all.
+    /// Must be called before execute()/start().
+    void setCompletionCounter(std::atomic<int>* remaining);
+
+    /// Wait for the write in flight, write out coalesced bytes, report them
+    /// as progress and return the buffers to the pool. Called on pause,
+    /// completion and transfer errors. Returns false if a write failed.
+    bool flush();
+
+    /// If the (primary's) range has been filled, possibly by another
+    /// transfer, mark this block completed without notifying the Task and
+    /// cancel its own transfer if it is still running. Returns true once
+    /// the range is filled.
+    bool finishIfFilled();
+
 private:
-    /// Write data at the given file offset using overlapped I/O.
+    /// Write data at the given file offset through the task's FileSink.
     size_t writeAtOffset(const char* data, size_t size, int64_t offset);
 
+    /// First file offset not yet written to disk by this block. Caller holds info_mutex_.
+    int64_t resumeOffset() const;
+
+    /// Count size bytes written at resumeOffset(): downloaded and the chunk
+    /// map. Caller holds info_mutex_.
+    void recordWrittenLocked(int64_t size);
+
+    /// First file offset not yet owned (on disk, being written or buffered).
+    /// Caller holds info_mutex_.
+    int64_t ownedEnd() const;
+
+    /// Reset the transfer state for execute()/start() and return the range
+    /// start to request (-1: no Range header). Without a range the server
+    /// resends from byte 0, so the stream starts there and claim() skips
+    /// what is already owned. Caller holds info_mutex_.
+    int64_t beginTransferLocked();
+
+    enum class AppendResult {
+        Ok,
+        Blocked,  // the write stage is busy: nothing more can be taken now
+        Failed    // write error
+    };
+
+    /// Returned by claim()/consume() when the chunk must be delivered again
+    /// later (backpressure from the write stage).
+    static constexpr size_t kWriteBlocked = static_cast<size_t>(-1);
+
+    /// Append fresh bytes at ownedEnd(), through the write buffer when there
+    /// is one. Adds bytes that reached the disk to *flushed. On Blocked a
+    /// prefix of the data may have been taken. Caller holds info_mutex_.
+    AppendResult appendLocked(const char* data, size_t size, int64_t* flushed);
+
+    /// Pass the buffered bytes on: to the disk writer when there is one,
+    /// otherwise write them here. Caller holds info_mutex_.
+    AppendResult handOffLocked(int64_t* flushed);
+
+    /// Completion of a disk writer write (runs on a writer thread).
+    void onWriteDone(bool ok);
+
+    /// Write the buffered bytes at resumeOffset(). Adds them to *flushed.
+    /// Returns false on write error (the bytes are dropped, write_failed_
+    /// is set and the transfer stops at the gap). Caller holds info_mutex_.
+    bool flushLocked(int64_t* flushed);
+
+    /// Feed a chunk of this block's transfer stream to the owning block
+    /// (this, or primary_ when racing). Returns the number of bytes
+    /// consumed; less than size on write error or once the (possibly
+    /// shrunk) range is full; kWriteBlocked if the whole chunk has to be
+    /// delivered again later.
+    size_t consume(const char* data, size_t size);
+
+    /// Accept a chunk that starts at stream offset pos: bytes below
+    /// ownedEnd() are already owned and skipped, the rest are written
+    /// and reported as progress. Clamped to range_end. Returns the number
+    /// of bytes of the chunk accepted (written or skipped), 0 on error,
+    /// kWriteBlocked under backpressure.
+    size_t claim(const char* data, size_t size, int64_t pos);
+
+    /// True once every byte up to range_end (of the primary when racing)
+    /// has been written.
+    bool rangeFilled() const;
+
+    /// Set info_.completed and count down remaining_ if it was not yet set.
+    /// Caller holds info_mutex_.
+    void completeLocked();
+
+    /// Mark the block completed and notify the Task. Returns false, leaving
+    /// the block incomplete, if its data could not be written.
+    bool markCompleted();
+
+    /// Data callback for start(): never blocks the reactor thread.
+    size_t onAsyncData(const char* data, size_t size);
+
+    /// Completion callback for start().
+    void onAsyncDone(const HttpError* error);
+
+    /// Settle the finished transfer and invoke on_done_ (from onAsyncDone()).
+    void reportAsyncDone(const HttpError* error);
+
     BlockInfo info_;
-    std::string file_path_;
+    mutable std::mutex info_mutex_;   // guards info_ against splitTail() and getInfo()
+    FileSink* sink_;              // non-owning, shared by all blocks of the task
     std::string url_;
     HttpEngine* engine_;          // non-owning
-    TokenBucket* limiter_;        // non-owning, may be nullptr
+    TokenBucket::Lease lease_;    // tokens from the (non-owning, optional) limiter
     BlockProgressCallback on_progress_;
     std::atomic<bool> paused_{false};
+    Block* primary_ = nullptr;        // non-owning, set when racing (end-game)
+    std::atomic<int>* remaining_ = nullptr;  // Task's countdown of incomplete blocks
+    ChunkMap* chunks_ = nullptr;      // non-owning, may be nullptr
+    int64_t stream_offset_ = 0;       // file offset of the next byte the transfer delivers
+
+    // Write coalescing (guarded by info_mutex_). info_.downloaded counts
+    // bytes on disk only, so the MetaFile never claims buffered data.
+    BufferPool* buffer_pool_ = nullptr;  // non-owning, may be nullptr
+    BufferPool::Buffer buffer_;          // holds [resumeOffset() + writing_size_, ownedEnd())
+    size_t buffered_ = 0;
+    std::chrono::steady_clock::time_point buffered_since_;
+
+    // Asynchronous writes (guarded by info_mutex_). At most one buffer per
+    // block is with the writer, so downloaded still grows contiguously.
+    DiskWriter* disk_writer_ = nullptr;  // non-owning, may be nullptr
+    BufferPool::Buffer writing_;         // holds [resumeOffset(), resumeOffset() + writing_size_)
+    size_t writing_size_ = 0;
+    int pending_writes_ = 0;             // onWriteDone() calls not yet returned
+    bool write_failed_ = false;          // until the next execute()/start(): see writeError()
+    std::condition_variable writes_done_;
 
-#ifdef _WIN32
-    HANDLE file_handle_ = INVALID_HANDLE_VALUE;
-#endif
+    // Asynchronous mode (start())
+    MultiHttpEngine* multi_ = nullptr;  // non-owning
+    std::mutex transfer_mutex_;         // guards transfer_id_ assignment
+    TransferId transfer_id_ = 0;
+    BlockDoneCallback on_done_;
+    size_t prepaid_ = 0;                // limiter tokens already taken for a blocked chunk
 };
@@ -0,0 +1,86 @@
+// buffer_pool.cpp
+#include "buffer_pool.h"
+
+BufferPool::BufferPool(size_t buffer_size, size_t max_buffers)
+    : buffer_size_(buffer_size)
+    , max_buffers_(max_buffers)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    // Lent-out buffers are freed by their owners, which must be gone by now
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!free_.empty()) {
+        freeLocked(std::move(free_.back()));
+        free_.pop_back();
+    }
+}
+
+void BufferPool::setHooks(BufferHook on_allocate, BufferHook on_free)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    on_allocate_ = std::move(on_allocate);
+    on_free_ = std::move(on_free);
+}
+
+BufferPool::Buffer BufferPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffer_size_ == 0 || in_use_ >= max_buffers_) {
+        return nullptr;
+    }
+    ++in_use_;
+
+    if (!free_.empty()) {
+        Buffer buffer = std::move(free_.back());
+        free_.pop_back();
+        return buffer;
+    }
+    Buffer buffer(new char[buffer_size_]);
+    if (on_allocate_) {
+        on_allocate_(buffer.get(), buffer_size_);
+    }
+    return buffer;
+}
+
+void BufferPool::release(Buffer buffer)
+{
+    if (!buffer) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_use_ > 0) {
+        --in_use_;
+    }
+    // Keep at most max_buffers_ in total; the rest are freed here
+    if (in_use_ + free_.size() < max_buffers_) {
+        free_.push_back(std::move(buffer));
+    } else {
+        freeLocked(std::move(buffer));
+    }
+}
+
+void BufferPool::setMaxBuffers(size_t max_buffers)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_buffers_ = max_buffers;
+    while (!free_.empty() && in_use_ + free_.size() > max_buffers_) {
+        freeLocked(std::move(free_.back()));
+        free_.pop_back();
+    }
+}
+
+void BufferPool::freeLocked(Buffer buffer)
+{
+    if (on_free_) {
+        on_free_(buffer.get(), buffer_size_);
+    }
+}
+
+size_t BufferPool::inUse() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return in_use_;
+}
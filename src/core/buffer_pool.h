@@ -0,0 +1,58 @@
+// buffer_pool.h
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// Fixed-size byte buffers shared by every block of every task. Blocks
+/// coalesce small network chunks into one buffer and write it with a single
+/// positional write. At most max_buffers are lent out at a time, which caps
+/// the memory held in unflushed data; released buffers are recycled.
+class BufferPool {
+public:
+    using Buffer = std::unique_ptr<char[]>;
+
+    // Told about each buffer the pool allocates, and again before it frees
+    // one (e.g. to register the memory with the kernel for faster writes).
+    // Runs under the pool's lock.
+    using BufferHook = std::function<void(const char* data, size_t size)>;
+
+    BufferPool(size_t buffer_size, size_t max_buffers);
+    ~BufferPool();
+
+    // Non-copyable
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Install the allocation hooks. Call before the first acquire().
+    void setHooks(BufferHook on_allocate, BufferHook on_free);
+
+    // Take a buffer of bufferSize() bytes. Returns nullptr when max_buffers
+    // are already lent out (the caller then writes unbuffered).
+    Buffer acquire();
+
+    // Give a buffer back for reuse. nullptr is ignored.
+    void release(Buffer buffer);
+
+    // Change the number of buffers that may be lent out at once.
+    void setMaxBuffers(size_t max_buffers);
+
+    size_t bufferSize() const { return buffer_size_; }
+
+    // Buffers currently lent out.
+    size_t inUse() const;
+
+private:
+    // Free a buffer, telling on_free_ first. Caller holds mutex_.
+    void freeLocked(Buffer buffer);
+
+    const size_t buffer_size_;
+    mutable std::mutex mutex_;
+    size_t max_buffers_;
+    size_t in_use_ = 0;
+    std::vector<Buffer> free_;  // recycled buffers, at most max_buffers_ kept
+    BufferHook on_allocate_;
+    BufferHook on_free_;
+};
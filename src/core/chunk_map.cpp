@@ -0,0 +1,135 @@
+#include "chunk_map.h"
+#include <algorithm>
+
+// ── Sizing ─────────────────────────────────────────────────────
+
+int64_t ChunkMap::chunkSizeFor(int64_t file_size)
+{
+    int64_t chunk_size = kDefaultChunkSize;
+    while (file_size > chunk_size * static_cast<int64_t>(kMaxChunks)) {
+        chunk_size *= 2;
+    }
+    return chunk_size;
+}
+
+// ── Constructors ───────────────────────────────────────────────
+
+ChunkMap::ChunkMap(int64_t file_size)
+    : ChunkMap(file_size, chunkSizeFor(file_size), {})
+{
+}
+
+ChunkMap::ChunkMap(int64_t file_size, int64_t chunk_size, const std::vector<uint8_t>& bitmap)
+    : file_size_(std::max<int64_t>(file_size, 0))
+    , chunk_size_(std::max<int64_t>(chunk_size, 1))
+    , count_(static_cast<size_t>((file_size_ + chunk_size_ - 1) / chunk_size_))
+    , written_(new std::atomic<int32_t>[count_])
+{
+    for (size_t i = 0; i < count_; ++i) {
+        bool done = i / 8 < bitmap.size() && (bitmap[i / 8] >> (i % 8)) & 1;
+        written_[i].store(done ? static_cast<int32_t>(chunkBytes(i)) : 0,
+                          std::memory_order_relaxed);
+    }
+}
+
+// ── Updates / queries ──────────────────────────────────────────
+
+void ChunkMap::markWritten(int64_t offset, int64_t size)
+{
+    int64_t end = std::min(offset + size, file_size_);
+    offset = std::max<int64_t>(offset, 0);
+    while (offset < end) {
+        size_t chunk = static_cast<size_t>(offset / chunk_size_);
+        int64_t chunk_end = std::min(static_cast<int64_t>(chunk + 1) * chunk_size_, end);
+        written_[chunk].fetch_add(static_cast<int32_t>(chunk_end - offset),
+                                  std::memory_order_relaxed);
+        offset = chunk_end;
+    }
+}
+
+std::vector<uint8_t> ChunkMap::bitmap() const
+{
+    std::vector<uint8_t> bits((count_ + 7) / 8, 0);
+    for (size_t i = 0; i < count_; ++i) {
+        if (isDone(i)) {
+            bits[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+        }
+    }
+    return bits;
+}
+
+bool ChunkMap::isDone(size_t chunk) const
+{
+    return chunk < count_
+        && written_[chunk].load(std::memory_order_relaxed) >= chunkBytes(chunk);
+}
+
+int64_t ChunkMap::doneBytes() const
+{
+    int64_t total = 0;
+    for (size_t i = 0; i < count_; ++i) {
+        if (isDone(i)) {
+            total += chunkBytes(i);
+        }
+    }
+    return total;
+}
+
+std::vector<std::pair<int64_t, int64_t>> ChunkMap::missingRanges(size_t max_ranges) const
+{
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    for (size_t i = 0; i < count_; ++i) {
+        if (isDone(i)) {
+            continue;
+        }
+        int64_t first = static_cast<int64_t>(i) * chunk_size_;
+        int64_t last = first + chunkBytes(i) - 1;
+        if (!ranges.empty() && ranges.back().second + 1 == first) {
+            ranges.back().second = last;
+        } else {
+            ranges.emplace_back(first, last);
+        }
+    }
+
+    max_ranges = std::max<size_t>(max_ranges, 1);
+    if (ranges.size() <= max_ranges) {
+        return ranges;
+    }
+
+    // Keep the max_ranges - 1 widest gaps, fill in the rest
+    std::vector<int64_t> gaps;
+    gaps.reserve(ranges.size() - 1);
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        gaps.push_back(ranges[i].first - ranges[i - 1].second - 1);
+    }
+    size_t fill = ranges.size() - max_ranges;
+    std::nth_element(gaps.begin(), gaps.begin() + static_cast<ptrdiff_t>(fill - 1), gaps.end());
+    int64_t threshold = gaps[fill - 1];
+
+    // As many gaps equal to the threshold as are still needed
+    size_t equal_budget = fill - static_cast<size_t>(
+        std::count_if(gaps.begin(), gaps.end(), [threshold](int64_t g) { return g < threshold; }));
+
+    std::vector<std::pair<int64_t, int64_t>> merged;
+    merged.push_back(ranges.front());
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        int64_t gap = ranges[i].first - ranges[i - 1].second - 1;
+        if (gap < threshold || (gap == threshold && equal_budget > 0)) {
+            if (gap == threshold) {
+                --equal_budget;
+            }
+            merged.back().second = ranges[i].second;
+        } else {
+            merged.push_back(ranges[i]);
+        }
+    }
+    return merged;
+}
+
+// ── Helpers (private) ──────────────────────────────────────────
+
+int64_t ChunkMap::chunkBytes(size_t chunk) const
+{
+    int64_t start = static_cast<int64_t>(chunk) * chunk_size_;
+    return std::min(chunk_size_, file_size_ - start);
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/// Which fixed-size chunks of a file have been written, independent of
+/// how the file is split into blocks: bytes may reach the disk in any
+/// order (coalesced buffers, asynchronous writes, stolen ranges). Every
+/// byte must be reported exactly once; a chunk is done once all its bytes
+/// were. Thread-safe, lock-free.
+class ChunkMap {
+public:
+    static constexpr int64_t kDefaultChunkSize = 256 * 1024;
+
+    /// Larger files get larger chunks: the map never has more chunks than this.
+    static constexpr size_t kMaxChunks = 1 << 20;
+
+    /// The chunk size ChunkMap uses for a file of file_size bytes.
+    static int64_t chunkSizeFor(int64_t file_size);
+
+    /// An empty map of file_size bytes.
+    explicit ChunkMap(int64_t file_size);
+
+    /// A map restored from bitmap() (see there). Bits past the last chunk
+    /// are ignored, missing ones read as not done.
+    ChunkMap(int64_t file_size, int64_t chunk_size, const std::vector<uint8_t>& bitmap);
+
+    ChunkMap(const ChunkMap&) = delete;
+    ChunkMap& operator=(const ChunkMap&) = delete;
+
+    /// Report [offset, offset + size) written.
+    void markWritten(int64_t offset, int64_t size);
+
+    /// One bit per chunk, chunk i in bit i % 8 of byte i / 8; set = done.
+    std::vector<uint8_t> bitmap() const;
+
+    int64_t fileSize() const { return file_size_; }
+    int64_t chunkSize() const { return chunk_size_; }
+    size_t chunkCount() const { return count_; }
+
+    bool isDone(size_t chunk) const;
+
+    /// Bytes in the chunks that are done.
+    int64_t doneBytes() const;
+
+    /// The byte ranges [first, last] of the chunks not done, adjacent
+    /// chunks merged. With more than max_ranges of them, the ones with the
+    /// smallest gaps in between are merged (refetching those gaps).
+    std::vector<std::pair<int64_t, int64_t>> missingRanges(size_t max_ranges = SIZE_MAX) const;
+
+private:
+    /// Bytes of chunk i (the last one may be short).
+    int64_t chunkBytes(size_t chunk) const;
+
+    const int64_t file_size_;
+    const int64_t chunk_size_;
+    const size_t count_;
+    std::unique_ptr<std::atomic<int32_t>[]> written_;  // bytes reported per chunk
+};
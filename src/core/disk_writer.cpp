@@ -0,0 +1,158 @@
+// disk_writer.cpp
+#include "disk_writer.h"
+#include "file_sink.h"
+
+#include <algorithm>
+
+DiskWriter::DiskWriter(size_t queue_capacity, size_t threads_per_device)
+    : queue_capacity_(std::max<size_t>(queue_capacity, 1))
+    , threads_per_device_(std::max<size_t>(threads_per_device, 1))
+{
+    stats_.queue_capacity = queue_capacity_;
+}
+
+DiskWriter::~DiskWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    for (auto& entry : devices_) {
+        entry.second->cv.notify_all();
+    }
+    for (auto& entry : devices_) {
+        for (auto& writer : entry.second->writers) {
+            if (writer.joinable()) {
+                writer.join();
+            }
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    async_cv_.wait(lock, [this] { return async_pending_ == 0; });
+}
+
+bool DiskWriter::trySubmit(FileSink* sink, const char* data, size_t size, int64_t offset,
+                           WriteDone on_done)
+{
+    uint64_t device_id = sink->device();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) {
+        return false;
+    }
+
+    auto& device = devices_[device_id];
+    if (!device) {
+        device = std::make_unique<Device>();
+        for (size_t i = 0; i < threads_per_device_; ++i) {
+            device->writers.emplace_back(&DiskWriter::writerLoop, this, device.get());
+        }
+    }
+
+    if (device->queue.size() + device->in_flight >= queue_capacity_) {
+        ++stats_.rejected;
+        return false;
+    }
+
+    device->queue.push_back(Request{sink, data, size, offset, std::move(on_done),
+                                    std::chrono::steady_clock::now()});
+    ++stats_.queue_depth;
+    device->cv.notify_one();
+    return true;
+}
+
+DiskWriterStats DiskWriter::stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void DiskWriter::writerLoop(Device* device)
+{
+    while (true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            device->cv.wait(lock, [this, device] {
+                return stopped_ || !device->queue.empty();
+            });
+
+            // Drain before exiting: the submitters wait for their callbacks
+            if (device->queue.empty()) {
+                return;
+            }
+
+            request = std::move(device->queue.front());
+            device->queue.pop_front();
+            --stats_.queue_depth;
+        }
+
+        if (writeAsync(device, request)) {
+            continue;
+        }
+
+        bool ok = request.sink->writeAt(request.data, request.size, request.offset)
+                  == request.size;
+        recordWrite(ok, request.size,
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - request.submitted));
+
+        if (request.on_done) {
+            request.on_done(ok);
+        }
+    }
+}
+
+bool DiskWriter::writeAsync(Device* device, const Request& request)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++device->in_flight;
+        ++async_pending_;
+    }
+
+    bool async = request.sink->writeAtAsync(request.data, request.size, request.offset,
+        [this, device, size = request.size, submitted = request.submitted,
+         on_done = request.on_done](bool ok) {
+            recordWrite(ok, size,
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - submitted));
+            {
+                // Before on_done: it may submit the next write right away
+                std::lock_guard<std::mutex> lock(mutex_);
+                --device->in_flight;
+            }
+            if (on_done) {
+                on_done(ok);
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--async_pending_ == 0) {
+                async_cv_.notify_all();
+            }
+        });
+
+    if (!async) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --device->in_flight;
+        --async_pending_;
+    }
+    return async;
+}
+
+void DiskWriter::recordWrite(bool ok, size_t size, std::chrono::microseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++stats_.writes;
+    if (ok) {
+        stats_.bytes_written += size;
+    }
+
+    // Exponential moving average over roughly the last 8 writes
+    if (stats_.writes == 1) {
+        stats_.avg_latency = latency;
+    } else {
+        stats_.avg_latency += (latency - stats_.avg_latency) / 8;
+    }
+    stats_.max_latency = std::max(stats_.max_latency, latency);
+}
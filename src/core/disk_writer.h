@@ -0,0 +1,91 @@
+// disk_writer.h
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class FileSink;
+
+/// Snapshot of the write stage, summed over all devices.
+struct DiskWriterStats {
+    size_t queue_depth = 0;         // writes waiting for a writer thread
+    size_t queue_capacity = 0;      // per-device bound on queue_depth
+    uint64_t writes = 0;            // writes finished (successful or not)
+    uint64_t bytes_written = 0;
+    uint64_t rejected = 0;          // trySubmit() calls refused because a queue was full
+    std::chrono::microseconds avg_latency{0};  // submit -> write finished, moving average
+    std::chrono::microseconds max_latency{0};
+};
+
+/// Asynchronous write stage between the network and the disk. Filled
+/// buffers are queued per storage device and written by that device's own
+/// writer threads, so a slow disk never stalls a transfer callback and one
+/// slow device does not hold up writes to another.
+/// Sinks with asynchronous writes (io_uring) are only handed the write by
+/// the writer thread and finish it on their own completion thread.
+/// Each queue is bounded, those writes in flight included: trySubmit()
+/// never blocks, it refuses the write and the caller applies backpressure
+/// (pauses its transfer) instead.
+class DiskWriter {
+public:
+    // Called on a writer thread (or the sink's completion thread) once the
+    // write is done; ok is false on error.
+    using WriteDone = std::function<void(bool ok)>;
+
+    DiskWriter(size_t queue_capacity, size_t threads_per_device);
+
+    // Finishes every queued write, then joins the writer threads and waits
+    // for the asynchronous writes still in flight.
+    ~DiskWriter();
+
+    // Non-copyable
+    DiskWriter(const DiskWriter&) = delete;
+    DiskWriter& operator=(const DiskWriter&) = delete;
+
+    // Queue a write of [data, data + size) at offset. data must stay valid
+    // until on_done runs. Returns false, without queueing, when the queue
+    // of the sink's device is full.
+    bool trySubmit(FileSink* sink, const char* data, size_t size, int64_t offset,
+                   WriteDone on_done);
+
+    DiskWriterStats stats() const;
+
+private:
+    struct Request {
+        FileSink* sink = nullptr;
+        const char* data = nullptr;
+        size_t size = 0;
+        int64_t offset = 0;
+        WriteDone on_done;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    struct Device {
+        std::deque<Request> queue;
+        std::condition_variable cv;
+        std::vector<std::thread> writers;
+        size_t in_flight = 0;  // asynchronous writes handed to the sink
+    };
+
+    void writerLoop(Device* device);
+    bool writeAsync(Device* device, const Request& request);
+    void recordWrite(bool ok, size_t size, std::chrono::microseconds latency);
+
+    const size_t queue_capacity_;
+    const size_t threads_per_device_;
+
+    mutable std::mutex mutex_;  // guards devices_, every queue and the stats
+    std::map<uint64_t, std::unique_ptr<Device>> devices_;  // created on first use
+    bool stopped_ = false;
+    DiskWriterStats stats_;
+    size_t async_pending_ = 0;          // asynchronous writes whose callback has not returned
+    std::condition_variable async_cv_;  // async_pending_ reached 0
+};
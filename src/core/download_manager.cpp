@@ -1,11 +1,52 @@
 #include "download_manager.h"
+#include "logger.h"
 
 #include <filesystem>
 #include <algorithm>
+#include <cctype>
 #include <stdexcept>
 
 namespace fs = std::filesystem;
 
+namespace {
+
+constexpr size_t kMaxWriteBufferSize = 16 * 1024 * 1024;
+
+/// One write buffer per connection, plus the ones that can be waiting in
+/// (or being written from) the disk writer's queue.
+size_t writeBufferCount(const ManagerConfig& config)
+{
+    size_t count = static_cast<size_t>(config.max_connections);
+    if (config.disk_writer_threads > 0) {
+        count += static_cast<size_t>(config.disk_queue_depth + config.disk_writer_threads);
+    }
+    return count;
+}
+
+/// Lower-case host of url, without user info or port.
+std::string hostOf(const std::string& url)
+{
+    size_t start = url.find("://");
+    start = start == std::string::npos ? 0 : start + 3;
+    std::string authority = url.substr(start, url.find_first_of("/?#", start) - start);
+
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        authority.erase(0, at + 1);
+    }
+    if (!authority.empty() && authority.front() == '[') {
+        authority.erase(std::min(authority.find(']') + 1, authority.size()));  // IPv6 literal
+    } else {
+        authority.erase(std::min(authority.find(':'), authority.size()));
+    }
+
+    std::transform(authority.begin(), authority.end(), authority.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return authority;
+}
+
+} // anonymous namespace
+
 // ── Constructor ────────────────────────────────────────────────
 
 DownloadManager::DownloadManager(const ManagerConfig& config)
@@ -17,9 +58,18 @@ DownloadManager::DownloadManager(const ManagerConfig& config)
     if (config_.thread_pool_size < 1) {
         config_.thread_pool_size = 16;
     }
+    config_.control_pool_size = std::clamp(config_.control_pool_size, 1, 8);
+    if (config_.max_connections < 1) {
+        config_.max_connections = 32;
+    }
     if (config_.speed_limit < 0) {
         config_.speed_limit = 0;
     }
+    config_.write_buffer_size = std::min(config_.write_buffer_size, kMaxWriteBufferSize);
+    config_.disk_writer_threads = std::clamp(config_.disk_writer_threads, 0, 8);
+    config_.disk_queue_depth = std::clamp(config_.disk_queue_depth, 1, 64);
+    config_.checkpoint_interval = std::max(config_.checkpoint_interval, 0);
+    config_.checkpoint_bytes = std::max<int64_t>(config_.checkpoint_bytes, 0);
 
     // Ensure default save directory exists
     if (!config_.default_save_dir.empty()) {
@@ -31,12 +81,50 @@ DownloadManager::DownloadManager(const ManagerConfig& config)
     }
 
     // Initialize components
+    http_share_ = std::make_unique<HttpShare>();
+
+    // Every receiving transfer can coalesce into a buffer of its own
+    buffer_pool_ = std::make_unique<BufferPool>(
+        config_.write_buffer_size, writeBufferCount(config_));
+    if (config_.file_sink_backend == FileSinkBackend::IoUring
+        && isFileSinkBackendAvailable(FileSinkBackend::IoUring)) {
+        // Pool buffers become io_uring fixed buffers: no page pinning per write
+        buffer_pool_->setHooks(
+            [](const char* data, size_t size) { registerFileSinkBuffer(data, size); },
+            [](const char* data, size_t) { unregisterFileSinkBuffer(data); });
+    }
+
+    // Buffers only ever reach the disk writer when there are buffers
+    if (config_.disk_writer_threads > 0 && config_.write_buffer_size > 0) {
+        disk_writer_ = std::make_unique<DiskWriter>(
+            static_cast<size_t>(config_.disk_queue_depth),
+            static_cast<size_t>(config_.disk_writer_threads));
+    }
+
     thread_pool_ = std::make_unique<ThreadPool>(
         static_cast<size_t>(config_.thread_pool_size));
+    control_pool_ = std::make_unique<ThreadPool>(
+        static_cast<size_t>(config_.control_pool_size));
+    timer_wheel_ = std::make_unique<TimerWheel>();
+
+    if (!config_.data_dir.empty()) {
+        try {
+            fs::create_directories(config_.data_dir);
+            journal_ = std::make_unique<TaskJournal>(
+                (fs::path(config_.data_dir) / "tasks.journal").string(), control_pool_.get());
+        } catch (const std::exception& e) {
+            // Non-fatal: tasks are then recovered from their .meta files
+            Logger::instance().error(std::string("Task journal unavailable: ") + e.what());
+        }
+    }
+
+    transfer_engine_ = std::make_unique<MultiHttpEngine>(
+        config_.max_connections, http_share_.get());
 
     token_bucket_ = std::make_unique<TokenBucket>(config_.speed_limit);
 
     task_queue_ = std::make_unique<TaskQueue>(config_.max_concurrent_tasks);
+    task_queue_->setPreemption(config_.preempt_lower_priority);
 
     if (!config_.classification_rules.empty()) {
         file_classifier_ = std::make_unique<FileClassifier>(
@@ -44,17 +132,52 @@ DownloadManager::DownloadManager(const ManagerConfig& config)
     } else {
         file_classifier_ = std::make_unique<FileClassifier>();
     }
+
+    // Applies the limits in force now, then follows the schedule
+    schedule_ = BandwidthSchedule(config_.schedule);
+    schedule_thread_ = std::thread([this] { scheduleLoop(); });
 }
 
 // ── Destructor ─────────────────────────────────────────────────
 
 DownloadManager::~DownloadManager()
 {
+    // Recovery adds tasks and touches the queue
+    recovery_cancelled_.store(true);
+    if (recovery_.valid()) {
+        recovery_.wait();
+    }
+
+    // The schedule timer touches the token bucket and the queue
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        stopping_ = true;
+    }
+    schedule_cv_.notify_all();
+    if (schedule_thread_.joinable()) {
+        schedule_thread_.join();
+    }
+
     // Cancel the token bucket so any blocked threads wake up
     if (token_bucket_) {
         token_bucket_->cancel();
     }
 
+    // Stop the reactor first so no transfer callback can reach a dying Task
+    if (transfer_engine_) {
+        transfer_engine_->shutdown();
+    }
+
+    // Task jobs capture the Task: run the queued ones while every Task is
+    // still alive. Control jobs go first since they submit transfers; jobs
+    // submitted afterwards (retry timers, a block failing) are refused.
+    if (control_pool_) {
+        control_pool_->shutdown();
+    }
+    if (thread_pool_) {
+        thread_pool_->shutdown();
+    }
+
     // Clear task references before destroying the thread pool
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -65,7 +188,8 @@ DownloadManager::~DownloadManager()
 // ── addDownload ────────────────────────────────────────────────
 
 int DownloadManager::addDownload(const std::string& url, const std::string& save_dir,
-                                 const std::string& referer, const std::string& cookie)
+                                 const std::string& referer, const std::string& cookie,
+                                 TaskPriority priority, Deadline deadline)
 {
     std::string dir = save_dir.empty() ? config_.default_save_dir : save_dir;
 
@@ -83,6 +207,16 @@ int DownloadManager::addDownload(const std::string& url, const std::string& save
         }
     }
 
+    uint64_t journal_key = journal_ ? journal_->recordAdded(url, dir) : 0;
+    return queueTask(url, dir, referer, cookie, priority, deadline, journal_key);
+}
+
+// ── queueTask ──────────────────────────────────────────────────
+
+int DownloadManager::queueTask(const std::string& url, const std::string& dir,
+                               const std::string& referer, const std::string& cookie,
+                               TaskPriority priority, Deadline deadline, uint64_t journal_key)
+{
     int task_id;
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -95,13 +229,16 @@ int DownloadManager::addDownload(const std::string& url, const std::string& save
         dir,
         config_.max_blocks_per_task,
         thread_pool_.get(),
-        token_bucket_.get(),
+        hostLimiter(url),
         file_classifier_.get(),
         [this](int id, TaskState state) {
             onTaskStateChange(id, state);
         },
         referer,
         cookie);
+    task->setServices(taskServices());
+    task->setPriority(priority, deadline);
+    task->setJournalKey(journal_key);
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -113,6 +250,27 @@ int DownloadManager::addDownload(const std::string& url, const std::string& save
     return task_id;
 }
 
+// ── scheduleDownload ───────────────────────────────────────────
+
+void DownloadManager::scheduleDownload(const std::string& url,
+                                       std::chrono::system_clock::time_point when,
+                                       const std::string& save_dir,
+                                       const std::string& referer, const std::string& cookie)
+{
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        when - std::chrono::system_clock::now());
+    if (delay.count() <= 0) {
+        addDownload(url, save_dir, referer, cookie);
+        return;
+    }
+
+    timer_wheel_->schedule(delay, [this, url, save_dir, referer, cookie]() {
+        control_pool_->submitDetached([this, url, save_dir, referer, cookie]() {
+            addDownload(url, save_dir, referer, cookie);
+        });
+    });
+}
+
 // ── pauseTask ──────────────────────────────────────────────────
 
 void DownloadManager::pauseTask(int task_id)
@@ -133,6 +291,13 @@ void DownloadManager::resumeTask(int task_id)
     }
 }
 
+// ── setTaskPriority ────────────────────────────────────────────
+
+void DownloadManager::setTaskPriority(int task_id, TaskPriority priority, Deadline deadline)
+{
+    task_queue_->setPriority(task_id, priority, deadline);
+}
+
 // ── cancelTask ─────────────────────────────────────────────────
 
 void DownloadManager::cancelTask(int task_id)
@@ -162,6 +327,10 @@ void DownloadManager::removeTask(int task_id)
         }
     }
 
+    if (journal_ && kept_alive && kept_alive->getJournalKey() != 0) {
+        journal_->recordRemoved(kept_alive->getJournalKey());
+    }
+
     // kept_alive destructs here — Task is destroyed only after removeTask returns,
     // giving thread-pool workers time to see the cancel/pause flag and exit.
 }
@@ -187,8 +356,28 @@ void DownloadManager::setSpeedLimit(int64_t bytes_per_sec)
     if (bytes_per_sec < 0) {
         bytes_per_sec = 0;
     }
-    token_bucket_->setRate(bytes_per_sec);
+    std::lock_guard<std::mutex> lock(schedule_mutex_);
     config_.speed_limit = bytes_per_sec;
+    applyScheduleLocked();
+}
+
+// ── setHostSpeedLimit ──────────────────────────────────────────
+
+void DownloadManager::setHostSpeedLimit(const std::string& host, int64_t bytes_per_sec, int weight)
+{
+    TokenBucket* limiter = hostLimiter(host);
+    limiter->setWeight(weight);
+    limiter->setRate(std::max<int64_t>(bytes_per_sec, 0));
+}
+
+// ── setTaskSpeedLimit ──────────────────────────────────────────
+
+void DownloadManager::setTaskSpeedLimit(int task_id, int64_t bytes_per_sec, int weight)
+{
+    auto task = findTask(task_id);
+    if (task) {
+        task->setSpeedLimit(bytes_per_sec, weight);
+    }
 }
 
 // ── getAllTasks ─────────────────────────────────────────────────
@@ -202,6 +391,91 @@ std::vector<TaskInfo> DownloadManager::getAllTasks() const
 
 void DownloadManager::recoverTasks()
 {
+    // The entries as of now: tasks added from here on are not recovered
+    std::vector<JournalEntry> entries;
+    if (journal_) {
+        entries = journal_->entries();
+    }
+    recovery_ = control_pool_->submit(
+        [this, entries = std::move(entries)]() { runRecovery(entries); });
+}
+
+// ── runRecovery ────────────────────────────────────────────────
+
+void DownloadManager::runRecovery(const std::vector<JournalEntry>& entries)
+{
+    if (journal_) {
+        // First list every task from its journal entry (no file access)...
+        std::vector<std::shared_ptr<Task>> unloaded;
+        for (const auto& entry : entries) {
+            if (recovery_cancelled_.load()) {
+                return;
+            }
+            auto state = static_cast<TaskState>(entry.state);
+            if (state == TaskState::Completed || state == TaskState::Cancelled
+                || (state == TaskState::Failed && entry.meta_path.empty())) {
+                continue;  // history, not work
+            }
+            if (entry.meta_path.empty()) {
+                // Never reached its first checkpoint: start it over
+                queueTask(entry.url, entry.save_dir, "", "",
+                          TaskPriority::Normal, std::nullopt, entry.key);
+                continue;
+            }
+
+            int task_id;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                task_id = next_task_id_++;
+            }
+            auto task = std::shared_ptr<Task>(Task::fromJournal(
+                task_id,
+                entry,
+                config_.max_blocks_per_task,
+                thread_pool_.get(),
+                [this](const std::string& url) { return hostLimiter(url); },
+                file_classifier_.get(),
+                [this](int id, TaskState state) {
+                    onTaskStateChange(id, state);
+                }));
+            task->setServices(taskServices());
+            task->setJournalKey(entry.key);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_by_id_[task_id] = task;
+            }
+            task_queue_->addTask(task);
+            unloaded.push_back(std::move(task));
+        }
+
+        // ...then read their MetaFiles, one at a time
+        for (const auto& task : unloaded) {
+            if (recovery_cancelled_.load()) {
+                return;
+            }
+            if (task->loadMeta()) {
+                if (task->getPriority() != TaskPriority::Normal || task->getDeadline()) {
+                    task_queue_->setPriority(task->getId(), task->getPriority(),
+                                             task->getDeadline());
+                }
+            } else if (task->getState() == TaskState::Paused) {
+                // Completed (or lost) after its last journal record: forget
+                // it, leaving whatever is on disk alone
+                task_queue_->removeTask(task->getId(), false);
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    tasks_by_id_.erase(task->getId());
+                }
+                journal_->recordRemoved(task->getJournalKey());
+            }
+        }
+
+        if (!journal_->created()) {
+            return;
+        }
+        // A new journal: import the tasks saved before there was one
+    }
+
     if (config_.default_save_dir.empty()) {
         return;
     }
@@ -213,6 +487,9 @@ void DownloadManager::recoverTasks()
 
     // Scan for .meta files in the default save directory
     for (const auto& entry : fs::directory_iterator(scan_dir)) {
+        if (recovery_cancelled_.load()) {
+            return;
+        }
         if (!entry.is_regular_file()) {
             continue;
         }
@@ -222,42 +499,58 @@ void DownloadManager::recoverTasks()
             continue;
         }
 
-        // Try to restore the task from the meta file
-        auto task = Task::fromMeta(
-            path.string(),
-            thread_pool_.get(),
-            token_bucket_.get(),
-            file_classifier_.get(),
-            [this](int id, TaskState state) {
-                onTaskStateChange(id, state);
-            });
-
-        if (!task) {
+        if (!restoreTask(path.string())) {
             // Corrupted meta file: remove it
             MetaFile::remove(path.string());
-            continue;
         }
+    }
+}
 
-        int task_id;
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            task_id = next_task_id_++;
-        }
+// ── restoreTask ────────────────────────────────────────────────
 
-        // fromMeta creates the task with id=0; we need to assign a real id.
-        // Since Task doesn't expose a setter, we create a shared_ptr and
-        // track it. The task_id in TaskInfo will be 0 but we track by our map.
-        // NOTE: A better approach would be to add a setId() method to Task,
-        // but we work with the existing interface.
-        auto shared_task = std::shared_ptr<Task>(std::move(task));
+bool DownloadManager::restoreTask(const std::string& meta_path)
+{
+    int task_id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_id = next_task_id_++;
+    }
 
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            tasks_by_id_[task_id] = shared_task;
-        }
+    // Try to restore the task from the meta file
+    auto task = Task::fromMeta(
+        task_id,
+        meta_path,
+        thread_pool_.get(),
+        [this](const std::string& url) { return hostLimiter(url); },
+        file_classifier_.get(),
+        [this](int id, TaskState state) {
+            onTaskStateChange(id, state);
+        });
 
-        task_queue_->addTask(std::move(shared_task));
+    if (!task) {
+        return false;
     }
+
+    uint64_t journal_key = 0;
+    if (journal_) {
+        auto info = task->getInfo();
+        journal_key = journal_->recordAdded(
+            info.url, fs::path(info.file_path).parent_path().string());
+        journal_->recordCheckpoint(journal_key, meta_path, info.file_name,
+                                   info.file_size, info.progress.downloaded_bytes);
+    }
+
+    auto shared_task = std::shared_ptr<Task>(std::move(task));
+    shared_task->setServices(taskServices());
+    shared_task->setJournalKey(journal_key);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_by_id_[task_id] = shared_task;
+    }
+
+    task_queue_->addTask(std::move(shared_task));
+    return true;
 }
 
 // ── updateConfig ───────────────────────────────────────────────
@@ -266,13 +559,25 @@ void DownloadManager::updateConfig(const ManagerConfig& config)
 {
     config_.default_save_dir = config.default_save_dir;
     config_.max_blocks_per_task = std::clamp(config.max_blocks_per_task, 1, 32);
-    config_.max_concurrent_tasks = std::clamp(config.max_concurrent_tasks, 1, 10);
-
-    // Update speed limit
-    setSpeedLimit(config.speed_limit);
+    config_.checkpoint_interval = std::max(config.checkpoint_interval, 0);  // for tasks added from now on
+    config_.checkpoint_bytes = std::max<int64_t>(config.checkpoint_bytes, 0);
+    if (config.max_connections >= 1) {
+        config_.max_connections = config.max_connections;
+        transfer_engine_->setMaxConnections(config_.max_connections);
+        buffer_pool_->setMaxBuffers(writeBufferCount(config_));
+    }
 
-    // Update task queue concurrency
-    task_queue_->setMaxConcurrent(config_.max_concurrent_tasks);
+    // Update speed limit, task queue concurrency and the schedule over them
+    {
+        std::lock_guard<std::mutex> lock(schedule_mutex_);
+        config_.max_concurrent_tasks = std::clamp(config.max_concurrent_tasks, 1, 10);
+        config_.speed_limit = std::max<int64_t>(config.speed_limit, 0);
+        config_.schedule = config.schedule;
+        schedule_ = BandwidthSchedule(config_.schedule);
+        applyScheduleLocked();
+    }
+    config_.preempt_lower_priority = config.preempt_lower_priority;
+    task_queue_->setPreemption(config_.preempt_lower_priority);
 
     // Update file classifier rules
     if (!config.classification_rules.empty()) {
@@ -280,6 +585,62 @@ void DownloadManager::updateConfig(const ManagerConfig& config)
     }
 }
 
+// ── getDiskWriterStats ─────────────────────────────────────────
+
+DiskWriterStats DownloadManager::getDiskWriterStats() const
+{
+    return disk_writer_ ? disk_writer_->stats() : DiskWriterStats{};
+}
+
+// ── executor stats ─────────────────────────────────────────────
+
+ThreadPoolStats DownloadManager::getControlExecutorStats() const
+{
+    return control_pool_->stats();
+}
+
+ThreadPoolStats DownloadManager::getTransferExecutorStats() const
+{
+    return thread_pool_->stats();
+}
+
+// ── Bandwidth schedule (private) ───────────────────────────────
+
+void DownloadManager::scheduleLoop()
+{
+    std::unique_lock<std::mutex> lock(schedule_mutex_);
+    while (!stopping_) {
+        applyScheduleLocked();
+
+        // Windows are minute-aligned: wake just after the next minute starts
+        auto now = std::chrono::system_clock::now();
+        auto next_minute = std::chrono::floor<std::chrono::minutes>(now) + std::chrono::minutes(1);
+        schedule_cv_.wait_for(lock, next_minute - now + std::chrono::milliseconds(50),
+                              [this] { return stopping_; });
+    }
+}
+
+void DownloadManager::applyScheduleLocked()
+{
+    AppliedLimits limits{config_.speed_limit, config_.max_concurrent_tasks};
+    if (const BandwidthWindow* window = schedule_.windowAt(std::chrono::system_clock::now())) {
+        limits.speed_limit = window->speed_limit;
+        if (window->max_concurrent_tasks > 0) {
+            limits.max_concurrent_tasks = std::clamp(window->max_concurrent_tasks, 1, 10);
+        }
+    }
+
+    // Only act at boundaries, so waiting transfers are not woken every minute
+    if (applied_limits_
+        && applied_limits_->speed_limit == limits.speed_limit
+        && applied_limits_->max_concurrent_tasks == limits.max_concurrent_tasks) {
+        return;
+    }
+    token_bucket_->setRate(limits.speed_limit);
+    task_queue_->setMaxConcurrent(limits.max_concurrent_tasks);
+    applied_limits_ = limits;
+}
+
 // ── onTaskStateChange (private) ────────────────────────────────
 
 void DownloadManager::onTaskStateChange(int task_id, TaskState state)
@@ -309,3 +670,35 @@ std::shared_ptr<Task> DownloadManager::findTask(int task_id) const
     }
     return nullptr;
 }
+
+// ── hostLimiter (private) ──────────────────────────────────────
+
+TokenBucket* DownloadManager::hostLimiter(const std::string& url)
+{
+    std::string host = hostOf(url);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& limiter = host_limiters_[host];
+    if (!limiter) {
+        limiter = std::make_unique<TokenBucket>(0, token_bucket_.get());
+    }
+    return limiter.get();
+}
+
+// ── taskServices (private) ─────────────────────────────────────
+
+TaskServices DownloadManager::taskServices() const
+{
+    TaskServices services;
+    services.transfer_engine = transfer_engine_.get();
+    services.http_share = http_share_.get();
+    services.buffer_pool = buffer_pool_.get();
+    services.disk_writer = disk_writer_.get();
+    services.timers = timer_wheel_.get();
+    services.control_pool = control_pool_.get();
+    services.journal = journal_.get();
+    services.file_sink_backend = config_.file_sink_backend;
+    services.preallocation = config_.preallocation;
+    services.checkpoint_interval = std::chrono::seconds(config_.checkpoint_interval);
+    services.checkpoint_bytes = config_.checkpoint_bytes;
+    return services;
+}
@@ -1,24 +1,56 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
 #include <map>
 #include <mutex>
+#include <condition_variable>
+#include <future>
+#include <optional>
+#include <thread>
+#include <chrono>
 #include <cstdint>
 
 #include "task.h"
 #include "task_queue.h"
+#include "task_journal.h"
 #include "thread_pool.h"
+#include "timer_wheel.h"
+#include "multi_http_engine.h"
+#include "http_share.h"
+#include "buffer_pool.h"
+#include "disk_writer.h"
 #include "token_bucket.h"
+#include "bandwidth_schedule.h"
 #include "file_classifier.h"
 
 struct ManagerConfig {
     std::string default_save_dir;
+    // Where the task database (tasks.journal) lives; empty = none, tasks
+    // are recovered by scanning default_save_dir for .meta files
+    std::string data_dir;
     int max_blocks_per_task = 8;
     int max_concurrent_tasks = 3;
-    int thread_pool_size = 16;
+    int thread_pool_size = 16;     // transfer executor (thread-pool block transfers)
+    int control_pool_size = 4;     // control executor: HEAD probes, resume checks, completion
+    int max_connections = 32;      // connection budget shared by all block transfers
+    FileSinkBackend file_sink_backend = FileSinkBackend::Default;  // positional-write backend
+    PreallocationMode preallocation = PreallocationMode::Reserved; // disk space taken before a download starts
+    size_t write_buffer_size = 2 * 1024 * 1024;  // per-transfer write coalescing, 0 = off (max 16 MB)
+    int disk_writer_threads = 1;   // writer threads per storage device, 0 = write on the transfer thread
+    int disk_queue_depth = 8;      // buffers queued per device before transfers are paused
+    int checkpoint_interval = 5;   // seconds between progress checkpoints while downloading, 0 = on pause only
+    int64_t checkpoint_bytes = 64 * 1024 * 1024;  // also checkpoint after this much new data, 0 = off
     int64_t speed_limit = 0;       // 0 = no limit
+    // Time-of-day overrides of speed_limit / max_concurrent_tasks: the first
+    // window covering the current local time applies, outside all of them
+    // the values above do
+    std::vector<BandwidthWindow> schedule;
+    // Let a waiting task pause a running task of a lower priority class
+    // when every slot is taken (the paused one resumes when a slot frees)
+    bool preempt_lower_priority = false;
     // File classification rules: category_name -> [extensions]
     std::map<std::string, std::vector<std::string>> classification_rules;
 };
@@ -32,9 +64,18 @@ public:
     DownloadManager(const DownloadManager&) = delete;
     DownloadManager& operator=(const DownloadManager&) = delete;
 
-    /// Add a new download. Returns the assigned task_id.
+    /// Add a new download. Returns the assigned task_id. Waiting tasks
+    /// start by priority class, then earliest deadline, then queue order.
     int addDownload(const std::string& url, const std::string& save_dir = "",
-                    const std::string& referer = "", const std::string& cookie = "");
+                    const std::string& referer = "", const std::string& cookie = "",
+                    TaskPriority priority = TaskPriority::Normal,
+                    Deadline deadline = std::nullopt);
+
+    /// Add url at the given time (on the timer wheel; nothing waits for it).
+    /// A time in the past adds it now.
+    void scheduleDownload(const std::string& url, std::chrono::system_clock::time_point when,
+                          const std::string& save_dir = "",
+                          const std::string& referer = "", const std::string& cookie = "");
 
     /// Pause a downloading task.
     void pauseTask(int task_id);
@@ -54,31 +95,111 @@ public:
     /// Move task one position down in the queue.
     void moveTaskDown(int task_id);
 
-    /// Set global speed limit (bytes/sec). 0 = unlimited.
+    /// Change a task's priority class and deadline (whole seconds).
+    void setTaskPriority(int task_id, TaskPriority priority, Deadline deadline = std::nullopt);
+
+    /// Set global speed limit (bytes/sec). 0 = unlimited. While a schedule
+    /// window is active its limit applies instead.
     void setSpeedLimit(int64_t bytes_per_sec);
 
+    /// Cap all downloads from host (bytes/sec, 0 = only the global limit).
+    /// weight is the host's share of the global limit against the other
+    /// busy hosts; unused shares go to whoever has demand.
+    void setHostSpeedLimit(const std::string& host, int64_t bytes_per_sec, int weight = 1);
+
+    /// Cap one task (bytes/sec, 0 = only its host's and the global limit).
+    /// weight is the task's share of its host's bandwidth.
+    void setTaskSpeedLimit(int task_id, int64_t bytes_per_sec, int weight = 1);
+
     /// Get info snapshots for all tasks.
     std::vector<TaskInfo> getAllTasks() const;
 
-    /// Scan default_save_dir for .meta files and recover unfinished tasks.
+    /// Recover unfinished tasks from the task database, in the background:
+    /// returns at once, tasks appear (Paused) as they are restored. Each
+    /// is first listed from its journal entry alone; the MetaFiles are
+    /// read afterwards, one by one (or on a task's first resume). The
+    /// first time (or without a data_dir) default_save_dir is scanned for
+    /// .meta files instead, and what is found is imported into the
+    /// database. Call once.
     void recoverTasks();
 
     /// Update configuration (save dir, concurrency, blocks, speed limit, rules).
     void updateConfig(const ManagerConfig& config);
 
+    /// Queue depth and latency of the asynchronous write stage (all zero
+    /// when it is disabled).
+    DiskWriterStats getDiskWriterStats() const;
+
+    /// Queue depth and latency of the control executor (metadata work).
+    ThreadPoolStats getControlExecutorStats() const;
+
+    /// Queue depth and latency of the transfer executor.
+    ThreadPoolStats getTransferExecutorStats() const;
+
 private:
     /// Callback invoked when a task changes state.
     void onTaskStateChange(int task_id, TaskState state);
 
+    /// Create, register and queue a task. journal_key: its TaskJournal key
+    /// (0: none).
+    int queueTask(const std::string& url, const std::string& dir,
+                  const std::string& referer, const std::string& cookie,
+                  TaskPriority priority, Deadline deadline, uint64_t journal_key);
+
+    /// Job of recoverTasks(): entries are the journal's at the call.
+    /// Returns early once the manager is being destroyed.
+    void runRecovery(const std::vector<JournalEntry>& entries);
+
+    /// Queue the task saved in meta_path and record it in the journal.
+    /// Returns false if the meta file cannot be loaded.
+    bool restoreTask(const std::string& meta_path);
+
     /// Find a task by ID across the queue. Returns nullptr if not found.
     std::shared_ptr<Task> findTask(int task_id) const;
 
+    /// Shared services handed to every Task.
+    TaskServices taskServices() const;
+
+    /// The limiter of url's host (created on first use, under the global one).
+    TokenBucket* hostLimiter(const std::string& url);
+
+    /// Timer thread: re-evaluates the schedule at every minute boundary.
+    void scheduleLoop();
+
+    /// Apply the speed limit and concurrency in force now, if they differ
+    /// from the ones last applied. Caller holds schedule_mutex_.
+    void applyScheduleLocked();
+
     ManagerConfig config_;
-    std::unique_ptr<ThreadPool> thread_pool_;
-    std::unique_ptr<TokenBucket> token_bucket_;
+    std::unique_ptr<HttpShare> http_share_;  // declared first: outlives every engine
+    std::unique_ptr<BufferPool> buffer_pool_; // outlives every Task's blocks
+    std::unique_ptr<DiskWriter> disk_writer_; // outlives every Task's blocks, may be nullptr
+    std::unique_ptr<TaskJournal> journal_;    // outlives every Task and the pools' last jobs, may be nullptr
+    std::unique_ptr<ThreadPool> thread_pool_;   // transfer executor
+    std::unique_ptr<ThreadPool> control_pool_;  // control executor
+    std::unique_ptr<TimerWheel> timer_wheel_;  // retries and delayed starts, outlives every Task
+    std::unique_ptr<MultiHttpEngine> transfer_engine_;
+    std::unique_ptr<TokenBucket> token_bucket_;  // root of the limiter tree
+    std::map<std::string, std::unique_ptr<TokenBucket>> host_limiters_;  // guarded by mutex_, outlive every Task
     std::unique_ptr<TaskQueue> task_queue_;
     std::unique_ptr<FileClassifier> file_classifier_;
 
+    // Bandwidth schedule (guards config_.speed_limit, max_concurrent_tasks
+    // and schedule as well)
+    struct AppliedLimits {
+        int64_t speed_limit;
+        int max_concurrent_tasks;
+    };
+    std::mutex schedule_mutex_;
+    std::condition_variable schedule_cv_;
+    BandwidthSchedule schedule_;
+    std::optional<AppliedLimits> applied_limits_;
+    bool stopping_ = false;
+    std::thread schedule_thread_;
+
+    std::future<void> recovery_;                // runRecovery() on the control executor
+    std::atomic<bool> recovery_cancelled_{false};
+
     mutable std::mutex mutex_;
     // Map task_id -> shared_ptr<Task> for quick lookup
     std::map<int, std::shared_ptr<Task>> tasks_by_id_;
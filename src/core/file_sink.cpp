@@ -0,0 +1,923 @@
+#include "file_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// io_uring is driven through its system calls directly: no liburing needed.
+// The UAPI's operations and registration opcodes are enumerators, so the
+// headers' vintage is told by macros of the same release: the backend needs
+// the 5.6 UAPI (IORING_OP_WRITE, the opcode probe), the fixed-buffer table
+// the 5.13 one (IORING_REGISTER_BUFFERS2). Older headers fall back to pwrite.
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IO_URING_OP_SUPPORTED
+#define FILE_SINK_HAS_IO_URING 1
+#ifdef IORING_FEAT_RSRC_TAGS
+#define FILE_SINK_HAS_FIXED_BUFFERS 1
+#endif
+#include <condition_variable>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+/// Zeroed preallocation writes in chunks of this size.
+constexpr size_t kZeroChunk = 1024 * 1024;
+
+/// Disk space held by the file at file_path, 0 if there is none.
+int64_t allocatedBytes(const std::string& file_path)
+{
+#ifdef _WIN32
+    std::error_code ec;
+    uintmax_t size = fs::file_size(fs::path(file_path), ec);
+    return ec ? 0 : static_cast<int64_t>(size);
+#else
+    struct stat st = {};
+    if (::stat(file_path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    return static_cast<int64_t>(st.st_blocks) * 512;
+#endif
+}
+
+/// Throw if the volume holding file_path has less than `needed` bytes free,
+/// counting the space of the file already there as free: the caller is
+/// about to truncate it. An unknown amount of free space passes: the
+/// writes will tell.
+void checkFreeSpace(const std::string& file_path, int64_t needed)
+{
+    std::error_code ec;
+    fs::path dir = fs::absolute(fs::path(file_path), ec).parent_path();
+    fs::space_info info = fs::space(dir, ec);
+    needed -= allocatedBytes(file_path);
+    if (ec || needed <= 0 || static_cast<uintmax_t>(needed) <= info.available) {
+        return;
+    }
+    throw std::runtime_error("Not enough disk space for " + file_path + ": "
+        + std::to_string(needed) + " bytes needed, "
+        + std::to_string(info.available) + " available");
+}
+
+#ifdef _WIN32
+
+// ── Overlapped WriteFile backend (Windows) ─────────────────────
+
+/// One event per thread: concurrent overlapped writes on a shared handle
+/// must not wait on the file handle itself.
+struct ThreadEvent {
+    HANDLE event = ::CreateEventA(nullptr, TRUE, FALSE, nullptr);
+    ~ThreadEvent() {
+        if (event) ::CloseHandle(event);
+    }
+};
+
+class OverlappedFileSink : public FileSink {
+public:
+    explicit OverlappedFileSink(const std::string& file_path) {
+        // Open for overlapped writing, shared for reading
+        HANDLE h = ::CreateFileA(
+            file_path.c_str(),
+            GENERIC_WRITE,
+            FILE_SHARE_READ | FILE_SHARE_WRITE,
+            nullptr,
+            OPEN_ALWAYS,
+            FILE_FLAG_OVERLAPPED,
+            nullptr);
+
+        if (h == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("FileSink: failed to open file for writing: " + file_path);
+        }
+        handle_ = h;
+
+        BY_HANDLE_FILE_INFORMATION info = {};
+        if (::GetFileInformationByHandle(h, &info)) {
+            device_ = info.dwVolumeSerialNumber;
+        }
+    }
+
+    ~OverlappedFileSink() override { close(); }
+
+    size_t writeAt(const char* data, size_t size, int64_t offset) override {
+        // Shared: writers run concurrently, close() waits for them
+        std::shared_lock<std::shared_mutex> lock(close_mutex_);
+        HANDLE h = handle_;
+        if (h == INVALID_HANDLE_VALUE) {
+            return 0;
+        }
+
+        static thread_local ThreadEvent tls_event;
+
+        size_t total = 0;
+        while (total < size) {
+            DWORD chunk = static_cast<DWORD>(std::min<size_t>(size - total, 1u << 30));
+            int64_t pos = offset + static_cast<int64_t>(total);
+
+            OVERLAPPED ov = {};
+            ov.Offset = static_cast<DWORD>(pos & 0xFFFFFFFF);
+            ov.OffsetHigh = static_cast<DWORD>((pos >> 32) & 0xFFFFFFFF);
+            ov.hEvent = tls_event.event;
+
+            DWORD bytes_written = 0;
+            BOOL ok = ::WriteFile(h, data + total, chunk, &bytes_written, &ov);
+            if (!ok) {
+                // For overlapped I/O, ERROR_IO_PENDING means we need to wait
+                if (::GetLastError() != ERROR_IO_PENDING
+                    || !::GetOverlappedResult(h, &ov, &bytes_written, TRUE)) {
+                    return 0;
+                }
+            }
+            if (bytes_written == 0) {
+                return 0;
+            }
+            total += bytes_written;
+        }
+        return total;
+    }
+
+    void close() override {
+        std::unique_lock<std::shared_mutex> lock(close_mutex_);
+        if (handle_ != INVALID_HANDLE_VALUE) {
+            ::CloseHandle(handle_);
+            handle_ = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    bool sync() override {
+        std::shared_lock<std::shared_mutex> lock(close_mutex_);
+        return handle_ != INVALID_HANDLE_VALUE && ::FlushFileBuffers(handle_);
+    }
+
+    FileSinkBackend backend() const override { return FileSinkBackend::Overlapped; }
+
+    uint64_t device() const override { return device_; }
+
+private:
+    std::shared_mutex close_mutex_;
+    HANDLE handle_ = INVALID_HANDLE_VALUE;
+    uint64_t device_ = 0;
+};
+
+#else
+
+// ── pwrite backend (POSIX) ─────────────────────────────────────
+
+class PwriteFileSink : public FileSink {
+public:
+    explicit PwriteFileSink(const std::string& file_path) {
+        int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("FileSink: failed to open file for writing: " + file_path);
+        }
+        fd_ = fd;
+
+        struct stat st = {};
+        if (::fstat(fd, &st) == 0) {
+            device_ = static_cast<uint64_t>(st.st_dev);
+        }
+    }
+
+    ~PwriteFileSink() override { close(); }
+
+    size_t writeAt(const char* data, size_t size, int64_t offset) override {
+        // Shared: writers run concurrently, close() waits for them so the
+        // descriptor number cannot be recycled under an in-flight pwrite.
+        std::shared_lock<std::shared_mutex> lock(close_mutex_);
+        int fd = fd_;
+        if (fd < 0) {
+            return 0;
+        }
+
+        // pwrite may write less than asked (signals, quotas, pipes); loop
+        // until everything is on its way to the page cache.
+        size_t total = 0;
+        while (total < size) {
+            ssize_t n = ::pwrite(fd, data + total, size - total,
+                                 static_cast<off_t>(offset + static_cast<int64_t>(total)));
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return 0;
+            }
+            if (n == 0) {
+                return 0;  // no progress possible (e.g. disk full)
+            }
+            total += static_cast<size_t>(n);
+        }
+        return total;
+    }
+
+    void close() override {
+        std::unique_lock<std::shared_mutex> lock(close_mutex_);
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    bool sync() override {
+        // Shared like writeAt(): writes may go on while the data is flushed
+        std::shared_lock<std::shared_mutex> lock(close_mutex_);
+        if (fd_ < 0) {
+            return false;
+        }
+#if defined(__APPLE__)
+        return ::fsync(fd_) == 0;  // no fdatasync
+#else
+        return ::fdatasync(fd_) == 0;
+#endif
+    }
+
+    FileSinkBackend backend() const override { return FileSinkBackend::Pwrite; }
+
+    uint64_t device() const override { return device_; }
+
+protected:
+    std::shared_mutex close_mutex_;
+    int fd_ = -1;
+    uint64_t device_ = 0;
+};
+
+#endif
+
+#ifdef FILE_SINK_HAS_IO_URING
+
+// ── io_uring backend (Linux) ───────────────────────────────────
+
+/// One io_uring instance shared by every io_uring sink. Writers from all
+/// tasks queue their SQEs together and return; whoever finds the ring
+/// idle submits everything queued so far with one io_uring_enter(). A
+/// single completion thread sleeps in the kernel, takes every CQE
+/// available at once from the mapped CQ ring and runs their callbacks.
+class IoUring {
+public:
+    /// ok: the whole buffer was written. Runs on the completion thread, so
+    /// it must not wait for another write on the ring.
+    using Done = std::function<void(bool ok)>;
+
+    IoUring() = default;
+
+    /// Only reached when init() failed: shared() never destroys a working
+    /// ring. Releases whatever init() had set up.
+    ~IoUring() {
+        if (sqes_) {
+            ::munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            ::munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            ::munmap(sq_ring_, sq_ring_size_);
+        }
+        if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+        }
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /// The process-wide ring, or nullptr when the kernel lacks io_uring or
+    /// positional writes on it (or a seccomp profile blocks it).
+    static IoUring* shared() {
+        static IoUring* ring = [] {
+            auto r = new IoUring();  // never destroyed: sinks may outlive statics
+            if (!r->init()) {
+                delete r;
+                return static_cast<IoUring*>(nullptr);
+            }
+            std::thread(&IoUring::completionLoop, r).detach();
+            return r;
+        }();
+        return ring;
+    }
+
+    /// Queue a write of [data, data + size) at offset of fd and return
+    /// without waiting for it; on_done runs on the completion thread, which
+    /// also continues short writes. Blocks only while kEntries writes are
+    /// already in flight.
+    void write(int fd, const char* data, size_t size, int64_t offset, Done on_done) {
+        auto* op = new Op{fd, data, size, offset, 0, std::move(on_done)};
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return in_flight_ < sq_entries_; });
+        ++in_flight_;
+        queueLocked(op);
+        submitLocked(lock);
+    }
+
+    void registerBuffer(const char* data, size_t size) {
+        std::lock_guard<std::mutex> lock(fixed_mutex_);
+        if (fixed_free_.empty() || fixed_.count(data)) {
+            return;
+        }
+        unsigned slot = fixed_free_.back();
+        if (updateSlot(slot, const_cast<char*>(data), size)) {
+            fixed_free_.pop_back();
+            fixed_[data] = Fixed{slot, size};
+        }
+    }
+
+    void unregisterBuffer(const char* data) {
+        std::lock_guard<std::mutex> lock(fixed_mutex_);
+        auto it = fixed_.find(data);
+        if (it == fixed_.end()) {
+            return;
+        }
+        // Writes already submitted keep their own reference to the pages
+        updateSlot(it->second.slot, nullptr, 0);
+        fixed_free_.push_back(it->second.slot);
+        fixed_.erase(it);
+    }
+
+private:
+    /// One write, from write() until its callback; user_data of its SQEs.
+    struct Op {
+        int fd;
+        const char* data;
+        size_t size;
+        int64_t offset;
+        size_t written;  // continued from here after a short write
+        Done on_done;
+    };
+
+    struct Fixed {
+        unsigned slot;
+        size_t size;
+    };
+
+    static constexpr unsigned kEntries = 256;
+    static constexpr unsigned kFixedSlots = 1024;
+
+    bool init() {
+        io_uring_params params = {};
+        ring_fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, kEntries, &params));
+        if (ring_fd_ < 0 || !probeWrite()) {
+            return false;
+        }
+
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        }
+
+        // On failure the destructor unmaps what was mapped and closes the ring
+        sq_ring_size_ = sq_size;
+        sq_ring_ = ::mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        cq_ring_size_ = cq_size;
+        cq_ring_ = single_mmap ? sq_ring_
+                               : ::mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<char*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+        auto* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Sparse fixed-buffer table (5.13+), filled as the pool allocates.
+        // Without it every write simply goes through IORING_OP_WRITE.
+#ifdef FILE_SINK_HAS_FIXED_BUFFERS
+        std::vector<iovec> empty(kFixedSlots, iovec{nullptr, 0});
+        io_uring_rsrc_register reg = {};
+        reg.nr = kFixedSlots;
+        reg.data = reinterpret_cast<uint64_t>(empty.data());
+        if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS2,
+                      &reg, sizeof(reg)) == 0) {
+            for (unsigned slot = kFixedSlots; slot > 0; --slot) {
+                fixed_free_.push_back(slot - 1);
+            }
+        }
+#endif
+        return true;
+    }
+
+    /// Whether the kernel implements IORING_OP_WRITE (5.6+).
+    bool probeWrite() {
+        const size_t ops = IORING_OP_LAST;
+        std::vector<char> buffer(sizeof(io_uring_probe) + ops * sizeof(io_uring_probe_op));
+        auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PROBE,
+                      probe, static_cast<unsigned>(ops)) < 0) {
+            return false;
+        }
+        return probe->last_op >= IORING_OP_WRITE
+            && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    long enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags,
+                         nullptr, 0);
+    }
+
+    /// Put an SQE for the rest of op in the SQ. The in-flight bound keeps
+    /// a slot free. Caller holds mutex_.
+    void queueLocked(Op* op) {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = op->fd;
+        sqe->addr = reinterpret_cast<uint64_t>(op->data + op->written);
+        sqe->len = static_cast<uint32_t>(std::min<size_t>(op->size - op->written, 1u << 30));
+        sqe->off = static_cast<uint64_t>(op->offset + static_cast<int64_t>(op->written));
+        sqe->user_data = reinterpret_cast<uint64_t>(op);
+
+        // Pool buffers registered up front skip the per-write page pinning
+        int slot = fixedSlot(op->data, op->size);
+        if (slot >= 0) {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->buf_index = static_cast<uint16_t>(slot);
+        }
+
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    /// Batch: one submitter at a time takes everything queued meanwhile.
+    /// Caller holds mutex_ (through lock).
+    void submitLocked(std::unique_lock<std::mutex>& lock) {
+        std::vector<Op*> failed;
+        while (!submitting_ && unsubmittedLocked() > 0) {
+            submitting_ = true;
+            unsigned count = unsubmittedLocked();
+            lock.unlock();
+            long ret = enter(count, 0, 0);
+            int error = errno;
+            lock.lock();
+            submitting_ = false;
+            if (ret < 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+                takeUnsubmittedLocked(&failed);
+            }
+        }
+        if (failed.empty()) {
+            return;
+        }
+        in_flight_ -= static_cast<unsigned>(failed.size());
+        cv_.notify_all();
+        lock.unlock();
+        for (Op* op : failed) {
+            finish(op, false);
+        }
+        lock.lock();
+    }
+
+    /// SQEs queued but not yet consumed by the kernel. Caller holds mutex_.
+    unsigned unsubmittedLocked() const {
+        return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    }
+
+    /// The kernel refused the submission: take the queued SQEs back (it
+    /// only reads the SQ inside io_uring_enter). Caller holds mutex_.
+    void takeUnsubmittedLocked(std::vector<Op*>* ops) {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        for (unsigned i = head; i != *sq_tail_; ++i) {
+            ops->push_back(reinterpret_cast<Op*>(sqes_[sq_array_[i & sq_mask_]].user_data));
+        }
+        __atomic_store_n(sq_tail_, head, __ATOMIC_RELEASE);
+    }
+
+    /// Runs on its own thread for the life of the process: waits for at
+    /// least one completion, then handles every one available.
+    void completionLoop() {
+        std::vector<std::pair<Op*, bool>> finished;
+        while (true) {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            bool requeued = false;
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+                auto* op = reinterpret_cast<Op*>(cqe.user_data);
+                if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+                    queueLocked(op);  // retried as it was
+                    requeued = true;
+                    continue;
+                }
+                if (cqe.res > 0) {
+                    op->written += static_cast<size_t>(cqe.res);
+                    if (op->written < op->size) {
+                        queueLocked(op);  // short write: the rest goes next
+                        requeued = true;
+                        continue;
+                    }
+                }
+                // Done, failed, or no progress possible (e.g. disk full)
+                finished.emplace_back(op, cqe.res > 0);
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+            if (requeued) {
+                submitLocked(lock);
+            }
+            if (finished.empty()) {
+                continue;
+            }
+            in_flight_ -= static_cast<unsigned>(finished.size());
+            cv_.notify_all();
+            lock.unlock();
+
+            for (auto& [op, ok] : finished) {
+                finish(op, ok);
+            }
+            finished.clear();
+        }
+    }
+
+    static void finish(Op* op, bool ok) {
+        if (op->on_done) {
+            op->on_done(ok);
+        }
+        delete op;
+    }
+
+    int fixedSlot(const char* data, size_t size) {
+        std::lock_guard<std::mutex> lock(fixed_mutex_);
+        auto it = fixed_.find(data);
+        if (it == fixed_.end() || size > it->second.size) {
+            return -1;
+        }
+        return static_cast<int>(it->second.slot);
+    }
+
+    bool updateSlot(unsigned slot, char* data, size_t size) {
+#ifdef FILE_SINK_HAS_FIXED_BUFFERS
+        iovec iov{data, size};
+        io_uring_rsrc_update2 update = {};
+        update.offset = slot;
+        update.data = reinterpret_cast<uint64_t>(&iov);
+        update.nr = 1;
+        return ::syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS_UPDATE,
+                         &update, sizeof(update)) == 1;
+#else
+        (void)slot;
+        (void)data;
+        (void)size;
+        return false;  // no table: fixed_free_ stays empty, this is never reached
+#endif
+    }
+
+    int ring_fd_ = -1;
+    void* sq_ring_ = MAP_FAILED;
+    void* cq_ring_ = MAP_FAILED;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    size_t cq_ring_size_ = 0;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    std::mutex mutex_;              // guards the SQ tail, the CQ head and the two below
+    std::condition_variable cv_;    // in_flight_ went down
+    bool submitting_ = false;
+    unsigned in_flight_ = 0;        // writes between write() and their callback
+
+    std::mutex fixed_mutex_;        // guards the fixed-buffer table
+    std::unordered_map<const char*, Fixed> fixed_;
+    std::vector<unsigned> fixed_free_;
+};
+
+class IoUringFileSink : public PwriteFileSink {
+public:
+    IoUringFileSink(const std::string& file_path, IoUring* ring)
+        : PwriteFileSink(file_path)
+        , ring_(ring)
+    {
+    }
+
+    ~IoUringFileSink() override { close(); }
+
+    size_t writeAt(const char* data, size_t size, int64_t offset) override {
+        // The direct write-through path: wait for the ring like pwrite would
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool finished = false;
+        bool ok = false;
+        bool started = startWrite(data, size, offset, [&](bool result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            ok = result;
+            finished = true;
+            cv.notify_one();
+        });
+        if (!started) {
+            return 0;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return finished; });
+        return ok ? size : 0;
+    }
+
+    bool writeAtAsync(const char* data, size_t size, int64_t offset,
+                      std::function<void(bool ok)> on_done) override {
+        if (!startWrite(data, size, offset, on_done)) {
+            on_done(false);
+        }
+        return true;
+    }
+
+    void close() override {
+        // New writes wait for (and then fail on) the closed descriptor;
+        // the ones in the ring must land before its number can be reused
+        std::unique_lock<std::shared_mutex> lock(close_mutex_);
+        {
+            std::unique_lock<std::mutex> pending_lock(pending_mutex_);
+            pending_cv_.wait(pending_lock, [this] { return pending_ == 0; });
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    FileSinkBackend backend() const override { return FileSinkBackend::IoUring; }
+
+private:
+    /// Hand the write to the ring. False, without calling on_done, after close().
+    bool startWrite(const char* data, size_t size, int64_t offset,
+                    std::function<void(bool ok)> on_done) {
+        std::shared_lock<std::shared_mutex> lock(close_mutex_);
+        if (fd_ < 0) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+            ++pending_;
+        }
+        ring_->write(fd_, data, size, offset, [this, on_done = std::move(on_done)](bool ok) {
+            {
+                // Under the lock: close() may destroy the sink right after
+                std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+                --pending_;
+                pending_cv_.notify_all();
+            }
+            on_done(ok);
+        });
+        return true;
+    }
+
+    IoUring* ring_;  // process-wide, never destroyed
+
+    std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    size_t pending_ = 0;  // writes in the ring
+};
+
+#endif
+
+} // anonymous namespace
+
+std::unique_ptr<FileSink> openFileSink(const std::string& file_path, FileSinkBackend backend)
+{
+#ifdef _WIN32
+    if (backend == FileSinkBackend::Default || backend == FileSinkBackend::Overlapped) {
+        return std::make_unique<OverlappedFileSink>(file_path);
+    }
+#else
+#ifdef FILE_SINK_HAS_IO_URING
+    if (backend == FileSinkBackend::IoUring) {
+        if (IoUring* ring = IoUring::shared()) {
+            return std::make_unique<IoUringFileSink>(file_path, ring);
+        }
+        backend = FileSinkBackend::Pwrite;  // kernel without io_uring
+    }
+#endif
+    if (backend == FileSinkBackend::Default || backend == FileSinkBackend::Pwrite) {
+        return std::make_unique<PwriteFileSink>(file_path);
+    }
+#endif
+    throw std::runtime_error("FileSink: backend not available on this platform");
+}
+
+bool isFileSinkBackendAvailable(FileSinkBackend backend)
+{
+    switch (backend) {
+        case FileSinkBackend::Default:
+            return true;
+#ifdef _WIN32
+        case FileSinkBackend::Overlapped:
+            return true;
+#else
+        case FileSinkBackend::Pwrite:
+            return true;
+#endif
+#ifdef FILE_SINK_HAS_IO_URING
+        case FileSinkBackend::IoUring:
+            return IoUring::shared() != nullptr;
+#endif
+        default:
+            return false;
+    }
+}
+
+void registerFileSinkBuffer(const char* data, size_t size)
+{
+#ifdef FILE_SINK_HAS_IO_URING
+    if (IoUring* ring = IoUring::shared()) {
+        ring->registerBuffer(data, size);
+    }
+#else
+    (void)data;
+    (void)size;
+#endif
+}
+
+void unregisterFileSinkBuffer(const char* data)
+{
+#ifdef FILE_SINK_HAS_IO_URING
+    if (IoUring* ring = IoUring::shared()) {
+        ring->unregisterBuffer(data);
+    }
+#else
+    (void)data;
+#endif
+}
+
+// ── Preallocation ──────────────────────────────────────────────
+
+void preallocateFile(const std::string& file_path, int64_t size, PreallocationMode mode)
+{
+    size = std::max<int64_t>(size, 0);
+#ifndef _WIN32
+    // A sparse file takes its blocks as data arrives: nothing to check yet
+    if (mode != PreallocationMode::Sparse) {
+        checkFreeSpace(file_path, size);
+    }
+#else
+    checkFreeSpace(file_path, size);  // Sparse allocates too (see below)
+#endif
+
+#ifdef _WIN32
+    HANDLE h = ::CreateFileA(
+        file_path.c_str(),
+        GENERIC_WRITE,
+        FILE_SHARE_READ | FILE_SHARE_WRITE,
+        nullptr,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+    if (h == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("FileSink: failed to create file for pre-allocation: " + file_path);
+    }
+
+    auto fail = [&](const std::string& what) {
+        DWORD error = ::GetLastError();
+        ::CloseHandle(h);
+        if (error == ERROR_DISK_FULL || error == ERROR_HANDLE_DISK_FULL) {
+            throw std::runtime_error("Not enough disk space for " + file_path);
+        }
+        throw std::runtime_error("FileSink: " + what + " failed for: " + file_path);
+    };
+
+    if (mode == PreallocationMode::Zeroed) {
+        std::vector<char> zeros(kZeroChunk, 0);
+        for (int64_t done = 0; done < size;) {
+            DWORD chunk = static_cast<DWORD>(std::min<int64_t>(size - done, kZeroChunk));
+            DWORD written = 0;
+            if (!::WriteFile(h, zeros.data(), chunk, &written, nullptr) || written == 0) {
+                fail("WriteFile");
+            }
+            done += written;
+        }
+    } else {
+        // NTFS allocates the clusters of a file extended with SetEndOfFile,
+        // so Sparse and Reserved are the same here
+        LARGE_INTEGER li;
+        li.QuadPart = size;
+        if (!::SetFilePointerEx(h, li, nullptr, FILE_BEGIN)) {
+            fail("SetFilePointerEx");
+        }
+        if (!::SetEndOfFile(h)) {
+            fail("SetEndOfFile");
+        }
+    }
+
+    ::CloseHandle(h);
+#else
+    int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("FileSink: failed to create file: " + file_path);
+    }
+
+    auto fail = [&](const std::string& what, int error) {
+        ::close(fd);
+        if (error == ENOSPC || error == EDQUOT) {
+            throw std::runtime_error("Not enough disk space for " + file_path);
+        }
+        throw std::runtime_error("FileSink: " + what + " failed for " + file_path
+                                 + ": " + std::strerror(error));
+    };
+
+    if (mode == PreallocationMode::Reserved) {
+#ifdef __linux__
+        int error = ::fallocate(fd, 0, 0, static_cast<off_t>(size)) == 0 ? 0 : errno;
+#elif defined(__APPLE__)
+        int error = 0;
+        fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, static_cast<off_t>(size), 0};
+        if (::fcntl(fd, F_PREALLOCATE, &store) == -1) {
+            store.fst_flags = F_ALLOCATEALL;  // contiguous space not available
+            error = ::fcntl(fd, F_PREALLOCATE, &store) == -1 ? errno : 0;
+        }
+#else
+        int error = ::posix_fallocate(fd, 0, static_cast<off_t>(size));
+#endif
+        if (error != 0 && error != EOPNOTSUPP && error != ENOSYS && error != EINVAL) {
+            fail("fallocate", error);
+        }
+        // Unsupported by the filesystem (or macOS, which never sets the
+        // size): the ftruncate below gives at least the size
+    }
+
+    if (mode == PreallocationMode::Zeroed) {
+        std::vector<char> zeros(kZeroChunk, 0);
+        for (int64_t done = 0; done < size;) {
+            size_t chunk = static_cast<size_t>(std::min<int64_t>(size - done, kZeroChunk));
+            ssize_t n = ::pwrite(fd, zeros.data(), chunk, static_cast<off_t>(done));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                fail("pwrite", n < 0 ? errno : ENOSPC);
+            }
+            done += n;
+        }
+    }
+
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        fail("ftruncate", errno);
+    }
+    ::close(fd);
+#endif
+}
+
+void reserveFileSpace(const std::string& file_path, int64_t size)
+{
+#ifdef __linux__
+    int fd = ::open(file_path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    int error = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size)) == 0 ? 0 : errno;
+    ::close(fd);
+    if (error == ENOSPC || error == EDQUOT) {
+        throw std::runtime_error("Not enough disk space for " + file_path);
+    }
+#else
+    (void)file_path;
+    (void)size;
+#endif
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/// Positional-write implementations available to a FileSink.
+enum class FileSinkBackend {
+    Default,     // platform default: Overlapped on Windows, Pwrite elsewhere
+    Overlapped,  // Windows: overlapped WriteFile on a FILE_FLAG_OVERLAPPED handle
+    Pwrite,      // POSIX: pwrite(2) on a plain file descriptor
+    IoUring      // Linux: asynchronous, batched writes on a shared io_uring, pwrite if the kernel lacks it
+};
+
+/// How Task reserves room for a download of known size before it starts.
+enum class PreallocationMode {
+    Sparse,    // set the size only: blocks are allocated as data arrives
+    Reserved,  // reserve every block up front without writing it (fallocate)
+    Zeroed     // write zeros over the whole file first
+};
+
+/// Destination file of one Task, opened once and shared by all its Blocks.
+/// writeAt() is thread-safe: blocks write disjoint ranges concurrently.
+class FileSink {
+public:
+    virtual ~FileSink() = default;
+
+    /// Write the whole buffer at the given file offset.
+    /// Returns size on success, 0 on error or after close().
+    virtual size_t writeAt(const char* data, size_t size, int64_t offset) = 0;
+
+    /// Start writing the whole buffer at the given file offset and return
+    /// without waiting for it: on_done(ok) runs on the backend's completion
+    /// thread, and data must stay valid until then. After close() on_done
+    /// gets false. Returns false, without calling on_done, for backends
+    /// that only write synchronously: use writeAt() there.
+    virtual bool writeAtAsync(const char* data, size_t size, int64_t offset,
+                              std::function<void(bool ok)> on_done) {
+        (void)data;
+        (void)size;
+        (void)offset;
+        (void)on_done;
+        return false;
+    }
+
+    /// Release the underlying handle. Waits for writes already in flight
+    /// (asynchronous ones included); later writes return 0. Safe to call
+    /// more than once. Does not sync.
+    virtual void close() = 0;
+
+    /// Flush the data written so far to stable storage (fdatasync /
+    /// FlushFileBuffers). Returns false on error or after close().
+    virtual bool sync() = 0;
+
+    virtual FileSinkBackend backend() const = 0;
+
+    /// Identifies the storage device (volume) holding the file, so writes
+    /// can be scheduled per device. Stable for the lifetime of the sink.
+    virtual uint64_t device() const = 0;
+};
+
+/// Open (creating if missing, never truncating) a sink for file_path.
+/// IoUring falls back to Pwrite on kernels without io_uring (check
+/// backend() for the one in use). Throws std::runtime_error if the file
+/// cannot be opened or the backend is not available on this platform.
+std::unique_ptr<FileSink> openFileSink(const std::string& file_path,
+                                       FileSinkBackend backend = FileSinkBackend::Default);
+
+/// Create (truncating) file_path with a size of `size` bytes, laid out as
+/// mode asks. Filesystems that cannot reserve fall back to Sparse. Throws
+/// std::runtime_error if the file cannot be created, and before anything
+/// is allocated if the volume lacks the space (the old file's included),
+/// so a big download fails at the start rather than near the end. Sparse
+/// files are not checked on POSIX: they take no space up front.
+void preallocateFile(const std::string& file_path, int64_t size, PreallocationMode mode);
+
+/// Reserve the still unallocated blocks of an existing, partly written
+/// file (on resume) without changing its size or data, using
+/// FALLOC_FL_KEEP_SIZE. Throws std::runtime_error when the volume is out
+/// of space; any other failure leaves the file as it is. Linux only,
+/// a no-op elsewhere.
+void reserveFileSpace(const std::string& file_path, int64_t size);
+
+/// Whether openFileSink() would use this backend (rather than throw or
+/// fall back) on this platform and kernel.
+bool isFileSinkBackendAvailable(FileSinkBackend backend);
+
+/// Make a long-lived write buffer known to backends that can pre-register
+/// memory with the kernel (io_uring fixed buffers), so writes from it skip
+/// the per-write page mapping. No-op where unsupported.
+void registerFileSinkBuffer(const char* data, size_t size);
+
+/// Undo registerFileSinkBuffer() before the buffer is freed.
+void unregisterFileSinkBuffer(const char* data);
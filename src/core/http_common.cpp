@@ -0,0 +1,131 @@
+#include "http_common.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+/// Backoff intervals in seconds for retry attempts: 1s, 2s, 4s.
+constexpr int kRetryBackoffSec[] = {1, 2, 4};
+
+} // anonymous namespace
+
+void applyHttpConfig(CURL* curl, const HttpConfig& config, curl_slist** headers) {
+    // User-Agent (many servers reject requests without one)
+    curl_easy_setopt(curl, CURLOPT_USERAGENT,
+        "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
+        "(KHTML, like Gecko) Chrome/131.0.0.0 Safari/537.36");
+
+    // Accept headers (mimic browser)
+    struct curl_slist* list = nullptr;
+    list = curl_slist_append(list, "Accept: */*");
+    list = curl_slist_append(list, "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7");
+    list = curl_slist_append(list, "Connection: keep-alive");
+    if (!config.if_range.empty()) {
+        list = curl_slist_append(list, ("If-Range: " + config.if_range).c_str());
+    }
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+    *headers = list;
+
+    // Enable TCP keep-alive for connection reuse
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
+
+    // Redirects
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, static_cast<long>(config.max_redirects));
+
+    // TLS
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, config.verify_ssl ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, config.verify_ssl ? 2L : 0L);
+
+    // Timeouts
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, static_cast<long>(config.connect_timeout_sec));
+    if (config.transfer_timeout_sec > 0)
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(config.transfer_timeout_sec));
+
+    // Low-speed abort: detect stalled connections
+    if (config.low_speed_limit > 0) {
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(config.low_speed_limit));
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(config.low_speed_time));
+    }
+
+    // HTTP basic auth
+    if (!config.username.empty()) {
+        std::string userpwd = config.username + ":" + config.password;
+        curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+    }
+
+    // Referer header (from browser interception)
+    if (!config.referer.empty()) {
+        curl_easy_setopt(curl, CURLOPT_REFERER, config.referer.c_str());
+    }
+
+    // Cookie header (from browser interception)
+    if (!config.cookie.empty()) {
+        curl_easy_setopt(curl, CURLOPT_COOKIE, config.cookie.c_str());
+    }
+}
+
+bool isRetryableCurlCode(CURLcode code) {
+    switch (code) {
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_RESOLVE_PROXY:
+        case CURLE_GOT_NOTHING:
+        case CURLE_RECV_ERROR:
+        case CURLE_SEND_ERROR:
+        case CURLE_PARTIAL_FILE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool isNonRetryableHttpStatus(long http_code) {
+    return http_code >= 400 && http_code < 500;
+}
+
+bool isTlsCertError(CURLcode code) {
+    switch (code) {
+        case CURLE_SSL_CERTPROBLEM:
+        case CURLE_PEER_FAILED_VERIFICATION:  // same as CURLE_SSL_CACERT in newer libcurl
+            return true;
+        default:
+            return false;
+    }
+}
+
+int retryBackoffSeconds(int attempt) {
+    constexpr int count = static_cast<int>(sizeof(kRetryBackoffSec) / sizeof(kRetryBackoffSec[0]));
+    int backoff_index = std::clamp(attempt - 1, 0, count - 1);
+    return kRetryBackoffSec[backoff_index];
+}
+
+int64_t resumeRangeStart(int64_t range_start, int64_t delivered) {
+    if (range_start < 0 && delivered == 0) {
+        return -1;
+    }
+    return std::max<int64_t>(range_start, 0) + delivered;
+}
+
+void applyRange(CURL* curl, int64_t start, int64_t end) {
+    if (start < 0) {
+        return;
+    }
+    std::string range = std::to_string(start) + "-";
+    if (end >= 0) {
+        range += std::to_string(end);
+    }
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+}
+
+bool isRangeResponseAcceptable(long http_code, int64_t request_start, bool sent_if_range) {
+    if (http_code != 200 || request_start < 0) {
+        return true;
+    }
+    return request_start == 0 && !sent_if_range;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// Internal helpers shared by HttpEngine and MultiHttpEngine.
+// Only included from .cpp files so that <curl/curl.h> stays out of the
+// public headers.
+
+#include <curl/curl.h>
+
+#include "http_engine.h"
+
+/// Apply the options common to every request (UA, headers, TLS, timeouts,
+/// auth, referer, cookie). The header list is returned through *headers and
+/// must be freed with curl_slist_free_all() after the transfer.
+void applyHttpConfig(CURL* curl, const HttpConfig& config, curl_slist** headers);
+
+/// Whether a CURL error code represents a transient/retryable failure.
+bool isRetryableCurlCode(CURLcode code);
+
+/// Whether an HTTP status code is non-retryable (client errors).
+bool isNonRetryableHttpStatus(long http_code);
+
+/// Whether a CURL error code is a TLS certificate failure (non-retryable).
+bool isTlsCertError(CURLcode code);
+
+/// Backoff before retry attempt `attempt` (1-based): 1s, 2s, 4s, 4s, ...
+int retryBackoffSeconds(int attempt);
+
+/// Range start for the next attempt of a transfer that has already handed
+/// `delivered` bytes to its DataCallback, so a retry never re-fetches them.
+/// -1 (no Range header) only for a whole-file request with nothing delivered.
+int64_t resumeRangeStart(int64_t range_start, int64_t delivered);
+
+/// Set CURLOPT_RANGE for [start, end] (end < 0: open-ended; start < 0: none).
+void applyRange(CURL* curl, int64_t start, int64_t end);
+
+/// Whether the first response to a request starting at request_start may be
+/// written. A 200 carries the whole file from offset 0: that is wrong for a
+/// request past offset 0 (server ignored Range), and with If-Range it means
+/// the validator no longer matches (the file changed on the server).
+bool isRangeResponseAcceptable(long http_code, int64_t request_start, bool sent_if_range);
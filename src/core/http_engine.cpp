@@ -1,4 +1,6 @@
 #include "http_engine.h"
+#include "http_common.h"
+#include "http_share.h"
 
 #include <atomic>
 #include <sstream>
@@ -6,15 +8,16 @@
 #include <cctype>
 #include <chrono>
 #include <thread>
-#include <curl/curl.h>
 
 // ── Pimpl ──────────────────────────────────────────────────────
 
 struct HttpEngine::Impl {
     CURL* curl = nullptr;
+    curl_slist* headers = nullptr;   // owned; freed on reset / destruction
+    HttpShare* share = nullptr;      // non-owning, may be nullptr
     std::atomic<bool> cancelled{false};
 
-    Impl() {
+    explicit Impl(HttpShare* shared) : share(shared) {
         curl = curl_easy_init();
         if (!curl) {
             throw HttpError("Failed to initialise CURL easy handle");
@@ -25,66 +28,21 @@ struct HttpEngine::Impl {
         if (curl) {
             curl_easy_cleanup(curl);
         }
+        curl_slist_free_all(headers);
     }
 
     void reset() {
         curl_easy_reset(curl);
+        curl_slist_free_all(headers);
+        headers = nullptr;
         cancelled.store(false);
     }
 
-    // ── Common configuration applied to every request ──────────
     void applyConfig(const HttpConfig& config) {
-        // User-Agent (many servers reject requests without one)
-        curl_easy_setopt(curl, CURLOPT_USERAGENT,
-            "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 "
-            "(KHTML, like Gecko) Chrome/131.0.0.0 Safari/537.36");
-
-        // Accept headers (mimic browser)
-        struct curl_slist* headers = nullptr;
-        headers = curl_slist_append(headers, "Accept: */*");
-        headers = curl_slist_append(headers, "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7");
-        headers = curl_slist_append(headers, "Connection: keep-alive");
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-        // Enable TCP keep-alive for connection reuse
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPIDLE, 60L);
-        curl_easy_setopt(curl, CURLOPT_TCP_KEEPINTVL, 30L);
-
-        // Redirects
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_MAXREDIRS, static_cast<long>(config.max_redirects));
-
-        // TLS
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, config.verify_ssl ? 1L : 0L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, config.verify_ssl ? 2L : 0L);
-
-        // Timeouts
-        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, static_cast<long>(config.connect_timeout_sec));
-        if (config.transfer_timeout_sec > 0)
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, static_cast<long>(config.transfer_timeout_sec));
-
-        // Low-speed abort: detect stalled connections
-        if (config.low_speed_limit > 0) {
-            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, static_cast<long>(config.low_speed_limit));
-            curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, static_cast<long>(config.low_speed_time));
-        }
-
-        // HTTP basic auth
-        if (!config.username.empty()) {
-            std::string userpwd = config.username + ":" + config.password;
-            curl_easy_setopt(curl, CURLOPT_USERPWD, userpwd.c_str());
-            curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-        }
-
-        // Referer header (from browser interception)
-        if (!config.referer.empty()) {
-            curl_easy_setopt(curl, CURLOPT_REFERER, config.referer.c_str());
-        }
-
-        // Cookie header (from browser interception)
-        if (!config.cookie.empty()) {
-            curl_easy_setopt(curl, CURLOPT_COOKIE, config.cookie.c_str());
+        applyHttpConfig(curl, config, &headers);
+        // curl_easy_reset() drops the share, so attach it per request
+        if (share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share->nativeHandle());
         }
     }
 };
@@ -153,8 +111,12 @@ size_t headHeaderCallback(char* buffer, size_t size, size_t nitems, void* userda
 struct DownloadContext {
     DataCallback on_data;
     ProgressCallback on_progress;
-    int64_t bytes_downloaded = 0;
+    int64_t bytes_downloaded = 0;   // delivered to on_data, across all attempts
     std::atomic<bool>* cancelled = nullptr;
+    CURL* curl = nullptr;
+    int64_t request_start = -1;     // Range start of the current attempt
+    bool sent_if_range = false;
+    bool range_rejected = false;    // 200 where a partial response was required
 };
 
 size_t downloadWriteCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
@@ -165,6 +127,18 @@ size_t downloadWriteCallback(char* ptr, size_t size, size_t nmemb, void* userdat
         return 0; // returning 0 aborts the transfer
     }
 
+    long http_code = 0;
+    curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+    // Error bodies must not reach the data sink (they would land in the file)
+    if (http_code >= 400) {
+        return total;
+    }
+    if (!isRangeResponseAcceptable(http_code, ctx->request_start, ctx->sent_if_range)) {
+        ctx->range_rejected = true;
+        return 0;
+    }
+
     size_t consumed = 0;
     if (ctx->on_data) {
         consumed = ctx->on_data(ptr, total);
@@ -192,47 +166,11 @@ int progressFunction(void* clientp,
     return 0;
 }
 
-/// Determine whether a CURL error code represents a transient/retryable failure.
-bool isRetryableCurlCode(CURLcode code) {
-    switch (code) {
-        case CURLE_OPERATION_TIMEDOUT:
-        case CURLE_COULDNT_CONNECT:
-        case CURLE_COULDNT_RESOLVE_HOST:
-        case CURLE_COULDNT_RESOLVE_PROXY:
-        case CURLE_GOT_NOTHING:
-        case CURLE_RECV_ERROR:
-        case CURLE_SEND_ERROR:
-        case CURLE_PARTIAL_FILE:
-            return true;
-        default:
-            return false;
-    }
-}
-
-/// Determine whether an HTTP status code is non-retryable (client errors).
-bool isNonRetryableHttpStatus(long http_code) {
-    return http_code >= 400 && http_code < 500;
-}
-
-/// Determine whether a CURL error code is a TLS certificate failure (non-retryable).
-bool isTlsCertError(CURLcode code) {
-    switch (code) {
-        case CURLE_SSL_CERTPROBLEM:
-        case CURLE_PEER_FAILED_VERIFICATION:  // same as CURLE_SSL_CACERT in newer libcurl
-            return true;
-        default:
-            return false;
-    }
-}
-
-/// Backoff intervals in seconds for retry attempts: 1s, 2s, 4s.
-constexpr int kRetryBackoffSec[] = {1, 2, 4};
-
 } // anonymous namespace
 
 // ── HttpEngine public API ──────────────────────────────────────
 
-HttpEngine::HttpEngine() : impl_(std::make_unique<Impl>()) {}
+HttpEngine::HttpEngine(HttpShare* share) : impl_(std::make_unique<Impl>(share)) {}
 
 HttpEngine::~HttpEngine() = default;
 
@@ -247,9 +185,7 @@ FileInfo HttpEngine::fetchFileInfo(const std::string& url, const HttpConfig& con
 
         for (int attempt = 0; attempt < max_attempts; ++attempt) {
             if (attempt > 0) {
-                int backoff_index = std::min(attempt - 1,
-                    static_cast<int>(sizeof(kRetryBackoffSec) / sizeof(kRetryBackoffSec[0])) - 1);
-                std::this_thread::sleep_for(std::chrono::seconds(kRetryBackoffSec[backoff_index]));
+                std::this_thread::sleep_for(std::chrono::seconds(retryBackoffSeconds(attempt)));
 
                 if (impl_->cancelled.load(std::memory_order_relaxed)) {
                     throw HttpError("Request cancelled", 0, 0, false);
@@ -379,6 +315,9 @@ void HttpEngine::download(const std::string& url,
     const int max_attempts = config.max_retries + 1; // first attempt + retries
     HttpError last_error("Unknown error");
 
+    // Bytes already handed to on_data: each retry resumes after them
+    int64_t delivered = 0;
+
     for (int attempt = 0; attempt < max_attempts; ++attempt) {
         // Check cancellation before each attempt (including the first)
         if (impl_->cancelled.load(std::memory_order_relaxed)) {
@@ -387,9 +326,7 @@ void HttpEngine::download(const std::string& url,
 
         // Wait before retry (not before the first attempt)
         if (attempt > 0) {
-            int backoff_index = std::min(attempt - 1,
-                static_cast<int>(sizeof(kRetryBackoffSec) / sizeof(kRetryBackoffSec[0])) - 1);
-            std::this_thread::sleep_for(std::chrono::seconds(kRetryBackoffSec[backoff_index]));
+            std::this_thread::sleep_for(std::chrono::seconds(retryBackoffSeconds(attempt)));
 
             // Check cancellation after sleeping
             if (impl_->cancelled.load(std::memory_order_relaxed)) {
@@ -397,6 +334,11 @@ void HttpEngine::download(const std::string& url,
             }
         }
 
+        int64_t request_start = resumeRangeStart(range_start, delivered);
+        if (range_end >= 0 && request_start > range_end) {
+            return; // the failed attempt had already delivered the whole range
+        }
+
         try {
             impl_->reset();
             CURL* curl = impl_->curl;
@@ -404,7 +346,11 @@ void HttpEngine::download(const std::string& url,
             DownloadContext ctx;
             ctx.on_data = on_data;       // copy, not move – needed across retries
             ctx.on_progress = on_progress;
+            ctx.bytes_downloaded = delivered;
             ctx.cancelled = &impl_->cancelled;
+            ctx.curl = curl;
+            ctx.request_start = request_start;
+            ctx.sent_if_range = !config.if_range.empty();
 
             curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
             curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
@@ -416,18 +362,21 @@ void HttpEngine::download(const std::string& url,
             curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressFunction);
             curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &impl_->cancelled);
 
-            // Range header
-            if (range_start >= 0) {
-                std::string range = std::to_string(range_start) + "-";
-                if (range_end >= 0) {
-                    range += std::to_string(range_end);
-                }
-                curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
-            }
+            // Range header: resume after the bytes already delivered
+            applyRange(curl, request_start, range_end);
 
             impl_->applyConfig(config);
 
             CURLcode res = curl_easy_perform(curl);
+            delivered = ctx.bytes_downloaded;
+
+            if (ctx.range_rejected) {
+                // Never mix two versions of the file: fail fast, no retry
+                throw HttpError(ctx.sent_if_range
+                                    ? "Server file changed (If-Range mismatch)"
+                                    : "Server ignored the Range request",
+                                static_cast<int>(res), 200, false);
+            }
 
             if (res != CURLE_OK) {
                 long http_code = 0;
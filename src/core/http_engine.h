@@ -30,6 +30,7 @@ struct HttpConfig {
     std::string password;
     std::string referer;            // Referer header (from browser)
     std::string cookie;             // Cookie header (from browser)
+    std::string if_range;           // If-Range validator (strong ETag or Last-Modified) for ranged downloads
 };
 
 /// Data callback: receives a chunk, returns bytes consumed.
@@ -60,11 +61,15 @@ private:
     bool retryable_;
 };
 
+class HttpShare;
+
 /// Synchronous HTTP engine wrapping a libcurl easy handle (Pimpl).
 /// Each instance owns one CURL handle – not thread-safe; use one per thread.
+/// When a HttpShare is given, DNS entries and TLS sessions are reused
+/// across every engine attached to it.
 class HttpEngine {
 public:
-    HttpEngine();
+    explicit HttpEngine(HttpShare* share = nullptr);
     ~HttpEngine();
 
     HttpEngine(const HttpEngine&) = delete;
@@ -0,0 +1,51 @@
+#include "http_share.h"
+#include "http_engine.h"
+
+#include <mutex>
+#include <curl/curl.h>
+
+// ── Pimpl ──────────────────────────────────────────────────────
+
+struct HttpShare::Impl {
+    CURLSH* share = nullptr;
+    std::mutex locks[CURL_LOCK_DATA_LAST];
+
+    Impl() {
+        share = curl_share_init();
+        if (!share) {
+            throw HttpError("Failed to initialise CURL share handle");
+        }
+
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockCallback);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockCallback);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        // Not CURL_LOCK_DATA_CONNECT: libcurl does not support one connection
+        // cache used by several threads at once, whatever the lock callbacks do
+    }
+
+    ~Impl() {
+        curl_share_cleanup(share);
+    }
+
+    static void lockCallback(CURL* /*handle*/, curl_lock_data data,
+                             curl_lock_access /*access*/, void* userptr) {
+        static_cast<Impl*>(userptr)->locks[data].lock();
+    }
+
+    static void unlockCallback(CURL* /*handle*/, curl_lock_data data, void* userptr) {
+        static_cast<Impl*>(userptr)->locks[data].unlock();
+    }
+};
+
+// ── HttpShare public API ───────────────────────────────────────
+
+HttpShare::HttpShare() : impl_(std::make_unique<Impl>()) {}
+
+HttpShare::~HttpShare() = default;
+
+void* HttpShare::nativeHandle() const {
+    return impl_->share;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <memory>
+
+/// Process-wide libcurl share object (Pimpl over CURLSH).
+/// Engines attached to the same HttpShare reuse one DNS cache and one TLS
+/// session cache, so the block transfers that follow a HEAD probe skip its
+/// name lookup and resume its TLS session. Connections are not shared: the
+/// engines run on different threads, and libcurl's connection cache is
+/// not safe for concurrent use. Thread-safe: libcurl serialises access to
+/// the DNS and TLS session caches through per-data-type locks.
+///
+/// Must outlive every engine it is attached to.
+class HttpShare {
+public:
+    HttpShare();
+    ~HttpShare();
+
+    HttpShare(const HttpShare&) = delete;
+    HttpShare& operator=(const HttpShare&) = delete;
+
+    /// The underlying CURLSH*, for engines to pass to CURLOPT_SHARE.
+    void* nativeHandle() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
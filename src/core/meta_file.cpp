@@ -1,7 +1,23 @@
 #include "meta_file.h"
 #include <nlohmann/json.hpp>
-#include <fstream>
+#include <cerrno>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
 
 using json = nlohmann::json;
 
@@ -27,6 +43,26 @@ static BlockInfo blockInfoFromJson(const json& j) {
     return b;
 }
 
+static std::string toHex(const std::vector<uint8_t>& bytes) {
+    static const char kDigits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(bytes.size() * 2);
+    for (uint8_t b : bytes) {
+        hex += kDigits[b >> 4];
+        hex += kDigits[b & 0xf];
+    }
+    return hex;
+}
+
+static std::vector<uint8_t> fromHex(const std::string& hex) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(hex.size() / 2);
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoi(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
 static json taskMetaToJson(const TaskMeta& meta) {
     json blocks_arr = json::array();
     for (const auto& b : meta.blocks) {
@@ -40,7 +76,11 @@ static json taskMetaToJson(const TaskMeta& meta) {
         {"etag",          meta.etag},
         {"last_modified", meta.last_modified},
         {"max_blocks",    meta.max_blocks},
-        {"blocks",        blocks_arr}
+        {"priority",      meta.priority},
+        {"deadline",      meta.deadline},
+        {"blocks",        blocks_arr},
+        {"chunk_size",    meta.chunk_size},
+        {"chunks",        toHex(meta.chunks)}
     };
 }
 
@@ -53,22 +93,272 @@ static TaskMeta taskMetaFromJson(const json& j) {
     meta.etag          = j.at("etag").get<std::string>();
     meta.last_modified = j.at("last_modified").get<std::string>();
     meta.max_blocks    = j.at("max_blocks").get<int>();
+    meta.priority      = j.value("priority", 1);   // absent before priorities existed
+    meta.deadline      = j.value("deadline", int64_t(0));
     for (const auto& bj : j.at("blocks")) {
         meta.blocks.push_back(blockInfoFromJson(bj));
     }
+    meta.chunk_size    = j.value("chunk_size", int64_t(0));  // absent before chunk maps
+    meta.chunks        = fromHex(j.value("chunks", std::string()));
     return meta;
 }
 
+// ── Binary format ──────────────────────────────────────────────
+//
+// [BinHeader][BinBlock x block_count][chunk bitmap][strings]
+// The bitmap is padded to a multiple of 8 bytes. strings: url, file_path,
+// file_name, etag, last_modified, each a uint32 length and its bytes.
+// Version 1 had no bitmap and a header without its two fields. Native
+// byte order (little-endian on every supported platform). The block table
+// starts at a multiple of 8 and the counters in it are naturally aligned,
+// so they can be updated in place.
+
+static constexpr char kMagic[8] = {'S', 'D', 'M', 'E', 'T', 'A', '\0', '\x1a'};
+static constexpr uint32_t kVersion = 2;
+static constexpr uint32_t kHeaderSizeV1 = 56;
+
+struct BinHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;   // sizeof(BinHeader)
+    uint32_t record_size;   // sizeof(BinBlock)
+    uint32_t block_count;
+    int64_t file_size;
+    int64_t deadline;
+    int32_t max_blocks;
+    int32_t priority;
+    uint32_t strings_size;  // bytes after the bitmap
+    uint32_t bitmap_size;   // bitmap bytes, without the padding (0 in version 1)
+    int64_t chunk_size;     // bytes per bitmap bit
+};
+
+struct BinBlock {
+    int64_t range_start;
+    int64_t range_end;
+    int64_t downloaded;
+    int32_t block_id;
+    uint32_t completed;
+};
+
+static_assert(sizeof(BinHeader) % 8 == 0, "block table must stay 8-byte aligned");
+static_assert(sizeof(BinBlock) % 8 == 0, "counters must stay 8-byte aligned");
+
+static void appendString(std::string& out, const std::string& str) {
+    uint32_t len = static_cast<uint32_t>(str.size());
+    out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+    out.append(str);
+}
+
+static bool readString(const char*& pos, const char* end, std::string& str) {
+    uint32_t len = 0;
+    if (end - pos < static_cast<ptrdiff_t>(sizeof(len))) {
+        return false;
+    }
+    std::memcpy(&len, pos, sizeof(len));
+    pos += sizeof(len);
+    if (static_cast<size_t>(end - pos) < len) {
+        return false;
+    }
+    str.assign(pos, len);
+    pos += len;
+    return true;
+}
+
+static uint64_t paddedBitmapSize(uint32_t bitmap_size) {
+    return (static_cast<uint64_t>(bitmap_size) + 7) / 8 * 8;
+}
+
+/// Offset of the bitmap in a file with block_count blocks (current version).
+static uint64_t bitmapOffset(size_t block_count) {
+    return sizeof(BinHeader) + block_count * sizeof(BinBlock);
+}
+
+static BinBlock toBinBlock(const BlockInfo& b) {
+    BinBlock rec = {};
+    rec.range_start = b.range_start;
+    rec.range_end   = b.range_end;
+    rec.downloaded  = b.downloaded;
+    rec.block_id    = b.block_id;
+    rec.completed   = b.completed ? 1 : 0;
+    return rec;
+}
+
+static std::string taskMetaToBinary(const TaskMeta& meta) {
+    std::string strings;
+    for (const std::string* str : {&meta.url, &meta.file_path, &meta.file_name,
+                                   &meta.etag, &meta.last_modified}) {
+        appendString(strings, *str);
+    }
+
+    BinHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version      = kVersion;
+    header.header_size  = sizeof(BinHeader);
+    header.record_size  = sizeof(BinBlock);
+    header.block_count  = static_cast<uint32_t>(meta.blocks.size());
+    header.file_size    = meta.file_size;
+    header.deadline     = meta.deadline;
+    header.max_blocks   = meta.max_blocks;
+    header.priority     = meta.priority;
+    header.strings_size = static_cast<uint32_t>(strings.size());
+    header.bitmap_size  = static_cast<uint32_t>(meta.chunks.size());
+    header.chunk_size   = meta.chunk_size;
+
+    std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const auto& b : meta.blocks) {
+        BinBlock rec = toBinBlock(b);
+        out.append(reinterpret_cast<const char*>(&rec), sizeof(rec));
+    }
+    out.append(reinterpret_cast<const char*>(meta.chunks.data()), meta.chunks.size());
+    out.append(paddedBitmapSize(header.bitmap_size) - meta.chunks.size(), '\0');
+    out += strings;
+    return out;
+}
+
+static bool isBinary(const std::string& data) {
+    return data.size() >= sizeof(kMagic) && std::memcmp(data.data(), kMagic, sizeof(kMagic)) == 0;
+}
+
+static std::optional<TaskMeta> taskMetaFromBinary(const std::string& data) {
+    BinHeader header = {};
+    if (data.size() < kHeaderSizeV1) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, data.data(), kHeaderSizeV1);
+    uint32_t header_size = header.version == 1 ? kHeaderSizeV1 : sizeof(BinHeader);
+    if (header.version < 1 || header.version > kVersion || header.header_size != header_size
+        || header.record_size != sizeof(BinBlock) || data.size() < header_size) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, data.data(), header_size);
+    if (header.version == 1) {
+        // No chunk map; bitmap_size sits where version 1 had a reserved field
+        header.bitmap_size = 0;
+        header.chunk_size = 0;
+    }
+    uint64_t table_end = header_size
+        + static_cast<uint64_t>(header.block_count) * sizeof(BinBlock);
+    uint64_t bitmap_end = table_end + paddedBitmapSize(header.bitmap_size);
+    if (bitmap_end + header.strings_size != data.size()) {
+        return std::nullopt;  // truncated or trailing garbage
+    }
+
+    TaskMeta meta;
+    meta.file_size  = header.file_size;
+    meta.deadline   = header.deadline;
+    meta.max_blocks = header.max_blocks;
+    meta.priority   = header.priority;
+    meta.blocks.reserve(header.block_count);
+    for (uint32_t i = 0; i < header.block_count; ++i) {
+        BinBlock rec;
+        std::memcpy(&rec, data.data() + header_size + i * sizeof(BinBlock), sizeof(rec));
+        BlockInfo b;
+        b.block_id    = rec.block_id;
+        b.range_start = rec.range_start;
+        b.range_end   = rec.range_end;
+        b.downloaded  = rec.downloaded;
+        b.completed   = rec.completed != 0;
+        meta.blocks.push_back(b);
+    }
+
+    meta.chunk_size = header.chunk_size;
+    meta.chunks.assign(data.data() + table_end, data.data() + table_end + header.bitmap_size);
+
+    const char* pos = data.data() + bitmap_end;
+    const char* end = data.data() + data.size();
+    for (std::string* str : {&meta.url, &meta.file_path, &meta.file_name,
+                             &meta.etag, &meta.last_modified}) {
+        if (!readString(pos, end, *str)) {
+            return std::nullopt;
+        }
+    }
+    return meta;
+}
+
+static std::optional<std::string> readFile(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open()) {
+        return std::nullopt;
+    }
+    return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+// ── Durable replace ────────────────────────────────────────────
+
+/// Write data to path, flushed to stable storage. Returns false on error.
+static bool writeDurably(const std::string& path, const std::string& data) {
+#ifdef _WIN32
+    HANDLE h = ::CreateFileA(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                             CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    DWORD written = 0;
+    bool ok = ::WriteFile(h, data.data(), static_cast<DWORD>(data.size()), &written, nullptr)
+        && written == data.size()
+        && ::FlushFileBuffers(h);
+    ::CloseHandle(h);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t total = 0;
+    while (total < data.size()) {
+        ssize_t n = ::write(fd, data.data() + total, data.size() - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ::close(fd);
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+    bool ok = ::fsync(fd) == 0;
+    return ::close(fd) == 0 && ok;
+#endif
+}
+
+/// Atomically replace path with from (same directory), so a reader sees
+/// either the old or the new file, also after a crash.
+static bool replaceDurably(const std::string& from, const std::string& path) {
+#ifdef _WIN32
+    return ::MoveFileExA(from.c_str(), path.c_str(),
+                         MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    if (::rename(from.c_str(), path.c_str()) != 0) {
+        return false;
+    }
+    // The rename itself is only durable once the directory is
+    std::string dir = fs::path(path).parent_path().string();
+    int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        ::fsync(dfd);
+        ::close(dfd);
+    }
+    return true;
+#endif
+}
+
 // ── MetaFile implementation ────────────────────────────────────
 
+/// Write data to meta_path through a synced temporary file and a rename.
+static bool replaceFile(const std::string& meta_path, const std::string& data) {
+    // Never truncate the live file: a crash mid-write would leave
+    // neither the old checkpoint nor the new one
+    std::string tmp_path = meta_path + ".tmp";
+    if (!writeDurably(tmp_path, data) || !replaceDurably(tmp_path, meta_path)) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
 bool MetaFile::save(const std::string& meta_path, const TaskMeta& meta) {
     try {
-        std::ofstream ofs(meta_path);
-        if (!ofs.is_open()) {
-            return false;
-        }
-        ofs << taskMetaToJson(meta).dump(4);
-        return ofs.good();
+        return replaceFile(meta_path, taskMetaToBinary(meta));
     } catch (...) {
         return false;
     }
@@ -76,17 +366,187 @@ bool MetaFile::save(const std::string& meta_path, const TaskMeta& meta) {
 
 std::optional<TaskMeta> MetaFile::load(const std::string& meta_path) {
     try {
-        std::ifstream ifs(meta_path);
-        if (!ifs.is_open()) {
+        auto data = readFile(meta_path);
+        if (!data) {
             return std::nullopt;
         }
-        json j = json::parse(ifs);
-        return taskMetaFromJson(j);
+        if (isBinary(*data)) {
+            return taskMetaFromBinary(*data);
+        }
+
+        // Written by a version before the binary format: migrate it
+        TaskMeta meta = taskMetaFromJson(json::parse(*data));
+        save(meta_path, meta);
+        return meta;
     } catch (...) {
         return std::nullopt;
     }
 }
 
 bool MetaFile::remove(const std::string& meta_path) {
+    std::remove((meta_path + ".tmp").c_str());  // left by a save cut short
     return std::remove(meta_path.c_str()) == 0;
 }
+
+bool MetaFile::saveJson(const std::string& json_path, const TaskMeta& meta) {
+    try {
+        return replaceFile(json_path, taskMetaToJson(meta).dump(4));
+    } catch (...) {
+        return false;
+    }
+}
+
+std::optional<TaskMeta> MetaFile::loadJson(const std::string& json_path) {
+    try {
+        auto data = readFile(json_path);
+        if (!data) {
+            return std::nullopt;
+        }
+        return taskMetaFromJson(json::parse(*data));
+    } catch (...) {
+        return std::nullopt;
+    }
+}
+
+// ── MetaWriter ─────────────────────────────────────────────────
+
+MetaWriter::MetaWriter(std::string meta_path)
+    : meta_path_(std::move(meta_path))
+{
+}
+
+MetaWriter::~MetaWriter()
+{
+    close();
+}
+
+bool MetaWriter::update(const TaskMeta& meta)
+{
+    if (view_ && mapped_ && progressOnly(meta)) {
+        auto* table = reinterpret_cast<BinBlock*>(view_ + sizeof(BinHeader));
+        for (size_t i = 0; i < meta.blocks.size(); ++i) {
+            table[i].downloaded = meta.blocks[i].downloaded;
+            table[i].completed  = meta.blocks[i].completed ? 1 : 0;
+        }
+        if (!meta.chunks.empty()) {
+            std::memcpy(view_ + bitmapOffset(meta.blocks.size()),
+                        meta.chunks.data(), meta.chunks.size());
+        }
+#ifdef _WIN32
+        bool ok = ::FlushViewOfFile(view_, view_size_)
+            && ::FlushFileBuffers(static_cast<HANDLE>(file_));
+#else
+        bool ok = ::msync(view_, view_size_, MS_SYNC) == 0;
+#endif
+        if (ok) {
+            mapped_ = meta;
+            return true;
+        }
+        // Fall through: write the whole file instead
+    }
+
+    close();  // the rename replaces the file the mapping holds
+    if (!MetaFile::save(meta_path_, meta)) {
+        return false;
+    }
+    if (map()) {
+        mapped_ = meta;
+    }
+    return true;
+}
+
+bool MetaWriter::progressOnly(const TaskMeta& meta) const
+{
+    const TaskMeta& old = *mapped_;
+    if (meta.blocks.size() != old.blocks.size()
+        || meta.file_size != old.file_size || meta.deadline != old.deadline
+        || meta.max_blocks != old.max_blocks || meta.priority != old.priority
+        || meta.url != old.url || meta.file_path != old.file_path
+        || meta.file_name != old.file_name || meta.etag != old.etag
+        || meta.last_modified != old.last_modified
+        || meta.chunk_size != old.chunk_size || meta.chunks.size() != old.chunks.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < meta.chunks.size(); ++i) {
+        if ((old.chunks[i] & ~meta.chunks[i]) != 0) {
+            return false;  // a chunk no longer done: not progress
+        }
+    }
+    for (size_t i = 0; i < meta.blocks.size(); ++i) {
+        const BlockInfo& a = meta.blocks[i];
+        const BlockInfo& b = old.blocks[i];
+        if (a.block_id != b.block_id || a.range_start != b.range_start
+            || a.range_end != b.range_end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MetaWriter::map()
+{
+#ifdef _WIN32
+    HANDLE file = ::CreateFileA(meta_path_.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                                OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size = {};
+    HANDLE mapping = nullptr;
+    void* view = nullptr;
+    if (::GetFileSizeEx(file, &size) && size.QuadPart >= static_cast<LONGLONG>(sizeof(BinHeader))) {
+        mapping = ::CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    }
+    if (mapping) {
+        view = ::MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+    }
+    if (!view) {
+        if (mapping) {
+            ::CloseHandle(mapping);
+        }
+        ::CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    mapping_ = mapping;
+    view_ = static_cast<char*>(view);
+    view_size_ = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = ::open(meta_path_.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st = {};
+    void* view = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(BinHeader))) {
+        view = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    }
+    ::close(fd);  // the mapping keeps the file
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    view_ = static_cast<char*>(view);
+    view_size_ = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void MetaWriter::close()
+{
+    if (!view_) {
+        return;
+    }
+#ifdef _WIN32
+    ::UnmapViewOfFile(view_);
+    ::CloseHandle(static_cast<HANDLE>(mapping_));
+    ::CloseHandle(static_cast<HANDLE>(file_));
+    file_ = mapping_ = nullptr;
+#else
+    ::munmap(view_, view_size_);
+#endif
+    view_ = nullptr;
+    view_size_ = 0;
+    mapped_.reset();
+}
@@ -23,17 +23,72 @@ struct TaskMeta {
     std::string etag;
     std::string last_modified;
     int max_blocks = 8;
+    int priority = 1;        // TaskPriority, Normal by default
+    int64_t deadline = 0;    // seconds since the Unix epoch, 0 = none
     std::vector<BlockInfo> blocks;
+    // What is on disk, chunk by chunk (ChunkMap::bitmap()); when present
+    // resume goes by it rather than by the blocks' downloaded counters
+    int64_t chunk_size = 0;  // 0 = no chunk map
+    std::vector<uint8_t> chunks;
 };
 
+/// Task progress on disk. The .meta file is binary (see meta_file.cpp):
+/// a fixed header, a fixed-size block table, the chunk bitmap and the
+/// strings. JSON remains as an import/export format; load() reads both
+/// and migrates JSON files.
 class MetaFile {
 public:
-    /// Serialize TaskMeta to JSON and write to file.
+    /// Serialize TaskMeta (binary) and replace the file atomically: written
+    /// to meta_path + ".tmp", synced, then renamed over meta_path, so a
+    /// crash leaves either the previous or the new checkpoint intact.
     static bool save(const std::string& meta_path, const TaskMeta& meta);
 
-    /// Deserialize TaskMeta from a JSON file.
+    /// Deserialize TaskMeta from a binary or (older) JSON file. A JSON file
+    /// is rewritten in the binary format on the way.
     static std::optional<TaskMeta> load(const std::string& meta_path);
 
     /// Delete the meta file from disk.
     static bool remove(const std::string& meta_path);
+
+    /// Export / import TaskMeta as JSON (the format before the binary one).
+    static bool saveJson(const std::string& json_path, const TaskMeta& meta);
+    static std::optional<TaskMeta> loadJson(const std::string& json_path);
+};
+
+/// Keeps a task's binary MetaFile memory-mapped between checkpoints. A
+/// checkpoint that only advances progress (downloaded / completed, same
+/// blocks and ranges, chunk bits only set) is written in place with one
+/// msync: each counter is an aligned 8-byte field, so a crash leaves it
+/// old or new, never torn, and every chunk bit on disk stays true.
+/// Anything else (a block split, a restart) goes through MetaFile::save()
+/// and maps the new file. Not thread-safe.
+class MetaWriter {
+public:
+    explicit MetaWriter(std::string meta_path);
+    ~MetaWriter();
+
+    MetaWriter(const MetaWriter&) = delete;
+    MetaWriter& operator=(const MetaWriter&) = delete;
+
+    /// Persist meta. Returns false if it could not be written.
+    bool update(const TaskMeta& meta);
+
+    /// Unmap the file (before it is removed). The next update() rewrites it.
+    void close();
+
+private:
+    /// Whether meta differs from the mapped file in progress only.
+    bool progressOnly(const TaskMeta& meta) const;
+
+    /// Map meta_path_ read-write. Returns false on error.
+    bool map();
+
+    std::string meta_path_;
+    std::optional<TaskMeta> mapped_;  // what the mapping holds
+    char* view_ = nullptr;
+    size_t view_size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;     // HANDLE
+    void* mapping_ = nullptr;  // HANDLE
+#endif
 };
@@ -0,0 +1,666 @@
+#include "multi_http_engine.h"
+#include "http_common.h"
+#include "http_share.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+static_assert(kTransferPause == CURL_WRITEFUNC_PAUSE,
+              "kTransferPause must match CURL_WRITEFUNC_PAUSE");
+
+using Clock = std::chrono::steady_clock;
+
+// ── Pimpl ──────────────────────────────────────────────────────
+
+struct MultiHttpEngine::Impl {
+    // ── Per-transfer state (reactor thread only) ───────────────
+    struct Transfer {
+        TransferId id = 0;
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        std::string url;
+        int64_t range_start = -1;
+        int64_t range_end = -1;
+        HttpConfig config;
+        DataCallback on_data;
+        TransferDoneCallback on_done;
+        int attempt = 0;
+        int64_t delivered = 0;      // bytes handed to on_data; retries resume after them
+        int64_t request_start = -1; // Range start of the current attempt
+        bool range_rejected = false;
+        bool active = false;        // added to the multi handle
+        bool cancelled = false;
+    };
+
+    // ── Cross-thread commands ──────────────────────────────────
+    enum class CommandKind { Add, Cancel, Remove, Resume, SetMax };
+
+    struct Command {
+        explicit Command(CommandKind k) : kind(k) {}
+
+        CommandKind kind;
+        TransferId id = 0;
+        std::unique_ptr<Transfer> transfer;      // Add
+        std::chrono::milliseconds delay{0};      // Resume
+        std::shared_ptr<std::promise<void>> processed; // Remove (nullptr: deferred by the reactor)
+    };
+
+    // ── Reactor timers (retry backoff and delayed resume) ──────
+    enum class TimerKind { Retry, Resume };
+
+    struct Timer {
+        Clock::time_point due;
+        TransferId id;
+        TimerKind kind;
+        bool operator>(const Timer& o) const { return due > o.due; }
+    };
+
+    CURLM* multi = nullptr;
+    HttpShare* share = nullptr;  // non-owning, may be nullptr
+    std::thread reactor;
+    std::thread::id reactor_id;
+    std::atomic<bool> stopping{false};
+    std::promise<void> exited;              // set by stop() once the reactor has been joined
+    std::shared_future<void> reactor_exited = exited.get_future().share();
+
+    std::mutex cmd_mutex;
+    std::vector<Command> commands;
+
+    std::unordered_map<TransferId, std::unique_ptr<Transfer>> transfers;
+    std::deque<TransferId> pending;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+    std::atomic<TransferId> next_id{1};
+    std::atomic<int> max_connections{32};
+    std::atomic<size_t> active_count{0};
+    std::atomic<size_t> waiting_count{0};
+
+    // curl's requested timeout; time_point::max() when none is armed
+    Clock::time_point curl_deadline = Clock::time_point::max();
+
+#ifdef __linux__
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::set<curl_socket_t> watched;
+#endif
+
+    Impl(int max_conn, HttpShare* shared) : share(shared) {
+        max_connections.store(std::max(1, max_conn));
+
+        multi = curl_multi_init();
+        if (!multi) {
+            throw HttpError("Failed to initialise CURL multi handle");
+        }
+        applyConnectionLimit();
+
+#ifdef __linux__
+        epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd < 0 || wake_fd < 0) {
+            closeFds();
+            curl_multi_cleanup(multi);
+            throw HttpError("Failed to initialise epoll reactor");
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = wake_fd;
+        ::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+
+        curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+        curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+        curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+        curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+#endif
+
+        reactor = std::thread([this] { run(); });
+        reactor_id = reactor.get_id();
+    }
+
+    ~Impl() {
+        stop();
+        curl_multi_cleanup(multi);
+#ifdef __linux__
+        closeFds();
+#endif
+    }
+
+    void stop() {
+        if (stopping.exchange(true)) {
+            return;
+        }
+        wakeup();
+        if (reactor.joinable()) {
+            reactor.join();
+        }
+        // No callback runs any more: remove() may return
+        exited.set_value();
+
+        // Drop everything without invoking callbacks
+        for (auto& [id, t] : transfers) {
+            releaseTransfer(*t);
+        }
+        transfers.clear();
+        pending.clear();
+        active_count.store(0);
+        waiting_count.store(0);
+    }
+
+    void applyConnectionLimit() {
+        long limit = static_cast<long>(max_connections.load());
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, limit);
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, limit);
+    }
+
+    // ── Command submission (any thread) ────────────────────────
+
+    void post(Command cmd) {
+        {
+            std::lock_guard<std::mutex> lock(cmd_mutex);
+            commands.push_back(std::move(cmd));
+        }
+        wakeup();
+    }
+
+    void wakeup() {
+#ifdef __linux__
+        uint64_t one = 1;
+        ssize_t r = ::write(wake_fd, &one, sizeof(one));
+        (void)r;
+#else
+        curl_multi_wakeup(multi);
+#endif
+    }
+
+    // ── Reactor loop ───────────────────────────────────────────
+
+    void run() {
+        while (!stopping.load(std::memory_order_relaxed)) {
+            processCommands();
+            fireDueTimers();
+            startPending();
+
+            int timeout_ms = nextTimeoutMs();
+            int running = 0;
+
+#ifdef __linux__
+            epoll_event events[64];
+            int n = ::epoll_wait(epoll_fd, events, 64, timeout_ms);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == wake_fd) {
+                    uint64_t drained = 0;
+                    ssize_t r = ::read(wake_fd, &drained, sizeof(drained));
+                    (void)r;
+                    continue;
+                }
+                int flags = 0;
+                if (events[i].events & EPOLLIN)  flags |= CURL_CSELECT_IN;
+                if (events[i].events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+                curl_multi_socket_action(multi, fd, flags, &running);
+            }
+            if (Clock::now() >= curl_deadline) {
+                curl_deadline = Clock::time_point::max();
+                curl_multi_socket_action(multi, CURL_SOCKET_TIMEOUT, 0, &running);
+            }
+#else
+            curl_multi_poll(multi, nullptr, 0, timeout_ms < 0 ? 1000 : timeout_ms, nullptr);
+            curl_multi_perform(multi, &running);
+#endif
+            collectFinished();
+        }
+    }
+
+    /// Milliseconds until the earliest of curl's timer and our own timers;
+    /// -1 when nothing is armed.
+    int nextTimeoutMs() {
+        auto due = curl_deadline;
+        if (!timers.empty()) {
+            due = std::min(due, timers.top().due);
+        }
+        if (due == Clock::time_point::max()) {
+            return -1;
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            due - Clock::now()).count();
+        return static_cast<int>(std::clamp<int64_t>(ms, 0, 60'000));
+    }
+
+    void processCommands() {
+        std::vector<Command> batch;
+        {
+            std::lock_guard<std::mutex> lock(cmd_mutex);
+            batch.swap(commands);
+        }
+
+        for (auto& cmd : batch) {
+            switch (cmd.kind) {
+                case CommandKind::Add: {
+                    TransferId id = cmd.transfer->id;
+                    transfers.emplace(id, std::move(cmd.transfer));
+                    pending.push_back(id);
+                    break;
+                }
+                case CommandKind::Cancel:
+                    cancelTransfer(cmd.id, true);
+                    break;
+                case CommandKind::Remove:
+                    cancelTransfer(cmd.id, false);
+                    if (cmd.processed) {
+                        cmd.processed->set_value();
+                    }
+                    break;
+                case CommandKind::Resume:
+                    if (cmd.delay.count() > 0) {
+                        timers.push({Clock::now() + cmd.delay, cmd.id, TimerKind::Resume});
+                    } else {
+                        unpause(cmd.id);
+                    }
+                    break;
+                case CommandKind::SetMax:
+                    applyConnectionLimit();
+                    break;
+            }
+        }
+        updateWaitingCount();
+    }
+
+    void fireDueTimers() {
+        auto now = Clock::now();
+        while (!timers.empty() && timers.top().due <= now) {
+            Timer t = timers.top();
+            timers.pop();
+            if (t.kind == TimerKind::Retry) {
+                // Retries go to the front: they were admitted before newer work
+                if (transfers.count(t.id)) {
+                    pending.push_front(t.id);
+                }
+            } else {
+                unpause(t.id);
+            }
+        }
+        updateWaitingCount();
+    }
+
+    void startPending() {
+        while (!pending.empty()
+               && active_count.load() < static_cast<size_t>(max_connections.load())) {
+            TransferId id = pending.front();
+            pending.pop_front();
+
+            auto it = transfers.find(id);
+            if (it == transfers.end()) {
+                continue;  // cancelled while waiting
+            }
+            Transfer& t = *it->second;
+
+            if (!setupEasy(t)) {
+                HttpError err("Failed to initialise CURL easy handle");
+                finish(id, &err);
+                continue;
+            }
+            curl_multi_add_handle(multi, t.easy);
+            t.active = true;
+            active_count.fetch_add(1);
+        }
+        updateWaitingCount();
+    }
+
+    void updateWaitingCount() {
+        waiting_count.store(transfers.size() - active_count.load());
+    }
+
+    // ── Transfer lifecycle ─────────────────────────────────────
+
+    bool setupEasy(Transfer& t) {
+        if (!t.easy) {
+            t.easy = curl_easy_init();
+            if (!t.easy) {
+                return false;
+            }
+        } else {
+            curl_easy_reset(t.easy);
+        }
+        curl_slist_free_all(t.headers);
+        t.headers = nullptr;
+
+        CURL* curl = t.easy;
+        curl_easy_setopt(curl, CURLOPT_URL, t.url.c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &t);
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, &t);
+
+        // Range header: resume after the bytes already delivered
+        t.request_start = resumeRangeStart(t.range_start, t.delivered);
+        t.range_rejected = false;
+        applyRange(curl, t.request_start, t.range_end);
+
+        applyHttpConfig(curl, t.config, &t.headers);
+        if (share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, share->nativeHandle());
+        }
+        return true;
+    }
+
+    /// Detach a transfer from the multi handle and free its curl resources.
+    void releaseTransfer(Transfer& t) {
+        if (t.active) {
+            curl_multi_remove_handle(multi, t.easy);
+            t.active = false;
+            active_count.fetch_sub(1);
+        }
+        if (t.easy) {
+            curl_easy_cleanup(t.easy);
+            t.easy = nullptr;
+        }
+        curl_slist_free_all(t.headers);
+        t.headers = nullptr;
+    }
+
+    /// Erase a transfer and report its outcome (error == nullptr on success).
+    void finish(TransferId id, const HttpError* error) {
+        auto it = transfers.find(id);
+        if (it == transfers.end()) {
+            return;
+        }
+        std::unique_ptr<Transfer> t = std::move(it->second);
+        transfers.erase(it);
+        releaseTransfer(*t);
+        updateWaitingCount();
+
+        if (t->on_done) {
+            t->on_done(error);
+        }
+    }
+
+    void cancelTransfer(TransferId id, bool notify) {
+        auto it = transfers.find(id);
+        if (it == transfers.end()) {
+            return;
+        }
+        if (!notify) {
+            it->second->on_done = nullptr;
+        }
+        it->second->cancelled = true;
+        HttpError err("Download cancelled", 0, 0, false);
+        finish(id, &err);
+    }
+
+    void unpause(TransferId id) {
+        auto it = transfers.find(id);
+        if (it == transfers.end() || !it->second->active) {
+            return;
+        }
+        // curl re-delivers the held chunk inside curl_easy_pause(). If the
+        // DataCallback rejects it (e.g. the block's range is already full),
+        // the error is only reported here and the multi handle would keep
+        // waiting on a now-silent socket: finish the transfer ourselves.
+        CURLcode res = curl_easy_pause(it->second->easy, CURLPAUSE_CONT);
+        if (res != CURLE_OK) {
+            onTransferDone(*it->second, res);
+        }
+    }
+
+    /// remove() from inside a callback: curl may still be using the easy
+    /// handle, so only silence the transfer here and free it from the next
+    /// processCommands(), after curl_multi_socket_action() has returned.
+    void deferRemove(TransferId id) {
+        auto it = transfers.find(id);
+        if (it == transfers.end()) {
+            return;
+        }
+        it->second->cancelled = true;  // writeCallback() aborts from now on
+        it->second->on_done = nullptr;
+
+        Command cmd{CommandKind::Remove};
+        cmd.id = id;
+        post(std::move(cmd));
+    }
+
+    /// Drain CURLMSG_DONE messages and apply the retry policy.
+    void collectFinished() {
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            Transfer* t = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+            if (!t) {
+                continue;
+            }
+            onTransferDone(*t, msg->data.result);
+        }
+    }
+
+    void onTransferDone(Transfer& t, CURLcode res) {
+        long http_code = 0;
+        curl_easy_getinfo(t.easy, CURLINFO_RESPONSE_CODE, &http_code);
+
+        // Leave the multi handle now; the easy handle is kept for a retry.
+        curl_multi_remove_handle(multi, t.easy);
+        t.active = false;
+        active_count.fetch_sub(1);
+
+        if (res == CURLE_OK && http_code < 400) {
+            finish(t.id, nullptr);
+            return;
+        }
+
+        HttpError err("Unknown error");
+        if (t.range_rejected) {
+            // Never mix two versions of the file: fail fast, no retry
+            err = HttpError(t.config.if_range.empty()
+                                ? "Server ignored the Range request"
+                                : "Server file changed (If-Range mismatch)",
+                            static_cast<int>(res), 200, false);
+        } else if (res != CURLE_OK) {
+            bool retryable = isRetryableCurlCode(res) && !isTlsCertError(res);
+            err = HttpError(std::string("Download failed: ") + curl_easy_strerror(res),
+                            static_cast<int>(res), http_code, retryable);
+        } else {
+            err = HttpError("HTTP error " + std::to_string(http_code),
+                            0, http_code, !isNonRetryableHttpStatus(http_code));
+        }
+
+        // A transient failure after the whole range arrived: nothing left to fetch
+        if (err.isRetryable() && t.range_end >= 0
+            && resumeRangeStart(t.range_start, t.delivered) > t.range_end) {
+            finish(t.id, nullptr);
+            return;
+        }
+
+        if (err.isRetryable() && t.attempt < t.config.max_retries) {
+            ++t.attempt;
+            timers.push({Clock::now() + std::chrono::seconds(retryBackoffSeconds(t.attempt)),
+                         t.id, TimerKind::Retry});
+            updateWaitingCount();
+            return;
+        }
+        finish(t.id, &err);
+    }
+
+    // ── libcurl callbacks ──────────────────────────────────────
+
+    static size_t writeCallback(char* ptr, size_t size, size_t nmemb, void* userdata) {
+        auto* t = static_cast<Transfer*>(userdata);
+        size_t total = size * nmemb;
+
+        if (t->cancelled) {
+            return 0;  // abort
+        }
+
+        // Error bodies must not reach the data sink (they would land in the file)
+        long http_code = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &http_code);
+        if (http_code >= 400) {
+            return total;
+        }
+        if (!isRangeResponseAcceptable(http_code, t->request_start, !t->config.if_range.empty())) {
+            t->range_rejected = true;
+            return 0;
+        }
+
+        size_t consumed = total;  // discard if no callback
+        if (t->on_data) {
+            consumed = t->on_data(ptr, total);
+            if (consumed == kTransferPause) {
+                return CURL_WRITEFUNC_PAUSE;
+            }
+        }
+        t->delivered += static_cast<int64_t>(consumed);
+        return consumed;
+    }
+
+#ifdef __linux__
+    static int socketCallback(CURL* /*easy*/, curl_socket_t s, int what,
+                              void* userp, void* /*socketp*/) {
+        auto* self = static_cast<Impl*>(userp);
+
+        if (what == CURL_POLL_REMOVE) {
+            if (self->watched.erase(s)) {
+                ::epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, s, nullptr);
+            }
+            return 0;
+        }
+
+        epoll_event ev{};
+        ev.data.fd = s;
+        if (what == CURL_POLL_IN || what == CURL_POLL_INOUT)  ev.events |= EPOLLIN;
+        if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) ev.events |= EPOLLOUT;
+
+        // A socket closed behind our back (e.g. by another user of a shared
+        // connection pool) silently leaves epoll, and its fd number may be
+        // reused; fall back between ADD and MOD so the watch set self-heals.
+        int op = self->watched.insert(s).second ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (::epoll_ctl(self->epoll_fd, op, s, &ev) != 0) {
+            op = (op == EPOLL_CTL_ADD) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            ::epoll_ctl(self->epoll_fd, op, s, &ev);
+        }
+        return 0;
+    }
+
+    static int timerCallback(CURLM* /*multi*/, long timeout_ms, void* userp) {
+        auto* self = static_cast<Impl*>(userp);
+        if (timeout_ms < 0) {
+            self->curl_deadline = Clock::time_point::max();
+        } else {
+            self->curl_deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+        }
+        return 0;
+    }
+
+    void closeFds() {
+        if (epoll_fd >= 0) ::close(epoll_fd);
+        if (wake_fd >= 0) ::close(wake_fd);
+        epoll_fd = wake_fd = -1;
+    }
+#endif
+};
+
+// ── MultiHttpEngine public API ─────────────────────────────────
+
+MultiHttpEngine::MultiHttpEngine(int max_connections, HttpShare* share)
+    : impl_(std::make_unique<Impl>(max_connections, share)) {}
+
+MultiHttpEngine::~MultiHttpEngine() = default;
+
+TransferId MultiHttpEngine::download(const std::string& url,
+                                     int64_t range_start,
+                                     int64_t range_end,
+                                     const HttpConfig& config,
+                                     DataCallback on_data,
+                                     TransferDoneCallback on_done) {
+    auto t = std::make_unique<Impl::Transfer>();
+    t->id = impl_->next_id.fetch_add(1);
+    t->url = url;
+    t->range_start = range_start;
+    t->range_end = range_end;
+    t->config = config;
+    t->on_data = std::move(on_data);
+    t->on_done = std::move(on_done);
+
+    TransferId id = t->id;
+    Impl::Command cmd{Impl::CommandKind::Add};
+    cmd.transfer = std::move(t);
+    impl_->post(std::move(cmd));
+    return id;
+}
+
+void MultiHttpEngine::cancel(TransferId id) {
+    Impl::Command cmd{Impl::CommandKind::Cancel};
+    cmd.id = id;
+    impl_->post(std::move(cmd));
+}
+
+void MultiHttpEngine::remove(TransferId id) {
+    if (std::this_thread::get_id() == impl_->reactor_id) {
+        // Called from inside a callback: we already own the reactor
+        impl_->deferRemove(id);
+        return;
+    }
+    if (impl_->reactor_exited.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        return;
+    }
+
+    auto processed = std::make_shared<std::promise<void>>();
+    auto done = processed->get_future();
+
+    Impl::Command cmd{Impl::CommandKind::Remove};
+    cmd.id = id;
+    cmd.processed = processed;
+    impl_->post(std::move(cmd));
+
+    // The reactor may stop before draining the command. Stopping is not
+    // enough: a callback may still be running until the reactor has exited.
+    while (done.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        if (impl_->reactor_exited.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            return;
+        }
+    }
+}
+
+void MultiHttpEngine::resume(TransferId id, std::chrono::milliseconds delay) {
+    Impl::Command cmd{Impl::CommandKind::Resume};
+    cmd.id = id;
+    cmd.delay = delay;
+    impl_->post(std::move(cmd));
+}
+
+void MultiHttpEngine::setMaxConnections(int max_connections) {
+    impl_->max_connections.store(std::max(1, max_connections));
+    Impl::Command cmd{Impl::CommandKind::SetMax};
+    impl_->post(std::move(cmd));
+}
+
+int MultiHttpEngine::maxConnections() const {
+    return impl_->max_connections.load();
+}
+
+size_t MultiHttpEngine::activeTransfers() const {
+    return impl_->active_count.load();
+}
+
+size_t MultiHttpEngine::pendingTransfers() const {
+    return impl_->waiting_count.load();
+}
+
+void MultiHttpEngine::shutdown() {
+    impl_->stop();
+}
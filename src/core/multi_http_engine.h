@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "http_engine.h"
+
+/// Identifies one transfer submitted to a MultiHttpEngine.
+using TransferId = uint64_t;
+
+/// Completion callback: error is nullptr on success.
+/// Invoked on the reactor thread exactly once per transfer (unless the
+/// transfer was removed with MultiHttpEngine::remove()).
+using TransferDoneCallback = std::function<void(const HttpError* error)>;
+
+/// A DataCallback may return this value instead of a byte count to pause the
+/// transfer without consuming the chunk. The same chunk is delivered again
+/// after MultiHttpEngine::resume(). Equal to CURL_WRITEFUNC_PAUSE.
+constexpr size_t kTransferPause = 0x10000001;
+
+/// Event-driven HTTP engine built on curl_multi (Pimpl).
+/// A single reactor thread drives every in-flight transfer through socket and
+/// timer callbacks (epoll on Linux, curl_multi_poll elsewhere). Concurrency is
+/// bounded by a connection budget; transfers above the budget wait in FIFO
+/// order. Retry and backoff follow HttpEngine::download, but a transfer
+/// waiting for its next attempt does not hold a connection or a thread.
+///
+/// All public methods are thread-safe. Data and completion callbacks run on
+/// the reactor thread and must not block.
+///
+/// With a HttpShare, transfers draw DNS entries and TLS sessions from the
+/// shared caches (e.g. those warmed by a HEAD probe). Connections are
+/// reused among the engine's own transfers only.
+class MultiHttpEngine {
+public:
+    explicit MultiHttpEngine(int max_connections = 32, HttpShare* share = nullptr);
+    ~MultiHttpEngine();
+
+    MultiHttpEngine(const MultiHttpEngine&) = delete;
+    MultiHttpEngine& operator=(const MultiHttpEngine&) = delete;
+
+    /// Queue a download of a byte range (or the full file when
+    /// range_start == range_end == -1). Returns immediately.
+    TransferId download(const std::string& url,
+                        int64_t range_start,
+                        int64_t range_end,
+                        const HttpConfig& config,
+                        DataCallback on_data,
+                        TransferDoneCallback on_done);
+
+    /// Cancel a transfer; on_done receives a non-retryable "Download cancelled".
+    void cancel(TransferId id);
+
+    /// Cancel a transfer without invoking on_done. When this returns, no
+    /// callback of the transfer is running or will run again, so the owner
+    /// of the callbacks may be destroyed. Called from a callback (on the
+    /// reactor thread), the transfer's callbacks are not invoked again and
+    /// it is freed once that callback has returned.
+    void remove(TransferId id);
+
+    /// Un-pause a transfer whose DataCallback returned kTransferPause,
+    /// optionally after a delay.
+    void resume(TransferId id, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+
+    /// Change the connection budget (minimum 1). Takes effect immediately.
+    void setMaxConnections(int max_connections);
+    int maxConnections() const;
+
+    /// Transfers currently holding a connection.
+    size_t activeTransfers() const;
+
+    /// Transfers waiting for a connection slot or for a retry.
+    size_t pendingTransfers() const;
+
+    /// Stop the reactor thread. Outstanding transfers are dropped without
+    /// invoking their callbacks. Called automatically by the destructor.
+    void shutdown();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
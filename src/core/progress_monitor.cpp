@@ -1,68 +1,130 @@
 // progress_monitor.cpp
 #include "progress_monitor.h"
 #include <algorithm>
+#include <cmath>
 
-ProgressMonitor::ProgressMonitor(int64_t total_bytes)
+namespace {
+
+int remainingSeconds(int64_t remaining_bytes, double speed) {
+    if (speed <= 0.0) {
+        return -1;
+    }
+    return static_cast<int>(static_cast<double>(remaining_bytes) / speed);
+}
+
+} // namespace
+
+ProgressMonitor::ProgressMonitor(int64_t total_bytes, int64_t downloaded_bytes)
     : total_bytes_(total_bytes)
+    , start_(Clock::now())
+    , ewma_time_(start_)
+    , ewma_bytes_(std::max<int64_t>(downloaded_bytes, 0))
 {
+    counters_[0].bytes.store(ewma_bytes_, std::memory_order_relaxed);
+}
+
+int64_t ProgressMonitor::tickAt(Clock::time_point t) const {
+    return (t - start_) / BUCKET_WIDTH;
 }
 
-void ProgressMonitor::addBytes(int64_t bytes) {
+void ProgressMonitor::addBytes(int64_t bytes, int block_id) {
     if (bytes <= 0) {
         return;
     }
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    downloaded_bytes_ += bytes;
+    size_t index = static_cast<size_t>(block_id < 0 ? 0 : block_id) % kCounters;
+    counters_[index].bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+    int64_t tick = tickAt(Clock::now());
+    uint64_t tag = static_cast<uint64_t>(tick) & TAG_MASK;
+    auto& bucket = buckets_[static_cast<size_t>(tick % BUCKET_COUNT)];
+    uint64_t old = bucket.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        uint64_t old_tag = old >> (64 - TAG_BITS);
+        if (old_tag == tag) {
+            next = old + static_cast<uint64_t>(bytes);
+        } else if (((old_tag - tag) & TAG_MASK) < (TAG_MASK >> 1)) {
+            // A later tick already reused the slot: this writer was delayed
+            // past the window, its bytes only go to the counter
+            return;
+        } else {
+            next = (tag << (64 - TAG_BITS)) | (static_cast<uint64_t>(bytes) & BYTES_MASK);
+        }
+    } while (!bucket.compare_exchange_weak(old, next, std::memory_order_relaxed));
+}
+
+int64_t ProgressMonitor::downloadedBytes() const {
+    int64_t total = 0;
+    for (const auto& counter : counters_) {
+        total += counter.bytes.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double ProgressMonitor::speed() const {
+    auto now = Clock::now();
+    int64_t current = tickAt(now);
+    int64_t first = std::max<int64_t>(0, current - (BUCKET_COUNT - 1));
+
+    // The window starts at the oldest bucket still in the ring (or at
+    // construction) and includes the current, partial bucket
+    auto span = now - (start_ + first * BUCKET_WIDTH);
+    if (span < MIN_SPEED_SPAN) {
+        return 0.0;
+    }
 
-    Sample s;
-    s.time = std::chrono::steady_clock::now();
-    s.bytes = downloaded_bytes_;
-    samples_.push_back(s);
+    uint64_t bytes = 0;
+    for (int64_t tick = first; tick <= current; ++tick) {
+        uint64_t value = buckets_[static_cast<size_t>(tick % BUCKET_COUNT)].load(std::memory_order_relaxed);
+        if ((value >> (64 - TAG_BITS)) == (static_cast<uint64_t>(tick) & TAG_MASK)) {
+            bytes += value & BYTES_MASK;
+        }
+    }
+    return static_cast<double>(bytes) / std::chrono::duration<double>(span).count();
 }
 
 ProgressInfo ProgressMonitor::snapshot() {
-    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    int64_t downloaded = downloadedBytes();
 
     ProgressInfo info;
     info.total_bytes = total_bytes_;
-    info.downloaded_bytes = downloaded_bytes_;
+    info.downloaded_bytes = downloaded;
 
     // Progress percentage
     if (total_bytes_ > 0) {
         info.progress_percent =
-            static_cast<double>(downloaded_bytes_) / static_cast<double>(total_bytes_) * 100.0;
+            static_cast<double>(downloaded) / static_cast<double>(total_bytes_) * 100.0;
     } else {
         info.progress_percent = 0.0;
     }
 
-    // Sliding window speed calculation
-    auto now = std::chrono::steady_clock::now();
-    auto cutoff = now - std::chrono::seconds(WINDOW_SIZE_SEC);
+    info.speed_bytes_per_sec = speed();
+    info.remaining_seconds = remainingSeconds(total_bytes_ - downloaded, info.speed_bytes_per_sec);
 
-    // Remove samples older than the window
-    while (!samples_.empty() && samples_.front().time < cutoff) {
-        samples_.pop_front();
-    }
-
-    if (samples_.size() >= 2) {
-        const auto& oldest = samples_.front();
-        const auto& newest = samples_.back();
-
-        auto elapsed = std::chrono::duration<double>(newest.time - oldest.time).count();
-        if (elapsed > 0.0) {
-            int64_t byte_delta = newest.bytes - oldest.bytes;
-            info.speed_bytes_per_sec = static_cast<double>(byte_delta) / elapsed;
+    // Fold the average speed since the previous snapshot into the EWMA,
+    // weighted by how long that interval was
+    {
+        std::lock_guard<std::mutex> lock(ewma_mutex_);
+        auto elapsed = now - ewma_time_;
+        if (elapsed >= MIN_SPEED_SPAN) {
+            double seconds = std::chrono::duration<double>(elapsed).count();
+            double rate = static_cast<double>(downloaded - ewma_bytes_) / seconds;
+            if (ewma_valid_) {
+                double keep = std::exp(-seconds / EWMA_TIME_CONSTANT_SEC);
+                ewma_speed_ = keep * ewma_speed_ + (1.0 - keep) * rate;
+            } else {
+                ewma_speed_ = rate;
+                ewma_valid_ = true;
+            }
+            ewma_time_ = now;
+            ewma_bytes_ = downloaded;
         }
+        info.smoothed_speed_bytes_per_sec = ewma_speed_;
     }
-
-    // Remaining time
-    if (info.speed_bytes_per_sec > 0.0) {
-        double remaining_bytes = static_cast<double>(total_bytes_ - downloaded_bytes_);
-        info.remaining_seconds = static_cast<int>(remaining_bytes / info.speed_bytes_per_sec);
-    } else {
-        info.remaining_seconds = -1;
-    }
+    info.smoothed_remaining_seconds =
+        remainingSeconds(total_bytes_ - downloaded, info.smoothed_speed_bytes_per_sec);
 
     return info;
 }
@@ -1,38 +1,75 @@
 // progress_monitor.h
 #pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
-#include <deque>
 #include <mutex>
 #include <chrono>
 
 struct ProgressInfo {
     int64_t total_bytes = 0;
     int64_t downloaded_bytes = 0;
-    double speed_bytes_per_sec = 0.0;
+    double speed_bytes_per_sec = 0.0;           // average over the last 5 seconds
     double progress_percent = 0.0;
     int remaining_seconds = -1;    // -1 means "calculating"
+    double smoothed_speed_bytes_per_sec = 0.0;  // EWMA, steadier for the ETA
+    int smoothed_remaining_seconds = -1;        // ETA from the EWMA, -1 means "calculating"
 };
 
 class ProgressMonitor {
 public:
-    explicit ProgressMonitor(int64_t total_bytes);
+    // downloaded_bytes: bytes already on disk (resume); they never count as speed
+    explicit ProgressMonitor(int64_t total_bytes, int64_t downloaded_bytes = 0);
 
-    // Add downloaded bytes (thread-safe)
-    void addBytes(int64_t bytes);
+    // Add downloaded bytes (thread-safe, lock-free). Writers pass their
+    // block id so concurrent blocks update different cache lines.
+    void addBytes(int64_t bytes, int block_id = 0);
 
-    // Get current progress snapshot
+    // Average speed over the last 5 seconds (lock-free).
+    double speed() const;
+
+    // Get current progress snapshot. Also advances the EWMA.
     ProgressInfo snapshot();
 
 private:
-    mutable std::mutex mutex_;
-    int64_t total_bytes_;
-    int64_t downloaded_bytes_ = 0;
+    using Clock = std::chrono::steady_clock;
+
+    // Sum of all counters.
+    int64_t downloadedBytes() const;
+
+    // Index of the bucket covering time t.
+    int64_t tickAt(Clock::time_point t) const;
 
-    // Sliding window: record (timestamp, cumulative bytes) for last 5 seconds
-    static constexpr int WINDOW_SIZE_SEC = 5;
-    struct Sample {
-        std::chrono::steady_clock::time_point time;
-        int64_t bytes;
+    // One counter per cache line, indexed by block id
+    static constexpr size_t kCounters = 64;
+    struct alignas(64) Counter {
+        std::atomic<int64_t> bytes{0};
     };
-    std::deque<Sample> samples_;
+    std::array<Counter, kCounters> counters_;
+
+    int64_t total_bytes_;
+    const Clock::time_point start_;
+
+    // Speed window: a ring of 100 ms buckets covering the last 5 seconds.
+    // Each slot packs the low bits of its tick (to tell a stale slot from
+    // the current one) with the bytes added during that tick, so writers
+    // update it with a single CAS and memory stays constant however long
+    // nobody reads.
+    static constexpr auto BUCKET_WIDTH = std::chrono::milliseconds(100);
+    static constexpr int64_t BUCKET_COUNT = 50;
+    static constexpr int TAG_BITS = 24;
+    static constexpr uint64_t TAG_MASK = (uint64_t{1} << TAG_BITS) - 1;
+    static constexpr uint64_t BYTES_MASK = (uint64_t{1} << (64 - TAG_BITS)) - 1;
+    static constexpr auto MIN_SPEED_SPAN = std::chrono::milliseconds(50);
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets_{};
+
+    // EWMA of the speed, advanced by snapshot() over whatever time passed
+    // since the previous call, so irregular polling weighs correctly
+    static constexpr double EWMA_TIME_CONSTANT_SEC = 10.0;
+    std::mutex ewma_mutex_;
+    Clock::time_point ewma_time_;
+    int64_t ewma_bytes_;
+    double ewma_speed_ = 0.0;
+    bool ewma_valid_ = false;
 };
@@ -1,19 +1,18 @@
 #include "task.h"
+#include "task_journal.h"
 #include "http_engine.h"
+#include "http_common.h"
 #include "block_splitter.h"
+#include "chunk_map.h"
 #include "thread_pool.h"
 #include "token_bucket.h"
 #include "file_classifier.h"
 #include "logger.h"
 
 #include <filesystem>
-#include <fstream>
 #include <algorithm>
 #include <stdexcept>
-
-#ifdef _WIN32
-#include <windows.h>
-#endif
+#include <thread>
 
 namespace fs = std::filesystem;
 
@@ -33,8 +32,8 @@ Task::Task(int task_id,
     , url_(url)
     , save_dir_(save_dir)
     , max_blocks_(std::clamp(max_blocks, 1, 32))
+    , limiter_(0, limiter)
     , pool_(pool)
-    , limiter_(limiter)
     , classifier_(classifier)
     , on_state_change_(std::move(on_state_change))
     , referer_(referer)
@@ -45,12 +44,25 @@ Task::Task(int task_id,
     meta_path_ = buildMetaPath();
 }
 
+// ── Destructor ─────────────────────────────────────────────────
+
+Task::~Task()
+{
+    // A retry firing now would submit a job for this Task
+    cancelRetries();
+
+    // Blocks go first: a write still with the disk writer reports its
+    // progress into progress_ before the block can be destroyed.
+    blocks_.clear();
+}
+
 // ── fromMeta (static factory) ──────────────────────────────────
 
 std::unique_ptr<Task> Task::fromMeta(
+    int task_id,
     const std::string& meta_path,
     ThreadPool* pool,
-    TokenBucket* limiter,
+    const LimiterForUrl& limiter_for,
     FileClassifier* classifier,
     TaskStateCallback on_state_change)
 {
@@ -65,12 +77,12 @@ std::unique_ptr<Task> Task::fromMeta(
     std::string save_dir = fs::path(meta.file_path).parent_path().string();
 
     auto task = std::unique_ptr<Task>(new Task(
-        0,  // task_id will be assigned by DownloadManager
+        task_id,
         meta.url,
         save_dir,
         meta.max_blocks,
         pool,
-        limiter,
+        limiter_for ? limiter_for(meta.url) : nullptr,
         classifier,
         std::move(on_state_change)));
 
@@ -78,28 +90,97 @@ std::unique_ptr<Task> Task::fromMeta(
     task->file_name_ = meta.file_name;
     task->file_path_ = meta.file_path;
     task->file_size_ = meta.file_size;
-    task->etag_ = meta.etag;
-    task->last_modified_ = meta.last_modified;
     task->meta_path_ = meta_path;
-    task->accept_ranges_ = true;  // if we have blocks, range was supported
+    task->applyMeta(meta);
 
-    // Calculate already-downloaded bytes
+    // Calculate already-downloaded bytes (the blocks may only cover what
+    // was missing when the task was last resumed)
     int64_t already_downloaded = 0;
-    for (const auto& bi : meta.blocks) {
-        already_downloaded += bi.downloaded;
+    if (!meta.chunks.empty() && meta.chunk_size > 0) {
+        already_downloaded = ChunkMap(meta.file_size, meta.chunk_size, meta.chunks).doneBytes();
+    } else {
+        for (const auto& bi : meta.blocks) {
+            already_downloaded += bi.downloaded;
+        }
     }
 
     // Create progress monitor with existing progress
-    task->progress_ = std::make_unique<ProgressMonitor>(meta.file_size);
-    if (already_downloaded > 0) {
-        task->progress_->addBytes(already_downloaded);
-    }
+    task->progress_ = std::make_unique<ProgressMonitor>(meta.file_size, already_downloaded);
+
+    task->state_.store(TaskState::Paused);
+
+    return task;
+}
+
+// ── fromJournal (static factory) ───────────────────────────────
+
+std::unique_ptr<Task> Task::fromJournal(
+    int task_id,
+    const JournalEntry& entry,
+    int max_blocks,
+    ThreadPool* pool,
+    const LimiterForUrl& limiter_for,
+    FileClassifier* classifier,
+    TaskStateCallback on_state_change)
+{
+    auto task = std::unique_ptr<Task>(new Task(
+        task_id,
+        entry.url,
+        entry.save_dir,
+        max_blocks,
+        pool,
+        limiter_for ? limiter_for(entry.url) : nullptr,
+        classifier,
+        std::move(on_state_change)));
 
+    // No file access here: the rest comes from loadMeta()
+    task->file_name_ = entry.file_name;
+    task->file_path_ = (fs::path(entry.save_dir) / entry.file_name).string();
+    task->file_size_ = entry.file_size;
+    task->meta_path_ = entry.meta_path;
+    task->meta_pending_ = true;
+    task->progress_ = std::make_unique<ProgressMonitor>(entry.file_size, entry.downloaded);
     task->state_.store(TaskState::Paused);
 
     return task;
 }
 
+// ── loadMeta / applyMeta ───────────────────────────────────────
+
+bool Task::loadMeta()
+{
+    std::lock_guard<std::mutex> lock(load_mutex_);
+    if (!meta_pending_) {
+        return meta_ok_;
+    }
+    meta_pending_ = false;
+
+    auto meta = MetaFile::load(meta_path_);
+    meta_ok_ = meta.has_value();
+    if (meta_ok_) {
+        applyMeta(*meta);
+    }
+    return meta_ok_;
+}
+
+void Task::applyMeta(const TaskMeta& meta)
+{
+    max_blocks_ = std::clamp(meta.max_blocks, 1, 32);
+    etag_ = meta.etag;
+    last_modified_ = meta.last_modified;
+    accept_ranges_ = true;  // if we have blocks, range was supported
+    priority_.store(static_cast<TaskPriority>(
+        std::clamp(meta.priority, 0, static_cast<int>(TaskPriority::Urgent))));
+    deadline_.store(std::max<int64_t>(meta.deadline, 0));
+}
+
+// ── setServices ────────────────────────────────────────────────
+
+void Task::setServices(const TaskServices& services)
+{
+    services_ = services;
+}
+
 // ── start ──────────────────────────────────────────────────────
 
 void Task::start()
@@ -108,38 +189,130 @@ void Task::start()
     if (!state_.compare_exchange_strong(expected, TaskState::Downloading)) {
         return;  // not in Queued state
     }
+    journalState(TaskState::Downloading);  // setState() sees no change
     setState(TaskState::Downloading);
 
     // Submit the fetch+start sequence to the thread pool so we don't block
-    pool_->submit([this]() {
-        try {
-            fetchFileInfoAndStart();
-        } catch (const HttpError& e) {
-            error_message_ = std::string(e.what())
-                + " (HTTP " + std::to_string(e.httpStatus()) + ")";
-            Logger::instance().error("Task " + std::to_string(task_id_)
-                + " failed: " + e.what()
-                + " (curl=" + std::to_string(e.curlCode())
-                + " http=" + std::to_string(e.httpStatus()) + ")");
-
-            // Auto-retry on retryable errors
-            if (e.isRetryable() && auto_retry_count_ < kMaxAutoRetries) {
-                ++auto_retry_count_;
-                Logger::instance().info("Task " + std::to_string(task_id_)
-                    + " auto-retry " + std::to_string(auto_retry_count_)
-                    + "/" + std::to_string(kMaxAutoRetries));
-                state_.store(TaskState::Queued);
-                std::this_thread::sleep_for(std::chrono::seconds(2 * auto_retry_count_));
+    head_attempt_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_retries_.clear();
+    }
+    completion_queued_.store(false);
+    controlPool()->submitDetached([this]() { runStart(); });
+}
+
+// ── runStart ───────────────────────────────────────────────────
+
+void Task::runStart()
+{
+    try {
+        fetchFileInfoAndStart();
+    } catch (const HttpError& e) {
+        // HEAD backoff on the timer wheel instead of in the engine
+        if (e.isRetryable() && services_.timers && head_attempt_ < HttpConfig().max_retries
+            && state_.load() == TaskState::Downloading) {
+            ++head_attempt_;
+            retryLater(std::chrono::seconds(retryBackoffSeconds(head_attempt_)), controlPool(),
+                       [this] { runStart(); });
+            return;
+        }
+
+        error_message_ = std::string(e.what())
+            + " (HTTP " + std::to_string(e.httpStatus()) + ")";
+        Logger::instance().error("Task " + std::to_string(task_id_)
+            + " failed: " + e.what()
+            + " (curl=" + std::to_string(e.curlCode())
+            + " http=" + std::to_string(e.httpStatus()) + ")");
+
+        // Auto-retry on retryable errors
+        if (e.isRetryable() && auto_retry_count_ < kMaxAutoRetries) {
+            ++auto_retry_count_;
+            Logger::instance().info("Task " + std::to_string(task_id_)
+                + " auto-retry " + std::to_string(auto_retry_count_)
+                + "/" + std::to_string(kMaxAutoRetries));
+            state_.store(TaskState::Queued);
+            std::chrono::seconds delay(2 * auto_retry_count_);
+            if (services_.timers) {
+                retryLater(delay, controlPool(), [this] { start(); });
+            } else {
+                std::this_thread::sleep_for(delay);
                 start();
-                return;
             }
-            setState(TaskState::Failed);
-        } catch (const std::exception& e) {
-            error_message_ = e.what();
-            Logger::instance().error("Task " + std::to_string(task_id_)
-                + " failed: " + e.what());
-            setState(TaskState::Failed);
+            return;
+        }
+        setState(TaskState::Failed);
+    } catch (const std::exception& e) {
+        error_message_ = e.what();
+        Logger::instance().error("Task " + std::to_string(task_id_)
+            + " failed: " + e.what());
+        setState(TaskState::Failed);
+    }
+}
+
+// ── controlPool / retryLater / cancelRetries ───────────────────
+
+ThreadPool* Task::controlPool() const
+{
+    return services_.control_pool ? services_.control_pool : pool_;
+}
+
+void Task::retryLater(std::chrono::seconds delay, ThreadPool* pool, std::function<void()> job)
+{
+    std::lock_guard<std::mutex> lock(retry_mutex_);
+    retry_timers_.push_back(services_.timers->schedule(delay,
+        [pool, job = std::move(job)]() { pool->submitDetached(job); }));
+}
+
+void Task::cancelRetries()
+{
+    if (!services_.timers) {
+        return;
+    }
+    std::vector<TimerWheel::TimerId> timers;
+    {
+        std::lock_guard<std::mutex> lock(retry_mutex_);
+        timers.swap(retry_timers_);
+        if (checkpoint_timer_ != 0) {
+            timers.push_back(checkpoint_timer_);
+            checkpoint_timer_ = 0;
+        }
+    }
+    for (TimerWheel::TimerId id : timers) {
+        services_.timers->cancel(id);
+    }
+}
+
+// ── Checkpoints ────────────────────────────────────────────────
+
+void Task::scheduleCheckpoint()
+{
+    if (!services_.timers || services_.checkpoint_interval.count() <= 0) {
+        return;
+    }
+    TimerWheel::TimerId previous = 0;
+    {
+        std::lock_guard<std::mutex> lock(retry_mutex_);
+        previous = checkpoint_timer_;
+        checkpoint_timer_ = services_.timers->schedule(services_.checkpoint_interval,
+                                                       [this] { queueCheckpoint(); });
+    }
+    if (previous != 0) {
+        services_.timers->cancel(previous);
+    }
+}
+
+void Task::queueCheckpoint()
+{
+    if (checkpoint_queued_.exchange(true)) {
+        return;
+    }
+    controlPool()->submitDetached([this]() {
+        if (state_.load() == TaskState::Downloading) {
+            saveMeta();
+            scheduleCheckpoint();  // the next one a full interval from now
         }
+        checkpoint_queued_.store(false);
     });
 }
 
@@ -151,10 +324,13 @@ void Task::fetchFileInfoAndStart()
         + " fetching file info: " + url_);
 
     // Create a temporary HttpEngine for the HEAD request
-    HttpEngine head_engine;
+    HttpEngine head_engine(services_.http_share);
     HttpConfig config;
     config.referer = referer_;
     config.cookie = cookie_;
+    if (services_.timers) {
+        config.max_retries = 0;  // the caller retries through the timer wheel
+    }
 
     FileInfo info = head_engine.fetchFileInfo(url_, config);
 
@@ -212,9 +388,11 @@ void Task::fetchFileInfoAndStart()
     progress_ = std::make_unique<ProgressMonitor>(file_size_);
 
     // Create and submit blocks
+    synced_bytes_.store(0);
     createBlocks();
     saveMeta();
     submitBlocks();
+    scheduleCheckpoint();
 }
 
 // ── allocateFile ───────────────────────────────────────────────
@@ -227,58 +405,20 @@ void Task::allocateFile()
         fs::create_directories(dir);
     }
 
-#ifdef _WIN32
-    HANDLE hFile = ::CreateFileA(
-        file_path_.c_str(),
-        GENERIC_WRITE,
-        FILE_SHARE_READ | FILE_SHARE_WRITE,
-        nullptr,
-        CREATE_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr);
-
-    if (hFile == INVALID_HANDLE_VALUE) {
-        throw std::runtime_error("Task: failed to create file for pre-allocation: " + file_path_);
-    }
-
-    // Move file pointer to the desired size
-    LARGE_INTEGER li;
-    li.QuadPart = file_size_;
-    if (!::SetFilePointerEx(hFile, li, nullptr, FILE_BEGIN)) {
-        ::CloseHandle(hFile);
-        throw std::runtime_error("Task: SetFilePointerEx failed for: " + file_path_);
-    }
-
-    // Set the end of file at the current pointer position
-    if (!::SetEndOfFile(hFile)) {
-        ::CloseHandle(hFile);
-        throw std::runtime_error("Task: SetEndOfFile failed for: " + file_path_);
-    }
-
-    ::CloseHandle(hFile);
-#else
-    // Non-Windows fallback: create file and truncate to size
-    std::ofstream ofs(file_path_, std::ios::binary | std::ios::trunc);
-    if (!ofs) {
-        throw std::runtime_error("Task: failed to create file: " + file_path_);
-    }
-    if (file_size_ > 0) {
-        ofs.seekp(file_size_ - 1);
-        ofs.put('\0');
-    }
-    ofs.close();
-#endif
+    // Throws early when the volume cannot hold the whole file
+    preallocateFile(file_path_, file_size_, services_.preallocation);
 }
 
 // ── createBlocks ───────────────────────────────────────────────
 
 void Task::createBlocks()
 {
+    DetachedBlocks old;  // destroyed after the lock is released
     std::lock_guard<std::mutex> lock(mutex_);
 
-    blocks_.clear();
-    engines_.clear();
-    completed_blocks_.store(0);
+    old = detachBlocksLocked();
+    remaining_blocks_.store(0);
+    chunks_ = file_size_ > 0 ? std::make_unique<ChunkMap>(file_size_) : nullptr;
 
     std::vector<BlockInfo> block_infos;
 
@@ -296,40 +436,225 @@ void Task::createBlocks()
     }
 
     for (auto& bi : block_infos) {
-        auto engine = std::make_unique<HttpEngine>();
-        auto block = std::make_unique<Block>(
-            bi,
-            file_path_,
-            url_,
-            engine.get(),
-            limiter_,
-            [this](int block_id, int64_t bytes_delta) {
-                onBlockProgress(block_id, bytes_delta);
-            });
+        addBlock(bi);
+    }
+    next_block_id_ = static_cast<int>(block_infos.size());
+}
+
+// ── detachBlocksLocked ─────────────────────────────────────────
+
+Task::DetachedBlocks Task::detachBlocksLocked()
+{
+    DetachedBlocks old;
+    old.blocks.swap(blocks_);
+    old.engines.swap(engines_);
+    old.sink = std::move(sink_);
+    old.chunks = std::move(chunks_);
+    return old;
+}
+
+// ── addBlock ───────────────────────────────────────────────────
+
+void Task::addBlock(const BlockInfo& bi, Block* primary)
+{
+    // With a shared transfer engine, blocks don't need a private easy handle
+    HttpEngine* engine = nullptr;
+    if (!services_.transfer_engine) {
+        engines_.push_back(std::make_unique<HttpEngine>(services_.http_share));
+        engine = engines_.back().get();
+    }
+
+    if (!sink_) {
+        sink_ = openFileSink(file_path_, services_.file_sink_backend);
+    }
+
+    blocks_.push_back(std::make_unique<Block>(
+        bi,
+        sink_.get(),
+        url_,
+        engine,
+        &limiter_,
+        [this](int block_id, int64_t bytes_delta) {
+            onBlockProgress(block_id, bytes_delta);
+        }));
+    blocks_.back()->setBufferPool(services_.buffer_pool);
+    blocks_.back()->setDiskWriter(services_.disk_writer);
+    blocks_.back()->setChunkMap(chunks_.get());
+    if (primary) {
+        blocks_.back()->raceFor(primary);
+    } else if (!bi.completed) {
+        // Racers don't count: their primary does
+        remaining_blocks_.fetch_add(1);
+        blocks_.back()->setCompletionCounter(&remaining_blocks_);
+    }
+}
+
+// ── closeSink ──────────────────────────────────────────────────
 
-        engines_.push_back(std::move(engine));
-        blocks_.push_back(std::move(block));
+void Task::closeSink()
+{
+    if (sink_) {
+        sink_->close();
     }
 }
 
 // ── submitBlocks ───────────────────────────────────────────────
 
 void Task::submitBlocks()
+{
+    HttpConfig config = blockConfig();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& block : blocks_) {
+        submitBlock(block.get(), config);
+    }
+}
+
+// ── submitBlock ────────────────────────────────────────────────
+
+void Task::submitBlock(Block* block, const HttpConfig& config)
+{
+    if (services_.transfer_engine) {
+        block->start(services_.transfer_engine, config,
+            [this](int block_id, const HttpError* error) {
+                onBlockDone(block_id, error);
+            });
+        return;
+    }
+
+    pool_->submitDetached([this, block, config]() { runBlock(block, config, 0); });
+}
+
+// ── runBlock ───────────────────────────────────────────────────
+
+void Task::runBlock(Block* block, const HttpConfig& config, int attempt)
+{
+    HttpConfig attempt_config = config;
+    if (services_.timers) {
+        attempt_config.max_retries = 0;  // retried below, without sleeping on this worker
+    }
+
+    try {
+        block->execute(attempt_config);
+    } catch (const HttpError& e) {
+        // execute() resumes after the bytes already written
+        if (e.isRetryable() && services_.timers && attempt < config.max_retries
+            && state_.load() == TaskState::Downloading) {
+            retryLater(std::chrono::seconds(retryBackoffSeconds(attempt + 1)), pool_,
+                       [this, block, config, attempt] { runBlock(block, config, attempt + 1); });
+            return;
+        }
+        onBlockFailed(block->getInfo().block_id, e);
+    } catch (const std::exception& e) {
+        onBlockFailed(block->getInfo().block_id, HttpError(e.what()));
+    }
+}
+
+// ── blockConfig ────────────────────────────────────────────────
+
+HttpConfig Task::blockConfig() const
 {
     HttpConfig config;
     config.referer = referer_;
     config.cookie = cookie_;
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    for (size_t i = 0; i < blocks_.size(); ++i) {
-        Block* block_ptr = blocks_[i].get();
-        pool_->submit([block_ptr, config]() {
-            try {
-                block_ptr->execute(config);
-            } catch (const std::exception&) {
-                // Error handling: block failed, Task::checkCompletion will detect
-            }
-        });
+    // Ranged requests must come from the version we started on: a changed
+    // file then fails fast instead of being mixed into the old bytes.
+    // Weak ETags are not allowed in If-Range, so fall back to Last-Modified.
+    if (accept_ranges_) {
+        if (!etag_.empty() && etag_.rfind("W/", 0) != 0) {
+            config.if_range = etag_;
+        } else {
+            config.if_range = last_modified_;
+        }
+    }
+    return config;
+}
+
+// ── stealWork ──────────────────────────────────────────────────
+
+void Task::stealWork()
+{
+    if (!accept_ranges_ || file_size_ <= 0 || state_.load() != TaskState::Downloading) {
+        return;
+    }
+
+    // Racers never give work away, and each block is raced at most once
+    std::vector<Block*> raced;
+    for (const auto& block : blocks_) {
+        if (block->primary() && !block->getInfo().completed) {
+            raced.push_back(block->primary());
+        }
+    }
+
+    Block* victim = nullptr;
+    int64_t largest = 0;
+    int64_t task_remaining = 0;
+    for (const auto& block : blocks_) {
+        if (block->primary()) {
+            continue;
+        }
+        int64_t remaining = block->remainingBytes();
+        task_remaining += remaining;
+        if (std::find(raced.begin(), raced.end(), block.get()) != raced.end()) {
+            continue;
+        }
+        if (remaining > largest) {
+            largest = remaining;
+            victim = block.get();
+        }
+    }
+    if (!victim) {
+        return;
+    }
+
+    int victim_id = victim->getInfo().block_id;
+    BlockInfo bi;
+    Block* primary = nullptr;
+    if (auto tail = victim->splitTail(kMinSplitBytes)) {
+        bi = *tail;
+        bi.block_id = next_block_id_++;
+        Logger::instance().info("Task " + std::to_string(task_id_)
+            + " block " + std::to_string(victim_id)
+            + " split: block " + std::to_string(bi.block_id)
+            + " takes [" + std::to_string(bi.range_start)
+            + ", " + std::to_string(bi.range_end) + "]");
+    } else if (task_remaining <= kEndGameBytes && !limiter_.isLimited()) {
+        // End-game: too little left to split, so duplicate the request.
+        // Not under a speed limit: a racer cannot beat it, only burn tokens.
+        // The racer's BlockInfo only describes its own stream; it is not
+        // saved to the MetaFile.
+        // It starts after the victim's buffered bytes, which it owns already.
+        BlockInfo vi = victim->getInfo();
+        bi.block_id = next_block_id_++;
+        bi.range_start = vi.range_end - victim->remainingBytes() + 1;
+        bi.range_end = vi.range_end;
+        primary = victim;
+        Logger::instance().info("Task " + std::to_string(task_id_)
+            + " end-game: block " + std::to_string(bi.block_id)
+            + " races block " + std::to_string(victim_id)
+            + " for [" + std::to_string(bi.range_start)
+            + ", " + std::to_string(bi.range_end) + "]");
+    } else {
+        return;
+    }
+
+    // The MetaFile is not rewritten here (this may run on the reactor
+    // thread). pause() persists the new layout; until then the saved
+    // victim range still covers the stolen tail, so resume stays correct.
+    addBlock(bi, primary);
+    submitBlock(blocks_.back().get(), blockConfig());
+}
+
+// ── settleRaces ────────────────────────────────────────────────
+
+void Task::settleRaces()
+{
+    for (const auto& block : blocks_) {
+        Block* primary = block->primary();
+        if (primary && primary->finishIfFilled()) {
+            block->finishIfFilled();
+        }
     }
 }
 
@@ -341,6 +666,37 @@ void Task::pause()
     if (!state_.compare_exchange_strong(expected, TaskState::Paused)) {
         return;
     }
+    journalState(TaskState::Paused);  // setState() sees no change
+    stopTransfers();
+    setState(TaskState::Paused);
+}
+
+// ── fail ───────────────────────────────────────────────────────
+
+void Task::fail(const std::string& message)
+{
+    TaskState expected = TaskState::Downloading;
+    if (!state_.compare_exchange_strong(expected, TaskState::Failed)) {
+        return;  // paused or cancelled meanwhile, or another block failed first
+    }
+    journalState(TaskState::Failed);  // setState() sees no change
+    error_message_ = message;
+    Logger::instance().error("Task " + std::to_string(task_id_) + " failed: " + message);
+
+    // Like a pause: resume() continues from the blocks saved here
+    stopTransfers();
+
+    // setState() would see no change; the queue needs to hear of it
+    if (on_state_change_) {
+        on_state_change_(task_id_, TaskState::Failed);
+    }
+}
+
+// ── stopTransfers ──────────────────────────────────────────────
+
+void Task::stopTransfers()
+{
+    cancelRetries();
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -349,8 +705,21 @@ void Task::pause()
         }
     }
 
+    // While the file is still open: saveMeta() syncs the bytes it records
     saveMeta();
-    setState(TaskState::Paused);
+    {
+        // No checkpoints until resumed: don't hold the mapping meanwhile
+        std::lock_guard<std::mutex> meta_lock(meta_mutex_);
+        if (meta_writer_) {
+            meta_writer_->close();
+        }
+    }
+
+    {
+        // Release the file until resumed; resume() reopens it
+        std::lock_guard<std::mutex> lock(mutex_);
+        closeSink();
+    }
 }
 
 // ── resume ─────────────────────────────────────────────────────
@@ -365,127 +734,197 @@ void Task::resume()
             return;
         }
     }
+    journalState(TaskState::Downloading);  // setState() sees no change
     setState(TaskState::Downloading);
 
-    pool_->submit([this]() {
-        try {
-            // Check if server file has changed via ETag/Last-Modified
-            HttpEngine head_engine;
-            HttpConfig config;
-            config.referer = referer_;
-            config.cookie = cookie_;
-            FileInfo info = head_engine.fetchFileInfo(url_, config);
-
-            bool server_changed = false;
-            if (!etag_.empty() && !info.etag.empty() && etag_ != info.etag) {
-                server_changed = true;
-            }
-            if (!last_modified_.empty() && !info.last_modified.empty()
-                && last_modified_ != info.last_modified) {
-                server_changed = true;
-            }
+    head_attempt_ = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_retries_.clear();
+    }
+    completion_queued_.store(false);
+    controlPool()->submitDetached([this]() { runResume(); });
+}
 
-            if (server_changed) {
-                // Server file changed: discard progress and restart
-                {
-                    std::lock_guard<std::mutex> lock(mutex_);
-                    blocks_.clear();
-                    engines_.clear();
-                }
+// ── runResume ──────────────────────────────────────────────────
 
-                file_size_ = info.content_length;
-                accept_ranges_ = info.accept_ranges;
-                etag_ = info.etag;
-                last_modified_ = info.last_modified;
+void Task::runResume()
+{
+    // Restored from the journal and not loaded yet: the ETag check needs
+    // it. Without a MetaFile the task starts over below.
+    loadMeta();
 
-                if (file_size_ > 0) {
-                    allocateFile();
-                }
+    try {
+        // Check if server file has changed via ETag/Last-Modified
+        HttpEngine head_engine(services_.http_share);
+        HttpConfig config;
+        config.referer = referer_;
+        config.cookie = cookie_;
+        if (services_.timers) {
+            config.max_retries = 0;  // retried below through the timer wheel
+        }
+        FileInfo info = head_engine.fetchFileInfo(url_, config);
 
-                progress_ = std::make_unique<ProgressMonitor>(file_size_);
-                createBlocks();
-                saveMeta();
-                submitBlocks();
-                return;
+        bool server_changed = false;
+        if (!etag_.empty() && !info.etag.empty() && etag_ != info.etag) {
+            server_changed = true;
+        }
+        if (!last_modified_.empty() && !info.last_modified.empty()
+            && last_modified_ != info.last_modified) {
+            server_changed = true;
+        }
+
+        if (server_changed) {
+            // Server file changed: discard progress and restart
+            {
+                DetachedBlocks old;  // destroyed after the lock is released
+                std::lock_guard<std::mutex> lock(mutex_);
+                old = detachBlocksLocked();
             }
 
-            // Server file unchanged: restore blocks from MetaFile
-            auto meta_opt = MetaFile::load(meta_path_);
-            if (!meta_opt) {
-                // No meta file: restart from scratch
-                fetchFileInfoAndStart();
-                return;
+            file_size_ = info.content_length;
+            accept_ranges_ = info.accept_ranges;
+            etag_ = info.etag;
+            last_modified_ = info.last_modified;
+
+            if (file_size_ > 0) {
+                allocateFile();
             }
 
-            const TaskMeta& meta = *meta_opt;
+            progress_ = std::make_unique<ProgressMonitor>(file_size_);
+            synced_bytes_.store(0);
+            createBlocks();
+            saveMeta();
+            submitBlocks();
+            scheduleCheckpoint();
+            return;
+        }
 
-            // Recreate only incomplete blocks
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                blocks_.clear();
-                engines_.clear();
-                completed_blocks_.store(0);
+        // Server file unchanged: restore blocks from MetaFile
+        auto meta_opt = MetaFile::load(meta_path_);
+        if (!meta_opt) {
+            // No meta file: restart from scratch
+            fetchFileInfoAndStart();
+            return;
+        }
 
-                int64_t already_downloaded = 0;
-                for (const auto& bi : meta.blocks) {
-                    if (bi.completed) {
-                        completed_blocks_.fetch_add(1);
-                        already_downloaded += bi.downloaded;
-                        continue;
-                    }
+        const TaskMeta& meta = *meta_opt;
 
-                    already_downloaded += bi.downloaded;
+        // Space freed on the volume meanwhile may be gone: claim the
+        // missing blocks again so a full disk fails now, not at 99%
+        if (file_size_ > 0 && services_.preallocation == PreallocationMode::Reserved) {
+            reserveFileSpace(file_path_, file_size_);
+        }
 
-                    auto engine = std::make_unique<HttpEngine>();
-                    auto block = std::make_unique<Block>(
-                        bi,
-                        file_path_,
-                        url_,
-                        engine.get(),
-                        limiter_,
-                        [this](int block_id, int64_t bytes_delta) {
-                            onBlockProgress(block_id, bytes_delta);
-                        });
-
-                    engines_.push_back(std::move(engine));
-                    blocks_.push_back(std::move(block));
-                }
+        // Recreate only incomplete blocks
+        bool nothing_missing = false;
+        DetachedBlocks old;  // destroyed after the lock is released
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            old = detachBlocksLocked();
+            remaining_blocks_.store(0);
+
+            int64_t already_downloaded = 0;
+            next_block_id_ = 0;
+            for (const auto& bi : meta.blocks) {
+                next_block_id_ = std::max(next_block_id_, bi.block_id + 1);
+            }
 
-                // Reset progress monitor with already-downloaded bytes
-                progress_ = std::make_unique<ProgressMonitor>(file_size_);
-                if (already_downloaded > 0) {
-                    progress_->addBytes(already_downloaded);
+            bool has_chunk_map = file_size_ > 0 && meta.file_size == file_size_
+                && !meta.chunks.empty()
+                && meta.chunk_size == ChunkMap::chunkSizeFor(file_size_);
+            if (has_chunk_map) {
+                // Fetch exactly the chunks not on disk, whatever the blocks were.
+                // Done chunks between merged ranges are fetched (and reported)
+                // again, so they start over as not done.
+                auto ranges = ChunkMap(file_size_, meta.chunk_size, meta.chunks)
+                                  .missingRanges(static_cast<size_t>(max_blocks_));
+                std::vector<uint8_t> bitmap = meta.chunks;
+                for (const auto& [first, last] : ranges) {
+                    for (int64_t c = first / meta.chunk_size; c <= last / meta.chunk_size; ++c) {
+                        if (static_cast<size_t>(c / 8) < bitmap.size()) {
+                            bitmap[static_cast<size_t>(c / 8)] &= static_cast<uint8_t>(~(1u << (c % 8)));
+                        }
+                    }
+                }
+                chunks_ = std::make_unique<ChunkMap>(file_size_, meta.chunk_size, bitmap);
+                for (const auto& [first, last] : ranges) {
+                    BlockInfo bi;
+                    bi.block_id = next_block_id_++;
+                    bi.range_start = first;
+                    bi.range_end = last;
+                    addBlock(bi);
+                }
+                already_downloaded = chunks_->doneBytes();
+            } else {
+                // Saved before chunk maps: each block resumes after its prefix
+                chunks_ = file_size_ > 0 ? std::make_unique<ChunkMap>(file_size_) : nullptr;
+                for (const auto& bi : meta.blocks) {
+                    if (chunks_) {
+                        chunks_->markWritten(std::max<int64_t>(bi.range_start, 0), bi.downloaded);
+                    }
+                    already_downloaded += bi.downloaded;
+                    if (!bi.completed) {
+                        addBlock(bi);
+                    }
                 }
             }
 
-            submitBlocks();
+            // Reset progress monitor with already-downloaded bytes
+            progress_ = std::make_unique<ProgressMonitor>(file_size_, already_downloaded);
+            nothing_missing = blocks_.empty();
+        }
 
-        } catch (const HttpError& e) {
-            error_message_ = std::string(e.what())
-                + " (HTTP " + std::to_string(e.httpStatus()) + ")";
-            Logger::instance().error("Task " + std::to_string(task_id_)
-                + " resume failed: " + e.what()
-                + " (curl=" + std::to_string(e.curlCode())
-                + " http=" + std::to_string(e.httpStatus()) + ")");
-            setState(TaskState::Failed);
-        } catch (const std::exception& e) {
-            error_message_ = e.what();
-            setState(TaskState::Failed);
+        if (nothing_missing) {
+            // Paused (or crashed) after the last byte: no block will ever
+            // report completion, so finish here
+            queueCompletion();
+            return;
         }
-    });
+
+        // The MetaFile may predate synced checkpoints: the first one after
+        // resuming syncs whatever it claims
+        synced_bytes_.store(0);
+        submitBlocks();
+        scheduleCheckpoint();
+
+    } catch (const HttpError& e) {
+        if (e.isRetryable() && services_.timers && head_attempt_ < HttpConfig().max_retries
+            && state_.load() == TaskState::Downloading) {
+            ++head_attempt_;
+            retryLater(std::chrono::seconds(retryBackoffSeconds(head_attempt_)), controlPool(),
+                       [this] { runResume(); });
+            return;
+        }
+        error_message_ = std::string(e.what())
+            + " (HTTP " + std::to_string(e.httpStatus()) + ")";
+        Logger::instance().error("Task " + std::to_string(task_id_)
+            + " resume failed: " + e.what()
+            + " (curl=" + std::to_string(e.curlCode())
+            + " http=" + std::to_string(e.httpStatus()) + ")");
+        setState(TaskState::Failed);
+    } catch (const std::exception& e) {
+        error_message_ = e.what();
+        setState(TaskState::Failed);
+    }
 }
 
 // ── cancel ─────────────────────────────────────────────────────
 
 void Task::cancel()
 {
-    state_.store(TaskState::Cancelled);
+    if (state_.exchange(TaskState::Cancelled) != TaskState::Cancelled) {
+        // Before the files go: a crash after this must not bring it back
+        journalState(TaskState::Cancelled);
+    }
+    cancelRetries();
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
         for (auto& block : blocks_) {
             block->pause();
         }
+        closeSink();
         // Do NOT clear blocks_ or engines_ here!
         // Thread pool workers may still hold raw pointers to Block objects.
         // They will be cleaned up when the Task is destroyed.
@@ -498,43 +937,138 @@ void Task::cancel()
         }
     } catch (...) {}
 
-    MetaFile::remove(meta_path_);
+    removeMeta();
 
     setState(TaskState::Cancelled);
 }
 
 // ── onBlockProgress ────────────────────────────────────────────
 
-void Task::onBlockProgress(int /*block_id*/, int64_t bytes_delta)
+void Task::onBlockProgress(int block_id, int64_t bytes_delta)
 {
     // If cancelled, don't touch any state — the Task may be getting destroyed
     if (state_.load() == TaskState::Cancelled) return;
 
     if (progress_) {
-        progress_->addBytes(bytes_delta);
+        progress_->addBytes(bytes_delta, block_id);
+    }
+
+    if (services_.checkpoint_bytes > 0 && bytes_delta > 0
+        && unsaved_bytes_.fetch_add(bytes_delta) + bytes_delta >= services_.checkpoint_bytes) {
+        queueCheckpoint();
     }
 
-    // Check if all blocks are done
-    bool all_done = true;
+    // Only a completion (zero delta) can finish the task. Data deltas must
+    // not take mutex_: blocks flush their write buffers from pause(), which
+    // Task::pause() calls with mutex_ held.
+    if (bytes_delta != 0) {
+        return;
+    }
+
+    bool all_done = false;
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        for (const auto& block : blocks_) {
-            if (!block->getInfo().completed) {
-                all_done = false;
-                break;
+
+        // A block just completed: close finished races, then put its
+        // connection to work on the slowest remaining range.
+        settleRaces();
+        stealWork();
+
+        // Under mutex_: a block stealWork() adds is counted before this
+        all_done = remaining_blocks_.load(std::memory_order_acquire) == 0;
+    }
+
+    // Size check and the move into a category folder are file system
+    // work: keep them off the reactor and transfer threads
+    if (all_done) {
+        queueCompletion();
+    }
+}
+
+// ── queueCompletion ────────────────────────────────────────────
+
+void Task::queueCompletion()
+{
+    if (state_.load() == TaskState::Downloading && !completion_queued_.exchange(true)) {
+        controlPool()->submitDetached([this]() {
+            if (state_.load() == TaskState::Downloading) {
+                checkCompletion();
             }
+        });
+    }
+}
+
+// ── onBlockDone ────────────────────────────────────────────────
+
+void Task::onBlockDone(int block_id, const HttpError* error)
+{
+    if (!error) {
+        return;
+    }
+
+    // The engine has already retried the transfer. A failed write is
+    // retried here, from the first byte not on disk.
+    if (Block::isWriteError(*error) && services_.timers
+        && state_.load() == TaskState::Downloading) {
+        int attempt = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            attempt = ++write_retries_[block_id];
+        }
+        if (attempt <= HttpConfig().max_retries) {
+            retryLater(std::chrono::seconds(retryBackoffSeconds(attempt)), controlPool(),
+                       [this, block_id] { restartBlock(block_id); });
+            return;
+        }
+    }
+    onBlockFailed(block_id, *error);
+}
+
+// ── restartBlock ───────────────────────────────────────────────
+
+void Task::restartBlock(int block_id)
+{
+    if (state_.load() != TaskState::Downloading) {
+        return;
+    }
+    HttpConfig config = blockConfig();
+
+    // By id: the blocks may have been rebuilt since the retry was scheduled
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& block : blocks_) {
+        if (block->getInfo().block_id == block_id) {
+            submitBlock(block.get(), config);
+            return;
         }
     }
+}
 
-    if (all_done && state_.load() == TaskState::Downloading) {
-        checkCompletion();
+// ── onBlockFailed ──────────────────────────────────────────────
+
+void Task::onBlockFailed(int block_id, const HttpError& error)
+{
+    if (state_.load() != TaskState::Downloading) {
+        return;  // a pause or cancel stopped the transfer
     }
+
+    // The block can never complete now: fail the task, keeping its
+    // progress for resume(). Off the reactor: saving is file system work.
+    std::string message = "Block " + std::to_string(block_id) + ": " + error.what()
+        + " (curl=" + std::to_string(error.curlCode())
+        + " http=" + std::to_string(error.httpStatus()) + ")";
+    controlPool()->submitDetached([this, message]() { fail(message); });
 }
 
 // ── checkCompletion ────────────────────────────────────────────
 
 void Task::checkCompletion()
 {
+    // Every block is done: flush the handle before size check and move
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closeSink();
+    }
+
     // Verify file size matches expected
     if (file_size_ > 0) {
         try {
@@ -566,7 +1100,7 @@ void Task::checkCompletion()
     }
 
     // Clean up meta file on successful completion
-    MetaFile::remove(meta_path_);
+    removeMeta();
 }
 
 // ── saveMeta ───────────────────────────────────────────────────
@@ -581,15 +1115,68 @@ void Task::saveMeta()
     meta.etag = etag_;
     meta.last_modified = last_modified_;
     meta.max_blocks = max_blocks_;
+    meta.priority = static_cast<int>(priority_.load());
+    meta.deadline = deadline_.load();
 
+    std::lock_guard<std::mutex> meta_lock(meta_mutex_);
+    if (meta_removed_) {
+        return;  // a checkpoint queued before the task finished
+    }
+    unsaved_bytes_.store(0);
+
+    int64_t claimed = 0;
+    int64_t on_disk = 0;
+    std::shared_ptr<FileSink> sink;
     {
         std::lock_guard<std::mutex> lock(mutex_);
+        if (chunks_) {
+            // Before the counters: every chunk done now is in what they claim
+            meta.chunk_size = chunks_->chunkSize();
+            meta.chunks = chunks_->bitmap();
+            on_disk = chunks_->doneBytes();
+        }
         for (const auto& block : blocks_) {
-            meta.blocks.push_back(block->getInfo());
+            // End-game racers are transient; their bytes are in the primary
+            if (!block->primary()) {
+                meta.blocks.push_back(block->getInfo());
+                claimed += meta.blocks.back().downloaded;
+            }
+        }
+        sink = sink_;
+        if (!chunks_) {
+            on_disk = claimed;  // unknown size: one block from offset 0
         }
     }
 
-    MetaFile::save(meta_path_, meta);
+    // Block counters only count bytes already written to the sink: syncing
+    // now makes every byte this snapshot claims durable. Not under mutex_,
+    // the transfers keep going meanwhile.
+    if (claimed > synced_bytes_.load()) {
+        if (!sink || !sink->sync()) {
+            Logger::instance().error("Task " + std::to_string(task_id_)
+                + " checkpoint skipped: could not sync " + file_path_);
+            return;
+        }
+        synced_bytes_.store(claimed);
+    }
+
+    if (!meta_writer_) {
+        meta_writer_ = std::make_unique<MetaWriter>(meta_path_);
+    }
+    if (meta_writer_->update(meta) && services_.journal && journal_key_ != 0) {
+        services_.journal->recordCheckpoint(journal_key_, meta_path_, file_name_,
+                                            file_size_, on_disk);
+    }
+}
+
+// ── removeMeta ─────────────────────────────────────────────────
+
+void Task::removeMeta()
+{
+    std::lock_guard<std::mutex> meta_lock(meta_mutex_);
+    meta_writer_.reset();  // unmapped first: Windows cannot delete a mapped file
+    meta_removed_ = true;
+    MetaFile::remove(meta_path_);
 }
 
 // ── getInfo ────────────────────────────────────────────────────
@@ -604,6 +1191,8 @@ TaskInfo Task::getInfo() const
     info.file_size = file_size_;
     info.state = state_.load();
     info.error_message = error_message_;
+    info.priority = getPriority();
+    info.deadline = getDeadline();
 
     if (progress_) {
         info.progress = progress_->snapshot();
@@ -617,6 +1206,58 @@ int Task::getId() const
     return task_id_;
 }
 
+// ── getState ───────────────────────────────────────────────────
+
+TaskState Task::getState() const
+{
+    return state_.load();
+}
+
+// ── priority / deadline ────────────────────────────────────────
+
+void Task::setPriority(TaskPriority priority, Deadline deadline)
+{
+    priority_.store(priority);
+    deadline_.store(deadline
+        ? std::max<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+              deadline->time_since_epoch()).count(), 1)
+        : 0);
+}
+
+TaskPriority Task::getPriority() const
+{
+    return priority_.load();
+}
+
+Deadline Task::getDeadline() const
+{
+    int64_t seconds = deadline_.load();
+    if (seconds == 0) {
+        return std::nullopt;
+    }
+    return std::chrono::system_clock::time_point(std::chrono::seconds(seconds));
+}
+
+// ── journal key ────────────────────────────────────────────────
+
+void Task::setJournalKey(uint64_t key)
+{
+    journal_key_ = key;
+}
+
+uint64_t Task::getJournalKey() const
+{
+    return journal_key_;
+}
+
+// ── setSpeedLimit ──────────────────────────────────────────────
+
+void Task::setSpeedLimit(int64_t bytes_per_sec, int weight)
+{
+    limiter_.setWeight(weight);
+    limiter_.setRate(std::max<int64_t>(bytes_per_sec, 0));
+}
+
 // ── setState ───────────────────────────────────────────────────
 
 void Task::setState(TaskState new_state)
@@ -624,11 +1265,23 @@ void Task::setState(TaskState new_state)
     TaskState old_state = state_.load();
     state_.store(new_state);
     // Only invoke callback if state actually changed
+    if (old_state != new_state) {
+        journalState(new_state);
+    }
     if (on_state_change_ && old_state != new_state) {
         on_state_change_(task_id_, new_state);
     }
 }
 
+// ── journalState ───────────────────────────────────────────────
+
+void Task::journalState(TaskState state)
+{
+    if (services_.journal && journal_key_ != 0) {
+        services_.journal->recordState(journal_key_, static_cast<int>(state));
+    }
+}
+
 // ── extractFileName ────────────────────────────────────────────
 
 std::string Task::extractFileName(const std::string& url)
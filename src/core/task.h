@@ -1,7 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <optional>
 #include <string>
 #include <vector>
+#include <map>
 #include <memory>
 #include <functional>
 #include <atomic>
@@ -11,6 +14,9 @@
 #include "http_engine.h"
 #include "progress_monitor.h"
 #include "meta_file.h"
+#include "file_sink.h"
+#include "token_bucket.h"
+#include "timer_wheel.h"
 
 enum class TaskState {
     Queued,       // 等待中
@@ -21,6 +27,17 @@ enum class TaskState {
     Cancelled     // 已取消
 };
 
+/// Scheduling class: the queue starts higher classes first and may pause
+/// a running task of a lower class to make room for a higher one.
+enum class TaskPriority {
+    Low,
+    Normal,
+    High,
+    Urgent
+};
+
+using Deadline = std::optional<std::chrono::system_clock::time_point>;
+
 struct TaskInfo {
     int task_id = 0;
     std::string url;
@@ -30,13 +47,42 @@ struct TaskInfo {
     TaskState state = TaskState::Queued;
     ProgressInfo progress;
     std::string error_message;  // populated when state == Failed
+    TaskPriority priority = TaskPriority::Normal;
+    Deadline deadline;          // earliest deadline first within a priority class
 };
 
 using TaskStateCallback = std::function<void(int task_id, TaskState state)>;
 
-class ThreadPool;
 class TokenBucket;
+
+/// Picks the limiter a task's own bucket hangs under (its host's, or the global one).
+using LimiterForUrl = std::function<TokenBucket*(const std::string& url)>;
+
+class ThreadPool;
 class FileClassifier;
+class MultiHttpEngine;
+class HttpShare;
+class BufferPool;
+class DiskWriter;
+class TaskJournal;
+struct JournalEntry;
+class ChunkMap;
+
+/// Process-wide services and I/O options shared by every Task (owned by
+/// DownloadManager). Pointers are non-owning; nullptr selects the fallback.
+struct TaskServices {
+    MultiHttpEngine* transfer_engine = nullptr;  // event-driven block transfers
+    HttpShare* http_share = nullptr;             // DNS / TLS session cache
+    BufferPool* buffer_pool = nullptr;           // write-coalescing buffers (nullptr: unbuffered)
+    DiskWriter* disk_writer = nullptr;           // asynchronous write stage (nullptr: write on the transfer thread)
+    TimerWheel* timers = nullptr;                // retry backoff (nullptr: the pool worker sleeps)
+    ThreadPool* control_pool = nullptr;          // HEAD probes, resume checks, completion (nullptr: the task's pool)
+    TaskJournal* journal = nullptr;              // task database (nullptr: the MetaFiles alone)
+    FileSinkBackend file_sink_backend = FileSinkBackend::Default;
+    PreallocationMode preallocation = PreallocationMode::Reserved;
+    std::chrono::seconds checkpoint_interval{0};  // MetaFile checkpoints while downloading (0: on pause only, needs timers)
+    int64_t checkpoint_bytes = 0;                 // also checkpoint after this many new bytes (0: off)
+};
 
 class Task {
 public:
@@ -51,14 +97,37 @@ public:
          const std::string& referer = "",
          const std::string& cookie = "");
 
+    ~Task();
+
     /// Restore a Task from a MetaFile (created in Paused state, ready to resume).
     static std::unique_ptr<Task> fromMeta(
+         int task_id,
          const std::string& meta_path,
          ThreadPool* pool,
-         TokenBucket* limiter,
+         const LimiterForUrl& limiter_for,
+         FileClassifier* classifier,
+         TaskStateCallback on_state_change);
+
+    /// Restore a Task from its TaskJournal entry alone (Paused): enough to
+    /// list it and show its progress. The rest of the MetaFile is read by
+    /// loadMeta(), at the latest on the first resume().
+    static std::unique_ptr<Task> fromJournal(
+         int task_id,
+         const JournalEntry& entry,
+         int max_blocks,
+         ThreadPool* pool,
+         const LimiterForUrl& limiter_for,
          FileClassifier* classifier,
          TaskStateCallback on_state_change);
 
+    /// Read what fromJournal() left out (validators, priority, block
+    /// count) from the MetaFile; once, later calls return the first
+    /// result. True for tasks not restored by fromJournal(). Thread-safe.
+    bool loadMeta();
+
+    /// Attach shared services. Must be called before start()/resume().
+    void setServices(const TaskServices& services);
+
     /// Start downloading (sends HEAD, allocates file, splits blocks, submits).
     void start();
 
@@ -77,28 +146,150 @@ public:
     /// Return the task ID.
     int getId() const;
 
+    /// Current state, without the snapshot getInfo() takes.
+    TaskState getState() const;
+
+    /// Scheduling class and optional deadline (whole seconds), kept in the
+    /// MetaFile. Only TaskQueue::setPriority() should change them once the
+    /// task is queued.
+    void setPriority(TaskPriority priority, Deadline deadline = std::nullopt);
+    TaskPriority getPriority() const;
+    Deadline getDeadline() const;
+
+    /// This task's key in services' TaskJournal (0: not journaled). Set
+    /// before start()/resume(); state changes and checkpoints go there.
+    void setJournalKey(uint64_t key);
+    uint64_t getJournalKey() const;
+
+    /// Cap this task's bandwidth (bytes/sec, 0 = only the limits above it
+    /// apply). weight is its share of its parent limiter against the other
+    /// busy tasks there.
+    void setSpeedLimit(int64_t bytes_per_sec, int weight = 1);
+
 private:
+    /// Pool job of start(): fetchFileInfoAndStart() with HEAD retries and
+    /// auto-retry on retryable errors.
+    void runStart();
+
+    /// Pool job of resume(): check the server file and resume or restart.
+    void runResume();
+
+    /// Pool job of a thread-pool mode block transfer; attempt counts the
+    /// retries so far.
+    void runBlock(Block* block, const HttpConfig& config, int attempt);
+
+    /// Executor for metadata work, kept apart from block transfers so
+    /// starting, resuming and finishing stay responsive under load.
+    ThreadPool* controlPool() const;
+
+    /// Run job on pool once delay has passed, through the timer wheel: no
+    /// thread sleeps meanwhile. Needs services_.timers.
+    void retryLater(std::chrono::seconds delay, ThreadPool* pool, std::function<void()> job);
+
+    /// Drop the retries (and the checkpoint) still waiting on the timer wheel.
+    void cancelRetries();
+
+    /// Queue the next periodic checkpoint services_.checkpoint_interval
+    /// from now, replacing the one pending. Needs services_.timers.
+    void scheduleCheckpoint();
+
+    /// Save a checkpoint on the control executor, unless one is queued.
+    void queueCheckpoint();
+
     /// Send HEAD request, get file info, allocate, split, submit.
     void fetchFileInfoAndStart();
 
     /// Pre-allocate file space on disk (Windows: SetFilePointerEx + SetEndOfFile).
     void allocateFile();
 
+    /// Take the fields of meta that are not progress. Caller holds
+    /// load_mutex_ or owns the only reference.
+    void applyMeta(const TaskMeta& meta);
+
     /// Create Block objects from the split result.
     void createBlocks();
 
-    /// Submit all blocks to the thread pool for execution.
+    /// The blocks of a previous run and what they write through. ~Block
+    /// waits for the reactor, which may itself be waiting for mutex_, so
+    /// blocks are detached under mutex_ and destroyed once it is released.
+    /// Members are destroyed bottom-up: the blocks first.
+    struct DetachedBlocks {
+        std::shared_ptr<FileSink> sink;
+        std::unique_ptr<ChunkMap> chunks;
+        std::vector<std::unique_ptr<HttpEngine>> engines;
+        std::vector<std::unique_ptr<Block>> blocks;
+    };
+
+    /// Move the blocks, their engines, the FileSink and the chunk map out
+    /// of the Task. Caller holds mutex_.
+    DetachedBlocks detachBlocksLocked();
+
+    /// Create one Block (and its HttpEngine in thread-pool mode). Opens the
+    /// shared FileSink on first use. With a primary, the block is an
+    /// end-game racer for it. Caller holds mutex_.
+    void addBlock(const BlockInfo& bi, Block* primary = nullptr);
+
+    /// Close the shared FileSink so the file can be moved or deleted. Caller holds mutex_.
+    void closeSink();
+
+    /// Submit all blocks to the transfer engine (or the thread pool).
     void submitBlocks();
 
+    /// Submit one block. Caller holds mutex_.
+    void submitBlock(Block* block, const HttpConfig& config);
+
+    /// HttpConfig for block transfers (browser Referer / Cookie, If-Range).
+    HttpConfig blockConfig() const;
+
+    /// Work stealing: when a block finishes early, split the largest
+    /// remaining range of a sibling and start a new block on its back half.
+    /// In the end-game (nothing left worth splitting and at most
+    /// kEndGameBytes left in the task) the idle connection races a
+    /// duplicate transfer for the largest remaining range instead.
+    /// Caller holds mutex_.
+    void stealWork();
+
+    /// End-game bookkeeping after a block completes: a race is over once
+    /// its range is filled; mark both sides completed and cancel the
+    /// loser's transfer. Caller holds mutex_.
+    void settleRaces();
+
     /// Called by each Block to report incremental progress.
     void onBlockProgress(int block_id, int64_t bytes_delta);
 
+    /// Called when an asynchronous block transfer ends.
+    void onBlockDone(int block_id, const HttpError* error);
+
+    /// Submit the block with block_id again (after a failed write); it
+    /// continues from the first byte not on disk.
+    void restartBlock(int block_id);
+
+    /// A block ended with an error no retry is left for: fail the task.
+    void onBlockFailed(int block_id, const HttpError& error);
+
+    /// Downloading -> Failed: stop the other blocks and save the MetaFile
+    /// like pause() does, so resume() continues from there.
+    void fail(const std::string& message);
+
+    /// pause() and fail(): stop every block, save the MetaFile and close
+    /// the file.
+    void stopTransfers();
+
     /// Check if all blocks are done; verify file size and classify.
     void checkCompletion();
 
-    /// Persist current state to MetaFile.
+    /// Run checkCompletion() on the control executor, once per start/resume.
+    void queueCompletion();
+
+    /// Persist current state to MetaFile. The file data the block counters
+    /// and the chunk map claim is synced first, so a checkpoint never
+    /// claims bytes a crash could still lose; if that fails the previous
+    /// checkpoint is kept.
     void saveMeta();
 
+    /// Delete the MetaFile for good (completed or cancelled).
+    void removeMeta();
+
     /// Extract file name from URL (last path segment).
     static std::string extractFileName(const std::string& url);
     static std::string parseContentDisposition(const std::string& header);
@@ -111,6 +302,11 @@ private:
     /// Set state and invoke callback.
     void setState(TaskState new_state);
 
+    /// Record state in the task journal. setState() does when the state
+    /// changes; the transitions made by a compare-exchange on state_
+    /// first must call it themselves.
+    void journalState(TaskState state);
+
     int task_id_;
     std::string url_;
     std::string save_dir_;
@@ -125,18 +321,42 @@ private:
 
     std::atomic<TaskState> state_{TaskState::Queued};
     mutable std::mutex mutex_;
+    TokenBucket limiter_;             // this task's node in the limiter tree (outlives blocks_)
+    std::shared_ptr<FileSink> sink_;  // one handle per task, shared by blocks_ (declared first: outlives them) and checkpoints
+    std::unique_ptr<ChunkMap> chunks_;  // what blocks_ wrote, chunk by chunk (outlives them); nullptr for an unknown size
     std::vector<std::unique_ptr<Block>> blocks_;
-    std::vector<std::unique_ptr<HttpEngine>> engines_;  // one HttpEngine per Block
+    std::vector<std::unique_ptr<HttpEngine>> engines_;  // one HttpEngine per Block (thread-pool mode)
     std::unique_ptr<ProgressMonitor> progress_;
-    std::atomic<int> completed_blocks_{0};
+    std::atomic<int> remaining_blocks_{0};  // incomplete non-racer blocks, counted down by the blocks
+    std::atomic<bool> completion_queued_{false};  // checkCompletion() submitted for this run
+    int next_block_id_ = 0;      // id for the next block created by stealWork()
 
     ThreadPool* pool_;           // non-owning
-    TokenBucket* limiter_;       // non-owning
     FileClassifier* classifier_; // non-owning
+    TaskServices services_;
     TaskStateCallback on_state_change_;
     std::string error_message_;  // last error description
     std::string referer_;        // Referer header from browser
     std::string cookie_;         // Cookie header from browser
+    std::atomic<TaskPriority> priority_{TaskPriority::Normal};
+    std::atomic<int64_t> deadline_{0};  // seconds since the Unix epoch, 0 = none
+    uint64_t journal_key_ = 0;   // see setJournalKey()
+    std::mutex load_mutex_;      // guards the two below
+    bool meta_pending_ = false;  // restored by fromJournal(), loadMeta() not yet run
+    bool meta_ok_ = true;        // result of loadMeta()
     int auto_retry_count_ = 0;
+    int head_attempt_ = 0;       // HEAD retries of the current start()/resume()
+    std::map<int, int> write_retries_;  // block_id -> restarts after failed writes (mutex_)
+    std::mutex retry_mutex_;     // guards retry_timers_
+    std::vector<TimerWheel::TimerId> retry_timers_;  // retries scheduled (possibly fired)
+    TimerWheel::TimerId checkpoint_timer_ = 0;       // next periodic checkpoint (retry_mutex_)
+    std::atomic<bool> checkpoint_queued_{false};     // a checkpoint job is on the control executor
+    std::atomic<int64_t> unsaved_bytes_{0};          // progress since the last checkpoint
+    std::mutex meta_mutex_;                          // serializes saveMeta(), guards the two below
+    std::unique_ptr<MetaWriter> meta_writer_;        // keeps the MetaFile mapped between checkpoints
+    bool meta_removed_ = false;
+    std::atomic<int64_t> synced_bytes_{0};           // bytes the MetaFile claims, known durable
     static constexpr int kMaxAutoRetries = 3;
+    static constexpr int64_t kMinSplitBytes = 1024 * 1024;  // smallest half stealWork() creates
+    static constexpr int64_t kEndGameBytes = 4 * 1024 * 1024; // task bytes left before racing starts
 };
@@ -0,0 +1,464 @@
+#include "task_journal.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Record: [uint32 payload size][uint32 FNV-1a of the payload][payload]
+// payload: [uint8 type][uint64 key][fields of the type]; strings are a
+// uint32 length and the bytes. Native byte order, like the MetaFile.
+
+/// Compact once the file holds this many records and mostly superseded ones.
+constexpr size_t kCompactMinRecords = 4096;
+
+/// Upper bound of a sane record, against a corrupt size field.
+constexpr uint32_t kMaxRecordSize = 1 << 20;
+
+uint32_t fnv1a(const char* data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+void put(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, const std::string& str)
+{
+    put(out, static_cast<uint32_t>(str.size()));
+    out += str;
+}
+
+/// Bounds-checked reads from a record payload.
+struct Reader {
+    const char* pos;
+    const char* end;
+
+    template <typename T>
+    bool get(T& value)
+    {
+        if (static_cast<size_t>(end - pos) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string& str)
+    {
+        uint32_t size = 0;
+        if (!get(size) || static_cast<size_t>(end - pos) < size) {
+            return false;
+        }
+        str.assign(pos, size);
+        pos += size;
+        return true;
+    }
+};
+
+/// Flush f to stable storage.
+bool syncFile(std::FILE* f)
+{
+    if (std::fflush(f) != 0) {
+        return false;
+    }
+#ifdef _WIN32
+    return ::_commit(::_fileno(f)) == 0;
+#else
+    return ::fsync(::fileno(f)) == 0;
+#endif
+}
+
+/// Make a rename in path's directory durable (no-op on Windows).
+void syncDirectoryOf(const std::string& path)
+{
+#ifndef _WIN32
+    std::string dir = fs::path(path).parent_path().string();
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+#else
+    (void)path;
+#endif
+}
+
+} // anonymous namespace
+
+// ── Constructor / destructor ───────────────────────────────────
+
+TaskJournal::TaskJournal(std::string path, ThreadPool* compactor)
+    : path_(std::move(path))
+    , compactor_(compactor)
+{
+    std::error_code ec;
+    fs::path dir = fs::path(path_).parent_path();
+    if (!dir.empty()) {
+        fs::create_directories(dir, ec);
+    }
+    created_ = !fs::exists(path_, ec);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    replayLocked();
+    file_ = std::fopen(path_.c_str(), "ab");
+    if (!file_) {
+        throw std::runtime_error("TaskJournal: cannot open " + path_);
+    }
+}
+
+TaskJournal::~TaskJournal()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobs_done_.wait(lock, [this] { return pending_jobs_ == 0; });
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+// ── Queries ────────────────────────────────────────────────────
+
+std::vector<JournalEntry> TaskJournal::entries() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<JournalEntry> result;
+    result.reserve(entries_.size());
+    for (const auto& [key, entry] : entries_) {
+        result.push_back(entry);
+    }
+    return result;
+}
+
+size_t TaskJournal::records() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_;
+}
+
+// ── Records ────────────────────────────────────────────────────
+
+uint64_t TaskJournal::recordAdded(const std::string& url, const std::string& save_dir)
+{
+    JournalEntry data;
+    data.url = url;
+    data.save_dir = save_dir;
+    bool compact = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        data.key = next_key_;
+        compact = appendLocked(RecordType::Added, data, false);
+    }
+    if (compact) {
+        scheduleCompaction();
+    }
+    return data.key;
+}
+
+void TaskJournal::recordState(uint64_t key, int state)
+{
+    JournalEntry data;
+    data.key = key;
+    data.state = state;
+    bool compact = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compact = appendLocked(RecordType::State, data, false);
+    }
+    if (compact) {
+        scheduleCompaction();
+    }
+}
+
+void TaskJournal::recordCheckpoint(uint64_t key, const std::string& meta_path,
+                                   const std::string& file_name, int64_t file_size,
+                                   int64_t downloaded)
+{
+    JournalEntry data;
+    data.key = key;
+    data.meta_path = meta_path;
+    data.file_name = file_name;
+    data.file_size = file_size;
+    data.downloaded = downloaded;
+    bool compact = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        bool new_path = it != entries_.end() && it->second.meta_path != meta_path;
+        compact = appendLocked(RecordType::Checkpoint, data, new_path);
+    }
+    if (compact) {
+        scheduleCompaction();
+    }
+}
+
+void TaskJournal::recordRemoved(uint64_t key)
+{
+    JournalEntry data;
+    data.key = key;
+    bool compact = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        compact = appendLocked(RecordType::Removed, data, true);
+    }
+    if (compact) {
+        scheduleCompaction();
+    }
+}
+
+// ── Encoding / replay (private) ────────────────────────────────
+
+void TaskJournal::encodeRecord(RecordType type, const JournalEntry& data, std::string& out)
+{
+    std::string payload;
+    put(payload, static_cast<uint8_t>(type));
+    put(payload, data.key);
+    switch (type) {
+        case RecordType::Added:
+            putString(payload, data.url);
+            putString(payload, data.save_dir);
+            break;
+        case RecordType::State:
+            put(payload, static_cast<int32_t>(data.state));
+            break;
+        case RecordType::Checkpoint:
+            putString(payload, data.meta_path);
+            putString(payload, data.file_name);
+            put(payload, data.file_size);
+            put(payload, data.downloaded);
+            break;
+        default:
+            break;
+    }
+    put(out, static_cast<uint32_t>(payload.size()));
+    put(out, fnv1a(payload.data(), payload.size()));
+    out += payload;
+}
+
+size_t TaskJournal::encodeEntry(const JournalEntry& entry, std::string& out)
+{
+    encodeRecord(RecordType::Added, entry, out);
+    size_t count = 1;
+    if (!entry.meta_path.empty()) {
+        encodeRecord(RecordType::Checkpoint, entry, out);
+        ++count;
+    }
+    if (entry.state != 0) {
+        encodeRecord(RecordType::State, entry, out);
+        ++count;
+    }
+    return count;
+}
+
+void TaskJournal::applyLocked(RecordType type, uint64_t key, const JournalEntry& data)
+{
+    if (type == RecordType::Added) {
+        JournalEntry& entry = entries_[key];
+        entry = data;
+        entry.key = key;
+        next_key_ = std::max(next_key_, key + 1);
+        return;
+    }
+
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+        return;
+    }
+    switch (type) {
+        case RecordType::State:
+            it->second.state = data.state;
+            break;
+        case RecordType::Checkpoint:
+            it->second.meta_path = data.meta_path;
+            it->second.file_name = data.file_name;
+            it->second.file_size = data.file_size;
+            it->second.downloaded = data.downloaded;
+            break;
+        case RecordType::Removed:
+            entries_.erase(it);
+            break;
+        default:
+            break;
+    }
+}
+
+void TaskJournal::replayLocked()
+{
+    // One sequential read of the whole file
+    std::string data;
+    if (std::FILE* in = std::fopen(path_.c_str(), "rb")) {
+        char buf[64 * 1024];
+        size_t n;
+        while ((n = std::fread(buf, 1, sizeof(buf), in)) > 0) {
+            data.append(buf, n);
+        }
+        std::fclose(in);
+    }
+
+    size_t pos = 0;
+    while (data.size() - pos >= 2 * sizeof(uint32_t)) {
+        uint32_t size = 0;
+        uint32_t hash = 0;
+        std::memcpy(&size, data.data() + pos, sizeof(size));
+        std::memcpy(&hash, data.data() + pos + sizeof(size), sizeof(hash));
+        const char* payload = data.data() + pos + 2 * sizeof(uint32_t);
+        if (size > kMaxRecordSize || data.size() - pos - 2 * sizeof(uint32_t) < size
+            || fnv1a(payload, size) != hash) {
+            break;  // torn by a crash
+        }
+
+        Reader reader{payload, payload + size};
+        uint8_t type = 0;
+        JournalEntry entry;
+        bool ok = reader.get(type) && reader.get(entry.key);
+        int32_t state = 0;
+        switch (static_cast<RecordType>(type)) {
+            case RecordType::Added:
+                ok = ok && reader.getString(entry.url) && reader.getString(entry.save_dir);
+                break;
+            case RecordType::State:
+                ok = ok && reader.get(state);
+                entry.state = state;
+                break;
+            case RecordType::Checkpoint:
+                ok = ok && reader.getString(entry.meta_path) && reader.getString(entry.file_name)
+                    && reader.get(entry.file_size) && reader.get(entry.downloaded);
+                break;
+            case RecordType::Removed:
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            break;
+        }
+        applyLocked(static_cast<RecordType>(type), entry.key, entry);
+        ++records_;
+        pos += 2 * sizeof(uint32_t) + size;
+    }
+
+    if (pos < data.size()) {
+        // Appends must follow the last good record
+        std::error_code ec;
+        fs::resize_file(path_, pos, ec);
+    }
+}
+
+bool TaskJournal::appendLocked(RecordType type, const JournalEntry& data, bool sync)
+{
+    std::string record;
+    encodeRecord(type, data, record);
+    if (file_) {
+        std::fwrite(record.data(), 1, record.size(), file_);
+        if (sync) {
+            syncFile(file_);
+        } else {
+            std::fflush(file_);
+        }
+    }
+    if (compacting_) {
+        tail_ += record;
+        ++tail_records_;
+    }
+    ++records_;
+    applyLocked(type, data.key, data);
+
+    return !compacting_ && records_ >= kCompactMinRecords
+        && records_ > 4 * entries_.size() + kCompactMinRecords / 2;
+}
+
+// ── Compaction ─────────────────────────────────────────────────
+
+void TaskJournal::scheduleCompaction()
+{
+    if (!compactor_) {
+        compact();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++pending_jobs_;
+    }
+    try {
+        compactor_->submitDetached([this]() {
+            compact();
+            std::lock_guard<std::mutex> lock(mutex_);
+            --pending_jobs_;
+            jobs_done_.notify_all();
+        });
+    } catch (const std::exception&) {
+        // The compactor is shutting down: compact here instead
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --pending_jobs_;
+        }
+        compact();
+    }
+}
+
+void TaskJournal::compact()
+{
+    std::string snapshot;
+    size_t snapshot_records = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (compacting_) {
+            return;  // one at a time
+        }
+        compacting_ = true;
+        tail_.clear();
+        tail_records_ = 0;
+        for (const auto& [key, entry] : entries_) {
+            snapshot_records += encodeEntry(entry, snapshot);
+        }
+    }
+
+    // The bulk is written without blocking appends; they land in tail_ too
+    std::string tmp_path = path_ + ".tmp";
+    std::FILE* out = std::fopen(tmp_path.c_str(), "wb");
+    bool ok = out && std::fwrite(snapshot.data(), 1, snapshot.size(), out) == snapshot.size();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    compacting_ = false;
+    ok = ok && std::fwrite(tail_.data(), 1, tail_.size(), out) == tail_.size()
+        && syncFile(out);
+    if (out) {
+        ok = std::fclose(out) == 0 && ok;
+    }
+    if (ok) {
+        std::fclose(file_);
+        std::error_code ec;
+        fs::rename(tmp_path, path_, ec);
+        ok = !ec;
+        if (ok) {
+            syncDirectoryOf(path_);
+            records_ = snapshot_records + tail_records_;
+        }
+        file_ = std::fopen(path_.c_str(), "ab");
+    }
+    if (!ok) {
+        std::remove(tmp_path.c_str());
+    }
+    tail_.clear();
+    tail_records_ = 0;
+}
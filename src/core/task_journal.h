@@ -0,0 +1,110 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+/// One task as the journal last recorded it.
+struct JournalEntry {
+    uint64_t key = 0;           // stable across restarts (task ids are not)
+    std::string url;
+    std::string save_dir;
+    std::string meta_path;      // empty until the first checkpoint
+    std::string file_name;
+    int64_t file_size = 0;
+    int64_t downloaded = 0;     // at the last checkpoint
+    int state = 0;              // TaskState
+};
+
+/// The task database: one append-only file of records (task added, state
+/// changed, checkpoint, removed), wherever the downloads themselves are
+/// saved. Opening it replays the file in one sequential read; a record
+/// cut short by a crash ends the replay and is cut off. Once most records
+/// are superseded, the file is rewritten with the live entries only, on
+/// the compactor pool while appends go on. Thread-safe.
+class TaskJournal {
+public:
+    /// Open (creating if missing) the journal at path and replay it.
+    /// compactor runs compactions (nullptr: inline, on the appending
+    /// thread) and must outlive the journal's use. Throws
+    /// std::runtime_error if the file cannot be opened.
+    explicit TaskJournal(std::string path, ThreadPool* compactor = nullptr);
+    ~TaskJournal();
+
+    TaskJournal(const TaskJournal&) = delete;
+    TaskJournal& operator=(const TaskJournal&) = delete;
+
+    /// Entries not removed, in the order they were added.
+    std::vector<JournalEntry> entries() const;
+
+    /// Whether the file did not exist before this open.
+    bool created() const { return created_; }
+
+    /// Record a new task; returns its key. Not synced: until its first
+    /// checkpoint a task has no progress to lose.
+    uint64_t recordAdded(const std::string& url, const std::string& save_dir);
+
+    /// Record a state change (TaskState). Not synced: the MetaFile has it too.
+    void recordState(uint64_t key, int state);
+
+    /// Record a checkpoint. Synced when it names a new meta_path (the task
+    /// could not be found again otherwise).
+    void recordCheckpoint(uint64_t key, const std::string& meta_path,
+                          const std::string& file_name, int64_t file_size, int64_t downloaded);
+
+    /// Forget a task. Synced.
+    void recordRemoved(uint64_t key);
+
+    /// Rewrite the file with the live entries only.
+    void compact();
+
+    /// Records in the file (for tests and statistics).
+    size_t records() const;
+
+private:
+    enum class RecordType : uint8_t {
+        Added = 1,
+        State = 2,
+        Checkpoint = 3,
+        Removed = 4
+    };
+
+    /// Apply one decoded record to entries_. Caller holds mutex_.
+    void applyLocked(RecordType type, uint64_t key, const JournalEntry& data);
+
+    /// Replay the file; cut off a torn tail. Caller holds mutex_.
+    void replayLocked();
+
+    /// Append one record (to tail_ as well while a compaction runs) and
+    /// apply it. Returns whether a compaction is due. Caller holds mutex_.
+    bool appendLocked(RecordType type, const JournalEntry& data, bool sync);
+
+    /// Run compact() on the compactor, or here without one.
+    void scheduleCompaction();
+
+    static void encodeRecord(RecordType type, const JournalEntry& data, std::string& out);
+
+    /// Append the records describing entry (added, checkpoint, state) to
+    /// out; returns how many.
+    static size_t encodeEntry(const JournalEntry& entry, std::string& out);
+
+    const std::string path_;
+    ThreadPool* const compactor_;  // non-owning, may be nullptr
+    bool created_ = false;
+
+    mutable std::mutex mutex_;
+    std::FILE* file_ = nullptr;                // append handle (mutex_)
+    std::map<uint64_t, JournalEntry> entries_; // by key, i.e. in order added (mutex_)
+    uint64_t next_key_ = 1;
+    size_t records_ = 0;                       // records in the file (mutex_)
+    bool compacting_ = false;                  // (mutex_)
+    std::string tail_;                         // records appended during a compaction (mutex_)
+    size_t tail_records_ = 0;                  // (mutex_)
+    int pending_jobs_ = 0;                     // compactor jobs not yet returned (mutex_)
+    std::condition_variable jobs_done_;
+};
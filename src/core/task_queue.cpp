@@ -1,6 +1,7 @@
 #include "task_queue.h"
 
 #include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 // ── Constructor ────────────────────────────────────────────────
@@ -10,6 +11,8 @@ TaskQueue::TaskQueue(int max_concurrent)
 {
 }
 
+TaskQueue::~TaskQueue() = default;
+
 // ── addTask ────────────────────────────────────────────────────
 
 void TaskQueue::addTask(std::shared_ptr<Task> task)
@@ -18,46 +21,67 @@ void TaskQueue::addTask(std::shared_ptr<Task> task)
         return;
     }
 
-    std::lock_guard<std::mutex> lock(mutex_);
-    tasks_.push_back(std::move(task));
-    tryStartNext();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& slot = index_[task->getId()];
+        if (slot) {
+            return;  // already queued
+        }
+        slot = std::make_unique<Node>();
+        Node* node = slot.get();
+        node->task = std::move(task);
+        node->seq = next_seq_++;
+        node->priority = node->task->getPriority();
+        node->deadline = node->task->getDeadline();
+
+        node->prev = tail_;
+        (tail_ ? tail_->next : head_) = node;
+        tail_ = node;
+
+        // Only tasks waiting in Queued state are started by the queue (a task
+        // recovered from its MetaFile is Paused until the user resumes it)
+        if (node->task->getState() == TaskState::Queued) {
+            linkReadyLocked(node);
+        }
+
+        tryStartNext();
+    }
+    pausePreempted();
 }
 
 // ── removeTask ─────────────────────────────────────────────────
 
-bool TaskQueue::removeTask(int task_id)
+bool TaskQueue::removeTask(int task_id, bool cancel)
 {
     std::shared_ptr<Task> task;
-    bool was_active = false;
 
     {
         std::lock_guard<std::mutex> lock(mutex_);
 
-        auto it = std::find_if(tasks_.begin(), tasks_.end(),
-            [task_id](const std::shared_ptr<Task>& t) {
-                return t->getId() == task_id;
-            });
-
-        if (it == tasks_.end()) {
+        auto it = index_.find(task_id);
+        if (it == index_.end()) {
             return false;
         }
 
-        task = *it;
-        TaskState state = task->getInfo().state;
-        was_active = (state == TaskState::Downloading);
-
-        if (was_active) {
-            --active_count_;
+        Node* node = it->second.get();
+        task = std::move(node->task);
+        if (node->active) {
+            deactivateLocked(node);
         }
-
-        tasks_.erase(it);
+        if (node->ready) {
+            unlinkReadyLocked(node);
+        }
+        (node->prev ? node->prev->next : head_) = node->next;
+        (node->next ? node->next->prev : tail_) = node->prev;
+        index_.erase(it);
 
         // Start next queued task if a slot opened up
         tryStartNext();
     }
+    pausePreempted();
 
     // Cancel OUTSIDE the lock to avoid deadlock with onTaskFinished callback
-    if (task) {
+    if (task && cancel) {
         task->cancel();
     }
 
@@ -70,16 +94,12 @@ bool TaskQueue::moveUp(int task_id)
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto it = std::find_if(tasks_.begin(), tasks_.end(),
-        [task_id](const std::shared_ptr<Task>& t) {
-            return t->getId() == task_id;
-        });
-
-    if (it == tasks_.end() || it == tasks_.begin()) {
+    Node* node = findLocked(task_id);
+    if (!node || !node->prev) {
         return false;
     }
 
-    std::iter_swap(it, it - 1);
+    swapWithNextLocked(node->prev);
     return true;
 }
 
@@ -89,16 +109,41 @@ bool TaskQueue::moveDown(int task_id)
 {
     std::lock_guard<std::mutex> lock(mutex_);
 
-    auto it = std::find_if(tasks_.begin(), tasks_.end(),
-        [task_id](const std::shared_ptr<Task>& t) {
-            return t->getId() == task_id;
-        });
-
-    if (it == tasks_.end() || it + 1 == tasks_.end()) {
+    Node* node = findLocked(task_id);
+    if (!node || !node->next) {
         return false;
     }
 
-    std::iter_swap(it, it + 1);
+    swapWithNextLocked(node);
+    return true;
+}
+
+// ── setPriority ────────────────────────────────────────────────
+
+bool TaskQueue::setPriority(int task_id, TaskPriority priority, Deadline deadline)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Node* node = findLocked(task_id);
+        if (!node) {
+            return false;
+        }
+
+        bool ready = node->ready;
+        if (ready) {
+            unlinkReadyLocked(node);
+        }
+        node->task->setPriority(priority, deadline);
+        node->priority = node->task->getPriority();
+        node->deadline = node->task->getDeadline();  // as stored: whole seconds
+        if (ready) {
+            linkReadyLocked(node);
+        }
+
+        tryStartNext();
+    }
+    pausePreempted();
     return true;
 }
 
@@ -106,24 +151,26 @@ bool TaskQueue::moveDown(int task_id)
 
 void TaskQueue::onTaskFinished(int task_id)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
 
-    // Only decrement if the task is still in our queue.
-    // If removeTask already erased it, we must not double-decrement.
-    auto it = std::find_if(tasks_.begin(), tasks_.end(),
-        [task_id](const std::shared_ptr<Task>& t) {
-            return t->getId() == task_id;
-        });
+        // Only release a slot the task still holds: if removeTask already
+        // erased it, we must not double-decrement.
+        Node* node = findLocked(task_id);
+        if (!node) {
+            return;  // already removed by removeTask
+        }
 
-    if (it == tasks_.end()) {
-        return;  // already removed by removeTask
-    }
+        if (node->ready) {
+            unlinkReadyLocked(node);  // finished (cancelled) before it was started
+        }
+        if (node->active) {
+            deactivateLocked(node);
+        }
 
-    if (active_count_ > 0) {
-        --active_count_;
+        tryStartNext();
     }
-
-    tryStartNext();
+    pausePreempted();
 }
 
 // ── getAllTaskInfo ──────────────────────────────────────────────
@@ -133,9 +180,9 @@ std::vector<TaskInfo> TaskQueue::getAllTaskInfo() const
     std::lock_guard<std::mutex> lock(mutex_);
 
     std::vector<TaskInfo> infos;
-    infos.reserve(tasks_.size());
-    for (const auto& task : tasks_) {
-        infos.push_back(task->getInfo());
+    infos.reserve(index_.size());
+    for (const Node* node = head_; node; node = node->next) {
+        infos.push_back(node->task->getInfo());
     }
     return infos;
 }
@@ -144,9 +191,12 @@ std::vector<TaskInfo> TaskQueue::getAllTaskInfo() const
 
 void TaskQueue::setMaxConcurrent(int max)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    max_concurrent_ = std::clamp(max, 1, 10);
-    tryStartNext();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_concurrent_ = std::clamp(max, 1, 10);
+        tryStartNext();
+    }
+    pausePreempted();
 }
 
 // ── getMaxConcurrent ───────────────────────────────────────────
@@ -162,7 +212,7 @@ int TaskQueue::getMaxConcurrent() const
 size_t TaskQueue::size() const
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    return tasks_.size();
+    return index_.size();
 }
 
 // ── setAutoStart ───────────────────────────────────────────────
@@ -173,21 +223,206 @@ void TaskQueue::setAutoStart(bool enabled)
     auto_start_ = enabled;
 }
 
+// ── setPreemption ──────────────────────────────────────────────
+
+void TaskQueue::setPreemption(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    preemption_ = enabled;
+}
+
+// ── List helpers (private, must be called with mutex held) ─────
+
+TaskQueue::Node* TaskQueue::findLocked(int task_id) const
+{
+    auto it = index_.find(task_id);
+    return it == index_.end() ? nullptr : it->second.get();
+}
+
+TaskQueue::DeadlineKey TaskQueue::deadlineKey(const Node* node)
+{
+    int64_t deadline = node->deadline
+        ? std::chrono::duration_cast<std::chrono::seconds>(
+              node->deadline->time_since_epoch()).count()
+        : std::numeric_limits<int64_t>::max();
+    return {deadline, node->seq};
+}
+
+void TaskQueue::linkReadyLocked(Node* node)
+{
+    ClassQueue& cls = classes_[static_cast<size_t>(node->priority)];
+    node->ready = true;
+
+    if (node->deadline) {
+        cls.by_deadline.emplace(deadlineKey(node), node);
+        return;
+    }
+
+    // The last task in the queue goes to the tail; anything else (a moved,
+    // re-prioritised or preempted task) after its nearest list predecessor
+    Node* before = nullptr;
+    if (!node->next) {
+        before = cls.tail;
+    } else {
+        before = node->prev;
+        while (before && !(before->ready && !before->deadline
+                           && before->priority == node->priority)) {
+            before = before->prev;
+        }
+    }
+
+    node->ready_prev = before;
+    node->ready_next = before ? before->ready_next : cls.head;
+    (node->ready_next ? node->ready_next->ready_prev : cls.tail) = node;
+    (before ? before->ready_next : cls.head) = node;
+}
+
+void TaskQueue::unlinkReadyLocked(Node* node)
+{
+    ClassQueue& cls = classes_[static_cast<size_t>(node->priority)];
+    node->ready = false;
+
+    if (node->deadline) {
+        cls.by_deadline.erase(deadlineKey(node));
+        return;
+    }
+
+    (node->ready_prev ? node->ready_prev->ready_next : cls.head) = node->ready_next;
+    (node->ready_next ? node->ready_next->ready_prev : cls.tail) = node->ready_prev;
+    node->ready_prev = node->ready_next = nullptr;
+}
+
+void TaskQueue::swapWithNextLocked(Node* node)
+{
+    Node* other = node->next;
+
+    // Queue order: prev, node, other, next  ->  prev, other, node, next
+    Node* prev = node->prev;
+    Node* next = other->next;
+    (prev ? prev->next : head_) = other;
+    other->prev = prev;
+    other->next = node;
+    node->prev = other;
+    node->next = next;
+    (next ? next->prev : tail_) = node;
+
+    // Only a swap of two neighbours waiting in the same ready list changes
+    // the start order (they are adjacent in that list too); deadlines and
+    // classes rank the rest regardless of queue position
+    if (node->ready && other->ready && !node->deadline && !other->deadline
+        && node->priority == other->priority) {
+        unlinkReadyLocked(node);
+        linkReadyLocked(node);  // right after other, its nearest list predecessor
+    }
+}
+
+TaskQueue::Node* TaskQueue::nextReadyLocked() const
+{
+    for (size_t c = kClasses; c-- > 0;) {
+        const ClassQueue& cls = classes_[c];
+        if (!cls.by_deadline.empty()) {
+            return cls.by_deadline.begin()->second;  // earliest deadline first
+        }
+        if (cls.head) {
+            return cls.head;
+        }
+    }
+    return nullptr;
+}
+
+// ── Slots (private, must be called with mutex held) ────────────
+
+bool TaskQueue::preemptForLocked(const Node* waiting)
+{
+    Node* victim = nullptr;
+    for (Node* node : active_) {
+        // Only a transfer in progress can be paused and resumed
+        if (node->priority >= waiting->priority
+            || node->task->getState() != TaskState::Downloading) {
+            continue;
+        }
+        if (!victim
+            || node->priority < victim->priority
+            || (node->priority == victim->priority
+                && (deadlineKey(node).first > deadlineKey(victim).first
+                    || (deadlineKey(node).first == deadlineKey(victim).first
+                        && node->started > victim->started)))) {
+            victim = node;
+        }
+    }
+    if (!victim) {
+        return false;
+    }
+
+    deactivateLocked(victim);
+    to_pause_.push_back(victim->task);
+    return true;
+}
+
+void TaskQueue::deactivateLocked(Node* node)
+{
+    node->active = false;
+    active_.erase(std::find(active_.begin(), active_.end(), node));
+}
+
 // ── tryStartNext (private, must be called with mutex held) ─────
 
 void TaskQueue::tryStartNext()
 {
     if (!auto_start_) return;
 
-    for (auto& task : tasks_) {
-        if (active_count_ >= max_concurrent_) {
+    while (Node* node = nextReadyLocked()) {
+        if (static_cast<int>(active_.size()) >= max_concurrent_
+            && !(preemption_ && preemptForLocked(node))) {
             break;
         }
 
-        TaskInfo info = task->getInfo();
-        if (info.state == TaskState::Queued) {
-            task->start();
-            ++active_count_;
+        unlinkReadyLocked(node);
+        bool preempted = node->preempted;
+        node->preempted = false;
+
+        TaskState state = node->task->getState();
+        if (state == TaskState::Queued) {
+            node->task->start();
+        } else if (preempted && state == TaskState::Paused) {
+            node->task->resume();
+        } else {
+            continue;  // started, paused or finished by someone else meanwhile
         }
+        node->active = true;
+        node->started = ++next_start_;
+        active_.push_back(node);
+    }
+}
+
+// ── pausePreempted (private, must be called without mutex) ─────
+
+void TaskQueue::pausePreempted()
+{
+    for (;;) {
+        std::vector<std::shared_ptr<Task>> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            victims.swap(to_pause_);
+        }
+        if (victims.empty()) {
+            return;
+        }
+
+        for (auto& task : victims) {
+            task->pause();  // saves the MetaFile
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& task : victims) {
+            Node* node = findLocked(task->getId());
+            if (node && !node->ready && !node->active
+                && task->getState() == TaskState::Paused) {
+                node->preempted = true;
+                linkReadyLocked(node);
+            }
+        }
+        // A slot may have freed while pausing
+        tryStartNext();
     }
 }
@@ -1,20 +1,39 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <mutex>
 #include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <utility>
 #include "task.h"
 
+/// Download order and admission. Tasks sit in an intrusive doubly-linked
+/// list in queue order, found through an id index. The ones waiting to be
+/// started are also kept per priority class: those with a deadline in a
+/// map ordered by deadline, the rest in a ready list in queue order. The
+/// next task to start is the one of the highest class, earliest deadline
+/// first, then in queue order. Adding, moving, finishing and starting are
+/// O(1) (O(log n) with deadlines); getAllTaskInfo() is O(n). Putting a
+/// task without a deadline back in the middle of its ready list (after
+/// setPriority() or a preemption) walks the queue back to its nearest
+/// waiting predecessor: O(n) at worst.
 class TaskQueue {
 public:
     explicit TaskQueue(int max_concurrent);
+    ~TaskQueue();
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
 
     /// Append task to end of queue; start immediately if slots available.
     void addTask(std::shared_ptr<Task> task);
 
-    /// Remove task by id, cancel it, return true if found.
-    bool removeTask(int task_id);
+    /// Remove task by id, cancel it (unless cancel is false: its files
+    /// are left alone), return true if found.
+    bool removeTask(int task_id, bool cancel = true);
 
     /// Move task one position up (toward front). Returns false if not found or already first.
     bool moveUp(int task_id);
@@ -22,6 +41,10 @@ public:
     /// Move task one position down (toward back). Returns false if not found or already last.
     bool moveDown(int task_id);
 
+    /// Change a task's priority class and deadline; a waiting task is
+    /// rescheduled accordingly. Returns false if not found.
+    bool setPriority(int task_id, TaskPriority priority, Deadline deadline = std::nullopt);
+
     /// Called when a task finishes (Completed/Cancelled/Failed). Decrements active count and starts next.
     void onTaskFinished(int task_id);
 
@@ -40,13 +63,86 @@ public:
     /// Disable auto-start of queued tasks (useful for testing).
     void setAutoStart(bool enabled);
 
+    /// When every slot is taken, let a waiting task pause a running task of
+    /// a lower class (Task::pause() saves its MetaFile). The paused task
+    /// waits in its class again and is resumed when a slot frees. Off by
+    /// default.
+    void setPreemption(bool enabled);
+
 private:
-    /// Start next queued task(s) if active_count_ < max_concurrent_.
+    static constexpr size_t kClasses = static_cast<size_t>(TaskPriority::Urgent) + 1;
+
+    using DeadlineKey = std::pair<int64_t, uint64_t>;  // deadline, then queue sequence
+
+    struct Node {
+        std::shared_ptr<Task> task;
+        Node* prev = nullptr;        // queue order
+        Node* next = nullptr;
+        Node* ready_prev = nullptr;  // ready list of its class, valid while in it
+        Node* ready_next = nullptr;
+        TaskPriority priority = TaskPriority::Normal;
+        Deadline deadline;
+        uint64_t seq = 0;            // order of arrival, ties deadlines
+        uint64_t started = 0;        // order of the last start by the queue
+        bool ready = false;          // waiting to be started by the queue
+        bool active = false;         // started by the queue, holds a slot
+        bool preempted = false;      // paused by the queue: resume, not start
+    };
+
+    struct ClassQueue {
+        Node* head = nullptr;        // ready list, queue order
+        Node* tail = nullptr;
+        std::map<DeadlineKey, Node*> by_deadline;
+    };
+
+    /// The node of task_id, or nullptr. Caller holds mutex_.
+    Node* findLocked(int task_id) const;
+
+    static DeadlineKey deadlineKey(const Node* node);
+
+    /// Make node wait in its class: by deadline, or in the ready list after
+    /// the nearest waiting node of the same list before it in queue order
+    /// (at the tail when node is last). Finding that predecessor is O(n)
+    /// at worst, O(1) for the last node and after swapWithNextLocked().
+    /// Caller holds mutex_.
+    void linkReadyLocked(Node* node);
+
+    /// Caller holds mutex_.
+    void unlinkReadyLocked(Node* node);
+
+    /// Swap node with its successor in the queue order (and the ready list
+    /// if both wait in the same one). Caller holds mutex_.
+    void swapWithNextLocked(Node* node);
+
+    /// The waiting task to start next, or nullptr. Caller holds mutex_.
+    Node* nextReadyLocked() const;
+
+    /// Free a slot for waiting by picking a running task of a lower class
+    /// to pause (lowest class, then latest deadline, then most recently
+    /// started). Returns false if there is none. Caller holds mutex_.
+    bool preemptForLocked(const Node* waiting);
+
+    /// Release node's slot. Caller holds mutex_.
+    void deactivateLocked(Node* node);
+
+    /// Start next queued task(s) while fewer than max_concurrent_ hold a slot.
     void tryStartNext();
 
+    /// Pause the tasks tryStartNext() preempted (outside mutex_: pausing
+    /// flushes and writes the MetaFile), then queue them again. Call after
+    /// releasing mutex_ whenever tryStartNext() may have run.
+    void pausePreempted();
+
     mutable std::mutex mutex_;
-    std::vector<std::shared_ptr<Task>> tasks_;
+    std::unordered_map<int, std::unique_ptr<Node>> index_;
+    Node* head_ = nullptr;
+    Node* tail_ = nullptr;
+    std::array<ClassQueue, kClasses> classes_;
+    std::vector<Node*> active_;                   // nodes holding a slot (at most 10)
+    std::vector<std::shared_ptr<Task>> to_pause_; // preempted, pause pending
+    uint64_t next_seq_ = 0;
+    uint64_t next_start_ = 0;
+    bool preemption_ = false;
     int max_concurrent_;
-    int active_count_ = 0;
     bool auto_start_ = true;  // set to false in tests to prevent network calls
 };
@@ -1,34 +1,108 @@
 // thread_pool.cpp
 #include "thread_pool.h"
 
+#include <algorithm>
+
+namespace {
+
+// The pool and worker the calling thread belongs to, if any: jobs submitted
+// from inside a job go to the running worker's own deque.
+thread_local ThreadPool* tls_pool = nullptr;
+thread_local void* tls_worker = nullptr;
+
+constexpr size_t kNodesPerBlock = 32;       // job nodes allocated at a time
+constexpr size_t kMaxCachedNodes = 64;      // free nodes a worker keeps for itself
+constexpr uint32_t kInjectPollInterval = 61; // jobs between forced injection queue polls
+
+} // namespace
+
+// ── WorkDeque (Chase-Lev, with the C11 orderings of Le et al.) ──
+
+ThreadPool::WorkDeque::WorkDeque() {
+    for (auto& slot : slots_) {
+        slot.store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+bool ThreadPool::WorkDeque::push(JobNode* node) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    if (b - t >= kCapacity) {
+        return false;
+    }
+    slots_[b % kCapacity].store(node, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+ThreadPool::JobNode* ThreadPool::WorkDeque::pop() {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        // Empty
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    JobNode* node = slots_[b % kCapacity].load(std::memory_order_relaxed);
+    if (t == b) {
+        // Last job: race the thieves for it
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            node = nullptr;
+        }
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+ThreadPool::JobNode* ThreadPool::WorkDeque::steal() {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) {
+        return nullptr;
+    }
+    JobNode* node = slots_[t % kCapacity].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+        return nullptr;  // lost to the owner or another thief
+    }
+    return node;
+}
+
+// ── ThreadPool ─────────────────────────────────────────────────
+
 ThreadPool::ThreadPool(size_t num_threads) {
+    worker_state_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        worker_state_.push_back(std::make_unique<Worker>());
+        worker_state_.back()->rng = static_cast<uint32_t>(i) * 2654435761u + 1;
+    }
     workers_.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i) {
-        workers_.emplace_back([this] {
-            while (true) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<std::mutex> lock(mutex_);
-                    cv_.wait(lock, [this] {
-                        return stopped_.load(std::memory_order_relaxed) || !tasks_.empty();
-                    });
-
-                    if (stopped_.load(std::memory_order_relaxed) && tasks_.empty()) {
-                        return;
-                    }
-
-                    task = std::move(tasks_.front());
-                    tasks_.pop();
-                }
-                task();
-            }
-        });
+        workers_.emplace_back([this, i] { workerLoop(i); });
     }
 }
 
 ThreadPool::~ThreadPool() {
-    stopped_.store(true, std::memory_order_relaxed);
-    cv_.notify_all();
+    shutdown();
+}
+
+void ThreadPool::shutdown() {
+    {
+        // Under the lock schedule() checks it under: a job injected before
+        // this is counted in pending_ before any worker sees the pool stopped
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        stopped_.store(true, std::memory_order_seq_cst);
+    }
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+    }
+    park_cv_.notify_all();
     for (auto& worker : workers_) {
         if (worker.joinable()) {
             worker.join();
@@ -39,3 +113,190 @@ ThreadPool::~ThreadPool() {
 size_t ThreadPool::size() const {
     return workers_.size();
 }
+
+ThreadPoolStats ThreadPool::stats() const {
+    ThreadPoolStats stats;
+    stats.threads = workers_.size();
+    stats.queue_depth = static_cast<size_t>(std::max<int64_t>(0, pending_.load(std::memory_order_relaxed)));
+    stats.jobs = jobs_.load(std::memory_order_relaxed);
+    stats.avg_latency = std::chrono::microseconds(avg_latency_us_.load(std::memory_order_relaxed));
+    stats.max_latency = std::chrono::microseconds(max_latency_us_.load(std::memory_order_relaxed));
+    return stats;
+}
+
+void ThreadPool::recordStart(std::chrono::microseconds latency) {
+    const int64_t us = latency.count();
+    if (jobs_.fetch_add(1, std::memory_order_relaxed) == 0) {
+        avg_latency_us_.store(us, std::memory_order_relaxed);
+    } else {
+        int64_t avg = avg_latency_us_.load(std::memory_order_relaxed);
+        avg_latency_us_.store(avg + (us - avg) / 8, std::memory_order_relaxed);
+    }
+
+    int64_t max = max_latency_us_.load(std::memory_order_relaxed);
+    while (us > max && !max_latency_us_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+ThreadPool::JobNode* ThreadPool::allocateNode() {
+    if (tls_pool == this) {
+        auto* worker = static_cast<Worker*>(tls_worker);
+        if (JobNode* node = worker->free_nodes) {
+            worker->free_nodes = node->next;
+            --worker->free_count;
+            return node;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    if (!free_nodes_) {
+        node_blocks_.push_back(std::make_unique<JobNode[]>(kNodesPerBlock));
+        JobNode* block = node_blocks_.back().get();
+        for (size_t i = 0; i < kNodesPerBlock; ++i) {
+            block[i].next = free_nodes_;
+            free_nodes_ = &block[i];
+        }
+    }
+    JobNode* node = free_nodes_;
+    free_nodes_ = node->next;
+    return node;
+}
+
+void ThreadPool::releaseNode(JobNode* node) {
+    node->run = nullptr;
+    node->discard = nullptr;
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    node->next = free_nodes_;
+    free_nodes_ = node;
+}
+
+void ThreadPool::recycleNode(Worker& worker, JobNode* node) {
+    node->run = nullptr;
+    node->discard = nullptr;
+    node->next = worker.free_nodes;
+    worker.free_nodes = node;
+    if (++worker.free_count <= kMaxCachedNodes) {
+        return;
+    }
+
+    // Hand half of the cache back so external submitters can reuse it
+    JobNode* first = worker.free_nodes;
+    JobNode* last = first;
+    for (size_t i = 1; i < kMaxCachedNodes / 2; ++i) {
+        last = last->next;
+    }
+    worker.free_nodes = last->next;
+    worker.free_count -= kMaxCachedNodes / 2;
+
+    std::lock_guard<std::mutex> lock(inject_mutex_);
+    last->next = free_nodes_;
+    free_nodes_ = first;
+}
+
+bool ThreadPool::schedule(JobNode* node) {
+    node->queued_at = std::chrono::steady_clock::now();
+    bool queued = false;
+    if (tls_pool == this) {
+        // The calling worker is running, so it drains this job before it
+        // can exit, even during shutdown()
+        queued = static_cast<Worker*>(tls_worker)->deque.push(node);
+        if (queued) {
+            pending_.fetch_add(1, std::memory_order_seq_cst);
+        }
+    }
+    if (!queued) {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        if (tls_pool != this && stopped_.load(std::memory_order_relaxed)) {
+            return false;  // the workers may already be gone
+        }
+        injected_.push_back(node);
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    // Pairs with the parked_/pending_ check in workerLoop(): either the
+    // parking worker sees the new job or this sees the parked worker.
+    if (parked_.load(std::memory_order_seq_cst) > 0) {
+        {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+        }
+        park_cv_.notify_one();
+    }
+    return true;
+}
+
+ThreadPool::JobNode* ThreadPool::findJob(size_t index) {
+    Worker& self = *worker_state_[index];
+
+    auto takeInjected = [this]() -> JobNode* {
+        std::lock_guard<std::mutex> lock(inject_mutex_);
+        if (injected_.empty()) {
+            return nullptr;
+        }
+        JobNode* node = injected_.front();
+        injected_.pop_front();
+        return node;
+    };
+
+    // Poll the injection queue now and then even while the own deque has
+    // work, so jobs from outside the pool are not starved
+    if (++self.ticks % kInjectPollInterval == 0) {
+        if (JobNode* node = takeInjected()) {
+            return node;
+        }
+    }
+    if (JobNode* node = self.deque.pop()) {
+        return node;
+    }
+    if (JobNode* node = takeInjected()) {
+        return node;
+    }
+
+    // Steal, starting at a random victim (xorshift32)
+    const size_t n = worker_state_.size();
+    self.rng ^= self.rng << 13;
+    self.rng ^= self.rng >> 17;
+    self.rng ^= self.rng << 5;
+    const size_t start = self.rng % n;
+    for (size_t k = 0; k < n; ++k) {
+        size_t victim = (start + k) % n;
+        if (victim == index) {
+            continue;
+        }
+        if (JobNode* node = worker_state_[victim]->deque.steal()) {
+            return node;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    Worker& self = *worker_state_[index];
+    tls_pool = this;
+    tls_worker = &self;
+
+    while (true) {
+        if (JobNode* node = findJob(index)) {
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+            recordStart(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - node->queued_at));
+            node->run(node);
+            recycleNode(self, node);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex_);
+        parked_.fetch_add(1, std::memory_order_seq_cst);
+        park_cv_.wait(lock, [this] {
+            return pending_.load(std::memory_order_seq_cst) > 0
+                || stopped_.load(std::memory_order_relaxed);
+        });
+        parked_.fetch_sub(1, std::memory_order_relaxed);
+
+        // Drain everything queued before honouring a stop. Acquire: every
+        // job injected before the stop is then visible in pending_.
+        if (stopped_.load(std::memory_order_acquire)
+            && pending_.load(std::memory_order_seq_cst) == 0) {
+            return;
+        }
+    }
+}
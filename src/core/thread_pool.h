@@ -1,19 +1,44 @@
 // thread_pool.h
 #pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <new>
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
 #include <future>
+#include <memory>
+#include <stdexcept>
 #include <type_traits>
+#include <utility>
 
+// Snapshot of a pool's load.
+struct ThreadPoolStats {
+    size_t threads = 0;
+    size_t queue_depth = 0;         // jobs queued, not yet started
+    uint64_t jobs = 0;              // jobs started
+    std::chrono::microseconds avg_latency{0};  // queued -> started, moving average
+    std::chrono::microseconds max_latency{0};
+};
+
+// Work-stealing pool: every worker owns a Chase-Lev deque that it pushes to
+// and pops from (LIFO) while idle workers steal from its other end (FIFO).
+// Jobs submitted from outside the pool go to a shared injection queue.
+// Workers with nothing to run or steal park on a condition variable.
 class ThreadPool {
 public:
     explicit ThreadPool(size_t num_threads);
-    ~ThreadPool();
+    ~ThreadPool();  // shutdown()
+
+    // Refuse new jobs (submit() throws), run every job already queued and
+    // join the workers. Idempotent; must not be called from a job of this pool.
+    void shutdown();
 
     // Non-copyable
     ThreadPool(const ThreadPool&) = delete;
@@ -23,15 +48,101 @@ public:
     template<typename F>
     auto submit(F&& func) -> std::future<decltype(func())>;
 
+    // Submit a callable whose result nobody waits for. Closures up to
+    // JobNode::kInlineSize bytes are stored in a recycled job node, so this
+    // does not allocate. An exception escaping func is dropped.
+    template<typename F>
+    void submitDetached(F&& func);
+
     // Number of worker threads.
     size_t size() const;
 
+    // Queue depth and queueing latency.
+    ThreadPoolStats stats() const;
+
 private:
+    // A queued callable, constructed in place and recycled after it ran.
+    struct JobNode {
+        // Room for a pointer plus an HttpConfig, the largest closure the
+        // download code submits
+        static constexpr size_t kInlineSize = 224;
+
+        void (*run)(JobNode*) = nullptr;      // invokes, then destroys the callable
+        void (*discard)(JobNode*) = nullptr;  // destroys the callable without running it
+        JobNode* next = nullptr;          // free list link
+        std::chrono::steady_clock::time_point queued_at;
+        alignas(std::max_align_t) unsigned char storage[kInlineSize];
+    };
+
+    // Chase-Lev work-stealing deque of fixed capacity (a full deque makes
+    // the owner fall back to the injection queue).
+    class WorkDeque {
+    public:
+        WorkDeque();
+        bool push(JobNode* node);  // owner only
+        JobNode* pop();            // owner only
+        JobNode* steal();          // any thread
+
+    private:
+        static constexpr int64_t kCapacity = 1024;
+        alignas(64) std::atomic<int64_t> top_{0};
+        alignas(64) std::atomic<int64_t> bottom_{0};
+        std::array<std::atomic<JobNode*>, kCapacity> slots_;
+    };
+
+    struct Worker {
+        WorkDeque deque;
+        JobNode* free_nodes = nullptr;  // nodes this worker ran, for reuse
+        size_t free_count = 0;
+        uint32_t rng = 0;               // victim selection
+        uint32_t ticks = 0;             // jobs run, to poll the injection queue fairly
+    };
+
+    template<typename F>
+    void enqueue(F&& func);
+
+    // A free job node: from the calling worker's cache, the shared free
+    // list or a fresh allocation.
+    JobNode* allocateNode();
+
+    // Return a node after its job ran. Caller is the worker that ran it.
+    void recycleNode(Worker& worker, JobNode* node);
+
+    // Return a node whose job never ran to the shared free list.
+    void releaseNode(JobNode* node);
+
+    // Queue a constructed node: on the calling worker's own deque, otherwise
+    // on the injection queue. Wakes a parked worker. Returns false, leaving
+    // node alone, when a thread outside the pool loses the race with
+    // shutdown().
+    bool schedule(JobNode* node);
+
+    // Next job for worker: own deque, injection queue, then stealing.
+    JobNode* findJob(size_t index);
+
+    void workerLoop(size_t index);
+
+    // Account for a job that waited latency in the queue.
+    void recordStart(std::chrono::microseconds latency);
+
+    std::vector<std::unique_ptr<Worker>> worker_state_;
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    std::mutex mutex_;
-    std::condition_variable cv_;
+
+    std::mutex inject_mutex_;                // guards injected_ and free_nodes_
+    std::deque<JobNode*> injected_;
+    JobNode* free_nodes_ = nullptr;
+    std::vector<std::unique_ptr<JobNode[]>> node_blocks_;  // owns every node
+
+    std::atomic<int64_t> pending_{0};        // jobs queued and not yet taken
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+    std::atomic<int> parked_{0};
     std::atomic<bool> stopped_{false};
+
+    // Statistics, updated without a lock (a lost average update is harmless)
+    std::atomic<uint64_t> jobs_{0};
+    std::atomic<int64_t> avg_latency_us_{0};
+    std::atomic<int64_t> max_latency_us_{0};
 };
 
 // ── Template implementation (must live in the header) ──────────
@@ -40,19 +151,59 @@ template<typename F>
 auto ThreadPool::submit(F&& func) -> std::future<decltype(func())> {
     using ReturnType = decltype(func());
 
-    auto task = std::make_shared<std::packaged_task<ReturnType()>>(
-        std::forward<F>(func));
-
-    std::future<ReturnType> future = task->get_future();
+    std::packaged_task<ReturnType()> task(std::forward<F>(func));
+    std::future<ReturnType> future = task.get_future();
+    enqueue(std::move(task));
+    return future;
+}
 
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        if (stopped_.load(std::memory_order_relaxed)) {
-            throw std::runtime_error("submit() called on a stopped ThreadPool");
+template<typename F>
+void ThreadPool::submitDetached(F&& func) {
+    using Fn = std::decay_t<F>;
+    enqueue([fn = Fn(std::forward<F>(func))]() mutable {
+        try {
+            fn();
+        } catch (...) {
+            // Detached: nobody to report to
         }
-        tasks_.emplace([task]() { (*task)(); });
+    });
+}
+
+template<typename F>
+void ThreadPool::enqueue(F&& func) {
+    using Fn = std::decay_t<F>;
+
+    if (stopped_.load(std::memory_order_relaxed)) {
+        throw std::runtime_error("submit() called on a stopped ThreadPool");
     }
 
-    cv_.notify_one();
-    return future;
+    JobNode* node = allocateNode();
+    if constexpr (sizeof(Fn) <= JobNode::kInlineSize
+                  && alignof(Fn) <= alignof(std::max_align_t)) {
+        new (node->storage) Fn(std::forward<F>(func));
+        node->run = [](JobNode* n) {
+            Fn* fn = std::launder(reinterpret_cast<Fn*>(n->storage));
+            (*fn)();
+            fn->~Fn();
+        };
+        node->discard = [](JobNode* n) {
+            std::launder(reinterpret_cast<Fn*>(n->storage))->~Fn();
+        };
+    } else {
+        // Too big to store inline: keep a pointer to a heap copy
+        Fn* heap = new Fn(std::forward<F>(func));
+        new (node->storage) Fn*(heap);
+        node->run = [](JobNode* n) {
+            std::unique_ptr<Fn> fn(*std::launder(reinterpret_cast<Fn**>(n->storage)));
+            (*fn)();
+        };
+        node->discard = [](JobNode* n) {
+            delete *std::launder(reinterpret_cast<Fn**>(n->storage));
+        };
+    }
+    if (!schedule(node)) {
+        node->discard(node);
+        releaseNode(node);
+        throw std::runtime_error("submit() called on a stopped ThreadPool");
+    }
 }
@@ -0,0 +1,175 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel(std::chrono::milliseconds tick)
+    : tick_(std::max(tick, std::chrono::milliseconds(1)))
+    , start_(std::chrono::steady_clock::now())
+{
+    thread_ = std::thread([this] { run(); });
+}
+
+TimerWheel::~TimerWheel()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+TimerWheel::TimerId TimerWheel::schedule(std::chrono::milliseconds delay, Callback callback)
+{
+    // Round up: a timer never fires before its delay has passed
+    auto due = std::chrono::steady_clock::now() + std::max(delay, std::chrono::milliseconds(0))
+        - start_;
+    uint64_t expires = static_cast<uint64_t>((due + tick_ - std::chrono::steady_clock::duration(1)) / tick_);
+
+    TimerId id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (timers_.empty()) {
+            // Idle wheel: skip the ticks that passed without timers
+            base_ = std::max(base_, currentTick() + 1);
+        }
+        id = next_id_++;
+        timers_.emplace(id, Timer{expires, std::move(callback)});
+        placeLocked(id, expires);
+    }
+    cv_.notify_one();
+    return id;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (timers_.erase(id) > 0) {
+        return true;  // its stale slot entry is skipped when reached
+    }
+    if (running_ == id && std::this_thread::get_id() != thread_.get_id()) {
+        done_cv_.wait(lock, [this, id] { return running_ != id; });
+    }
+    return false;
+}
+
+size_t TimerWheel::pending() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return timers_.size();
+}
+
+// ── Wheel ──────────────────────────────────────────────────────
+
+void TimerWheel::placeLocked(TimerId id, uint64_t expires)
+{
+    // Already due (or due while this tick is processed): next tick
+    expires = std::max(expires, base_);
+    uint64_t delta = expires - base_;
+
+    int level = 0;
+    while (level < kLevels - 1 && delta >= (uint64_t(1) << (kSlotBits * (level + 1)))) {
+        ++level;
+    }
+    if (level == kLevels - 1 && delta >= (uint64_t(1) << (kSlotBits * kLevels))) {
+        // Cap at the wheel's horizon
+        expires = base_ + (uint64_t(1) << (kSlotBits * kLevels)) - 1;
+        timers_[id].expires = expires;
+    }
+
+    wheel_[level][(expires >> (kSlotBits * level)) & kSlotMask].push_back(id);
+    if (level == 0) {
+        ++level0_count_;
+    }
+}
+
+uint64_t TimerWheel::cascadeLocked(int level)
+{
+    uint64_t index = (base_ >> (kSlotBits * level)) & kSlotMask;
+    std::vector<TimerId> ids;
+    ids.swap(wheel_[level][index]);
+    for (TimerId id : ids) {
+        auto it = timers_.find(id);
+        if (it != timers_.end()) {
+            placeLocked(id, it->second.expires);
+        }
+    }
+    return index;
+}
+
+void TimerWheel::advanceLocked(uint64_t target, std::vector<TimerId>* due)
+{
+    // Nothing can fire: jump straight to the target tick (slots only hold
+    // cancelled ids, which are skipped whenever they are reached)
+    if (timers_.empty()) {
+        base_ = std::max(base_, target + 1);
+        return;
+    }
+
+    while (base_ <= target) {
+        uint64_t index = base_ & kSlotMask;
+        if (index == 0) {
+            // Entering a new lap of level 0: pull the timers due in it down
+            for (int level = 1; level < kLevels && cascadeLocked(level) == 0; ++level) {
+            }
+        }
+
+        std::vector<TimerId> ids;
+        ids.swap(wheel_[0][index]);
+        level0_count_ -= ids.size();
+        for (TimerId id : ids) {
+            if (timers_.count(id) > 0) {
+                due->push_back(id);  // stays cancellable until it runs
+            }
+        }
+        ++base_;
+    }
+}
+
+uint64_t TimerWheel::currentTick() const
+{
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - start_) / tick_);
+}
+
+void TimerWheel::run()
+{
+    std::vector<TimerId> due;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopped_) {
+        advanceLocked(currentTick(), &due);
+
+        for (TimerId id : due) {
+            auto it = timers_.find(id);
+            if (it == timers_.end() || stopped_) {
+                continue;  // cancelled meanwhile
+            }
+            Callback callback = std::move(it->second.callback);
+            timers_.erase(it);
+            running_ = id;
+            lock.unlock();
+            try {
+                callback();
+            } catch (...) {
+                // Nobody to report to
+            }
+            callback = nullptr;  // release captures before cancel() returns
+            lock.lock();
+            running_ = 0;
+            done_cv_.notify_all();
+        }
+        due.clear();
+        if (stopped_) {
+            break;
+        }
+
+        if (timers_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+        // With level 0 empty nothing fires before the next cascade
+        uint64_t next = level0_count_ > 0 ? base_ : ((base_ | kSlotMask) + 1);
+        cv_.wait_until(lock, start_ + tick_ * next);
+    }
+}
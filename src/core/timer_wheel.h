@@ -0,0 +1,83 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// Hierarchical timing wheel (four levels of 256 slots) driven by one
+/// thread, for retry backoff and delayed starts. Nothing waits for a timer:
+/// the callback runs on the wheel thread when it is due and should only
+/// hand the real work on, typically to a ThreadPool.
+/// Scheduling and cancelling are O(1); timers fire at tick resolution and
+/// never early. Delays beyond about 1.3 years (at 10 ms ticks) are capped.
+class TimerWheel {
+public:
+    using TimerId = uint64_t;
+    using Callback = std::function<void()>;
+
+    explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(10));
+
+    /// Joins the wheel thread; timers still pending never fire.
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /// Run callback once, delay from now. An exception escaping it is dropped.
+    TimerId schedule(std::chrono::milliseconds delay, Callback callback);
+
+    /// Cancel a timer. Returns true if it had not fired yet. If its callback
+    /// is running on the wheel thread, waits for it to return first (unless
+    /// called from that callback), so whatever it captured can be released.
+    bool cancel(TimerId id);
+
+    /// Timers scheduled and not yet fired or cancelled.
+    size_t pending() const;
+
+private:
+    static constexpr int kLevels = 4;
+    static constexpr int kSlotBits = 8;
+    static constexpr uint64_t kSlots = 1u << kSlotBits;
+    static constexpr uint64_t kSlotMask = kSlots - 1;
+
+    struct Timer {
+        uint64_t expires;  // tick
+        Callback callback;
+    };
+
+    /// Put id in the slot its expiry falls into. Caller holds mutex_.
+    void placeLocked(TimerId id, uint64_t expires);
+
+    /// Move the timers of one slot of level to the levels below. Returns
+    /// that slot's index. Caller holds mutex_.
+    uint64_t cascadeLocked(int level);
+
+    /// Process every tick up to target, collecting the ids of the due
+    /// timers. Caller holds mutex_.
+    void advanceLocked(uint64_t target, std::vector<TimerId>* due);
+
+    /// The tick now (rounded down).
+    uint64_t currentTick() const;
+
+    void run();
+
+    const std::chrono::steady_clock::duration tick_;
+    const std::chrono::steady_clock::time_point start_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;        // wakes the wheel thread
+    std::condition_variable done_cv_;   // a callback returned
+    std::unordered_map<TimerId, Timer> timers_;
+    std::array<std::array<std::vector<TimerId>, kSlots>, kLevels> wheel_;
+    size_t level0_count_ = 0;           // ids in level 0 (cancelled ones included)
+    uint64_t base_ = 1;                 // next tick to process
+    TimerId next_id_ = 1;
+    TimerId running_ = 0;               // id whose callback is running
+    bool stopped_ = false;
+    std::thread thread_;
+};
@@ -2,102 +2,474 @@
 #include "token_bucket.h"
 #include <algorithm>
 
-TokenBucket::TokenBucket(int64_t rate_bytes_per_sec)
-    : rate_(rate_bytes_per_sec)
-    , tokens_(rate_bytes_per_sec)  // start with a full bucket
-    , max_tokens_(rate_bytes_per_sec)
-    , last_refill_(std::chrono::steady_clock::now())
-{
+namespace {
+
+constexpr int64_t kMicrosPerSec = 1'000'000;
+constexpr int64_t kLeaseBytes = 64 * 1024;
+constexpr int64_t kMinWaitUs = 1000;           // minimum 1 ms to avoid busy-spin
+constexpr int64_t kIdleUs = 1'000'000;         // no demand for this long: the share goes to busy siblings
+constexpr int64_t kRebalanceUs = 200'000;      // how often shares follow busy/idle changes
+constexpr int64_t kActiveUpdateUs = 10'000;    // granularity of the demand timestamp
+constexpr int kMaxWeight = 1000;
+
+// The tighter of two rates where 0 means unlimited.
+int64_t minRate(int64_t a, int64_t b) {
+    if (a == 0) {
+        return b;
+    }
+    if (b == 0) {
+        return a;
+    }
+    return std::min(a, b);
+}
+
+} // namespace
+
+// ── Counter ────────────────────────────────────────────────────
+
+void TokenBucket::Counter::reset(int64_t new_rate, int64_t now) {
+    // Refill with the old rate before switching
+    refill(now);
+
+    int64_t old_rate = rate.exchange(new_rate, std::memory_order_relaxed);
+    max_tokens.store(new_rate, std::memory_order_relaxed);
+
+    if (old_rate == 0) {
+        // Limiting starts now, with a full bucket
+        tokens.store(new_rate, std::memory_order_relaxed);
+        last_refill_us.store(now, std::memory_order_relaxed);
+        return;
+    }
+
+    // Clamp current tokens to new capacity
+    if (new_rate > 0) {
+        int64_t current = tokens.load(std::memory_order_relaxed);
+        while (current > new_rate
+               && !tokens.compare_exchange_weak(current, new_rate, std::memory_order_relaxed)) {
+        }
+    }
 }
 
-void TokenBucket::refill() {
-    // Must be called with mutex_ held.
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
-        now - last_refill_).count();
+void TokenBucket::Counter::refill(int64_t now) {
+    int64_t r = rate.load(std::memory_order_relaxed);
+    if (r <= 0) {
+        return;
+    }
 
-    if (elapsed <= 0 || rate_ <= 0) {
+    int64_t last = last_refill_us.load(std::memory_order_relaxed);
+    int64_t elapsed = now - last;
+    if (elapsed <= 0) {
         return;
     }
 
-    // tokens to add = rate * elapsed_seconds = rate * elapsed_us / 1'000'000
-    int64_t new_tokens = static_cast<int64_t>(
-        static_cast<double>(rate_) * static_cast<double>(elapsed) / 1'000'000.0);
+    // A full bucket holds one second: longer idle periods add nothing more,
+    // which also keeps rate * elapsed within int64_t
+    int64_t new_tokens = r * std::min(elapsed, kMicrosPerSec) / kMicrosPerSec;
+    if (new_tokens <= 0) {
+        return;  // keep accumulating time until a whole token is due
+    }
+    if (!last_refill_us.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+        return;  // another thread claimed this interval
+    }
 
-    if (new_tokens > 0) {
-        tokens_ = std::min(tokens_ + new_tokens, max_tokens_);
-        last_refill_ = now;
+    int64_t max = max_tokens.load(std::memory_order_relaxed);
+    int64_t current = tokens.load(std::memory_order_relaxed);
+    while (!tokens.compare_exchange_weak(current, std::min(current + new_tokens, max),
+                                         std::memory_order_relaxed)) {
     }
 }
 
-int64_t TokenBucket::acquire(int64_t tokens) {
-    if (tokens <= 0) {
+bool TokenBucket::Counter::take(int64_t count, int64_t now) {
+    if (rate.load(std::memory_order_relaxed) == 0) {
+        return true;
+    }
+    refill(now);
+
+    // A chunk larger than the bucket could never fit; accept it once the
+    // bucket is full and let the balance go into debt instead.
+    int64_t needed = std::min(count, max_tokens.load(std::memory_order_relaxed));
+    int64_t current = tokens.load(std::memory_order_relaxed);
+    while (current >= needed) {
+        if (tokens.compare_exchange_weak(current, current - count, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TokenBucket::Counter::force(int64_t count) {
+    if (rate.load(std::memory_order_relaxed) != 0) {
+        tokens.fetch_sub(count, std::memory_order_relaxed);
+    }
+}
+
+void TokenBucket::Counter::give(int64_t count) {
+    if (rate.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    int64_t max = max_tokens.load(std::memory_order_relaxed);
+    int64_t current = tokens.load(std::memory_order_relaxed);
+    while (!tokens.compare_exchange_weak(current, std::min(current + count, max),
+                                         std::memory_order_relaxed)) {
+    }
+}
+
+int64_t TokenBucket::Counter::waitUs(int64_t count) const {
+    int64_t r = rate.load(std::memory_order_relaxed);
+    if (r == 0) {
         return 0;
     }
+    int64_t needed = std::min(count, max_tokens.load(std::memory_order_relaxed));
+    int64_t deficit = needed - tokens.load(std::memory_order_relaxed);
+    return deficit > 0 ? deficit * kMicrosPerSec / r : 0;
+}
 
-    std::unique_lock<std::mutex> lock(mutex_);
+// ── TokenBucket ────────────────────────────────────────────────
 
-    // No rate limiting — pass through immediately
-    if (rate_ == 0) {
-        return tokens;
+TokenBucket::TokenBucket(int64_t rate_bytes_per_sec, TokenBucket* parent, int weight)
+    : parent_(parent)
+    , weight_(std::clamp(weight, 1, kMaxWeight))
+{
+    int64_t now = nowMicros();
+    cap_.reset(rate_bytes_per_sec, now);  // start with a full bucket
+    effective_rate_.store(rate_bytes_per_sec, std::memory_order_relaxed);
+    last_active_us_.store(now, std::memory_order_relaxed);  // a new bucket counts as busy
+
+    // Joining and leaving are O(1), so a queue of thousands of tasks does
+    // not rebalance all siblings for each one: a new child takes a
+    // provisional share against the busy siblings of the last rebalance,
+    // the parent's next charge recomputes every share.
+    if (parent_) {
+        std::lock_guard<std::mutex> lock(parent_->mutex_);
+        child_index_ = parent_->children_.size();
+        parent_->children_.push_back(this);
+
+        int64_t parent_rate = parent_->effective_rate_.load(std::memory_order_relaxed);
+        if (parent_rate > 0) {
+            int64_t weight = weight_.load(std::memory_order_relaxed);
+            int64_t share = std::max<int64_t>(
+                parent_rate * weight / (parent_->busy_weight_ + weight), 1);
+            share_.reset(share, now);
+            effective_rate_.store(minRate(rate_bytes_per_sec, share), std::memory_order_relaxed);
+            parent_->busy_weight_ += weight;
+            parent_->next_rebalance_us_.store(0, std::memory_order_relaxed);
+        }
     }
+}
 
-    while (true) {
-        if (cancelled_.load(std::memory_order_relaxed)) {
-            return 0;
+TokenBucket::~TokenBucket() {
+    if (parent_) {
+        std::lock_guard<std::mutex> lock(parent_->mutex_);
+        auto& siblings = parent_->children_;
+        siblings[child_index_] = siblings.back();
+        siblings[child_index_]->child_index_ = child_index_;
+        siblings.pop_back();
+        parent_->next_rebalance_us_.store(0, std::memory_order_relaxed);
+    }
+}
+
+int64_t TokenBucket::nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool TokenBucket::charge(int64_t tokens, int64_t now) {
+    markActive(now);
+    maybeRebalance(now);
+    if (!cap_.take(tokens, now)) {
+        return false;
+    }
+    if (!chargeAbove(tokens, now)) {
+        cap_.give(tokens);
+        return false;
+    }
+    return true;
+}
+
+bool TokenBucket::chargeAbove(int64_t tokens, int64_t now) {
+    if (!parent_) {
+        return true;
+    }
+    parent_->maybeRebalance(now);
+
+    if (share_.take(tokens, now)) {
+        parent_->markActive(now);
+        parent_->cap_.force(tokens);
+        if (parent_->chargeAbove(tokens, now)) {
+            return true;
         }
+        parent_->cap_.give(tokens);
+        share_.give(tokens);
+        return false;
+    }
 
-        refill();
+    // Beyond the guaranteed share: borrow capacity the siblings leave unused
+    return parent_->charge(tokens, now);
+}
 
-        if (tokens_ >= tokens) {
-            tokens_ -= tokens;
-            return tokens;
+int64_t TokenBucket::waitUs(int64_t tokens) const {
+    int64_t wait = cap_.waitUs(tokens);
+    if (parent_) {
+        wait = std::max(wait, std::min(share_.waitUs(tokens), parent_->waitUs(tokens)));
+    }
+    return std::max(wait, kMinWaitUs);
+}
+
+bool TokenBucket::isCancelled() const {
+    for (const TokenBucket* bucket = this; bucket; bucket = bucket->parent_) {
+        if (bucket->cancelled_.load(std::memory_order_relaxed)) {
+            return true;
         }
+    }
+    return false;
+}
 
-        // Not enough tokens — figure out how long to wait for them.
-        int64_t deficit = tokens - tokens_;
-        // wait_us = deficit / rate * 1'000'000
-        auto wait_us = static_cast<int64_t>(
-            static_cast<double>(deficit) / static_cast<double>(rate_) * 1'000'000.0);
-        if (wait_us < 1000) {
-            wait_us = 1000; // minimum 1 ms to avoid busy-spin
+bool TokenBucket::isLimited() const {
+    for (const TokenBucket* bucket = this; bucket; bucket = bucket->parent_) {
+        if (bucket->cap_.rate.load(std::memory_order_relaxed) > 0) {
+            return true;
         }
+    }
+    return false;
+}
 
-        cv_.wait_for(lock, std::chrono::microseconds(wait_us), [this] {
-            return cancelled_.load(std::memory_order_relaxed) || rate_ == 0;
-        });
+int64_t TokenBucket::effectiveRate() const {
+    if (parent_) {
+        parent_->maybeRebalance(nowMicros());
+    }
+    return effective_rate_.load(std::memory_order_relaxed);
+}
 
-        // After waking up, re-check: rate may have changed to 0 (unlimited)
-        if (rate_ == 0) {
-            return tokens;
-        }
+void TokenBucket::markActive(int64_t now) {
+    int64_t last = last_active_us_.load(std::memory_order_relaxed);
+    if (now - last < kActiveUpdateUs) {
+        return;
+    }
+    last_active_us_.store(now, std::memory_order_relaxed);
+
+    if (parent_ && now - last > kIdleUs) {
+        // Back from idle: take the share back now rather than at the next rebalance
+        std::lock_guard<std::mutex> lock(parent_->mutex_);
+        parent_->rebalanceLocked(now);
     }
 }
 
-void TokenBucket::setRate(int64_t rate_bytes_per_sec) {
+void TokenBucket::maybeRebalance(int64_t now) {
+    int64_t next = next_rebalance_us_.load(std::memory_order_relaxed);
+    if (now < next
+        || !next_rebalance_us_.compare_exchange_strong(next, now + kRebalanceUs,
+                                                       std::memory_order_relaxed)) {
+        return;
+    }
     std::lock_guard<std::mutex> lock(mutex_);
+    rebalanceLocked(now);
+}
 
-    // Refill with the old rate before switching
-    refill();
+void TokenBucket::rebalanceLocked(int64_t now) {
+    next_rebalance_us_.store(now + kRebalanceUs, std::memory_order_relaxed);
+    if (children_.empty()) {
+        busy_weight_ = 0;
+        return;
+    }
 
-    rate_ = rate_bytes_per_sec;
-    max_tokens_ = rate_bytes_per_sec;
+    int64_t rate = effective_rate_.load(std::memory_order_relaxed);
+    int64_t busy_weight = 0;
+    for (const TokenBucket* child : children_) {
+        if (now - child->last_active_us_.load(std::memory_order_relaxed) <= kIdleUs) {
+            busy_weight += child->weight_.load(std::memory_order_relaxed);
+        }
+    }
+    busy_weight_ = busy_weight;
 
-    // Clamp current tokens to new capacity
-    if (max_tokens_ > 0 && tokens_ > max_tokens_) {
-        tokens_ = max_tokens_;
+    for (TokenBucket* child : children_) {
+        int64_t weight = child->weight_.load(std::memory_order_relaxed);
+        bool busy = now - child->last_active_us_.load(std::memory_order_relaxed) <= kIdleUs;
+        // An idle child is sized as if it were joining the busy ones
+        int64_t total_weight = busy_weight + (busy ? 0 : weight);
+        int64_t share = rate > 0 ? std::max<int64_t>(rate * weight / total_weight, 1) : 0;
+
+        std::lock_guard<std::mutex> lock(child->mutex_);
+        if (child->share_.rate.load(std::memory_order_relaxed) != share) {
+            child->share_.reset(share, now);
+        }
+        int64_t effective = minRate(child->cap_.rate.load(std::memory_order_relaxed), share);
+        if (child->effective_rate_.exchange(effective, std::memory_order_relaxed) != effective) {
+            child->rebalanceLocked(now);
+        }
     }
+}
 
-    // Wake up all waiters so they re-evaluate with the new rate
+void TokenBucket::wakeLocked() {
+    generation_.fetch_add(1, std::memory_order_relaxed);
     cv_.notify_all();
+    for (TokenBucket* child : children_) {
+        std::lock_guard<std::mutex> lock(child->mutex_);
+        child->wakeLocked();
+    }
 }
 
-int64_t TokenBucket::getRate() const {
+int64_t TokenBucket::acquire(int64_t tokens) {
+    if (tokens <= 0) {
+        return 0;
+    }
+
+    while (true) {
+        // No rate limiting — pass through immediately
+        if (!isLimited()) {
+            return tokens;
+        }
+        if (isCancelled()) {
+            return 0;
+        }
+
+        if (charge(tokens, nowMicros())) {
+            return tokens;
+        }
+
+        // Not enough tokens — sleep until they should have accrued, or until
+        // a rate change or cancel() wakes us to re-evaluate
+        uint64_t generation = generation_.load(std::memory_order_relaxed);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait_for(lock, std::chrono::microseconds(waitUs(tokens)), [this, generation] {
+            return generation_.load(std::memory_order_relaxed) != generation;
+        });
+    }
+}
+
+bool TokenBucket::tryAcquire(int64_t tokens, std::chrono::microseconds* retry_after) {
+    if (tokens <= 0 || !isLimited()) {
+        return true;
+    }
+    if (isCancelled()) {
+        return false;
+    }
+
+    if (charge(tokens, nowMicros())) {
+        return true;
+    }
+
+    if (retry_after) {
+        *retry_after = std::chrono::microseconds(waitUs(tokens));
+    }
+    return false;
+}
+
+void TokenBucket::setRate(int64_t rate_bytes_per_sec) {
     std::lock_guard<std::mutex> lock(mutex_);
-    return rate_;
+    int64_t now = nowMicros();
+
+    cap_.reset(rate_bytes_per_sec, now);
+    int64_t share = parent_ ? share_.rate.load(std::memory_order_relaxed) : 0;
+    effective_rate_.store(minRate(rate_bytes_per_sec, share), std::memory_order_relaxed);
+    rebalanceLocked(now);
+
+    // Wake up all waiters so they re-evaluate with the new rate
+    wakeLocked();
+}
+
+int64_t TokenBucket::getRate() const {
+    return cap_.rate.load(std::memory_order_relaxed);
+}
+
+void TokenBucket::setWeight(int weight) {
+    weight_.store(std::clamp(weight, 1, kMaxWeight), std::memory_order_relaxed);
+    if (parent_) {
+        std::lock_guard<std::mutex> lock(parent_->mutex_);
+        parent_->rebalanceLocked(nowMicros());
+    }
+}
+
+int TokenBucket::getWeight() const {
+    return weight_.load(std::memory_order_relaxed);
 }
 
 void TokenBucket::cancel() {
+    // Under the mutex so a waiter between its predicate check and sleeping
+    // cannot miss the notification
+    std::lock_guard<std::mutex> lock(mutex_);
     cancelled_.store(true, std::memory_order_relaxed);
-    cv_.notify_all();
+    wakeLocked();
+}
+
+// ── Lease ──────────────────────────────────────────────────────
+
+TokenBucket::Lease::Lease(TokenBucket* bucket)
+    : bucket_(bucket)
+{
+}
+
+int64_t TokenBucket::Lease::batchSize() const {
+    // At low rates a 64 KB batch would let one transfer hoard a large part
+    // of the second's budget: lease at most 1/64 of it
+    int64_t rate = bucket_->effectiveRate();
+    return rate > 0 ? std::clamp<int64_t>(rate / 64, 1, kLeaseBytes) : kLeaseBytes;
+}
+
+void TokenBucket::Lease::checkGeneration() {
+    uint64_t generation = bucket_->generation_.load(std::memory_order_relaxed);
+    if (generation != generation_) {
+        generation_ = generation;
+        balance_ = 0;
+    }
+}
+
+int64_t TokenBucket::Lease::acquire(int64_t tokens) {
+    if (tokens <= 0) {
+        return 0;
+    }
+    if (!bucket_) {
+        return tokens;
+    }
+    if (bucket_->isCancelled()) {
+        return 0;
+    }
+
+    checkGeneration();
+    if (balance_ >= tokens) {
+        balance_ -= tokens;
+        return tokens;
+    }
+
+    // Top up with a whole batch when the buckets have it, otherwise wait
+    // for just what this chunk lacks
+    int64_t deficit = tokens - balance_;
+    int64_t batch = std::max(deficit, batchSize());
+    if (batch > deficit && bucket_->isLimited() && bucket_->charge(batch, nowMicros())) {
+        balance_ += batch - tokens;
+        return tokens;
+    }
+
+    if (bucket_->acquire(deficit) == 0) {
+        return 0;  // cancelled
+    }
+    balance_ = 0;
+    return tokens;
+}
+
+bool TokenBucket::Lease::tryAcquire(int64_t tokens, std::chrono::microseconds* retry_after) {
+    if (tokens <= 0 || !bucket_) {
+        return true;
+    }
+    if (bucket_->isCancelled()) {
+        return false;
+    }
+
+    checkGeneration();
+    if (balance_ >= tokens) {
+        balance_ -= tokens;
+        return true;
+    }
+
+    int64_t deficit = tokens - balance_;
+    int64_t batch = std::max(deficit, batchSize());
+    if (batch > deficit && bucket_->isLimited() && bucket_->charge(batch, nowMicros())) {
+        balance_ += batch - tokens;
+        return true;
+    }
+
+    if (!bucket_->tryAcquire(deficit, retry_after)) {
+        return false;
+    }
+    balance_ = 0;
+    return true;
 }
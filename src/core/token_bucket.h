@@ -5,33 +5,138 @@
 #include <chrono>
 #include <atomic>
 #include <cstdint>
+#include <vector>
 
+// Buckets form a tree (global -> host -> task): tokens taken from a bucket
+// are charged to every ancestor as well. Each child is guaranteed a share
+// of its parent's rate in proportion to its weight among the siblings that
+// are busy; beyond that it borrows whatever the parent has spare.
 class TokenBucket {
 public:
-    // rate_bytes_per_sec = 0 means no rate limiting
-    explicit TokenBucket(int64_t rate_bytes_per_sec = 0);
+    // rate_bytes_per_sec = 0 means no rate limiting of its own. parent must
+    // outlive this bucket.
+    explicit TokenBucket(int64_t rate_bytes_per_sec = 0, TokenBucket* parent = nullptr,
+                         int weight = 1);
+    ~TokenBucket();
+
+    TokenBucket(const TokenBucket&) = delete;
+    TokenBucket& operator=(const TokenBucket&) = delete;
 
     // Acquire the specified number of tokens, blocking when insufficient.
     // Returns the number of tokens actually acquired (0 when cancelled).
     int64_t acquire(int64_t tokens);
 
+    // Non-blocking acquire for event-loop callers. Succeeds when the bucket
+    // holds at least min(tokens, capacity); the balance may then go negative
+    // (the debt is repaid by later refills). On failure *retry_after is set
+    // to the estimated wait until the request could succeed.
+    bool tryAcquire(int64_t tokens, std::chrono::microseconds* retry_after = nullptr);
+
     // Dynamically adjust the rate. 0 means no rate limiting.
     void setRate(int64_t rate_bytes_per_sec);
 
     // Get the current rate.
     int64_t getRate() const;
 
-    // Cancel all waiting threads.
+    // Relative share of the parent's rate (minimum 1).
+    void setWeight(int weight);
+    int getWeight() const;
+
+    // True if this bucket or an ancestor has a rate.
+    bool isLimited() const;
+
+    // Bandwidth this bucket gets when all its busy siblings are saturated:
+    // its own rate capped by its share of the parent's. 0 = unlimited.
+    // Settles a rebalance the siblings still owe (after a join or leave).
+    int64_t effectiveRate() const;
+
+    // Cancel all waiting threads (of this bucket and its descendants).
     void cancel();
 
+    // A per-transfer cache of tokens taken from the bucket in batches of up
+    // to 64 KB, so most chunks are paid for without touching shared state.
+    // Not thread-safe: one lease per transfer. Tokens still cached when the
+    // rate changes are dropped. bucket may be nullptr (no limiting).
+    class Lease {
+    public:
+        explicit Lease(TokenBucket* bucket = nullptr);
+
+        // Same contracts as TokenBucket::acquire()/tryAcquire().
+        int64_t acquire(int64_t tokens);
+        bool tryAcquire(int64_t tokens, std::chrono::microseconds* retry_after = nullptr);
+
+    private:
+        // Tokens to take from the bucket at once for the current rate.
+        int64_t batchSize() const;
+
+        // Drop the cache if a rate changed since it was filled.
+        void checkGeneration();
+
+        TokenBucket* bucket_;  // non-owning
+        int64_t balance_ = 0;
+        uint64_t generation_ = 0;
+    };
+
 private:
-    void refill();
+    // A lock-free token counter: refilled by whichever thread advances
+    // last_refill_us with a CAS, debited with a CAS loop.
+    struct Counter {
+        std::atomic<int64_t> rate{0};        // token generation rate (bytes/sec), 0 = unlimited
+        std::atomic<int64_t> tokens{0};      // currently available tokens, negative = debt
+        std::atomic<int64_t> max_tokens{0};  // capacity (= rate, i.e. 1 second worth)
+        std::atomic<int64_t> last_refill_us{0};
+
+        void reset(int64_t new_rate, int64_t now);
+        void refill(int64_t now);
+        // Take tokens if at least min(tokens, capacity) are available.
+        bool take(int64_t tokens, int64_t now);
+        // Take tokens unconditionally, going into debt if need be.
+        void force(int64_t tokens);
+        // Return tokens taken by take()/force().
+        void give(int64_t tokens);
+        // Estimated wait until take(tokens) can succeed, 0 if it can now.
+        int64_t waitUs(int64_t tokens) const;
+    };
+
+    // Take tokens from this bucket and all its ancestors, all or nothing.
+    bool charge(int64_t tokens, int64_t now);
+
+    // The ancestors' part of charge(): within this bucket's share the
+    // parent's own limit is debited regardless, beyond it the parent must
+    // have spare tokens.
+    bool chargeAbove(int64_t tokens, int64_t now);
+
+    int64_t waitUs(int64_t tokens) const;
+    bool isCancelled() const;
+
+    // Record demand; a bucket that was idle has its share restored at once.
+    void markActive(int64_t now);
+
+    // Recompute the children's shares if it has not been done lately
+    // (so idle children's shares go to the busy ones).
+    void maybeRebalance(int64_t now);
+
+    // Caller holds mutex_. Recomputes the children's shares, recursively.
+    void rebalanceLocked(int64_t now);
+
+    // Caller holds mutex_. Wakes waiters and invalidates leases, recursively.
+    void wakeLocked();
+
+    static int64_t nowMicros();
+
+    TokenBucket* const parent_;  // non-owning
+    std::atomic<int> weight_;
+    Counter cap_;    // this bucket's own rate
+    Counter share_;  // this bucket's guaranteed share of the parent's rate
+    std::atomic<int64_t> effective_rate_{0};
+    std::atomic<int64_t> last_active_us_{0};
+    std::atomic<int64_t> next_rebalance_us_{0};
 
-    mutable std::mutex mutex_;
+    std::mutex mutex_;                      // waiting, setRate() and children_
     std::condition_variable cv_;
-    int64_t rate_;              // token generation rate (bytes/sec)
-    int64_t tokens_;            // currently available tokens
-    int64_t max_tokens_;        // bucket capacity (= rate, i.e. 1 second worth)
-    std::chrono::steady_clock::time_point last_refill_;
+    std::vector<TokenBucket*> children_;    // guarded by mutex_
+    int64_t busy_weight_ = 0;               // busy children's weight at the last rebalance (mutex_)
+    size_t child_index_ = 0;                // position in parent_->children_ (parent_->mutex_)
+    std::atomic<uint64_t> generation_{0};   // bumped on rate changes, invalidates leases
     std::atomic<bool> cancelled_{false};
 };
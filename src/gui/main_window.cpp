@@ -721,13 +721,12 @@ void MainWindow::onScheduleDownload()
 
     if (url.isEmpty()) return;
 
-    int delay_ms = static_cast<int>(QDateTime::currentDateTime().msecsTo(scheduled));
-    if (delay_ms <= 0) {
+    if (QDateTime::currentDateTime().msecsTo(scheduled) <= 0) {
         manager_->addDownload(url.toStdString(), std::string());
     } else {
-        QTimer::singleShot(delay_ms, this, [this, url]() {
-            manager_->addDownload(url.toStdString(), std::string());
-        });
+        manager_->scheduleDownload(url.toStdString(),
+            std::chrono::system_clock::time_point(
+                std::chrono::milliseconds(scheduled.toMSecsSinceEpoch())));
         QMessageBox::information(this, QStringLiteral("Super Download"),
             QString::fromUtf8("已计划在 %1 开始下载").arg(
                 scheduled.toString("yyyy-MM-dd hh:mm")));
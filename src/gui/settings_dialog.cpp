@@ -111,6 +111,11 @@ QWidget* SettingsDialog::createGeneralTab()
     speed_limit_spin_->setSuffix(QString::fromUtf8(" KB/s"));
     speed_limit_spin_->setSpecialValueText(QString::fromUtf8("不限速"));
 
+    schedule_edit_ = new QPlainTextEdit(page);
+    schedule_edit_->setPlaceholderText(QString::fromUtf8(
+        "每行一条时段, 例如:\nMon-Fri 09:00-18:00 512 2\n(KB/s, 0 = 不限速; 最大并发可省略)"));
+    schedule_edit_->setMaximumHeight(90);
+
     clipboard_check_ = new QCheckBox(QString::fromUtf8("启用剪贴板监听"), page);
     clipboard_check_->setChecked(true);
 
@@ -133,6 +138,7 @@ QWidget* SettingsDialog::createGeneralTab()
     form->addRow(QString::fromUtf8("最大分块数"), max_blocks_spin_);
     form->addRow(QString::fromUtf8("最大并发任务"), max_concurrent_spin_);
     form->addRow(QString::fromUtf8("速度限制"), speed_limit_spin_);
+    form->addRow(QString::fromUtf8("带宽计划"), schedule_edit_);
     form->addRow("", clipboard_check_);
     form->addRow("", autostart_check_);
     form->addRow("", auto_open_folder_check_);
@@ -624,6 +630,21 @@ void SettingsDialog::onAccepted()
     config_.max_blocks_per_task = max_blocks_spin_->value();
     config_.max_concurrent_tasks = max_concurrent_spin_->value();
     config_.speed_limit = static_cast<int64_t>(speed_limit_spin_->value()) * 1024;
+
+    config_.schedule.clear();
+    const QStringList lines = schedule_edit_->toPlainText().split('\n', Qt::SkipEmptyParts);
+    for (const QString& line : lines) {
+        if (line.trimmed().isEmpty())
+            continue;
+        auto window = BandwidthSchedule::parse(line.trimmed().toStdString());
+        if (!window) {
+            QMessageBox::warning(this, QStringLiteral("Super Download"),
+                                 QString::fromUtf8("带宽计划格式错误: %1").arg(line.trimmed()));
+            return;
+        }
+        config_.schedule.push_back(*window);
+    }
+
     saveToSettings();
     accept();
 }
@@ -641,6 +662,8 @@ void SettingsDialog::loadFromSettings()
     int speed_kb = static_cast<int>(
         s.value("settings/speed_limit_kbps", config_.speed_limit / 1024).toLongLong());
     speed_limit_spin_->setValue(speed_kb);
+    schedule_edit_->setPlainText(
+        s.value("settings/bandwidth_schedule").toString());
     clipboard_check_->setChecked(
         s.value("settings/clipboard_monitor", true).toBool());
     auto_open_folder_check_->setChecked(
@@ -658,6 +681,7 @@ void SettingsDialog::saveToSettings()
     s.setValue("settings/max_concurrent_tasks", config_.max_concurrent_tasks);
     s.setValue("settings/speed_limit_kbps",
               static_cast<qlonglong>(config_.speed_limit / 1024));
+    s.setValue("settings/bandwidth_schedule", schedule_edit_->toPlainText().trimmed());
     s.setValue("settings/clipboard_monitor", clipboard_check_->isChecked());
     s.setValue("settings/auto_open_folder", auto_open_folder_check_->isChecked());
     s.setValue("settings/file_types", file_types_edit_->toPlainText().trimmed());
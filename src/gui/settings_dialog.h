@@ -59,6 +59,7 @@ private:
     QSpinBox* max_blocks_spin_;
     QSpinBox* max_concurrent_spin_;
     QSpinBox* speed_limit_spin_;
+    QPlainTextEdit* schedule_edit_;
     QCheckBox* clipboard_check_;
     QCheckBox* autostart_check_;
     QCheckBox* auto_open_folder_check_;
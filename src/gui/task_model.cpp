@@ -60,7 +60,7 @@ QVariant TaskModel::data(const QModelIndex& index, int role) const {
         case TaskColumn::Speed:
             return t.state == TaskState::Downloading ? formatSpeed(t.progress.speed_bytes_per_sec) : QStringLiteral("--");
         case TaskColumn::RemainingTime:
-            return t.state == TaskState::Downloading ? formatRemainingTime(t.progress.remaining_seconds) : QStringLiteral("--");
+            return t.state == TaskState::Downloading ? formatRemainingTime(t.progress.smoothed_remaining_seconds) : QStringLiteral("--");
         case TaskColumn::Status:        return t.state == TaskState::Failed && !t.error_message.empty()
                                                 ? QString::fromUtf8("失败: %1").arg(QString::fromStdString(t.error_message))
                                                 : stateToString(t.state);
@@ -229,7 +229,7 @@ void TaskModel::refresh() {
             case TaskColumn::Speed:
                 less = a.progress.speed_bytes_per_sec < b.progress.speed_bytes_per_sec; break;
             case TaskColumn::RemainingTime:
-                less = a.progress.remaining_seconds < b.progress.remaining_seconds; break;
+                less = a.progress.smoothed_remaining_seconds < b.progress.smoothed_remaining_seconds; break;
             default: less = a.task_id < b.task_id; break;
             }
             return sort_order_ == Qt::AscendingOrder ? less : !less;
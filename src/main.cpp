@@ -152,13 +152,21 @@ int main(int argc, char* argv[])
     config.default_save_dir = settings.value("settings/save_dir",
         QStandardPaths::writableLocation(QStandardPaths::DownloadLocation))
         .toString().toStdString();
+    config.data_dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+        .toStdString();
     config.max_concurrent_tasks = settings.value("settings/max_tasks", 3).toInt();
     config.max_blocks_per_task = settings.value("settings/max_blocks", 8).toInt();
     int64_t limitKbps = settings.value("settings/speed_limit_kbps", 0).toLongLong();
     config.speed_limit = limitKbps * 1024;
+    const QStringList scheduleLines = settings.value("settings/bandwidth_schedule").toString()
+                                          .split('\n', Qt::SkipEmptyParts);
+    for (const QString& line : scheduleLines) {
+        if (auto window = BandwidthSchedule::parse(line.trimmed().toStdString()))
+            config.schedule.push_back(*window);
+    }
 
     DownloadManager manager(config);
-    manager.recoverTasks();
+    manager.recoverTasks();  // in the background: the list fills in as tasks are restored
 
     // Apply stylesheet
     app.setStyleSheet(appStyleSheet());
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "bandwidth_schedule.h"
+
+namespace {
+
+constexpr int64_t kKB = 1024;
+
+std::tm at(int wday, int hour, int minute) {
+    std::tm tm{};
+    tm.tm_wday = wday;
+    tm.tm_hour = hour;
+    tm.tm_min = minute;
+    return tm;
+}
+
+BandwidthWindow window(const std::string& text) {
+    auto parsed = BandwidthSchedule::parse(text);
+    EXPECT_TRUE(parsed.has_value()) << text;
+    return parsed.value_or(BandwidthWindow{});
+}
+
+} // namespace
+
+// ── windowAt ───────────────────────────────────────────────────
+
+TEST(BandwidthScheduleTest, EmptyScheduleHasNoWindow) {
+    BandwidthSchedule schedule;
+    EXPECT_TRUE(schedule.empty());
+    EXPECT_EQ(schedule.windowAt(at(1, 12, 0)), nullptr);
+}
+
+TEST(BandwidthScheduleTest, BusinessHoursOnWeekdaysOnly) {
+    BandwidthSchedule schedule({window("Mon-Fri 09:00-18:00 512 2")});
+
+    const BandwidthWindow* active = schedule.windowAt(at(3, 9, 0));
+    ASSERT_NE(active, nullptr);
+    EXPECT_EQ(active->speed_limit, 512 * kKB);
+    EXPECT_EQ(active->max_concurrent_tasks, 2);
+
+    EXPECT_EQ(schedule.windowAt(at(3, 8, 59)), nullptr);
+    EXPECT_EQ(schedule.windowAt(at(3, 18, 0)), nullptr);   // end is exclusive
+    EXPECT_EQ(schedule.windowAt(at(6, 12, 0)), nullptr);   // Saturday
+}
+
+TEST(BandwidthScheduleTest, OvernightWindowSpillsIntoNextDay) {
+    BandwidthSchedule schedule({window("Fri 22:00-06:00 0")});
+
+    EXPECT_NE(schedule.windowAt(at(5, 23, 0)), nullptr);   // Friday night
+    EXPECT_NE(schedule.windowAt(at(6, 5, 59)), nullptr);   // Saturday morning
+    EXPECT_EQ(schedule.windowAt(at(5, 5, 0)), nullptr);    // Friday morning
+    EXPECT_EQ(schedule.windowAt(at(6, 23, 0)), nullptr);   // Saturday night
+}
+
+TEST(BandwidthScheduleTest, FirstMatchingWindowWins) {
+    BandwidthSchedule schedule({window("* 12:00-13:00 1000"), window("* 00:00-24:00 100")});
+    EXPECT_EQ(schedule.windowAt(at(0, 12, 30))->speed_limit, 1000 * kKB);
+    EXPECT_EQ(schedule.windowAt(at(0, 14, 0))->speed_limit, 100 * kKB);
+}
+
+// ── parse / format ─────────────────────────────────────────────
+
+TEST(BandwidthScheduleTest, ParsesDayLists) {
+    EXPECT_EQ(window("* 00:00-01:00 1").weekdays, 0x7F);
+    EXPECT_EQ(window("Sat,Sun 00:00-01:00 1").weekdays, 0x41);
+    EXPECT_EQ(window("mon-wed,fri 00:00-01:00 1").weekdays, 0x2E);
+    EXPECT_EQ(window("Fri-Mon 00:00-01:00 1").weekdays, 0x63);  // wraps over the weekend
+}
+
+TEST(BandwidthScheduleTest, RejectsMalformedLines) {
+    EXPECT_FALSE(BandwidthSchedule::parse(""));
+    EXPECT_FALSE(BandwidthSchedule::parse("Mon 09:00 512"));
+    EXPECT_FALSE(BandwidthSchedule::parse("Xyz 09:00-10:00 512"));
+    EXPECT_FALSE(BandwidthSchedule::parse("Mon 25:00-26:00 512"));
+    EXPECT_FALSE(BandwidthSchedule::parse("Mon 09:00-10:00 -1"));
+    EXPECT_FALSE(BandwidthSchedule::parse("Mon 09:00-10:00 512K"));
+    EXPECT_FALSE(BandwidthSchedule::parse("Mon 09:00-10:00 512 2 extra"));
+}
+
+TEST(BandwidthScheduleTest, FormatRoundTrips) {
+    for (const char* text : {"Mon,Tue,Wed,Thu,Fri 09:00-18:00 512 2", "* 22:30-06:00 0",
+                             "Sun,Sat 00:00-24:00 64"}) {
+        EXPECT_EQ(BandwidthSchedule::format(window(text)), text);
+    }
+}
@@ -0,0 +1,781 @@
+#include <gtest/gtest.h>
+#include "block.h"
+#include "chunk_map.h"
+#include "disk_writer.h"
+#include "file_sink.h"
+#include "http_engine.h"
+#include "multi_http_engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr int64_t kMB = 1024 * 1024;
+
+/// In-memory sink that can be told to fail writes.
+class MemorySink : public FileSink {
+public:
+    size_t writeAt(const char* data, size_t size, int64_t offset) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return open_; });
+        if (fail_after_ >= 0 && writes_ >= fail_after_) {
+            return 0;
+        }
+        ++writes_;
+        sizes_.push_back(size);
+        threads_.push_back(std::this_thread::get_id());
+        size_t end = static_cast<size_t>(offset) + size;
+        if (content_.size() < end) {
+            content_.resize(end, '.');
+        }
+        content_.replace(static_cast<size_t>(offset), size, data, size);
+        return size;
+    }
+
+    void close() override {}
+    bool sync() override { return true; }
+    FileSinkBackend backend() const override { return FileSinkBackend::Default; }
+    uint64_t device() const override { return 1; }
+
+    /// Let `writes` more writes succeed, then fail every one; -1 = never fail.
+    void failAfter(int writes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fail_after_ = writes < 0 ? -1 : writes_ + writes;
+    }
+
+    /// Block writes until release().
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = false;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    std::string content() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return content_;
+    }
+
+    /// Size of each successful write, in order.
+    std::vector<size_t> sizes() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sizes_;
+    }
+
+    /// Thread of each successful write, in order.
+    std::vector<std::thread::id> threads() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return threads_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool open_ = true;
+    std::vector<size_t> sizes_;
+    std::vector<std::thread::id> threads_;
+    int writes_ = 0;
+    int fail_after_ = -1;
+    std::string content_;
+};
+
+/// A local file served through file://, so the data path runs without a server.
+class SourceFile {
+public:
+    explicit SourceFile(size_t size)
+        : path_(fs::temp_directory_path() / "block_test_source.bin")
+    {
+        data_.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            data_[i] = static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+        }
+        std::ofstream out(path_, std::ios::binary);
+        out.write(data_.data(), static_cast<std::streamsize>(size));
+    }
+
+    ~SourceFile() {
+        std::error_code ec;
+        fs::remove(path_, ec);
+    }
+
+    std::string url() const { return "file://" + path_.string(); }
+    const std::string& data() const { return data_; }
+
+private:
+    fs::path path_;
+    std::string data_;
+};
+
+std::unique_ptr<Block> makeBlock(int64_t start, int64_t end, int64_t downloaded = 0,
+                                 bool completed = false) {
+    BlockInfo bi;
+    bi.block_id = 0;
+    bi.range_start = start;
+    bi.range_end = end;
+    bi.downloaded = downloaded;
+    bi.completed = completed;
+    return std::make_unique<Block>(bi, nullptr, "http://127.0.0.1:1/f.bin",
+                                   nullptr, nullptr, nullptr);
+}
+
+#ifndef _WIN32
+
+/// Minimal HTTP server on 127.0.0.1 answering GET/HEAD with Range support,
+/// one thread per connection. file:// transfers cannot be paused, so the
+/// engine's backpressure path needs a real socket.
+class RangeServer {
+public:
+    explicit RangeServer(std::string body) : body_(std::move(body)) {
+        listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(listen_fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+        ::listen(listen_fd_, 16);
+        socklen_t len = sizeof(addr);
+        ::getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len);
+        port_ = ntohs(addr.sin_port);
+        acceptor_ = std::thread([this] { acceptLoop(); });
+    }
+
+    ~RangeServer() {
+        ::shutdown(listen_fd_, SHUT_RDWR);
+        ::close(listen_fd_);
+        acceptor_.join();
+        std::vector<std::thread> connections;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (int fd : open_fds_) {
+                ::shutdown(fd, SHUT_RDWR);
+            }
+            connections.swap(connections_);
+        }
+        for (auto& connection : connections) {
+            connection.join();
+        }
+    }
+
+    std::string url() const { return "http://127.0.0.1:" + std::to_string(port_) + "/f.bin"; }
+
+    /// Send bodies in pieces of `piece` bytes, `gap` apart.
+    void setPacing(size_t piece, std::chrono::milliseconds gap) {
+        piece_ = piece;
+        gap_ = gap;
+    }
+
+private:
+    void acceptLoop() {
+        while (true) {
+            int fd = ::accept(listen_fd_, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_fds_.push_back(fd);
+            connections_.emplace_back([this, fd] { serve(fd); });
+        }
+    }
+
+    void serve(int fd) {
+        std::string request;
+        char buf[4096];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                finish(fd);
+                return;
+            }
+            request.append(buf, static_cast<size_t>(n));
+        }
+
+        size_t first = 0;
+        size_t last = body_.size() - 1;
+        bool ranged = false;
+        size_t range = request.find("Range: bytes=");
+        if (range != std::string::npos) {
+            ranged = true;
+            size_t dash = request.find('-', range);
+            first = std::stoul(request.substr(range + 13, dash - range - 13));
+            if (std::isdigit(static_cast<unsigned char>(request[dash + 1]))) {
+                last = std::min<size_t>(std::stoul(request.substr(dash + 1)), last);
+            }
+        }
+
+        std::string head = std::string(ranged ? "HTTP/1.1 206 Partial Content" : "HTTP/1.1 200 OK")
+            + "\r\nAccept-Ranges: bytes\r\nConnection: close\r\nContent-Length: "
+            + std::to_string(last - first + 1) + "\r\n";
+        if (ranged) {
+            head += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last)
+                + "/" + std::to_string(body_.size()) + "\r\n";
+        }
+        head += "\r\n";
+        if (sendAll(fd, head.data(), head.size()) && request.compare(0, 4, "HEAD") != 0) {
+            for (size_t pos = first; pos <= last; pos += piece_) {
+                if (pos > first) {
+                    std::this_thread::sleep_for(gap_);
+                }
+                size_t size = std::min(piece_, last + 1 - pos);
+                if (!sendAll(fd, body_.data() + pos, size)) {
+                    break;  // the client went away
+                }
+            }
+        }
+        finish(fd);
+    }
+
+    static bool sendAll(int fd, const char* data, size_t size) {
+        for (size_t sent = 0; sent < size;) {
+            ssize_t n = ::send(fd, data + sent, size - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void finish(int fd) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_fds_.erase(std::find(open_fds_.begin(), open_fds_.end(), fd));
+        ::close(fd);
+    }
+
+    std::string body_;
+    size_t piece_ = SIZE_MAX;
+    std::chrono::milliseconds gap_{0};
+    int listen_fd_ = -1;
+    int port_ = 0;
+    std::thread acceptor_;
+    std::mutex mutex_;  // guards the two below
+    std::vector<int> open_fds_;
+    std::vector<std::thread> connections_;
+};
+
+#endif
+
+} // namespace
+
+// ── remainingBytes ─────────────────────────────────────────────
+
+TEST(BlockTest, RemainingBytesSubtractsDownloaded) {
+    auto block = makeBlock(100, 199, 40);
+    EXPECT_EQ(block->remainingBytes(), 60);
+}
+
+TEST(BlockTest, RemainingBytesZeroWhenCompletedOrUnknownSize) {
+    EXPECT_EQ(makeBlock(0, 99, 100, true)->remainingBytes(), 0);
+    EXPECT_EQ(makeBlock(-1, -1)->remainingBytes(), 0);
+}
+
+// ── splitTail ──────────────────────────────────────────────────
+
+TEST(BlockTest, SplitTailGivesAwayBackHalf) {
+    auto block = makeBlock(0, 10 * kMB - 1);
+    auto tail = block->splitTail(kMB);
+    ASSERT_TRUE(tail.has_value());
+
+    EXPECT_EQ(tail->range_start, 5 * kMB);
+    EXPECT_EQ(tail->range_end, 10 * kMB - 1);
+    EXPECT_EQ(tail->downloaded, 0);
+    EXPECT_FALSE(tail->completed);
+    EXPECT_EQ(block->getInfo().range_end, 5 * kMB - 1);
+}
+
+TEST(BlockTest, SplitTailStartsAfterDownloadedBytes) {
+    auto block = makeBlock(4 * kMB, 12 * kMB - 1, 2 * kMB);
+    auto tail = block->splitTail(kMB);
+    ASSERT_TRUE(tail.has_value());
+
+    // 6 MB remain from offset 6 MB: each side keeps 3 MB
+    EXPECT_EQ(tail->range_start, 9 * kMB);
+    EXPECT_EQ(block->getInfo().range_end, 9 * kMB - 1);
+    EXPECT_EQ(block->remainingBytes(), 3 * kMB);
+}
+
+TEST(BlockTest, SplitTailRefusesSmallRemainder) {
+    auto block = makeBlock(0, 2 * kMB - 1, 1);
+    EXPECT_FALSE(block->splitTail(kMB).has_value());
+    EXPECT_EQ(block->getInfo().range_end, 2 * kMB - 1);
+}
+
+TEST(BlockTest, SplitTailRefusesCompletedAndUnknownSize) {
+    EXPECT_FALSE(makeBlock(0, 10 * kMB - 1, 10 * kMB, true)->splitTail(kMB).has_value());
+    EXPECT_FALSE(makeBlock(-1, -1)->splitTail(kMB).has_value());
+}
+
+TEST(BlockTest, RepeatedSplitsStayContiguous) {
+    auto block = makeBlock(0, 16 * kMB - 1);
+    auto first = block->splitTail(kMB);
+    auto second = block->splitTail(kMB);
+    ASSERT_TRUE(first.has_value());
+    ASSERT_TRUE(second.has_value());
+
+    EXPECT_EQ(block->getInfo().range_end + 1, second->range_start);
+    EXPECT_EQ(second->range_end + 1, first->range_start);
+    EXPECT_EQ(first->range_end, 16 * kMB - 1);
+}
+
+// ── End-game racing ────────────────────────────────────────────
+
+TEST(BlockTest, RacerFinishesWhenPrimaryRangeFilled) {
+    auto primary = makeBlock(0, kMB - 1, kMB);
+    auto racer = makeBlock(kMB / 2, kMB - 1);
+    racer->raceFor(primary.get());
+
+    EXPECT_EQ(racer->primary(), primary.get());
+    EXPECT_TRUE(racer->finishIfFilled());
+    EXPECT_TRUE(racer->getInfo().completed);
+    EXPECT_TRUE(primary->finishIfFilled());
+    EXPECT_TRUE(primary->getInfo().completed);
+}
+
+TEST(BlockTest, RaceContinuesWhilePrimaryHasBytesLeft) {
+    auto primary = makeBlock(0, kMB - 1, kMB / 2);
+    auto racer = makeBlock(kMB / 2, kMB - 1);
+    racer->raceFor(primary.get());
+
+    EXPECT_FALSE(racer->finishIfFilled());
+    EXPECT_FALSE(racer->getInfo().completed);
+    EXPECT_FALSE(primary->finishIfFilled());
+    EXPECT_EQ(makeBlock(0, 9)->primary(), nullptr);
+}
+
+// ── Completion countdown ───────────────────────────────────────
+
+TEST(BlockTest, CompletionCounterCountsDownOnce) {
+    std::atomic<int> remaining{2};
+    auto filled = makeBlock(0, kMB - 1, kMB);
+    auto partial = makeBlock(kMB, 2 * kMB - 1, kMB / 2);
+    filled->setCompletionCounter(&remaining);
+    partial->setCompletionCounter(&remaining);
+
+    EXPECT_TRUE(filled->finishIfFilled());
+    EXPECT_TRUE(filled->finishIfFilled());
+    EXPECT_FALSE(partial->finishIfFilled());
+    EXPECT_EQ(remaining.load(), 1);
+}
+
+// ── Write coalescing ───────────────────────────────────────────
+
+TEST(BlockTest, SmallChunksAreCoalescedIntoBufferSizedWrites) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 2);
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    std::atomic<int64_t> progress{0};
+    Block block(bi, &sink, source.url(), &engine, nullptr,
+                [&progress](int, int64_t delta) { progress += delta; });
+    block.setBufferPool(&pool);
+    block.execute(HttpConfig());
+
+    // The transfer delivers far smaller pieces than a buffer
+    std::vector<size_t> sizes = sink.sizes();
+    ASSERT_EQ(sizes.size(), 16u);
+    for (size_t size : sizes) {
+        EXPECT_EQ(size, 64u * 1024);
+    }
+    EXPECT_EQ(sink.content(), source.data());
+    EXPECT_EQ(progress.load(), kMB);
+    EXPECT_TRUE(block.getInfo().completed);
+    EXPECT_EQ(pool.inUse(), 0u);  // every buffer back in the pool
+}
+
+TEST(BlockTest, DiskWriterWritesOffTheTransferThread) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 4);
+    DiskWriter writer(2, 1);
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    std::atomic<int64_t> progress{0};
+    Block block(bi, &sink, source.url(), &engine, nullptr,
+                [&progress](int, int64_t delta) { progress += delta; });
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+    block.execute(HttpConfig());
+
+    // Every full buffer went through the writer; the tail is flushed on completion
+    std::vector<std::thread::id> threads = sink.threads();
+    ASSERT_FALSE(threads.empty());
+    EXPECT_NE(threads.front(), std::this_thread::get_id());
+    EXPECT_GE(writer.stats().writes, 15u);
+    EXPECT_EQ(sink.content(), source.data());
+    EXPECT_EQ(progress.load(), kMB);
+    EXPECT_EQ(block.getInfo().downloaded, kMB);
+}
+
+TEST(BlockTest, OldBufferIsWrittenBeforeItFills) {
+#ifdef _WIN32
+    GTEST_SKIP() << "test server is POSIX only";
+#else
+    // 4 pieces 300 ms apart, into a buffer they never fill
+    SourceFile source(64 * 1024);
+    RangeServer server(source.data());
+    server.setPacing(16 * 1024, std::chrono::milliseconds(300));
+    MemorySink sink;
+    BufferPool pool(kMB, 1);
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = 64 * 1024 - 1;
+    Block block(bi, &sink, server.url(), &engine, nullptr, nullptr);
+    block.setBufferPool(&pool);
+    block.execute(HttpConfig());
+
+    // Aged out at least once before the completion flush
+    EXPECT_GE(sink.sizes().size(), 2u);
+    EXPECT_EQ(sink.content(), source.data());
+#endif
+}
+
+// ── Backpressure ───────────────────────────────────────────────
+
+TEST(BlockTest, BusyWriterPausesTheTransferUntilItCatchesUp) {
+#ifdef _WIN32
+    GTEST_SKIP() << "test server is POSIX only";
+#else
+    SourceFile source(3 * kMB);
+    RangeServer server(source.data());
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 8);
+    // The writer thread takes one block's write and the queue holds
+    // another: the third block is turned away
+    DiskWriter writer(1, 1);
+    MultiHttpEngine engine(4);
+
+    std::vector<std::unique_ptr<Block>> blocks;
+    for (int i = 0; i < 3; ++i) {
+        BlockInfo bi;
+        bi.block_id = i;
+        bi.range_start = i * kMB;
+        bi.range_end = (i + 1) * kMB - 1;
+        blocks.push_back(std::make_unique<Block>(bi, &sink, server.url(), nullptr, nullptr,
+                                                 nullptr));
+        blocks.back()->setBufferPool(&pool);
+        blocks.back()->setDiskWriter(&writer);
+    }
+
+    // The disk stalls: the transfers are paused (not failed) meanwhile
+    sink.hold();
+    std::promise<void> done[3];
+    std::atomic<int> failures{0};
+    for (int i = 0; i < 3; ++i) {
+        blocks[i]->start(&engine, HttpConfig(), [&done, &failures](int id, const HttpError* error) {
+            if (error) {
+                ++failures;
+            }
+            done[id].set_value();
+        });
+    }
+    std::vector<std::future<void>> finished;
+    for (auto& promise : done) {
+        finished.push_back(promise.get_future());
+    }
+    EXPECT_EQ(finished[0].wait_for(std::chrono::milliseconds(300)), std::future_status::timeout);
+    for (const auto& block : blocks) {
+        EXPECT_EQ(block->getInfo().downloaded, 0);
+    }
+    EXPECT_GT(writer.stats().rejected, 0u);
+
+    sink.release();
+    for (auto& future : finished) {
+        future.get();
+    }
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_EQ(sink.content(), source.data());
+    for (const auto& block : blocks) {
+        EXPECT_TRUE(block->getInfo().completed);
+    }
+#endif
+}
+
+TEST(BlockTest, DestructorWaitsForTheRunningCompletionCallback) {
+#ifdef _WIN32
+    GTEST_SKIP() << "test server is POSIX only";
+#else
+    SourceFile source(64 * 1024);
+    RangeServer server(source.data());
+    MemorySink sink;
+    MultiHttpEngine engine(4);
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = 64 * 1024 - 1;
+    auto block = std::make_unique<Block>(bi, &sink, server.url(), nullptr, nullptr, nullptr);
+
+    std::promise<void> entered;
+    std::atomic<bool> left{false};
+    block->start(&engine, HttpConfig(), [&entered, &left](int, const HttpError*) {
+        entered.set_value();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        left = true;
+    });
+
+    // Destroyed while on_done still runs on the reactor: must wait for it
+    entered.get_future().get();
+    block.reset();
+    EXPECT_TRUE(left.load());
+#endif
+}
+
+TEST(BlockTest, BusyWriterHoldsBackTheThreadPoolTransfer) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 2);
+    DiskWriter writer(1, 1);
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    Block block(bi, &sink, source.url(), &engine, nullptr, nullptr);
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+
+    sink.hold();
+    auto finished = std::async(std::launch::async, [&block] { block.execute(HttpConfig()); });
+    EXPECT_EQ(finished.wait_for(std::chrono::milliseconds(300)), std::future_status::timeout);
+    EXPECT_EQ(block.getInfo().downloaded, 0);
+
+    sink.release();
+    finished.get();
+    EXPECT_EQ(sink.content(), source.data());
+}
+
+// ── Chunk map ──────────────────────────────────────────────────
+
+TEST(BlockTest, WrittenBytesAreReportedToTheChunkMap) {
+    const int64_t size = 4 * ChunkMap::kDefaultChunkSize;
+    SourceFile source(static_cast<size_t>(size));
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 4);
+    DiskWriter writer(2, 1);
+    HttpEngine engine;
+    ChunkMap chunks(size);
+
+    // The second half only, then a failed write part way through it
+    BlockInfo bi;
+    bi.range_start = size / 2;
+    bi.range_end = size - 1;
+    Block block(bi, &sink, source.url(), &engine, nullptr, nullptr);
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+    block.setChunkMap(&chunks);
+
+    sink.failAfter(5);  // 320 KB: chunk 2 and a part of chunk 3
+    EXPECT_THROW(block.execute(HttpConfig()), HttpError);
+    EXPECT_FALSE(chunks.isDone(1));
+    EXPECT_TRUE(chunks.isDone(2));
+    EXPECT_FALSE(chunks.isDone(3));
+    EXPECT_EQ(chunks.doneBytes(), ChunkMap::kDefaultChunkSize);
+
+    sink.failAfter(-1);
+    block.execute(HttpConfig());
+    EXPECT_TRUE(chunks.isDone(3));
+    EXPECT_EQ(chunks.doneBytes(), size / 2);
+    EXPECT_EQ(chunks.missingRanges(), (std::vector<std::pair<int64_t, int64_t>>{
+        {0, size / 2 - 1}}));
+}
+
+// ── Failed writes ──────────────────────────────────────────────
+
+TEST(BlockTest, FailedWriteEndsWithWriteErrorAndResumesAtTheGap) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 4);
+    DiskWriter writer(2, 1);
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    std::atomic<int64_t> progress{0};
+    Block block(bi, &sink, source.url(), &engine, nullptr,
+                [&progress](int, int64_t delta) { progress += delta; });
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+
+    // The fourth buffer cannot be written: the transfer stops there
+    sink.failAfter(3);
+    try {
+        block.execute(HttpConfig());
+        FAIL() << "execute() did not report the failed write";
+    } catch (const HttpError& e) {
+        EXPECT_TRUE(Block::isWriteError(e));
+        EXPECT_TRUE(e.isRetryable());
+    }
+    EXPECT_EQ(block.getInfo().downloaded, 3 * 64 * 1024);
+    EXPECT_EQ(progress.load(), 3 * 64 * 1024);
+    EXPECT_FALSE(block.getInfo().completed);
+
+    // Once the disk takes writes again the block continues from the gap
+    sink.failAfter(-1);
+    block.execute(HttpConfig());
+    EXPECT_TRUE(block.getInfo().completed);
+    EXPECT_EQ(progress.load(), kMB);
+    EXPECT_EQ(sink.content(), source.data());
+}
+
+TEST(BlockTest, FailedWriteThroughEndsWithWriteError) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    HttpEngine engine;
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    Block block(bi, &sink, source.url(), &engine, nullptr, nullptr);
+
+    sink.failAfter(2);
+    EXPECT_THROW({
+        try {
+            block.execute(HttpConfig());
+        } catch (const HttpError& e) {
+            EXPECT_TRUE(Block::isWriteError(e));
+            throw;
+        }
+    }, HttpError);
+    int64_t written = block.getInfo().downloaded;
+    EXPECT_GT(written, 0);
+    EXPECT_LT(written, kMB);
+
+    sink.failAfter(-1);
+    block.execute(HttpConfig());
+    EXPECT_TRUE(block.getInfo().completed);
+    EXPECT_EQ(sink.content(), source.data());
+}
+
+TEST(BlockTest, UnknownSizeRetryRewritesFromTheStart) {
+    SourceFile source(kMB);
+    MemorySink sink;
+    HttpEngine engine;
+
+    // No Range header without a size: the retry gets the body from byte 0
+    BlockInfo bi;
+    bi.range_start = -1;
+    bi.range_end = -1;
+    Block block(bi, &sink, source.url(), &engine, nullptr, nullptr);
+
+    sink.failAfter(2);
+    EXPECT_THROW(block.execute(HttpConfig()), HttpError);
+    int64_t written = block.getInfo().downloaded;
+    EXPECT_GT(written, 0);
+    EXPECT_LT(written, kMB);
+
+    // The bytes already on disk are skipped, not written again further on
+    sink.failAfter(-1);
+    block.execute(HttpConfig());
+    EXPECT_TRUE(block.getInfo().completed);
+    EXPECT_EQ(block.getInfo().downloaded, kMB);
+    EXPECT_EQ(sink.content(), source.data());
+}
+
+TEST(BlockTest, FailedWriteOnTheEngineReportsWriteError) {
+#ifdef _WIN32
+    GTEST_SKIP() << "test server is POSIX only";
+#else
+    SourceFile source(kMB);
+    RangeServer server(source.data());
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 4);
+    DiskWriter writer(2, 1);
+    MultiHttpEngine engine(4);
+
+    BlockInfo bi;
+    bi.range_start = 0;
+    bi.range_end = kMB - 1;
+    Block block(bi, &sink, server.url(), nullptr, nullptr, nullptr);
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+
+    sink.failAfter(1);
+    std::promise<bool> failed;
+    block.start(&engine, HttpConfig(), [&failed](int, const HttpError* error) {
+        failed.set_value(error && Block::isWriteError(*error));
+    });
+    EXPECT_TRUE(failed.get_future().get());
+    EXPECT_EQ(block.getInfo().downloaded, 64 * 1024);
+
+    // The Task restarts it like this: from the first byte not on disk
+    sink.failAfter(-1);
+    std::promise<bool> done;
+    block.start(&engine, HttpConfig(), [&done](int, const HttpError* error) {
+        done.set_value(error == nullptr);
+    });
+    EXPECT_TRUE(done.get_future().get());
+    EXPECT_EQ(sink.content(), source.data());
+#endif
+}
+
+TEST(BlockTest, UnknownSizeRestartOnTheEngineRewritesFromTheStart) {
+#ifdef _WIN32
+    GTEST_SKIP() << "test server is POSIX only";
+#else
+    SourceFile source(kMB);
+    RangeServer server(source.data());
+    MemorySink sink;
+    BufferPool pool(64 * 1024, 4);
+    DiskWriter writer(2, 1);
+    MultiHttpEngine engine(4);
+
+    BlockInfo bi;
+    bi.range_start = -1;
+    bi.range_end = -1;
+    Block block(bi, &sink, server.url(), nullptr, nullptr, nullptr);
+    block.setBufferPool(&pool);
+    block.setDiskWriter(&writer);
+
+    sink.failAfter(1);
+    std::promise<bool> failed;
+    block.start(&engine, HttpConfig(), [&failed](int, const HttpError* error) {
+        failed.set_value(error && Block::isWriteError(*error));
+    });
+    EXPECT_TRUE(failed.get_future().get());
+    EXPECT_EQ(block.getInfo().downloaded, 64 * 1024);
+
+    // The restart gets the body from byte 0 again (no Range header)
+    sink.failAfter(-1);
+    std::promise<bool> done;
+    block.start(&engine, HttpConfig(), [&done](int, const HttpError* error) {
+        done.set_value(error == nullptr);
+    });
+    EXPECT_TRUE(done.get_future().get());
+    EXPECT_EQ(block.getInfo().downloaded, kMB);
+    EXPECT_EQ(sink.content(), source.data());
+#endif
+}
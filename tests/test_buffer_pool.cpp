@@ -0,0 +1,88 @@
+#include <gtest/gtest.h>
+#include "buffer_pool.h"
+
+#include <vector>
+
+// ── Lending ────────────────────────────────────────────────────
+
+TEST(BufferPoolTest, LendsUpToMaxBuffers) {
+    BufferPool pool(4096, 2);
+    auto a = pool.acquire();
+    auto b = pool.acquire();
+    EXPECT_NE(a, nullptr);
+    EXPECT_NE(b, nullptr);
+    EXPECT_EQ(pool.acquire(), nullptr);
+    EXPECT_EQ(pool.inUse(), 2u);
+    EXPECT_EQ(pool.bufferSize(), 4096u);
+}
+
+TEST(BufferPoolTest, ReleasedBufferIsRecycled) {
+    BufferPool pool(4096, 1);
+    auto a = pool.acquire();
+    char* raw = a.get();
+    pool.release(std::move(a));
+    EXPECT_EQ(pool.inUse(), 0u);
+
+    auto b = pool.acquire();
+    EXPECT_EQ(b.get(), raw);
+}
+
+TEST(BufferPoolTest, ZeroSizeDisablesBuffering) {
+    BufferPool pool(0, 8);
+    EXPECT_EQ(pool.acquire(), nullptr);
+}
+
+TEST(BufferPoolTest, ReleaseNullIsIgnored) {
+    BufferPool pool(4096, 1);
+    auto a = pool.acquire();
+    pool.release(nullptr);
+    EXPECT_EQ(pool.inUse(), 1u);
+}
+
+// ── Resizing ───────────────────────────────────────────────────
+
+TEST(BufferPoolTest, ShrinkingLimitsFurtherLending) {
+    BufferPool pool(1024, 4);
+    std::vector<BufferPool::Buffer> lent;
+    for (int i = 0; i < 3; ++i) {
+        lent.push_back(pool.acquire());
+    }
+    pool.setMaxBuffers(2);
+    EXPECT_EQ(pool.acquire(), nullptr);
+
+    pool.release(std::move(lent.back()));
+    lent.pop_back();
+    EXPECT_EQ(pool.acquire(), nullptr);  // still 2 lent out
+
+    pool.setMaxBuffers(3);
+    EXPECT_NE(pool.acquire(), nullptr);
+}
+
+// ── Hooks ──────────────────────────────────────────────────────
+
+TEST(BufferPoolTest, HooksSeeEveryAllocationAndFree) {
+    std::vector<const char*> allocated;
+    std::vector<const char*> freed;
+    {
+        BufferPool pool(4096, 2);
+        pool.setHooks(
+            [&](const char* data, size_t size) {
+                EXPECT_EQ(size, 4096u);
+                allocated.push_back(data);
+            },
+            [&](const char* data, size_t) { freed.push_back(data); });
+
+        auto a = pool.acquire();
+        auto b = pool.acquire();
+        pool.release(std::move(a));
+        auto c = pool.acquire();  // recycled: no new allocation
+        EXPECT_EQ(allocated.size(), 2u);
+
+        pool.setMaxBuffers(1);
+        pool.release(std::move(b));  // over the new limit: freed
+        EXPECT_EQ(freed.size(), 1u);
+        pool.release(std::move(c));
+    }
+    // The recycled one is freed with the pool
+    EXPECT_EQ(freed.size(), 2u);
+}
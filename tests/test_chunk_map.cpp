@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include "chunk_map.h"
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kChunk = ChunkMap::kDefaultChunkSize;
+
+using Ranges = std::vector<std::pair<int64_t, int64_t>>;
+
+} // anonymous namespace
+
+// ── marking ────────────────────────────────────────────────────
+
+TEST(ChunkMapTest, ChunkIsDoneOnlyOnceEveryByteIsWritten) {
+    ChunkMap map(4 * kChunk);
+    ASSERT_EQ(map.chunkCount(), 4u);
+
+    map.markWritten(kChunk, kChunk / 2);
+    EXPECT_FALSE(map.isDone(1));
+    map.markWritten(kChunk + kChunk / 2, kChunk / 2);
+    EXPECT_TRUE(map.isDone(1));
+    EXPECT_FALSE(map.isDone(0));
+    EXPECT_FALSE(map.isDone(2));
+    EXPECT_EQ(map.doneBytes(), kChunk);
+}
+
+TEST(ChunkMapTest, WritesOutOfOrderAndAcrossChunks) {
+    ChunkMap map(3 * kChunk);
+
+    // Back to front, each write straddling a chunk boundary
+    map.markWritten(2 * kChunk + 100, kChunk - 100);
+    map.markWritten(kChunk + 100, kChunk);
+    map.markWritten(100, kChunk);
+    EXPECT_FALSE(map.isDone(0));
+    EXPECT_TRUE(map.isDone(1));
+    EXPECT_TRUE(map.isDone(2));
+
+    map.markWritten(0, 100);
+    EXPECT_TRUE(map.isDone(0));
+    EXPECT_EQ(map.doneBytes(), 3 * kChunk);
+}
+
+TEST(ChunkMapTest, ShortLastChunk) {
+    ChunkMap map(2 * kChunk + 10);
+    ASSERT_EQ(map.chunkCount(), 3u);
+
+    map.markWritten(2 * kChunk, 10);
+    EXPECT_TRUE(map.isDone(2));
+    EXPECT_EQ(map.doneBytes(), 10);
+}
+
+TEST(ChunkMapTest, ConcurrentWritersOnSharedChunks) {
+    ChunkMap map(64 * kChunk);
+    const int64_t piece = kChunk / 3;  // pieces never line up with chunks
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) {
+        writers.emplace_back([&map, t, piece] {
+            for (int64_t off = t * piece; off < 64 * kChunk; off += 4 * piece) {
+                map.markWritten(off, piece);
+            }
+        });
+    }
+    for (auto& w : writers) {
+        w.join();
+    }
+    EXPECT_EQ(map.doneBytes(), 64 * kChunk);
+}
+
+TEST(ChunkMapTest, LargeFilesGetLargerChunks) {
+    EXPECT_EQ(ChunkMap::chunkSizeFor(100 * 1024 * 1024), kChunk);
+    int64_t huge = kChunk * static_cast<int64_t>(ChunkMap::kMaxChunks) * 3;
+    EXPECT_EQ(ChunkMap::chunkSizeFor(huge), 4 * kChunk);
+}
+
+// ── bitmap ─────────────────────────────────────────────────────
+
+TEST(ChunkMapTest, BitmapRoundTrip) {
+    ChunkMap map(10 * kChunk);
+    map.markWritten(0, kChunk);
+    map.markWritten(3 * kChunk, 2 * kChunk);
+    map.markWritten(9 * kChunk, kChunk);
+    map.markWritten(6 * kChunk, kChunk - 1);  // not done: not in the bitmap
+
+    auto bits = map.bitmap();
+    ASSERT_EQ(bits.size(), 2u);
+    EXPECT_EQ(bits[0], 0x19);  // chunks 0, 3, 4
+    EXPECT_EQ(bits[1], 0x02);  // chunk 9
+
+    ChunkMap restored(10 * kChunk, kChunk, bits);
+    EXPECT_EQ(restored.bitmap(), bits);
+    EXPECT_EQ(restored.doneBytes(), 4 * kChunk);
+    EXPECT_FALSE(restored.isDone(6));
+}
+
+// ── missing ranges ─────────────────────────────────────────────
+
+TEST(ChunkMapTest, MissingRangesMergeAdjacentChunks) {
+    ChunkMap map(6 * kChunk + 5);
+    map.markWritten(kChunk, kChunk);
+    map.markWritten(4 * kChunk, kChunk);
+
+    Ranges expected = {
+        {0, kChunk - 1},
+        {2 * kChunk, 4 * kChunk - 1},
+        {5 * kChunk, 6 * kChunk + 4},
+    };
+    EXPECT_EQ(map.missingRanges(), expected);
+}
+
+TEST(ChunkMapTest, MissingRangesFillTheSmallestGaps) {
+    ChunkMap map(12 * kChunk);
+    // Missing: 0, 2, 5, 11 -> gaps of 1, 2 and 5 chunks
+    for (size_t i : {1, 3, 4, 6, 7, 8, 9, 10}) {
+        map.markWritten(static_cast<int64_t>(i) * kChunk, kChunk);
+    }
+    ASSERT_EQ(map.missingRanges().size(), 4u);
+
+    Ranges expected = {
+        {0, 6 * kChunk - 1},
+        {11 * kChunk, 12 * kChunk - 1},
+    };
+    EXPECT_EQ(map.missingRanges(2), expected);
+    EXPECT_EQ(map.missingRanges(1), (Ranges{{0, 12 * kChunk - 1}}));
+}
+
+TEST(ChunkMapTest, CompleteMapHasNoMissingRanges) {
+    ChunkMap map(3 * kChunk);
+    map.markWritten(0, 3 * kChunk);
+    EXPECT_TRUE(map.missingRanges().empty());
+}
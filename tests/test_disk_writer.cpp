@@ -0,0 +1,268 @@
+#include <gtest/gtest.h>
+#include "disk_writer.h"
+#include "file_sink.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+/// In-memory sink whose writes can be held back to fill the writer queue.
+class GatedSink : public FileSink {
+public:
+    explicit GatedSink(uint64_t device = 1) : device_(device) {}
+
+    size_t writeAt(const char* data, size_t size, int64_t offset) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return open_; });
+        if (fail_) {
+            return 0;
+        }
+        size_t end = static_cast<size_t>(offset) + size;
+        if (content_.size() < end) {
+            content_.resize(end, '.');
+        }
+        content_.replace(static_cast<size_t>(offset), size, data, size);
+        return size;
+    }
+
+    void close() override {}
+    bool sync() override { return true; }
+    FileSinkBackend backend() const override { return FileSinkBackend::Default; }
+    uint64_t device() const override { return device_; }
+
+    void hold() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_ = false;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            open_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    void failWrites() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fail_ = true;
+    }
+
+    std::string content() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return content_;
+    }
+
+private:
+    const uint64_t device_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool open_ = true;
+    bool fail_ = false;
+    std::string content_;
+};
+
+/// Sink with asynchronous writes whose completions are held until
+/// complete() runs them, as a completion thread would.
+class AsyncSink : public FileSink {
+public:
+    size_t writeAt(const char*, size_t size, int64_t) override { return size; }
+
+    bool writeAtAsync(const char*, size_t, int64_t,
+                      std::function<void(bool ok)> on_done) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(on_done));
+        return true;
+    }
+
+    void close() override {}
+    bool sync() override { return true; }
+    FileSinkBackend backend() const override { return FileSinkBackend::IoUring; }
+    uint64_t device() const override { return 1; }
+
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pending_.size();
+    }
+
+    void complete() {
+        std::vector<std::function<void(bool)>> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done.swap(pending_);
+        }
+        for (auto& on_done : done) {
+            on_done(true);
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<std::function<void(bool)>> pending_;
+};
+
+} // namespace
+
+// ── Writing ────────────────────────────────────────────────────
+
+TEST(DiskWriterTest, WritesAtOffsetAndCallsBack) {
+    GatedSink sink;
+    std::promise<bool> done;
+    {
+        DiskWriter writer(4, 1);
+        ASSERT_TRUE(writer.trySubmit(&sink, "world", 5, 6, [&](bool ok) { done.set_value(ok); }));
+        EXPECT_TRUE(done.get_future().get());
+    }
+    EXPECT_EQ(sink.content(), "......world");
+}
+
+TEST(DiskWriterTest, FailedWriteReportsFalse) {
+    GatedSink sink;
+    sink.failWrites();
+    DiskWriter writer(4, 1);
+
+    std::promise<bool> done;
+    ASSERT_TRUE(writer.trySubmit(&sink, "x", 1, 0, [&](bool ok) { done.set_value(ok); }));
+    EXPECT_FALSE(done.get_future().get());
+    EXPECT_EQ(writer.stats().bytes_written, 0u);
+}
+
+TEST(DiskWriterTest, DestructorFinishesQueuedWrites) {
+    GatedSink sink;
+    std::atomic<int> completed{0};
+    {
+        DiskWriter writer(8, 1);
+        sink.hold();
+        for (int i = 0; i < 4; ++i) {
+            ASSERT_TRUE(writer.trySubmit(&sink, "ab", 2, i * 2, [&](bool) { ++completed; }));
+        }
+        sink.release();
+    }
+    EXPECT_EQ(completed.load(), 4);
+    EXPECT_EQ(sink.content(), "abababab");
+}
+
+// ── Backpressure ───────────────────────────────────────────────
+
+TEST(DiskWriterTest, FullQueueRefusesWithoutBlocking) {
+    GatedSink sink;
+    sink.hold();
+    DiskWriter writer(2, 1);
+
+    // One write is taken by the (held) writer thread, two wait in the queue
+    ASSERT_TRUE(writer.trySubmit(&sink, "a", 1, 0, nullptr));
+    while (writer.stats().queue_depth != 0) {
+        std::this_thread::yield();
+    }
+    ASSERT_TRUE(writer.trySubmit(&sink, "b", 1, 1, nullptr));
+    ASSERT_TRUE(writer.trySubmit(&sink, "c", 1, 2, nullptr));
+
+    EXPECT_FALSE(writer.trySubmit(&sink, "d", 1, 3, nullptr));
+    DiskWriterStats stats = writer.stats();
+    EXPECT_EQ(stats.queue_depth, 2u);
+    EXPECT_EQ(stats.queue_capacity, 2u);
+    EXPECT_EQ(stats.rejected, 1u);
+
+    sink.release();
+}
+
+TEST(DiskWriterTest, DevicesHaveSeparateQueues) {
+    GatedSink slow(1);
+    GatedSink fast(2);
+    slow.hold();
+    DiskWriter writer(1, 1);
+
+    ASSERT_TRUE(writer.trySubmit(&slow, "a", 1, 0, nullptr));
+    while (writer.stats().queue_depth != 0) {
+        std::this_thread::yield();
+    }
+    ASSERT_TRUE(writer.trySubmit(&slow, "b", 1, 1, nullptr));
+    EXPECT_FALSE(writer.trySubmit(&slow, "c", 1, 2, nullptr));
+
+    // The stalled device does not hold up the other one
+    std::promise<bool> done;
+    ASSERT_TRUE(writer.trySubmit(&fast, "z", 1, 0, [&](bool ok) { done.set_value(ok); }));
+    EXPECT_TRUE(done.get_future().get());
+    EXPECT_EQ(fast.content(), "z");
+
+    slow.release();
+}
+
+// ── Metrics ────────────────────────────────────────────────────
+
+TEST(DiskWriterTest, StatsCountWritesBytesAndLatency) {
+    GatedSink sink;
+    {
+        DiskWriter writer(4, 2);
+        std::promise<void> done;
+        std::atomic<int> left{3};
+        for (int i = 0; i < 3; ++i) {
+            ASSERT_TRUE(writer.trySubmit(&sink, "1234", 4, i * 4, [&](bool) {
+                if (--left == 0) {
+                    done.set_value();
+                }
+            }));
+        }
+        done.get_future().get();
+
+        DiskWriterStats stats = writer.stats();
+        EXPECT_EQ(stats.writes, 3u);
+        EXPECT_EQ(stats.bytes_written, 12u);
+        EXPECT_EQ(stats.queue_depth, 0u);
+        EXPECT_LE(stats.avg_latency, stats.max_latency);
+    }
+    EXPECT_EQ(sink.content(), "123412341234");
+}
+
+// ── Asynchronous sinks ─────────────────────────────────────────
+
+TEST(DiskWriterTest, AsyncWritesDoNotHoldTheWriterThread) {
+    AsyncSink sink;
+    std::atomic<int> completed{0};
+    DiskWriter writer(3, 1);
+
+    // One writer thread hands all of them over without waiting
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_TRUE(writer.trySubmit(&sink, "a", 1, i, [&](bool ok) { completed += ok; }));
+    }
+    while (sink.pending() != 3) {
+        std::this_thread::yield();
+    }
+
+    // In flight counts against the queue until the completions come in
+    EXPECT_FALSE(writer.trySubmit(&sink, "b", 1, 3, nullptr));
+    sink.complete();
+    EXPECT_EQ(completed.load(), 3);
+    EXPECT_EQ(writer.stats().writes, 3u);
+    EXPECT_TRUE(writer.trySubmit(&sink, "b", 1, 3, nullptr));
+
+    while (sink.pending() != 1) {
+        std::this_thread::yield();
+    }
+    sink.complete();
+}
+
+TEST(DiskWriterTest, DestructorWaitsForAsyncWrites) {
+    AsyncSink sink;
+    std::atomic<bool> completed{false};
+    std::thread completer;
+    {
+        DiskWriter writer(4, 1);
+        ASSERT_TRUE(writer.trySubmit(&sink, "a", 1, 0, [&](bool) { completed = true; }));
+        while (sink.pending() != 1) {
+            std::this_thread::yield();
+        }
+        completer = std::thread([&sink] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            sink.complete();
+        });
+    }
+    EXPECT_TRUE(completed.load());
+    completer.join();
+}
@@ -0,0 +1,302 @@
+#include <gtest/gtest.h>
+#include "file_sink.h"
+
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+class FileSinkTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        path_ = (fs::temp_directory_path() / "file_sink_test.bin").string();
+        fs::remove(path_);
+    }
+
+    void TearDown() override {
+        std::error_code ec;
+        fs::remove(path_, ec);
+    }
+
+    std::string readAll() const {
+        std::ifstream ifs(path_, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    }
+
+    std::string path_;
+};
+
+} // namespace
+
+// ── Opening ────────────────────────────────────────────────────
+
+TEST_F(FileSinkTest, OpenCreatesMissingFile) {
+    auto sink = openFileSink(path_);
+    ASSERT_NE(sink, nullptr);
+    EXPECT_TRUE(fs::exists(path_));
+}
+
+TEST_F(FileSinkTest, OpenDoesNotTruncate) {
+    {
+        std::ofstream ofs(path_, std::ios::binary);
+        ofs << "0123456789";
+    }
+    auto sink = openFileSink(path_);
+    sink->close();
+    EXPECT_EQ(readAll(), "0123456789");
+}
+
+TEST_F(FileSinkTest, OpenInMissingDirectoryThrows) {
+    std::string bad = (fs::temp_directory_path() / "no_such_dir_12345" / "x.bin").string();
+    EXPECT_THROW(openFileSink(bad), std::runtime_error);
+}
+
+TEST_F(FileSinkTest, DefaultBackendIsPlatformNative) {
+    auto sink = openFileSink(path_);
+#ifdef _WIN32
+    EXPECT_EQ(sink->backend(), FileSinkBackend::Overlapped);
+    EXPECT_THROW(openFileSink(path_, FileSinkBackend::Pwrite), std::runtime_error);
+#else
+    EXPECT_EQ(sink->backend(), FileSinkBackend::Pwrite);
+    EXPECT_THROW(openFileSink(path_, FileSinkBackend::Overlapped), std::runtime_error);
+#endif
+}
+
+TEST_F(FileSinkTest, IoUringFallsBackToPwrite) {
+#ifdef _WIN32
+    EXPECT_THROW(openFileSink(path_, FileSinkBackend::IoUring), std::runtime_error);
+#else
+    auto sink = openFileSink(path_, FileSinkBackend::IoUring);
+    EXPECT_EQ(sink->backend(), isFileSinkBackendAvailable(FileSinkBackend::IoUring)
+                                   ? FileSinkBackend::IoUring
+                                   : FileSinkBackend::Pwrite);
+#endif
+}
+
+// ── Positional writes ──────────────────────────────────────────
+
+TEST_F(FileSinkTest, OutOfOrderWritesLandAtOffsets) {
+    auto sink = openFileSink(path_);
+    EXPECT_EQ(sink->writeAt("world", 5, 5), 5u);
+    EXPECT_EQ(sink->writeAt("hello", 5, 0), 5u);
+    sink->close();
+    EXPECT_EQ(readAll(), "helloworld");
+}
+
+TEST_F(FileSinkTest, ConcurrentDisjointWriters) {
+    static constexpr int kThreads = 8;
+    static constexpr size_t kChunk = 64 * 1024;
+    auto sink = openFileSink(path_);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&sink, t] {
+            std::string buf(kChunk, static_cast<char>('a' + t));
+            EXPECT_EQ(sink->writeAt(buf.data(), buf.size(),
+                                    static_cast<int64_t>(t) * static_cast<int64_t>(kChunk)),
+                      kChunk);
+        });
+    }
+    for (auto& th : threads) th.join();
+    sink->close();
+
+    std::string data = readAll();
+    ASSERT_EQ(data.size(), kThreads * kChunk);
+    for (int t = 0; t < kThreads; ++t) {
+        EXPECT_EQ(data[t * kChunk], static_cast<char>('a' + t));
+        EXPECT_EQ(data[(t + 1) * kChunk - 1], static_cast<char>('a' + t));
+    }
+}
+
+TEST_F(FileSinkTest, IoUringConcurrentWritersFromRegisteredBuffers) {
+#ifdef _WIN32
+    GTEST_SKIP() << "io_uring is Linux only";
+#else
+    static constexpr int kThreads = 8;
+    static constexpr size_t kChunk = 256 * 1024;
+    auto sink = openFileSink(path_, FileSinkBackend::IoUring);
+
+    // Half the writers use buffers registered with the kernel
+    std::vector<std::string> buffers;
+    for (int t = 0; t < kThreads; ++t) {
+        buffers.emplace_back(kChunk, static_cast<char>('a' + t));
+    }
+    for (int t = 0; t < kThreads; t += 2) {
+        registerFileSinkBuffer(buffers[t].data(), kChunk);
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&sink, &buffers, t] {
+            for (int round = 0; round < 4; ++round) {
+                EXPECT_EQ(sink->writeAt(buffers[t].data(), kChunk,
+                                        static_cast<int64_t>(t) * static_cast<int64_t>(kChunk)),
+                          kChunk);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    for (int t = 0; t < kThreads; t += 2) {
+        unregisterFileSinkBuffer(buffers[t].data());
+    }
+    sink->close();
+
+    std::string data = readAll();
+    ASSERT_EQ(data.size(), kThreads * kChunk);
+    for (int t = 0; t < kThreads; ++t) {
+        EXPECT_EQ(data.substr(t * kChunk, kChunk), buffers[t]);
+    }
+#endif
+}
+
+TEST_F(FileSinkTest, IoUringAsyncWritesCompleteOnTheCompletionThread) {
+#ifdef _WIN32
+    GTEST_SKIP() << "io_uring is Linux only";
+#else
+    if (!isFileSinkBackendAvailable(FileSinkBackend::IoUring)) {
+        GTEST_SKIP() << "kernel without io_uring";
+    }
+    static constexpr int kWrites = 600;  // more than the ring holds at once
+    static constexpr size_t kChunk = 4096;
+    auto sink = openFileSink(path_, FileSinkBackend::IoUring);
+
+    std::vector<std::string> buffers;
+    for (int i = 0; i < kWrites; ++i) {
+        buffers.emplace_back(kChunk, static_cast<char>('a' + i % 26));
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    int done = 0;
+    int ok = 0;
+    auto caller = std::this_thread::get_id();
+    std::atomic<bool> on_caller_thread{false};
+    for (int i = 0; i < kWrites; ++i) {
+        ASSERT_TRUE(sink->writeAtAsync(buffers[i].data(), kChunk,
+                                       static_cast<int64_t>(i) * static_cast<int64_t>(kChunk),
+                                       [&](bool result) {
+            if (std::this_thread::get_id() == caller) {
+                on_caller_thread = true;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            ++done;
+            ok += result;
+            cv.notify_one();
+        }));
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return done == kWrites; });
+    }
+    EXPECT_EQ(ok, kWrites);
+    EXPECT_FALSE(on_caller_thread.load());
+    sink->close();
+
+    std::string data = readAll();
+    ASSERT_EQ(data.size(), kWrites * kChunk);
+    for (int i = 0; i < kWrites; ++i) {
+        EXPECT_EQ(data.substr(i * kChunk, kChunk), buffers[i]);
+    }
+
+    // After close() the callback still runs, with false
+    bool after_close = true;
+    EXPECT_TRUE(sink->writeAtAsync("x", 1, 0, [&](bool result) { after_close = result; }));
+    EXPECT_FALSE(after_close);
+#endif
+}
+
+TEST_F(FileSinkTest, PwriteHasNoAsyncWrites) {
+    auto sink = openFileSink(path_);
+    EXPECT_FALSE(sink->writeAtAsync("x", 1, 0, [](bool) {}));
+}
+
+TEST_F(FileSinkTest, WriteAfterCloseReturnsZero) {
+    auto sink = openFileSink(path_);
+    sink->close();
+    EXPECT_EQ(sink->writeAt("x", 1, 0), 0u);
+    sink->close();  // idempotent
+}
+
+TEST_F(FileSinkTest, SyncSucceedsUntilClosed) {
+    auto sink = openFileSink(path_);
+    ASSERT_EQ(sink->writeAt("abc", 3, 0), 3u);
+    EXPECT_TRUE(sink->sync());
+    sink->close();
+    EXPECT_FALSE(sink->sync());
+}
+
+// ── Preallocation ──────────────────────────────────────────────
+
+TEST_F(FileSinkTest, PreallocateSetsSizeInEveryMode) {
+    for (auto mode : {PreallocationMode::Sparse, PreallocationMode::Reserved,
+                      PreallocationMode::Zeroed}) {
+        preallocateFile(path_, 3 * 1024 * 1024 + 17, mode);
+        EXPECT_EQ(fs::file_size(path_), 3u * 1024 * 1024 + 17);
+    }
+}
+
+TEST_F(FileSinkTest, PreallocateTruncatesOldContent) {
+    {
+        std::ofstream ofs(path_, std::ios::binary);
+        ofs << "0123456789";
+    }
+    preallocateFile(path_, 4, PreallocationMode::Zeroed);
+    EXPECT_EQ(readAll(), std::string(4, '\0'));
+}
+
+#ifndef _WIN32
+TEST_F(FileSinkTest, ReservedModeAllocatesBlocks) {
+    constexpr int64_t kSize = 8 * 1024 * 1024;
+    preallocateFile(path_, kSize, PreallocationMode::Sparse);
+    struct stat sparse = {};
+    ASSERT_EQ(::stat(path_.c_str(), &sparse), 0);
+
+    preallocateFile(path_, kSize, PreallocationMode::Reserved);
+    struct stat reserved = {};
+    ASSERT_EQ(::stat(path_.c_str(), &reserved), 0);
+
+    // Filesystems without fallocate fall back to sparse
+    EXPECT_GE(reserved.st_blocks, sparse.st_blocks);
+    EXPECT_LT(sparse.st_blocks * 512, kSize);
+}
+#endif
+
+TEST_F(FileSinkTest, PreallocateFailsUpFrontWithoutSpace) {
+    // Far more than any test machine has free: refused before allocating
+    constexpr int64_t kHuge = int64_t{1} << 62;
+    EXPECT_THROW(preallocateFile(path_, kHuge, PreallocationMode::Reserved), std::runtime_error);
+    EXPECT_THROW(preallocateFile(path_, kHuge, PreallocationMode::Zeroed), std::runtime_error);
+#ifdef _WIN32
+    EXPECT_THROW(preallocateFile(path_, kHuge, PreallocationMode::Sparse), std::runtime_error);
+#endif
+}
+
+#ifndef _WIN32
+TEST_F(FileSinkTest, SparseModeIsNotLimitedByFreeSpace) {
+    // Larger than the volume's free space, but nothing is reserved
+    auto space = fs::space(fs::temp_directory_path());
+    int64_t size = static_cast<int64_t>(space.available) + 1024 * 1024 * 1024;
+    ASSERT_NO_THROW(preallocateFile(path_, size, PreallocationMode::Sparse));
+    EXPECT_EQ(fs::file_size(path_), static_cast<uintmax_t>(size));
+}
+#endif
+
+TEST_F(FileSinkTest, ReserveKeepsSizeAndData) {
+    {
+        std::ofstream ofs(path_, std::ios::binary);
+        ofs << "0123456789";
+    }
+    reserveFileSpace(path_, 1024 * 1024);
+    EXPECT_EQ(readAll(), "0123456789");
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "http_engine.h"
+#include "http_common.h"
 
 // ── HttpError retryable flag tests ─────────────────────────────
 
@@ -64,3 +65,32 @@ TEST(HttpEngineRetry, CancelledRequestNotRetryable) {
         EXPECT_FALSE(e.isRetryable());
     }
 }
+
+// ── Resume-aware retries ───────────────────────────────────────
+
+TEST(HttpEngineRetry, RetryResumesAfterDeliveredBytes) {
+    EXPECT_EQ(resumeRangeStart(1000, 0), 1000);
+    EXPECT_EQ(resumeRangeStart(1000, 250), 1250);
+}
+
+TEST(HttpEngineRetry, WholeFileRequestGainsRangeOnlyAfterData) {
+    EXPECT_EQ(resumeRangeStart(-1, 0), -1);
+    EXPECT_EQ(resumeRangeStart(-1, 4096), 4096);
+}
+
+TEST(HttpEngineRetry, PartialResponseAlwaysAcceptable) {
+    EXPECT_TRUE(isRangeResponseAcceptable(206, 1000, true));
+    EXPECT_TRUE(isRangeResponseAcceptable(206, 0, false));
+}
+
+TEST(HttpEngineRetry, FullResponseRejectedPastOffsetZero) {
+    // The body would start at byte 0 but be written at the range offset
+    EXPECT_FALSE(isRangeResponseAcceptable(200, 1000, false));
+    EXPECT_TRUE(isRangeResponseAcceptable(200, 0, false));
+    EXPECT_TRUE(isRangeResponseAcceptable(200, -1, false));
+}
+
+TEST(HttpEngineRetry, FullResponseToIfRangeMeansFileChanged) {
+    EXPECT_FALSE(isRangeResponseAcceptable(200, 0, true));
+    EXPECT_FALSE(isRangeResponseAcceptable(200, 5000, true));
+}
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+#include "http_share.h"
+#include "http_engine.h"
+#include "multi_http_engine.h"
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+
+// ── Construction ───────────────────────────────────────────────
+
+TEST(HttpShareTest, ProvidesNativeHandle) {
+    HttpShare share;
+    EXPECT_NE(share.nativeHandle(), nullptr);
+}
+
+// ── Engines attached to a share ────────────────────────────────
+
+TEST(HttpShareTest, SharedEnginesStillReportErrors) {
+    HttpShare share;
+    HttpEngine engine(&share);
+    HttpConfig config;
+    config.max_retries = 0;
+    config.connect_timeout_sec = 2;
+
+    EXPECT_THROW(engine.fetchFileInfo("http://127.0.0.1:1/file.bin", config), HttpError);
+}
+
+TEST(HttpShareTest, ConcurrentEnginesOnOneShare) {
+    // The share's lock callbacks must serialise concurrent users.
+    HttpShare share;
+    MultiHttpEngine multi(4, &share);
+    HttpConfig config;
+    config.max_retries = 0;
+    config.connect_timeout_sec = 2;
+
+    std::vector<std::thread> probes;
+    for (int i = 0; i < 4; ++i) {
+        probes.emplace_back([&share, &config] {
+            HttpEngine engine(&share);
+            try {
+                engine.fetchFileInfo("http://127.0.0.1:1/file.bin", config);
+            } catch (const HttpError&) {
+            }
+        });
+    }
+
+    std::vector<std::future<void>> done;
+    for (int i = 0; i < 4; ++i) {
+        auto p = std::make_shared<std::promise<void>>();
+        done.push_back(p->get_future());
+        multi.download("http://127.0.0.1:1/file.bin", 0, 99, config, nullptr,
+                       [p](const HttpError*) { p->set_value(); });
+    }
+
+    for (auto& t : probes) t.join();
+    for (auto& f : done) {
+        EXPECT_EQ(f.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    }
+}
@@ -1,9 +1,16 @@
 #include <gtest/gtest.h>
 #include "meta_file.h"
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <string>
 
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
 namespace {
 
 // Helper: build a sample TaskMeta
@@ -72,6 +79,67 @@ TEST_F(MetaFileTest, SaveAndLoadRoundTrip) {
     }
 }
 
+// ── atomic replace ─────────────────────────────────────────────
+
+TEST_F(MetaFileTest, SaveReplacesWithoutLeavingTempFile) {
+    TaskMeta first = makeSampleMeta();
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, first));
+
+    TaskMeta second = makeSampleMeta();
+    second.blocks[1].downloaded = 6291456;
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, second));
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->blocks[1].downloaded, 6291456);
+    EXPECT_FALSE(std::filesystem::exists(std::string(kTestMetaPath) + ".tmp"));
+}
+
+TEST_F(MetaFileTest, FailedSaveKeepsPreviousCheckpoint) {
+    TaskMeta first = makeSampleMeta();
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, first));
+
+    // The temporary file cannot be created: the live file is never touched
+    std::string tmp_path = std::string(kTestMetaPath) + ".tmp";
+    std::filesystem::create_directory(tmp_path);
+    std::filesystem::create_directory(tmp_path + "/keep");
+    TaskMeta second = makeSampleMeta();
+    second.blocks[1].downloaded = 6291456;
+    EXPECT_FALSE(MetaFile::save(kTestMetaPath, second));
+    std::filesystem::remove_all(tmp_path);
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->blocks[1].downloaded, first.blocks[1].downloaded);
+}
+
+// ── priority / deadline ────────────────────────────────────────
+
+TEST_F(MetaFileTest, PriorityAndDeadlineRoundTrip) {
+    TaskMeta original = makeSampleMeta();
+    original.priority = 3;
+    original.deadline = 1767225600;
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, original));
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->priority, 3);
+    EXPECT_EQ(loaded->deadline, 1767225600);
+}
+
+TEST_F(MetaFileTest, MissingPriorityDefaultsToNormal) {
+    // Written before priorities existed
+    {
+        std::ofstream out(kTestMetaPath);
+        out << R"({"url":"https://example.com/a","file_path":"/tmp/a","file_name":"a",)"
+               R"("file_size":10,"etag":"","last_modified":"","max_blocks":1,"blocks":[]})";
+    }
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->priority, 1);
+    EXPECT_EQ(loaded->deadline, 0);
+}
+
 // ── empty blocks list ──────────────────────────────────────────
 
 TEST_F(MetaFileTest, EmptyBlocksList) {
@@ -107,6 +175,234 @@ TEST_F(MetaFileTest, SpecialCharacters) {
     EXPECT_EQ(loaded->etag,      meta.etag);
 }
 
+// ── binary format / JSON migration ─────────────────────────────
+
+TEST_F(MetaFileTest, SaveWritesBinaryFormat) {
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, makeSampleMeta()));
+    std::ifstream ifs(kTestMetaPath, std::ios::binary);
+    char magic[6] = {};
+    ifs.read(magic, sizeof(magic));
+    EXPECT_EQ(std::string(magic, sizeof(magic)), "SDMETA");
+}
+
+TEST_F(MetaFileTest, LoadMigratesJsonFile) {
+    TaskMeta original = makeSampleMeta();
+    ASSERT_TRUE(MetaFile::saveJson(kTestMetaPath, original));
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->url, original.url);
+    ASSERT_EQ(loaded->blocks.size(), 2u);
+    EXPECT_EQ(loaded->blocks[1].downloaded, original.blocks[1].downloaded);
+
+    // Rewritten as binary: JSON no longer parses it
+    EXPECT_FALSE(MetaFile::loadJson(kTestMetaPath).has_value());
+    auto again = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(again.has_value());
+    EXPECT_EQ(again->etag, original.etag);
+}
+
+TEST_F(MetaFileTest, JsonExportImportRoundTrip) {
+    TaskMeta original = makeSampleMeta();
+    original.priority = 2;
+    ASSERT_TRUE(MetaFile::saveJson(kTestMetaPath, original));
+    auto loaded = MetaFile::loadJson(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->file_name, original.file_name);
+    EXPECT_EQ(loaded->priority, 2);
+    EXPECT_EQ(loaded->blocks[0].completed, true);
+}
+
+TEST_F(MetaFileTest, TruncatedBinaryFileIsRejected) {
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, makeSampleMeta()));
+    auto size = std::filesystem::file_size(kTestMetaPath);
+    std::filesystem::resize_file(kTestMetaPath, size - 3);
+    EXPECT_FALSE(MetaFile::load(kTestMetaPath).has_value());
+}
+
+// ── chunk bitmap ───────────────────────────────────────────────
+
+TEST_F(MetaFileTest, ChunkBitmapRoundTrip) {
+    TaskMeta original = makeSampleMeta();
+    original.chunk_size = 262144;
+    original.chunks = {0xff, 0x0f, 0x00, 0x81, 0x01};  // not a multiple of 8 bytes
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, original));
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->chunk_size, 262144);
+    EXPECT_EQ(loaded->chunks, original.chunks);
+    EXPECT_EQ(loaded->file_name, original.file_name);
+
+    ASSERT_TRUE(MetaFile::saveJson(kTestMetaPath, original));
+    auto from_json = MetaFile::loadJson(kTestMetaPath);
+    ASSERT_TRUE(from_json.has_value());
+    EXPECT_EQ(from_json->chunk_size, 262144);
+    EXPECT_EQ(from_json->chunks, original.chunks);
+}
+
+TEST_F(MetaFileTest, LoadsVersion1FileWithoutBitmap) {
+    TaskMeta original = makeSampleMeta();
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, original));
+
+    // Version 1: version 1, 56-byte header (no bitmap fields), no bitmap
+    std::string data;
+    {
+        std::ifstream ifs(kTestMetaPath, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    uint32_t version = 1;
+    uint32_t header_size = 56;
+    std::memcpy(&data[8], &version, sizeof(version));
+    std::memcpy(&data[12], &header_size, sizeof(header_size));
+    data.erase(56, 8);
+    {
+        std::ofstream ofs(kTestMetaPath, std::ios::binary | std::ios::trunc);
+        ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->url, original.url);
+    ASSERT_EQ(loaded->blocks.size(), 2u);
+    EXPECT_EQ(loaded->blocks[1].downloaded, original.blocks[1].downloaded);
+    EXPECT_EQ(loaded->chunk_size, 0);
+    EXPECT_TRUE(loaded->chunks.empty());
+}
+
+TEST_F(MetaFileTest, Version1ReservedFieldIsNotABitmapSize) {
+    TaskMeta original = makeSampleMeta();
+    ASSERT_TRUE(MetaFile::save(kTestMetaPath, original));
+
+    // Version 1 header whose last (reserved) field is not zero
+    std::string data;
+    {
+        std::ifstream ifs(kTestMetaPath, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    uint32_t version = 1;
+    uint32_t header_size = 56;
+    uint32_t reserved = 0xdeadbeef;
+    std::memcpy(&data[8], &version, sizeof(version));
+    std::memcpy(&data[12], &header_size, sizeof(header_size));
+    std::memcpy(&data[52], &reserved, sizeof(reserved));
+    data.erase(56, 8);
+    {
+        std::ofstream ofs(kTestMetaPath, std::ios::binary | std::ios::trunc);
+        ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->url, original.url);
+    EXPECT_EQ(loaded->chunk_size, 0);
+    EXPECT_TRUE(loaded->chunks.empty());
+}
+
+// ── MetaWriter ─────────────────────────────────────────────────
+
+TEST_F(MetaFileTest, WriterUpdatesProgressInPlace) {
+    TaskMeta meta = makeSampleMeta();
+    MetaWriter writer(kTestMetaPath);
+    ASSERT_TRUE(writer.update(meta));
+#ifndef _WIN32
+    struct stat before = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &before), 0);
+#endif
+
+    meta.blocks[1].downloaded = 7340032;
+    ASSERT_TRUE(writer.update(meta));
+    meta.blocks[1].downloaded = 13107200;
+    meta.blocks[1].completed = true;
+    ASSERT_TRUE(writer.update(meta));
+
+#ifndef _WIN32
+    // Same file: no temporary was renamed over it
+    struct stat after = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &after), 0);
+    EXPECT_EQ(before.st_ino, after.st_ino);
+#endif
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->blocks[1].downloaded, 13107200);
+    EXPECT_TRUE(loaded->blocks[1].completed);
+}
+
+TEST_F(MetaFileTest, WriterUpdatesChunkBitsInPlace) {
+    TaskMeta meta = makeSampleMeta();
+    meta.chunk_size = 262144;
+    meta.chunks = {0x01, 0x00, 0x00};
+    MetaWriter writer(kTestMetaPath);
+    ASSERT_TRUE(writer.update(meta));
+#ifndef _WIN32
+    struct stat before = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &before), 0);
+#endif
+
+    meta.chunks = {0x03, 0x80, 0x04};
+    ASSERT_TRUE(writer.update(meta));
+
+#ifndef _WIN32
+    struct stat after = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &after), 0);
+    EXPECT_EQ(before.st_ino, after.st_ino);
+#endif
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->chunks, meta.chunks);
+}
+
+TEST_F(MetaFileTest, WriterRewritesWhenChunkBitIsCleared) {
+    TaskMeta meta = makeSampleMeta();
+    meta.chunk_size = 262144;
+    meta.chunks = {0x03};
+    MetaWriter writer(kTestMetaPath);
+    ASSERT_TRUE(writer.update(meta));
+#ifndef _WIN32
+    struct stat before = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &before), 0);
+#endif
+
+    // A restart: in place, a crash could leave stale bits set
+    meta.chunks = {0x00};
+    ASSERT_TRUE(writer.update(meta));
+
+#ifndef _WIN32
+    struct stat after = {};
+    ASSERT_EQ(::stat(kTestMetaPath, &after), 0);
+    EXPECT_NE(before.st_ino, after.st_ino);
+#endif
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    EXPECT_EQ(loaded->chunks, meta.chunks);
+}
+
+TEST_F(MetaFileTest, WriterRewritesWhenBlocksChange) {
+    TaskMeta meta = makeSampleMeta();
+    MetaWriter writer(kTestMetaPath);
+    ASSERT_TRUE(writer.update(meta));
+
+    // Work stealing: block 1 gives away the back half of its range
+    BlockInfo tail;
+    tail.block_id    = 2;
+    tail.range_start = 19660800;
+    tail.range_end   = meta.blocks[1].range_end;
+    meta.blocks[1].range_end = 19660799;
+    meta.blocks.push_back(tail);
+    meta.etag = "\"def456\"";
+    ASSERT_TRUE(writer.update(meta));
+
+    auto loaded = MetaFile::load(kTestMetaPath);
+    ASSERT_TRUE(loaded.has_value());
+    ASSERT_EQ(loaded->blocks.size(), 3u);
+    EXPECT_EQ(loaded->blocks[1].range_end, 19660799);
+    EXPECT_EQ(loaded->blocks[2].range_start, 19660800);
+    EXPECT_EQ(loaded->etag, meta.etag);
+
+    writer.close();
+    EXPECT_TRUE(MetaFile::remove(kTestMetaPath));
+}
+
 // ── load from non-existent file ────────────────────────────────
 
 TEST_F(MetaFileTest, LoadNonExistentFile) {
@@ -0,0 +1,193 @@
+#include <gtest/gtest.h>
+#include "multi_http_engine.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Nothing listens on port 1, so connects fail fast with CURLE_COULDNT_CONNECT.
+const char* kUnreachableUrl = "http://127.0.0.1:1/file.bin";
+
+struct DoneResult {
+    bool ok = false;
+    bool retryable = false;
+    std::string what;
+};
+
+TransferDoneCallback captureInto(std::shared_ptr<std::promise<DoneResult>> p) {
+    return [p](const HttpError* error) {
+        DoneResult r;
+        r.ok = (error == nullptr);
+        if (error) {
+            r.retryable = error->isRetryable();
+            r.what = error->what();
+        }
+        p->set_value(r);
+    };
+}
+
+} // namespace
+
+// ── Construction / budget ──────────────────────────────────────
+
+TEST(MultiHttpEngineTest, ConnectionBudgetClampedToOne) {
+    MultiHttpEngine engine(0);
+    EXPECT_EQ(engine.maxConnections(), 1);
+    engine.setMaxConnections(-5);
+    EXPECT_EQ(engine.maxConnections(), 1);
+    engine.setMaxConnections(16);
+    EXPECT_EQ(engine.maxConnections(), 16);
+}
+
+TEST(MultiHttpEngineTest, IdleEngineHasNoTransfers) {
+    MultiHttpEngine engine(4);
+    EXPECT_EQ(engine.activeTransfers(), 0u);
+    EXPECT_EQ(engine.pendingTransfers(), 0u);
+}
+
+// ── Failure reporting ──────────────────────────────────────────
+
+TEST(MultiHttpEngineTest, ConnectFailureReportedWithoutRetries) {
+    MultiHttpEngine engine(4);
+    HttpConfig config;
+    config.max_retries = 0;
+    config.connect_timeout_sec = 2;
+
+    auto p = std::make_shared<std::promise<DoneResult>>();
+    auto f = p->get_future();
+    engine.download(kUnreachableUrl, 0, 99, config, nullptr, captureInto(p));
+
+    ASSERT_EQ(f.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+    DoneResult r = f.get();
+    EXPECT_FALSE(r.ok);
+    EXPECT_TRUE(r.retryable);  // connect errors are transient...
+    EXPECT_NE(r.what.find("Download failed"), std::string::npos);  // ...but the budget was 0
+}
+
+TEST(MultiHttpEngineTest, CancelDuringBackoffReportsCancelled) {
+    MultiHttpEngine engine(4);
+    HttpConfig config;
+    config.max_retries = 3;  // first backoff is 1 s
+    config.connect_timeout_sec = 2;
+
+    auto p = std::make_shared<std::promise<DoneResult>>();
+    auto f = p->get_future();
+    TransferId id = engine.download(kUnreachableUrl, 0, 99, config, nullptr, captureInto(p));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    engine.cancel(id);
+
+    ASSERT_EQ(f.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+    DoneResult r = f.get();
+    EXPECT_FALSE(r.ok);
+    EXPECT_FALSE(r.retryable);
+    EXPECT_EQ(r.what, "Download cancelled");
+}
+
+TEST(MultiHttpEngineTest, RemoveSuppressesCallback) {
+    MultiHttpEngine engine(4);
+    HttpConfig config;
+    config.max_retries = 3;
+
+    std::atomic<bool> called{false};
+    TransferId id = engine.download(kUnreachableUrl, 0, 99, config, nullptr,
+        [&called](const HttpError*) { called.store(true); });
+
+    engine.remove(id);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_FALSE(called.load());
+}
+
+TEST(MultiHttpEngineTest, RemoveFromOwnDataCallback) {
+    auto path = std::filesystem::temp_directory_path() / "multi_engine_remove.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << std::string(1024 * 1024, 'x');
+    }
+
+    MultiHttpEngine engine(4);
+    std::promise<TransferId> id_promise;
+    std::shared_future<TransferId> id_future = id_promise.get_future().share();
+    std::atomic<int> chunks{0};
+    std::atomic<bool> called{false};
+    TransferId id = engine.download("file://" + path.string(), -1, -1, HttpConfig(),
+        [&engine, id_future, &chunks](const char*, size_t size) {
+            // curl is still using the handle: the removal must wait
+            if (chunks++ == 0) {
+                engine.remove(id_future.get());
+            }
+            return size;
+        },
+        [&called](const HttpError*) { called.store(true); });
+    id_promise.set_value(id);
+
+    for (int i = 0; i < 100
+         && (chunks.load() == 0 || engine.activeTransfers() + engine.pendingTransfers() > 0); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(engine.activeTransfers(), 0u);
+    EXPECT_EQ(engine.pendingTransfers(), 0u);
+    EXPECT_EQ(chunks.load(), 1);
+    EXPECT_FALSE(called.load());
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+TEST(MultiHttpEngineTest, RemoveDuringShutdownWaitsForRunningCallback) {
+    auto path = std::filesystem::temp_directory_path() / "multi_engine_remove_stop.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << std::string(1024 * 1024, 'x');
+    }
+
+    MultiHttpEngine engine(4);
+    std::promise<void> entered;
+    std::atomic<int> chunks{0};
+    std::atomic<bool> left{false};
+    TransferId id = engine.download("file://" + path.string(), -1, -1, HttpConfig(),
+        [&entered, &chunks, &left](const char*, size_t size) {
+            if (chunks++ == 0) {
+                entered.set_value();
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                left = true;
+            }
+            return size;
+        },
+        nullptr);
+
+    // The engine is stopping, but the reactor is still inside on_data
+    entered.get_future().get();
+    std::thread stopper([&engine] { engine.shutdown(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    engine.remove(id);
+    EXPECT_TRUE(left.load());
+    stopper.join();
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+TEST(MultiHttpEngineTest, ShutdownDropsOutstandingTransfers) {
+    std::atomic<bool> called{false};
+    {
+        MultiHttpEngine engine(1);
+        HttpConfig config;
+        config.max_retries = 3;
+        for (int i = 0; i < 5; ++i) {
+            engine.download(kUnreachableUrl, 0, 99, config, nullptr,
+                [&called](const HttpError*) { called.store(true); });
+        }
+        engine.shutdown();
+        EXPECT_EQ(engine.activeTransfers(), 0u);
+        EXPECT_EQ(engine.pendingTransfers(), 0u);
+    }
+    EXPECT_FALSE(called.load());
+}
@@ -18,6 +18,17 @@ TEST(ProgressMonitorTest, InitialSnapshotIsZero) {
     EXPECT_EQ(info.remaining_seconds, -1);
 }
 
+TEST(ProgressMonitorTest, ConstructedWithResumedBytes) {
+    ProgressMonitor pm(1000, 400);
+    pm.addBytes(100, 3);
+    auto info = pm.snapshot();
+
+    EXPECT_EQ(info.downloaded_bytes, 500);
+    EXPECT_DOUBLE_EQ(info.progress_percent, 50.0);
+    // Resumed bytes are in the anchor sample, never counted as speed
+    EXPECT_DOUBLE_EQ(info.speed_bytes_per_sec, 0.0);
+}
+
 // --- Progress percentage ---
 
 TEST(ProgressMonitorTest, ProgressPercentHalfway) {
@@ -141,6 +152,43 @@ TEST(ProgressMonitorTest, SlidingWindowDropsOldSamples) {
     EXPECT_GT(info.speed_bytes_per_sec, 0.0);
 }
 
+TEST(ProgressMonitorTest, SpeedReadableWithoutSnapshot) {
+    ProgressMonitor pm(100000);
+
+    pm.addBytes(5000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // ~5000 bytes in ~100ms; generous bounds for slow CI machines
+    double speed = pm.speed();
+    EXPECT_GT(speed, 0.0);
+    EXPECT_LT(speed, 5000.0 / 0.05 + 1.0);
+}
+
+// --- Smoothed ETA ---
+
+TEST(ProgressMonitorTest, SmoothedEtaOfferedAlongsideWindowSpeed) {
+    ProgressMonitor pm(100000);
+
+    pm.addBytes(1000);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto first = pm.snapshot();
+    EXPECT_GT(first.smoothed_speed_bytes_per_sec, 0.0);
+    EXPECT_GE(first.smoothed_remaining_seconds, 0);
+
+    // Nothing arrives: the EWMA decays but does not drop to zero at once
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto second = pm.snapshot();
+    EXPECT_LT(second.smoothed_speed_bytes_per_sec, first.smoothed_speed_bytes_per_sec);
+    EXPECT_GT(second.smoothed_speed_bytes_per_sec, 0.0);
+}
+
+TEST(ProgressMonitorTest, SmoothedEtaCalculatingAtStart) {
+    ProgressMonitor pm(10000, 2000);
+    auto info = pm.snapshot();
+    EXPECT_DOUBLE_EQ(info.smoothed_speed_bytes_per_sec, 0.0);
+    EXPECT_EQ(info.smoothed_remaining_seconds, -1);
+}
+
 // --- Thread safety ---
 
 TEST(ProgressMonitorTest, ConcurrentAddBytesDoesNotCrash) {
@@ -195,3 +243,22 @@ TEST(ProgressMonitorTest, ConcurrentAddAndSnapshotDoesNotCrash) {
     auto info = pm.snapshot();
     EXPECT_EQ(info.downloaded_bytes, 20000);
 }
+
+TEST(ProgressMonitorTest, ConcurrentPerBlockCountersSum) {
+    ProgressMonitor pm(1000000);
+    std::vector<std::thread> threads;
+    constexpr int num_blocks = 70;  // more blocks than counters: ids wrap around
+
+    for (int id = 0; id < num_blocks; ++id) {
+        threads.emplace_back([&pm, id] {
+            for (int j = 0; j < 100; ++j) {
+                pm.addBytes(3, id);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(pm.snapshot().downloaded_bytes, num_blocks * 100 * 3);
+}
@@ -0,0 +1,478 @@
+#include <gtest/gtest.h>
+#include "task_journal.h"
+#include "task.h"
+#include "meta_file.h"
+#include "chunk_map.h"
+#include "thread_pool.h"
+#include "download_manager.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const char* kTestJournalPath = "test_task_journal.journal";
+
+class TaskJournalTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        fs::remove(kTestJournalPath);
+        fs::remove(std::string(kTestJournalPath) + ".tmp");
+    }
+    void TearDown() override {
+        fs::remove(kTestJournalPath);
+        fs::remove(std::string(kTestJournalPath) + ".tmp");
+    }
+};
+
+} // anonymous namespace
+
+// ── replay ─────────────────────────────────────────────────────
+
+TEST_F(TaskJournalTest, ReplayRestoresRecordedEntries) {
+    uint64_t first = 0;
+    uint64_t second = 0;
+    {
+        TaskJournal journal(kTestJournalPath);
+        EXPECT_TRUE(journal.created());
+        first = journal.recordAdded("https://example.com/a.zip", "/downloads");
+        second = journal.recordAdded("https://example.com/b.iso", "/isos");
+        journal.recordCheckpoint(first, "/downloads/a.zip.meta", "a.zip", 1000, 400);
+        journal.recordState(first, static_cast<int>(TaskState::Paused));
+    }
+
+    TaskJournal journal(kTestJournalPath);
+    EXPECT_FALSE(journal.created());
+    auto entries = journal.entries();
+    ASSERT_EQ(entries.size(), 2u);
+
+    EXPECT_EQ(entries[0].key, first);
+    EXPECT_EQ(entries[0].url, "https://example.com/a.zip");
+    EXPECT_EQ(entries[0].save_dir, "/downloads");
+    EXPECT_EQ(entries[0].meta_path, "/downloads/a.zip.meta");
+    EXPECT_EQ(entries[0].file_name, "a.zip");
+    EXPECT_EQ(entries[0].file_size, 1000);
+    EXPECT_EQ(entries[0].downloaded, 400);
+    EXPECT_EQ(entries[0].state, static_cast<int>(TaskState::Paused));
+
+    EXPECT_EQ(entries[1].key, second);
+    EXPECT_TRUE(entries[1].meta_path.empty());
+
+    // Keys are never reused
+    EXPECT_GT(journal.recordAdded("https://example.com/c", "/"), second);
+}
+
+TEST_F(TaskJournalTest, RemovedEntriesAreNotReplayed) {
+    {
+        TaskJournal journal(kTestJournalPath);
+        uint64_t gone = journal.recordAdded("https://example.com/gone", "/d");
+        journal.recordAdded("https://example.com/kept", "/d");
+        journal.recordRemoved(gone);
+    }
+
+    TaskJournal journal(kTestJournalPath);
+    auto entries = journal.entries();
+    ASSERT_EQ(entries.size(), 1u);
+    EXPECT_EQ(entries[0].url, "https://example.com/kept");
+}
+
+TEST_F(TaskJournalTest, TornTailIsCutOff) {
+    {
+        TaskJournal journal(kTestJournalPath);
+        journal.recordAdded("https://example.com/a", "/d");
+        journal.recordAdded("https://example.com/b", "/d");
+    }
+    auto intact = fs::file_size(kTestJournalPath);
+    fs::resize_file(kTestJournalPath, intact - 3);  // the second record, cut short
+
+    {
+        TaskJournal journal(kTestJournalPath);
+        ASSERT_EQ(journal.entries().size(), 1u);
+        EXPECT_EQ(journal.records(), 1u);
+        journal.recordAdded("https://example.com/c", "/d");
+    }
+
+    // Appends after the cut are readable
+    TaskJournal journal(kTestJournalPath);
+    auto entries = journal.entries();
+    ASSERT_EQ(entries.size(), 2u);
+    EXPECT_EQ(entries[1].url, "https://example.com/c");
+}
+
+TEST_F(TaskJournalTest, CorruptRecordEndsReplay) {
+    {
+        TaskJournal journal(kTestJournalPath);
+        journal.recordAdded("https://example.com/a", "/d");
+        journal.recordAdded("https://example.com/b", "/d");
+    }
+    {
+        std::fstream file(kTestJournalPath, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-1, std::ios::end);
+        file.put('\x7f');  // checksum no longer matches
+    }
+
+    TaskJournal journal(kTestJournalPath);
+    EXPECT_EQ(journal.entries().size(), 1u);
+}
+
+// ── compaction ─────────────────────────────────────────────────
+
+TEST_F(TaskJournalTest, CompactKeepsLiveEntriesOnly) {
+    {
+        TaskJournal journal(kTestJournalPath);
+        uint64_t key = journal.recordAdded("https://example.com/a", "/d");
+        for (int i = 0; i < 100; ++i) {
+            journal.recordCheckpoint(key, "/d/a.meta", "a", 1000, i);
+        }
+        uint64_t gone = journal.recordAdded("https://example.com/b", "/d");
+        journal.recordRemoved(gone);
+        ASSERT_EQ(journal.records(), 103u);
+
+        journal.compact();
+        EXPECT_LE(journal.records(), 3u);
+        EXPECT_FALSE(fs::exists(std::string(kTestJournalPath) + ".tmp"));
+    }
+
+    TaskJournal journal(kTestJournalPath);
+    auto entries = journal.entries();
+    ASSERT_EQ(entries.size(), 1u);
+    EXPECT_EQ(entries[0].downloaded, 99);
+    EXPECT_EQ(entries[0].meta_path, "/d/a.meta");
+}
+
+TEST_F(TaskJournalTest, BackgroundCompactionKeepsAppends) {
+    ThreadPool pool(2);
+    uint64_t key = 0;
+    {
+        TaskJournal journal(kTestJournalPath, &pool);
+        key = journal.recordAdded("https://example.com/a", "/d");
+        for (int i = 0; i < 20000; ++i) {
+            journal.recordCheckpoint(key, "/d/a.meta", "a", 100000, i);
+        }
+    }  // waits for the compactions still running
+
+    EXPECT_LT(fs::file_size(kTestJournalPath), 20000u * 16);
+
+    TaskJournal journal(kTestJournalPath);
+    auto entries = journal.entries();
+    ASSERT_EQ(entries.size(), 1u);
+    EXPECT_EQ(entries[0].key, key);
+    EXPECT_EQ(entries[0].downloaded, 19999);
+}
+
+// ── scale ──────────────────────────────────────────────────────
+
+TEST_F(TaskJournalTest, HundredThousandEntriesReplayQuickly) {
+    {
+        TaskJournal journal(kTestJournalPath);
+        for (int i = 0; i < 100000; ++i) {
+            uint64_t key = journal.recordAdded("https://example.com/file" + std::to_string(i), "/d");
+            journal.recordState(key, static_cast<int>(TaskState::Completed));
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    TaskJournal journal(kTestJournalPath);
+    auto entries = journal.entries();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(entries.size(), 100000u);
+    EXPECT_LT(elapsed, std::chrono::seconds(1));
+}
+
+// ── Task::fromJournal ──────────────────────────────────────────
+
+TEST_F(TaskJournalTest, TaskFromJournalReadsMetaOnlyWhenLoaded) {
+    const std::string meta_path = "test_task_journal_task.meta";
+    TaskMeta meta;
+    meta.url = "https://example.com/a.zip";
+    meta.file_path = "a.zip";
+    meta.file_name = "a.zip";
+    meta.file_size = 1000;
+    meta.priority = static_cast<int>(TaskPriority::Urgent);
+    ASSERT_TRUE(MetaFile::save(meta_path, meta));
+
+    JournalEntry entry;
+    entry.key = 7;
+    entry.url = meta.url;
+    entry.meta_path = meta_path;
+    entry.file_name = "a.zip";
+    entry.file_size = 1000;
+    entry.downloaded = 400;
+
+    auto task = Task::fromJournal(1, entry, 4, nullptr, nullptr, nullptr, nullptr);
+    auto info = task->getInfo();
+    EXPECT_EQ(info.state, TaskState::Paused);
+    EXPECT_EQ(info.file_name, "a.zip");
+    EXPECT_EQ(info.progress.downloaded_bytes, 400);
+    EXPECT_EQ(task->getPriority(), TaskPriority::Normal);  // not read yet
+
+    EXPECT_TRUE(task->loadMeta());
+    EXPECT_EQ(task->getPriority(), TaskPriority::Urgent);
+
+    fs::remove(meta_path);
+    EXPECT_TRUE(task->loadMeta());  // read once
+
+    entry.meta_path = "test_task_journal_missing.meta";
+    auto orphan = Task::fromJournal(2, entry, 4, nullptr, nullptr, nullptr, nullptr);
+    EXPECT_FALSE(orphan->loadMeta());
+}
+
+// ── resume ─────────────────────────────────────────────────────
+
+TEST_F(TaskJournalTest, ResumeWithEveryChunkDoneCompletes) {
+    fs::path dir = fs::temp_directory_path() / "task_journal_resume_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    const int64_t size = 3 * ChunkMap::kDefaultChunkSize;
+    fs::path file = dir / "done.bin";
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << std::string(static_cast<size_t>(size), 'x');
+    }
+
+    // Paused after the last byte reached the disk
+    TaskMeta meta;
+    meta.url = "file://" + file.string();
+    meta.file_path = file.string();
+    meta.file_name = "done.bin";
+    meta.file_size = size;
+    meta.max_blocks = 4;
+    meta.chunk_size = ChunkMap::chunkSizeFor(size);
+    meta.chunks = {0x07};
+    BlockInfo block;
+    block.range_start = 0;
+    block.range_end = size - 1;
+    block.downloaded = size;
+    block.completed = true;
+    meta.blocks.push_back(block);
+    const std::string meta_path = (dir / "done.bin.meta").string();
+    ASSERT_TRUE(MetaFile::save(meta_path, meta));
+
+    JournalEntry entry;
+    entry.key = 1;
+    entry.url = meta.url;
+    entry.save_dir = dir.string();
+    entry.meta_path = meta_path;
+    entry.file_name = "done.bin";
+    entry.file_size = size;
+    entry.downloaded = size;
+
+    ThreadPool pool(2);
+    std::atomic<TaskState> last{TaskState::Paused};
+    auto task = Task::fromJournal(1, entry, 4, &pool, nullptr, nullptr,
+                                  [&last](int, TaskState state) { last.store(state); });
+    task->resume();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (last.load() != TaskState::Completed && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(last.load(), TaskState::Completed);
+    EXPECT_FALSE(fs::exists(meta_path));
+
+    task.reset();
+    fs::remove_all(dir);
+}
+
+TEST_F(TaskJournalTest, ResumeRefetchingDoneChunksCountsThemOnce) {
+    fs::path dir = fs::temp_directory_path() / "task_journal_merge_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    const int64_t chunk = ChunkMap::kDefaultChunkSize;
+    const int64_t size = 5 * chunk;
+
+    std::string data(static_cast<size_t>(size), '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>('a' + i % 23);
+    }
+    fs::path source = dir / "source.bin";
+    {
+        std::ofstream out(source, std::ios::binary);
+        out << data;
+    }
+    fs::path file = dir / "merged.bin";
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << std::string(static_cast<size_t>(size), 'x');
+    }
+
+    // Chunks 1 and 3 done: one block fetches 0-4, those two included
+    TaskMeta meta;
+    meta.url = "file://" + source.string();
+    meta.file_path = file.string();
+    meta.file_name = "merged.bin";
+    meta.file_size = size;
+    meta.max_blocks = 1;
+    meta.chunk_size = ChunkMap::chunkSizeFor(size);
+    meta.chunks = {0x0A};
+    const std::string meta_path = (dir / "merged.bin.meta").string();
+    ASSERT_TRUE(MetaFile::save(meta_path, meta));
+
+    JournalEntry entry;
+    entry.key = 1;
+    entry.url = meta.url;
+    entry.save_dir = dir.string();
+    entry.meta_path = meta_path;
+    entry.file_name = "merged.bin";
+    entry.file_size = size;
+    entry.downloaded = 2 * chunk;
+
+    ThreadPool pool(2);
+    std::atomic<TaskState> last{TaskState::Paused};
+    auto task = Task::fromJournal(1, entry, 1, &pool, nullptr, nullptr,
+                                  [&last](int, TaskState state) { last.store(state); });
+    task->resume();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (last.load() != TaskState::Completed && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQ(last.load(), TaskState::Completed);
+    ProgressInfo progress = task->getInfo().progress;
+    EXPECT_EQ(progress.downloaded_bytes, size);
+    EXPECT_LE(progress.progress_percent, 100.0);
+
+    std::ifstream in(file, std::ios::binary);
+    EXPECT_EQ(std::string(std::istreambuf_iterator<char>(in), {}), data);
+
+    task.reset();
+    fs::remove_all(dir);
+}
+
+TEST_F(TaskJournalTest, ResumeFailsWhenABlockFailsForGood) {
+    fs::path dir = fs::temp_directory_path() / "task_journal_block_fail_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    const int64_t chunk = ChunkMap::kDefaultChunkSize;
+
+    // The source answers the HEAD but no read of it ever succeeds
+    fs::path source = dir / "source.bin";
+    fs::create_directories(source);
+    fs::path file = dir / "partial.bin";
+    {
+        std::ofstream out(file, std::ios::binary);
+        out << std::string(static_cast<size_t>(2 * chunk), 'x');
+    }
+
+    TaskMeta meta;
+    meta.url = "file://" + source.string();
+    meta.file_path = file.string();
+    meta.file_name = "partial.bin";
+    meta.file_size = 2 * chunk;
+    meta.max_blocks = 4;
+    meta.chunk_size = ChunkMap::chunkSizeFor(2 * chunk);
+    meta.chunks = {0x01};
+    const std::string meta_path = (dir / "partial.bin.meta").string();
+    ASSERT_TRUE(MetaFile::save(meta_path, meta));
+
+    JournalEntry entry;
+    entry.key = 1;
+    entry.url = meta.url;
+    entry.save_dir = dir.string();
+    entry.meta_path = meta_path;
+    entry.file_name = "partial.bin";
+    entry.file_size = 2 * chunk;
+    entry.downloaded = chunk;
+
+    ThreadPool pool(2);
+    std::atomic<TaskState> last{TaskState::Paused};
+    auto task = Task::fromJournal(1, entry, 4, &pool, nullptr, nullptr,
+                                  [&last](int, TaskState state) { last.store(state); });
+    task->resume();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (last.load() != TaskState::Failed && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(last.load(), TaskState::Failed);
+    EXPECT_FALSE(task->getInfo().error_message.empty());
+
+    // Progress is kept for resume()
+    auto saved = MetaFile::load(meta_path);
+    ASSERT_TRUE(saved.has_value());
+    EXPECT_EQ(saved->chunks, meta.chunks);
+
+    task.reset();
+    fs::remove_all(dir);
+}
+
+// ── cancel ─────────────────────────────────────────────────────
+
+TEST_F(TaskJournalTest, TaskStateChangesAreJournaled) {
+    TaskJournal journal(kTestJournalPath);
+    uint64_t key = journal.recordAdded("http://0.0.0.0:1/a.bin", "journal_test_dir");
+
+    // No workers: start() only changes the state
+    ThreadPool idle_pool(0);
+    Task task(1, "http://0.0.0.0:1/a.bin", "journal_test_dir", 1, &idle_pool,
+              nullptr, nullptr, [](int, TaskState) {});
+    TaskServices services;
+    services.journal = &journal;
+    task.setServices(services);
+    task.setJournalKey(key);
+
+    task.start();
+    ASSERT_EQ(journal.entries().size(), 1u);
+    EXPECT_EQ(journal.entries()[0].state, static_cast<int>(TaskState::Downloading));
+
+    task.cancel();
+    EXPECT_EQ(journal.entries()[0].state, static_cast<int>(TaskState::Cancelled));
+}
+
+TEST_F(TaskJournalTest, ManagerDestroyedWithTaskJobsQueued) {
+    fs::path root = fs::temp_directory_path() / "task_journal_shutdown_test";
+    fs::remove_all(root);
+    ManagerConfig config;
+    config.default_save_dir = (root / "downloads").string();
+    config.data_dir = (root / "data").string();
+    config.control_pool_size = 1;
+
+    {
+        // Start jobs still queued (and retries pending) when the manager goes
+        DownloadManager manager(config);
+        for (int i = 0; i < 16; ++i) {
+            manager.addDownload("http://0.0.0.0:1/f" + std::to_string(i) + ".bin");
+        }
+    }
+    {
+        TaskJournal journal((root / "data" / "tasks.journal").string());
+        EXPECT_EQ(journal.entries().size(), 16u);
+    }
+    fs::remove_all(root);
+}
+
+TEST_F(TaskJournalTest, CancelledTaskIsNotRecovered) {
+    fs::path root = fs::temp_directory_path() / "task_journal_cancel_test";
+    fs::remove_all(root);
+    ManagerConfig config;
+    config.default_save_dir = (root / "downloads").string();
+    config.data_dir = (root / "data").string();
+
+    {
+        // Cancelled before its first checkpoint: no meta_path in the journal
+        DownloadManager manager(config);
+        int id = manager.addDownload("http://0.0.0.0:1/never.bin");
+        manager.cancelTask(id);
+    }
+    {
+        TaskJournal journal((root / "data" / "tasks.journal").string());
+        auto entries = journal.entries();
+        ASSERT_EQ(entries.size(), 1u);
+        EXPECT_EQ(entries[0].state, static_cast<int>(TaskState::Cancelled));
+    }
+
+    {
+        DownloadManager manager(config);
+        manager.recoverTasks();
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        EXPECT_TRUE(manager.getAllTasks().empty());
+    }
+    fs::remove_all(root);
+}
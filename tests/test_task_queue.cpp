@@ -6,7 +6,9 @@
 #include <memory>
 #include <vector>
 #include <atomic>
+#include <chrono>
 #include <filesystem>
+#include <fstream>
 
 namespace fs = std::filesystem;
 
@@ -18,12 +20,14 @@ protected:
         test_dir_ = fs::temp_directory_path() / "task_queue_test";
         fs::create_directories(test_dir_);
         pool_ = std::make_unique<ThreadPool>(2);
+        idle_pool_ = std::make_unique<ThreadPool>(0);
         limiter_ = std::make_unique<TokenBucket>(0);
     }
 
     void TearDown() override {
         if (limiter_) limiter_->cancel();
         pool_.reset();
+        idle_pool_.reset();
         limiter_.reset();
         try { fs::remove_all(test_dir_); } catch (...) {}
     }
@@ -35,6 +39,15 @@ protected:
             nullptr, [](int, TaskState) {});
     }
 
+    // A task whose start() only changes its state: its pool has no
+    // workers, so the HEAD request never runs
+    std::shared_ptr<Task> makeIdleTask(int id) {
+        return std::make_shared<Task>(
+            id, "http://0.0.0.0:1/file" + std::to_string(id) + ".bin",
+            test_dir_.string(), 1, idle_pool_.get(), limiter_.get(),
+            nullptr, [](int, TaskState) {});
+    }
+
     std::unique_ptr<TaskQueue> makeQueue(int max_concurrent) {
         auto q = std::make_unique<TaskQueue>(max_concurrent);
         q->setAutoStart(false);
@@ -43,6 +56,7 @@ protected:
 
     fs::path test_dir_;
     std::unique_ptr<ThreadPool> pool_;
+    std::unique_ptr<ThreadPool> idle_pool_;
     std::unique_ptr<TokenBucket> limiter_;
 };
 
@@ -89,6 +103,19 @@ TEST_F(TaskQueueTest, RemoveExistingTask) {
     EXPECT_EQ(infos[1].task_id, 3);
 }
 
+TEST_F(TaskQueueTest, RemoveWithoutCancelLeavesFilesAlone) {
+    auto q = makeQueue(10);
+    auto task = makeTask(1);
+    auto path = test_dir_ / "file1.bin";
+    { std::ofstream(path) << "data"; }
+    q->addTask(task);
+
+    EXPECT_TRUE(q->removeTask(1, false));
+    EXPECT_EQ(q->size(), 0u);
+    EXPECT_NE(task->getState(), TaskState::Cancelled);
+    EXPECT_TRUE(fs::exists(path));
+}
+
 TEST_F(TaskQueueTest, RemoveNonExistentTaskReturnsFalse) {
     auto q = makeQueue(10);
     q->addTask(makeTask(1));
@@ -233,4 +260,227 @@ TEST_F(TaskQueueTest, MoveLastToFirst) {
     EXPECT_EQ(infos[2].task_id, 2);
 }
 
+// ── Admission ──────────────────────────────────────────────────
+
+TEST_F(TaskQueueTest, StartsQueuedTasksInOrderUpToLimit) {
+    TaskQueue q(2);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 4; ++id) {
+        tasks.push_back(makeIdleTask(id));
+        q.addTask(tasks.back());
+    }
+    EXPECT_EQ(tasks[0]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Queued);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, FinishedTaskFreesSlotForNextReadyTask) {
+    TaskQueue q(2);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 4; ++id) {
+        tasks.push_back(makeIdleTask(id));
+        q.addTask(tasks.back());
+    }
+
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Queued);
+
+    // A second report for the same task must not free another slot
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, CancelledWaitingTaskIsSkipped) {
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 3; ++id) {
+        tasks.push_back(makeIdleTask(id));
+        q.addTask(tasks.back());
+    }
+
+    tasks[1]->cancel();
+    q.onTaskFinished(2);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Queued);  // no slot freed
+
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Cancelled);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Downloading);
+}
+
+TEST_F(TaskQueueTest, MovesChangeStartOrder) {
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 4; ++id) {
+        tasks.push_back(makeIdleTask(id));
+        q.addTask(tasks.back());
+    }
+    // Order 1 2 3 4 -> 1 4 2 3; 1 is running, 4 is next
+    EXPECT_TRUE(q.moveUp(4));
+    EXPECT_TRUE(q.moveUp(4));
+    auto infos = q.getAllTaskInfo();
+    ASSERT_EQ(infos.size(), 4u);
+    EXPECT_EQ(infos[1].task_id, 4);
+
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Downloading);
+
+    // 2 moved behind 3: 3 starts before it
+    EXPECT_TRUE(q.moveDown(2));
+    tasks[3]->cancel();
+    q.onTaskFinished(4);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, LargeQueueOperationsStayFast) {
+    constexpr int N = 20000;
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    tasks.reserve(N);
+    for (int id = 1; id <= N; ++id) {
+        tasks.push_back(makeIdleTask(id));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& task : tasks) {
+        q.addTask(task);
+    }
+    for (int id = 2; id <= N; id += 2) {
+        EXPECT_TRUE(q.moveDown(id) || id == N);
+    }
+    // Finish every running task in turn: each start is O(1)
+    for (int i = 0; i < 1000; ++i) {
+        for (auto& task : tasks) {
+            if (task->getState() == TaskState::Downloading) {
+                task->cancel();
+                q.onTaskFinished(task->getId());
+                break;
+            }
+        }
+    }
+    for (int id = N; id > N - 1000; --id) {
+        EXPECT_TRUE(q.removeTask(id));
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_EQ(q.size(), static_cast<size_t>(N - 1000));
+    EXPECT_LT(elapsed, std::chrono::seconds(5));
+}
+
+// ── Priority and deadline ──────────────────────────────────────
+
+TEST_F(TaskQueueTest, HigherClassStartsFirst) {
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 4; ++id) {
+        tasks.push_back(makeIdleTask(id));
+    }
+    tasks[2]->setPriority(TaskPriority::High);
+    tasks[3]->setPriority(TaskPriority::Low);
+    for (auto& task : tasks) {
+        q.addTask(task);
+    }
+    // 1 took the free slot; then High 3, Normal 2, Low 4
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Queued);
+
+    tasks[2]->cancel();
+    q.onTaskFinished(3);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, EarliestDeadlineFirstWithinClass) {
+    auto now = std::chrono::system_clock::now();
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 4; ++id) {
+        tasks.push_back(makeIdleTask(id));
+    }
+    tasks[1]->setPriority(TaskPriority::Normal, now + std::chrono::hours(2));
+    tasks[3]->setPriority(TaskPriority::Normal, now + std::chrono::hours(1));
+    for (auto& task : tasks) {
+        q.addTask(task);
+    }
+    // Waiting: 2 (+2h), 3 (none), 4 (+1h) -> 4, 2, 3
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[3]->getState(), TaskState::Downloading);
+
+    tasks[3]->cancel();
+    q.onTaskFinished(4);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, SetPriorityReordersWaitingTasks) {
+    TaskQueue q(1);
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (int id = 1; id <= 3; ++id) {
+        tasks.push_back(makeIdleTask(id));
+        q.addTask(tasks.back());
+    }
+    EXPECT_TRUE(q.setPriority(3, TaskPriority::Urgent));
+    EXPECT_FALSE(q.setPriority(42, TaskPriority::Urgent));
+    EXPECT_EQ(tasks[2]->getPriority(), TaskPriority::Urgent);
+
+    tasks[0]->cancel();
+    q.onTaskFinished(1);
+    EXPECT_EQ(tasks[2]->getState(), TaskState::Downloading);
+    EXPECT_EQ(tasks[1]->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, WithoutPreemptionHigherClassWaits) {
+    TaskQueue q(1);
+    auto low = makeIdleTask(1);
+    low->setPriority(TaskPriority::Low);
+    q.addTask(low);
+
+    auto urgent = makeIdleTask(2);
+    urgent->setPriority(TaskPriority::Urgent);
+    q.addTask(urgent);
+    EXPECT_EQ(low->getState(), TaskState::Downloading);
+    EXPECT_EQ(urgent->getState(), TaskState::Queued);
+}
+
+TEST_F(TaskQueueTest, PreemptionPausesLowerClassAndResumesIt) {
+    TaskQueue q(2);
+    q.setPreemption(true);
+    auto low = makeIdleTask(1);
+    low->setPriority(TaskPriority::Low);
+    auto normal = makeIdleTask(2);
+    q.addTask(low);
+    q.addTask(normal);
+
+    // The lowest class running gives way
+    auto high = makeIdleTask(3);
+    high->setPriority(TaskPriority::High);
+    q.addTask(high);
+    EXPECT_EQ(high->getState(), TaskState::Downloading);
+    EXPECT_EQ(normal->getState(), TaskState::Downloading);
+    EXPECT_EQ(low->getState(), TaskState::Paused);
+
+    // Nothing running is of a lower class than Normal
+    auto normal2 = makeIdleTask(4);
+    q.addTask(normal2);
+    EXPECT_EQ(normal2->getState(), TaskState::Queued);
+
+    // The preempted task waits in its class and is resumed, not restarted
+    high->cancel();
+    q.onTaskFinished(3);
+    EXPECT_EQ(normal2->getState(), TaskState::Downloading);
+    EXPECT_EQ(low->getState(), TaskState::Paused);
+
+    normal->cancel();
+    q.onTaskFinished(2);
+    EXPECT_EQ(low->getState(), TaskState::Downloading);
+}
+
 } // namespace
@@ -2,9 +2,13 @@
 #include <gtest/gtest.h>
 #include "thread_pool.h"
 
+#include <array>
 #include <atomic>
 #include <chrono>
+#include <future>
 #include <numeric>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
 // ── Basic construction / size ──────────────────────────────────
@@ -110,3 +114,167 @@ TEST(ThreadPoolTest, DestructorCompletesQueuedTasks) {
     } // destructor joins here
     EXPECT_EQ(counter.load(), 6);
 }
+
+TEST(ThreadPoolTest, ShutdownDrainsQueueAndRefusesNewJobs) {
+    std::atomic<int> counter{0};
+    ThreadPool pool(1);
+    pool.submitDetached([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ++counter;
+    });
+    for (int i = 0; i < 5; ++i) {
+        pool.submitDetached([&] { ++counter; });
+    }
+
+    pool.shutdown();
+    EXPECT_EQ(counter.load(), 6);
+    EXPECT_THROW(pool.submitDetached([&] { ++counter; }), std::runtime_error);
+    pool.shutdown();  // again: nothing left to do
+}
+
+TEST(ThreadPoolTest, SubmitRacingShutdownIsRunOrRefused) {
+    for (int round = 0; round < 50; ++round) {
+        ThreadPool pool(2);
+        std::atomic<bool> go{false};
+        std::vector<std::future<void>> accepted[4];
+        std::vector<std::thread> submitters;
+        for (auto& futures : accepted) {
+            submitters.emplace_back([&pool, &go, &futures] {
+                while (!go.load()) {
+                }
+                try {
+                    for (;;) {
+                        futures.push_back(pool.submit([] {}));
+                    }
+                } catch (const std::runtime_error&) {
+                    // Stopped: refused, not dropped
+                }
+            });
+        }
+        go = true;
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        pool.shutdown();
+        for (auto& submitter : submitters) {
+            submitter.join();
+        }
+
+        // Every job that was accepted has run
+        for (auto& futures : accepted) {
+            for (auto& future : futures) {
+                ASSERT_EQ(future.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+            }
+        }
+    }
+}
+
+// ── Detached submission ────────────────────────────────────────
+
+TEST(ThreadPoolTest, DetachedTasksAllRun) {
+    std::atomic<int> counter{0};
+    {
+        ThreadPool pool(4);
+        for (int i = 0; i < 10000; ++i) {
+            pool.submitDetached([&] { ++counter; });
+        }
+    } // destructor drains detached work too
+    EXPECT_EQ(counter.load(), 10000);
+}
+
+TEST(ThreadPoolTest, DetachedExceptionDoesNotKillWorker) {
+    ThreadPool pool(1);
+    pool.submitDetached([] { throw std::runtime_error("ignored"); });
+    auto f = pool.submit([] { return 5; });
+    EXPECT_EQ(f.get(), 5);
+}
+
+TEST(ThreadPoolTest, LargeClosureFallsBackToHeap) {
+    ThreadPool pool(2);
+    std::array<char, 4096> big{};
+    big[4095] = 9;
+    auto f = pool.submit([big] { return static_cast<int>(big[4095]); });
+    EXPECT_EQ(f.get(), 9);
+}
+
+// ── Work stealing ──────────────────────────────────────────────
+
+TEST(ThreadPoolTest, NestedSubmitsFromWorkersComplete) {
+    // Jobs spawned from inside a job land on that worker's own deque;
+    // the other workers must steal them
+    ThreadPool pool(4);
+    std::atomic<int> counter{0};
+    std::atomic<int> max_concurrent{0};
+    std::atomic<int> running{0};
+
+    auto f = pool.submit([&] {
+        for (int i = 0; i < 64; ++i) {
+            pool.submitDetached([&] {
+                int cur = ++running;
+                int prev_max = max_concurrent.load();
+                while (cur > prev_max &&
+                       !max_concurrent.compare_exchange_weak(prev_max, cur)) {
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                --running;
+                ++counter;
+            });
+        }
+    });
+    f.get();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (counter.load() < 64 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(counter.load(), 64);
+    EXPECT_GT(max_concurrent.load(), 1);
+}
+
+TEST(ThreadPoolTest, OverflowingWorkerDequeStillRunsEverything) {
+    std::atomic<int> counter{0};
+    {
+        ThreadPool pool(2);
+        pool.submit([&] {
+            // More than one deque holds: the rest goes to the injection queue
+            for (int i = 0; i < 5000; ++i) {
+                pool.submitDetached([&] { ++counter; });
+            }
+        }).get();
+    }
+    EXPECT_EQ(counter.load(), 5000);
+}
+
+// ── Statistics ─────────────────────────────────────────────────
+
+TEST(ThreadPoolTest, StatsReportQueueDepthAndLatency) {
+    ThreadPool pool(1);
+    std::atomic<bool> release{false};
+    auto blocker = pool.submit([&] {
+        while (!release.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+    // Let the worker pick up the blocker first
+    while (pool.stats().jobs < 1) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::vector<std::future<void>> queued;
+    for (int i = 0; i < 3; ++i) {
+        queued.push_back(pool.submit([] {}));
+    }
+    EXPECT_EQ(pool.stats().queue_depth, 3u);
+    EXPECT_EQ(pool.stats().threads, 1u);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    release = true;
+    blocker.get();
+    for (auto& f : queued) {
+        f.get();
+    }
+
+    ThreadPoolStats stats = pool.stats();
+    EXPECT_EQ(stats.queue_depth, 0u);
+    EXPECT_EQ(stats.jobs, 4u);
+    EXPECT_GE(stats.max_latency, std::chrono::milliseconds(20));
+    EXPECT_GT(stats.avg_latency.count(), 0);
+}
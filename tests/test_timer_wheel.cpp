@@ -0,0 +1,147 @@
+// test_timer_wheel.cpp
+#include <gtest/gtest.h>
+#include "timer_wheel.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Wait up to timeout for pred to become true
+template<typename Pred>
+bool waitFor(Pred pred, std::chrono::milliseconds timeout = 2000ms) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!pred()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+    }
+    return true;
+}
+
+} // namespace
+
+// ── Firing ─────────────────────────────────────────────────────
+
+TEST(TimerWheelTest, FiresAfterDelayNotBefore) {
+    TimerWheel wheel(5ms);
+    std::atomic<bool> fired{false};
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<int64_t> elapsed_ms{0};
+
+    wheel.schedule(50ms, [&] {
+        elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        fired = true;
+    });
+
+    ASSERT_TRUE(waitFor([&] { return fired.load(); }));
+    EXPECT_GE(elapsed_ms.load(), 50);
+    EXPECT_EQ(wheel.pending(), 0u);
+}
+
+TEST(TimerWheelTest, FiresInDeadlineOrder) {
+    TimerWheel wheel(2ms);
+    std::mutex mutex;
+    std::vector<int> order;
+    for (int i : {4, 1, 3, 0, 2}) {
+        wheel.schedule(std::chrono::milliseconds(10 + 15 * i), [&, i] {
+            std::lock_guard<std::mutex> lock(mutex);
+            order.push_back(i);
+        });
+    }
+
+    ASSERT_TRUE(waitFor([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return order.size() == 5;
+    }));
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+TEST(TimerWheelTest, CascadesFromHigherLevels) {
+    // 1 ms ticks: 300 ms lies beyond level 0 (256 ticks)
+    TimerWheel wheel(1ms);
+    std::atomic<bool> fired{false};
+    auto start = std::chrono::steady_clock::now();
+    wheel.schedule(300ms, [&] { fired = true; });
+
+    ASSERT_TRUE(waitFor([&] { return fired.load(); }));
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 300ms);
+}
+
+TEST(TimerWheelTest, ZeroDelayFiresPromptly) {
+    TimerWheel wheel;
+    std::atomic<bool> fired{false};
+    wheel.schedule(0ms, [&] { fired = true; });
+    EXPECT_TRUE(waitFor([&] { return fired.load(); }, 500ms));
+}
+
+TEST(TimerWheelTest, ThrowingCallbackDoesNotStopTheWheel) {
+    TimerWheel wheel(2ms);
+    std::atomic<bool> fired{false};
+    wheel.schedule(5ms, [] { throw std::runtime_error("ignored"); });
+    wheel.schedule(10ms, [&] { fired = true; });
+    EXPECT_TRUE(waitFor([&] { return fired.load(); }));
+}
+
+// ── Cancellation ───────────────────────────────────────────────
+
+TEST(TimerWheelTest, CancelledTimerNeverFires) {
+    TimerWheel wheel(2ms);
+    std::atomic<bool> fired{false};
+    std::atomic<bool> other{false};
+    auto id = wheel.schedule(20ms, [&] { fired = true; });
+    wheel.schedule(40ms, [&] { other = true; });
+
+    EXPECT_TRUE(wheel.cancel(id));
+    EXPECT_FALSE(wheel.cancel(id));  // already gone
+    ASSERT_TRUE(waitFor([&] { return other.load(); }));
+    EXPECT_FALSE(fired.load());
+}
+
+TEST(TimerWheelTest, CancelWaitsForRunningCallback) {
+    TimerWheel wheel(1ms);
+    std::atomic<bool> started{false};
+    std::atomic<bool> finished{false};
+    auto id = wheel.schedule(1ms, [&] {
+        started = true;
+        std::this_thread::sleep_for(50ms);
+        finished = true;
+    });
+
+    ASSERT_TRUE(waitFor([&] { return started.load(); }));
+    EXPECT_FALSE(wheel.cancel(id));
+    EXPECT_TRUE(finished.load());
+}
+
+TEST(TimerWheelTest, DestructorDropsPendingTimers) {
+    std::atomic<bool> fired{false};
+    {
+        TimerWheel wheel;
+        wheel.schedule(std::chrono::hours(1), [&] { fired = true; });
+        EXPECT_EQ(wheel.pending(), 1u);
+    }
+    EXPECT_FALSE(fired.load());
+}
+
+// ── Many timers ────────────────────────────────────────────────
+
+TEST(TimerWheelTest, ManyTimersAllFireOnce) {
+    TimerWheel wheel(1ms);
+    constexpr int N = 2000;
+    std::atomic<int> count{0};
+    for (int i = 0; i < N; ++i) {
+        wheel.schedule(std::chrono::milliseconds(i % 400), [&] { ++count; });
+    }
+    ASSERT_TRUE(waitFor([&] { return count.load() == N; }));
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(count.load(), N);
+    EXPECT_EQ(wheel.pending(), 0u);
+}
@@ -170,3 +170,176 @@ TEST(TokenBucketTest, RefillAddsTokensOverTime) {
     // Should not have needed to wait long since tokens refilled during sleep
     EXPECT_LE(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 100);
 }
+
+// --- Lease ---
+
+TEST(TokenBucketTest, LeaseWithoutBucketPassesThrough) {
+    TokenBucket::Lease lease;
+    EXPECT_EQ(lease.acquire(999999), 999999);
+    EXPECT_TRUE(lease.tryAcquire(999999));
+}
+
+TEST(TokenBucketTest, LeaseServesChunksFromCachedBatch) {
+    TokenBucket tb(6400);  // leases 100 tokens at a time
+    TokenBucket::Lease lease(&tb);
+
+    EXPECT_TRUE(lease.tryAcquire(10));
+    EXPECT_EQ(tb.acquire(6300), 6300);  // drain the rest of the bucket
+
+    // The remaining 90 leased tokens need no trip to the (empty) bucket
+    EXPECT_TRUE(lease.tryAcquire(50));
+    EXPECT_TRUE(lease.tryAcquire(40));
+}
+
+TEST(TokenBucketTest, LeaseDropsCacheOnRateChange) {
+    TokenBucket tb(6400);
+    TokenBucket::Lease lease(&tb);
+
+    EXPECT_TRUE(lease.tryAcquire(10));
+    EXPECT_EQ(tb.acquire(6300), 6300);
+
+    tb.setRate(6400);
+    std::chrono::microseconds retry_after{0};
+    EXPECT_FALSE(lease.tryAcquire(50, &retry_after));
+    EXPECT_GT(retry_after.count(), 0);
+}
+
+TEST(TokenBucketTest, LeaseStillHonoursRate) {
+    TokenBucket tb(64000);  // leases 1000 tokens at a time
+    tb.acquire(64000);      // drain
+    TokenBucket::Lease lease(&tb);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 64; ++i) {
+        EXPECT_EQ(lease.acquire(250), 250);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // 16000 tokens at 64000/sec take ~250ms
+    EXPECT_GE(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 150);
+}
+
+TEST(TokenBucketTest, LeaseAfterCancelReturnsZero) {
+    TokenBucket tb(1000);
+    TokenBucket::Lease lease(&tb);
+    tb.cancel();
+
+    std::chrono::microseconds retry_after{0};
+    EXPECT_EQ(lease.acquire(100), 0);
+    EXPECT_FALSE(lease.tryAcquire(100, &retry_after));
+    EXPECT_EQ(retry_after.count(), 0);
+}
+
+// --- Hierarchy ---
+
+TEST(TokenBucketTest, ChildChargesParent) {
+    TokenBucket parent(1000);
+    TokenBucket child(0, &parent);
+
+    EXPECT_TRUE(child.isLimited());
+    EXPECT_EQ(child.effectiveRate(), 1000);
+    EXPECT_EQ(child.acquire(1000), 1000);
+    EXPECT_FALSE(parent.tryAcquire(500));
+}
+
+TEST(TokenBucketTest, ChildRateCapsBelowUnlimitedParent) {
+    TokenBucket parent;
+    TokenBucket child(1000, &parent);
+
+    EXPECT_FALSE(parent.isLimited());
+    EXPECT_EQ(child.acquire(1000), 1000);
+    EXPECT_FALSE(child.tryAcquire(500));
+    EXPECT_TRUE(parent.tryAcquire(500));
+}
+
+TEST(TokenBucketTest, SharesFollowWeights) {
+    TokenBucket parent(10000);
+    TokenBucket heavy(0, &parent, 3);
+    TokenBucket light(0, &parent, 1);
+
+    EXPECT_EQ(heavy.effectiveRate(), 7500);
+    EXPECT_EQ(light.effectiveRate(), 2500);
+
+    light.setWeight(2);
+    EXPECT_EQ(heavy.effectiveRate(), 6000);
+    EXPECT_EQ(light.effectiveRate(), 4000);
+
+    // An own rate below the share wins
+    light.setRate(1000);
+    EXPECT_EQ(light.effectiveRate(), 1000);
+}
+
+TEST(TokenBucketTest, GrandchildShareComesFromParentShare) {
+    TokenBucket global(9000);
+    TokenBucket host_a(0, &global);
+    TokenBucket host_b(0, &global, 2);
+    TokenBucket task(0, &host_b);
+
+    EXPECT_EQ(host_a.effectiveRate(), 3000);
+    EXPECT_EQ(task.effectiveRate(), 6000);
+
+    global.setRate(3000);
+    EXPECT_EQ(task.effectiveRate(), 2000);
+}
+
+TEST(TokenBucketTest, IdleSiblingShareGoesToBusyOne) {
+    TokenBucket parent(10000);
+    TokenBucket busy(0, &parent);
+    TokenBucket idle(0, &parent);
+    EXPECT_EQ(busy.effectiveRate(), 5000);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1200));
+    EXPECT_TRUE(busy.tryAcquire(1));
+    EXPECT_EQ(busy.effectiveRate(), 10000);
+
+    // Demand from the idle one restores its share at once
+    EXPECT_TRUE(idle.tryAcquire(1));
+    EXPECT_EQ(busy.effectiveRate(), 5000);
+}
+
+TEST(TokenBucketTest, BusyChildrenSplitParentByWeight) {
+    TokenBucket parent(40000);
+    TokenBucket heavy(0, &parent, 3);
+    TokenBucket light(0, &parent, 1);
+    heavy.acquire(30000);  // drain the initial bursts
+    light.acquire(10000);
+    parent.tryAcquire(40000);
+
+    std::atomic<bool> done{false};
+    auto run = [&](TokenBucket& bucket, std::atomic<int64_t>& total) {
+        while (!done.load()) {
+            total.fetch_add(bucket.acquire(200));
+        }
+    };
+    std::atomic<int64_t> heavy_total{0};
+    std::atomic<int64_t> light_total{0};
+    std::thread a(run, std::ref(heavy), std::ref(heavy_total));
+    std::thread b(run, std::ref(light), std::ref(light_total));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    done.store(true);
+    a.join();
+    b.join();
+
+    // ~30000 : ~10000 over the second, never much more than the parent's rate
+    EXPECT_GT(heavy_total.load(), 2 * light_total.load());
+    EXPECT_LT(heavy_total.load(), 5 * light_total.load());
+    EXPECT_LE(heavy_total.load() + light_total.load(), 60000);
+}
+
+TEST(TokenBucketTest, ParentCancelWakesChildWaiters) {
+    TokenBucket parent(100);
+    TokenBucket child(0, &parent);
+    child.acquire(100);  // drain
+
+    std::atomic<int64_t> result{-1};
+    std::thread t([&] {
+        result.store(child.acquire(50));
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    parent.cancel();
+    t.join();
+
+    EXPECT_EQ(result.load(), 0);
+}